@@ -0,0 +1,547 @@
+// bench.c
+// Benchmark suite: the engine's hot kernels, then end-to-end scenarios,
+// written as JSON so builds can be compared on one machine.
+//
+//   ts_bench [--out bench.json] [--config base.kv] [--only micro|macro]
+//            [--sizes 6,20,100] [--rates 0.1,0.25,0.5]
+//            [--controllers fixed,actuated,max_pressure] [--micro-size 20]
+//            [--warmup N] [--reps N] [--steps N] [--warm-steps N] [--threads N]
+//
+// Each measurement runs --warmup untimed repetitions (caches, page faults,
+// CPU clock) and then --reps timed ones. All of them start from the same
+// state, so repetitions differ only by machine noise. The JSON keeps every
+// repetition's time along with the mean, standard deviation, min and median.
+//
+// micro: one thread, on a --micro-size grid at the base arrival rate with
+// max-pressure lights, run for --warm-steps. Every repetition restores that
+// state from one checkpoint.
+//   nasch_kernel       the parallel-update NaSch kernel (move planning) on a
+//                      run of 4096 vehicles, both the CPU's kernel and the scalar one
+//   engine_step        --steps whole steps (planning, moves, crossings,
+//                      spawning, lights)
+//   light_sched_step   light decisions where every armed light's detectors
+//                      change each step, the most work a step can bring
+//   queue_for_group, pressure_for_phase   both phases of every intersection
+//   stats_collect_queues                  one queue sample of every intersection
+//
+// macro: every grid size x arrival rate x controller, with --threads. The
+// base config is run for --warm-steps, then each repetition restores that
+// state and times --steps steps. steps/s and vehicle updates/s (live
+// vehicles summed over the steps) come from the mean.
+#include "config_kv.h"
+#include "checkpoint.h"
+#include "controllers.h"
+#include "engine.h"
+#include "nasch.h"
+#include "trafficsim.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_LIST 16
+#define NASCH_RUN 4096
+
+typedef struct {
+    const char* out;
+    int warmup, reps;
+    int steps, warm_steps;
+    int threads;
+    int micro_size;
+    bool micro, macro;
+    int sizes[BENCH_MAX_LIST];
+    int n_sizes;
+    double rates[BENCH_MAX_LIST];
+    int n_rates;
+    int ctrls[BENCH_MAX_LIST];
+    int n_ctrls;
+} BenchOpts;
+
+/* the repetitions of one measurement */
+typedef struct {
+    double t[64];
+    int n;
+    double mean, sd, min, median;
+} Sample;
+
+/* one repetition: untimed setup, then returns the seconds of the timed part */
+typedef double (*BenchRep)(void* ctx);
+
+static const char* ctrl_name[] = { "fixed", "actuated", "max_pressure" };
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void measure(const BenchOpts* o, BenchRep rep, void* ctx, Sample* s) {
+    for (int i=0; i<o->warmup; i++) rep(ctx);
+    s->n = o->reps;
+    double sum = 0.0, sq = 0.0, sorted[64];
+    for (int i=0; i<s->n; i++) {
+        s->t[i] = rep(ctx);
+        sum += s->t[i];
+    }
+    s->mean = sum / s->n;
+    for (int i=0; i<s->n; i++) sq += (s->t[i] - s->mean) * (s->t[i] - s->mean);
+    s->sd = s->n > 1 ? sqrt(sq / (s->n - 1)) : 0.0;
+    memcpy(sorted, s->t, sizeof(double) * (size_t)s->n);
+    qsort(sorted, (size_t)s->n, sizeof(double), cmp_double);
+    s->min = sorted[0];
+    s->median = (s->n & 1) ? sorted[s->n / 2] : 0.5 * (sorted[s->n / 2 - 1] + sorted[s->n / 2]);
+}
+
+static void put_sample(FILE* f, const Sample* s) {
+    fprintf(f, "\"samples_s\": [");
+    for (int i=0; i<s->n; i++) fprintf(f, "%s%.9g", i ? ", " : "", s->t[i]);
+    fprintf(f, "], \"mean_s\": %.9g, \"stddev_s\": %.9g, \"min_s\": %.9g, \"median_s\": %.9g, \"cv\": %.4f",
+            s->mean, s->sd, s->min, s->median, s->mean > 0.0 ? s->sd / s->mean : 0.0);
+}
+
+/* ---- micro ---- */
+
+/* network state restored from a checkpoint, with or without an engine */
+typedef struct {
+    Grid g;
+    VehiclePool vp;
+    Stats s;
+    Engine e;
+    bool has_engine;
+    double t;
+    int step;
+} Inst;
+
+static void inst_free(Inst* in) {
+    if (in->has_engine) engine_free(&in->e);
+    stats_free(&in->s);
+    vp_free(&in->vp);
+    grid_free(&in->g);
+}
+
+static int inst_build(Inst* in, const Topology* topo, const Config* cfg, const TsCheckpoint* ck, bool engine) {
+    memset(in, 0, sizeof(*in));
+    int ok = grid_init(&in->g, topo, cfg) == 0
+          && vp_init(&in->vp, 1024) == 0
+          && stats_init(&in->s, in->g.n_intersections) == 0
+          && checkpoint_restore_state(ck, &in->g, &in->vp, &in->s, cfg, &in->t, &in->step) == 0;
+    if (ok && engine) {
+        ok = engine_init(&in->e, &in->g, &in->vp, &in->s, cfg, 1) == 0;
+        in->has_engine = ok;
+        ok = ok && checkpoint_restore_engine(ck, &in->e) == 0;
+    }
+    if (!ok) {
+        inst_free(in);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    NaschKernel kernel;
+    NaschStep st;
+    NaschRun run;
+    int iters;
+} NaschCtx;
+
+static double rep_nasch(void* ctx) {
+    NaschCtx* c = (NaschCtx*)ctx;
+    double t0 = now_s();
+    for (int it=0; it<c->iters; it++) {
+        c->st.step = (uint32_t)it;
+        c->kernel(&c->st, &c->run);
+    }
+    return now_s() - t0;
+}
+
+typedef struct {
+    const Topology* topo;
+    const Config* cfg;
+    const TsCheckpoint* ck;
+    int steps;
+    int64_t vehicle_steps;   /* of the last repetition */
+} StepCtx;
+
+static double rep_engine_step(void* ctx) {
+    StepCtx* c = (StepCtx*)ctx;
+    Inst in;
+    if (inst_build(&in, c->topo, c->cfg, c->ck, true) != 0) return NAN;
+    int64_t vs = 0;
+    bool ok = true;
+    double t0 = now_s();
+    for (int k=0; ok && k<c->steps; k++) {
+        vs += in.vp.n_used;
+        ok = (engine_step(&in.e, in.t, in.step) == 0);
+        in.t += c->cfg->time_step;
+        in.step++;
+    }
+    double dt = ok ? now_s() - t0 : NAN;
+    c->vehicle_steps = vs;
+    inst_free(&in);
+    return dt;
+}
+
+static double rep_light_sched(void* ctx) {
+    StepCtx* c = (StepCtx*)ctx;
+    Inst in;
+    if (inst_build(&in, c->topo, c->cfg, c->ck, false) != 0) return NAN;
+    int n = in.g.n_intersections;
+    int32_t* ids = (int32_t*)malloc(sizeof(int32_t) * (size_t)(n ? n : 1));
+    LightSched ls;
+    double dt = NAN;
+    for (int k=0; ids && k<n; k++) ids[k] = k;
+    if (ids && light_sched_init(&ls, &in.g, ids, n, c->cfg->time_step) == 0) {
+        bool ok = true;
+        double t0 = now_s();
+        for (int k=0; ok && k<c->steps; k++) {
+            for (int i=0; i<n; i++) atomic_store_explicit(&in.g.light_dirty[i], 1, memory_order_relaxed);
+            ok = (light_sched_step(&ls, &in.g, in.step, in.t, c->cfg->time_step) == 0);
+            in.t += c->cfg->time_step;
+            in.step++;
+        }
+        if (ok) dt = now_s() - t0;
+        light_sched_free(&ls);
+    }
+    free(ids);
+    inst_free(&in);
+    return dt;
+}
+
+typedef struct {
+    Inst* in;
+    int iters;
+    long sink;
+} GridCtx;
+
+static double rep_queue(void* ctx) {
+    GridCtx* c = (GridCtx*)ctx;
+    const Grid* g = &c->in->g;
+    long sum = 0;
+    double t0 = now_s();
+    for (int it=0; it<c->iters; it++)
+        for (int i=0; i<g->n_intersections; i++)
+            sum += queue_for_group(g, &g->intersections[i], PHASE_NS) + queue_for_group(g, &g->intersections[i], PHASE_EW);
+    double dt = now_s() - t0;
+    c->sink += sum;
+    return dt;
+}
+
+static double rep_pressure(void* ctx) {
+    GridCtx* c = (GridCtx*)ctx;
+    const Grid* g = &c->in->g;
+    long sum = 0;
+    double t0 = now_s();
+    for (int it=0; it<c->iters; it++)
+        for (int i=0; i<g->n_intersections; i++)
+            sum += pressure_for_phase(g, &g->intersections[i], PHASE_NS) + pressure_for_phase(g, &g->intersections[i], PHASE_EW);
+    double dt = now_s() - t0;
+    c->sink += sum;
+    return dt;
+}
+
+static double rep_collect(void* ctx) {
+    GridCtx* c = (GridCtx*)ctx;
+    double t0 = now_s();
+    for (int it=0; it<c->iters; it++) stats_collect_queues(&c->in->s, &c->in->g);
+    return now_s() - t0;
+}
+
+static void put_micro(FILE* f, bool* first, const char* name, const char* variant, const Sample* s,
+                      double work, const char* unit) {
+    fprintf(f, "%s\n    {\"name\": \"%s\", \"variant\": \"%s\", \"work_per_rep\": %.0f, \"unit\": \"%s\", ",
+            *first ? "" : ",", name, variant, work, unit);
+    put_sample(f, s);
+    fprintf(f, ", \"ns_per_unit\": %.4f}", work > 0 ? 1e9 * s->mean / work : 0.0);
+    fprintf(stderr, "  %-22s %-14s %10.3f ns/%s  (cv %.1f%%)\n", name, variant,
+            work > 0 ? 1e9 * s->mean / work : 0.0, unit, s->mean > 0 ? 100.0 * s->sd / s->mean : 0.0);
+    *first = false;
+}
+
+/* state after warm_steps of cfg, as a checkpoint */
+static TsCheckpoint* warm_state(const Config* cfg, const Topology* topo, int warm_steps, double* secs) {
+    TsSim* ts = ts_create(cfg, topo);
+    if (!ts) return NULL;
+    double t0 = now_s();
+    ts_step(ts, warm_steps);
+    if (secs) *secs = now_s() - t0;
+    TsCheckpoint* ck = ts_checkpoint(ts);  /* NULL if a step failed */
+    ts_destroy(ts);
+    return ck;
+}
+
+static int bench_micro(FILE* f, const BenchOpts* o, const Config* base) {
+    Config cfg = *base;
+    cfg.grid_size = o->micro_size;
+    cfg.controller = CTRL_MAX_PRESSURE;
+    cfg.threads = 1;
+    Topology topo;
+    if (topology_init(&topo, &cfg) != 0) return -1;
+    TsCheckpoint* ck = warm_state(&cfg, &topo, o->warm_steps, NULL);
+    Inst in;
+    if (!ck || inst_build(&in, &topo, &cfg, ck, false) != 0) {
+        ts_checkpoint_free(ck);
+        topology_free(&topo);
+        return -1;
+    }
+    fprintf(stderr, "micro: %dx%d grid, %d vehicles after %d steps\n", cfg.grid_size, cfg.grid_size, in.vp.n_used, o->warm_steps);
+    fprintf(f, "  \"micro_state\": {\"grid_size\": %d, \"arrival_rate\": %g, \"controller\": \"max_pressure\", "
+               "\"warm_steps\": %d, \"vehicles\": %d},\n  \"micro\": [",
+            cfg.grid_size, cfg.arrival_rate, o->warm_steps, in.vp.n_used);
+    bool first = true;
+    Sample s;
+
+    /* a run of vehicles 1..8 cells apart, vmax up to 5 */
+    NaschCtx nc;
+    memset(&nc, 0, sizeof(nc));
+    int32_t* buf = (int32_t*)calloc(4 * (size_t)(NASCH_RUN + 1 + NASCH_WIDTH), sizeof(int32_t));
+    if (buf) {
+        RngKey key = rng_key(cfg.random_seed);
+        size_t stride = (size_t)(NASCH_RUN + 1 + NASCH_WIDTH);
+        nc.run = (NaschRun){ NASCH_RUN, buf, buf + stride, buf + 2 * stride, buf + 3 * stride };
+        for (int i=0; i<=NASCH_RUN; i++) {
+            double u = rng_cb_uniform01(key, 0, (uint32_t)i, RNG_SPAWN, 0);
+            nc.run.pos[i] = (i ? nc.run.pos[i - 1] : 0) + 1 + (int32_t)(8 * u);
+            if (i == NASCH_RUN) break;
+            nc.run.id[i] = i;
+            nc.run.vmax[i] = 1 + i % 5;
+            nc.run.speed[i] = i % 3;
+        }
+        nc.st = (NaschStep){ key, 0, cfg.slowdown_probability, rng_threshold53(cfg.slowdown_probability) };
+        nc.iters = 2000;
+        const char* name;
+        nc.kernel = nasch_kernel(&name);
+        measure(o, rep_nasch, &nc, &s);
+        put_micro(f, &first, "nasch_kernel", name, &s, (double)NASCH_RUN * nc.iters, "vehicle");
+        if (nc.kernel != nasch_scalar) {
+            nc.kernel = nasch_scalar;
+            measure(o, rep_nasch, &nc, &s);
+            put_micro(f, &first, "nasch_kernel", "scalar", &s, (double)NASCH_RUN * nc.iters, "vehicle");
+        }
+        free(buf);
+    }
+
+    StepCtx sc = { &topo, &cfg, ck, o->steps, 0 };
+    measure(o, rep_engine_step, &sc, &s);
+    put_micro(f, &first, "engine_step", "1 thread", &s, (double)sc.vehicle_steps, "vehicle-update");
+
+    measure(o, rep_light_sched, &sc, &s);
+    put_micro(f, &first, "light_sched_step", "all dirty", &s, (double)in.g.n_intersections * o->steps, "light");
+
+    int n = in.g.n_intersections ? in.g.n_intersections : 1;
+    GridCtx gc = { &in, 500000 / n + 1, 0 };
+    measure(o, rep_queue, &gc, &s);
+    put_micro(f, &first, "queue_for_group", "both phases", &s, 2.0 * n * gc.iters, "call");
+    measure(o, rep_pressure, &gc, &s);
+    put_micro(f, &first, "pressure_for_phase", "both phases", &s, 2.0 * n * gc.iters, "call");
+    gc.iters = 200000 / n + 1;
+    measure(o, rep_collect, &gc, &s);
+    put_micro(f, &first, "stats_collect_queues", "all", &s, (double)n * gc.iters, "intersection");
+    fprintf(f, "\n  ]");
+
+    inst_free(&in);
+    ts_checkpoint_free(ck);
+    topology_free(&topo);
+    return 0;
+}
+
+/* ---- macro ---- */
+
+static double rep_scenario(void* ctx) {
+    StepCtx* c = (StepCtx*)ctx;
+    TsSim* ts = ts_restore(c->cfg, c->topo, c->ck);
+    if (!ts) return NAN;
+    int64_t vs = 0;
+    TsStatus st;
+    double t0 = now_s();
+    bool ok = true;
+    for (int k=0; ok && k<c->steps; k++) {
+        ts_query(ts, &st);
+        vs += st.n_vehicles;
+        ok = (ts_step(ts, 1) >= 0);
+    }
+    double dt = ok ? now_s() - t0 : NAN;
+    c->vehicle_steps = vs;
+    ts_destroy(ts);
+    return dt;
+}
+
+static int bench_macro(FILE* f, const BenchOpts* o, const Config* base) {
+    fprintf(f, "  \"macro\": [");
+    bool first = true;
+    for (int i=0; i<o->n_sizes; i++) {
+        Config cfg = *base;
+        cfg.grid_size = o->sizes[i];
+        cfg.threads = o->threads;
+        Topology topo;
+        double t0 = now_s();
+        if (topology_init(&topo, &cfg) != 0) {
+            fprintf(stderr, "bench: cannot build a %dx%d grid\n", cfg.grid_size, cfg.grid_size);
+            return -1;
+        }
+        double build_s = now_s() - t0;
+        for (int j=0; j<o->n_rates; j++) {
+            for (int k=0; k<o->n_ctrls; k++) {
+                cfg.arrival_rate = o->rates[j];
+                cfg.controller = (ControllerType)o->ctrls[k];
+                double warm_s = 0.0;
+                TsCheckpoint* ck = warm_state(&cfg, &topo, o->warm_steps, &warm_s);
+                if (!ck) {
+                    fprintf(stderr, "bench: %dx%d grid: out of memory\n", cfg.grid_size, cfg.grid_size);
+                    topology_free(&topo);
+                    return -1;
+                }
+                StepCtx sc = { &topo, &cfg, ck, o->steps, 0 };
+                Sample s;
+                measure(o, rep_scenario, &sc, &s);
+                ts_checkpoint_free(ck);
+
+                double vehicles = (double)sc.vehicle_steps / o->steps;
+                fprintf(f, "%s\n    {\"grid_size\": %d, \"arrival_rate\": %g, \"controller\": \"%s\", \"threads\": %d, "
+                           "\"topology_build_s\": %.6f, \"warm_steps\": %d, \"warm_s\": %.6f, \"steps_per_rep\": %d, "
+                           "\"mean_vehicles\": %.1f, ",
+                        first ? "" : ",", cfg.grid_size, cfg.arrival_rate, ctrl_name[cfg.controller], cfg.threads,
+                        build_s, o->warm_steps, warm_s, o->steps, vehicles);
+                put_sample(f, &s);
+                fprintf(f, ", \"steps_per_s\": %.3f, \"vehicle_updates_per_s\": %.1f}",
+                        o->steps / s.mean, (double)sc.vehicle_steps / s.mean);
+                fflush(f);
+                fprintf(stderr, "  %4dx%-4d rate %-5g %-12s %10.1f steps/s %8.2f M veh-updates/s  (%.0f vehicles, cv %.1f%%)\n",
+                        cfg.grid_size, cfg.grid_size, cfg.arrival_rate, ctrl_name[cfg.controller], o->steps / s.mean,
+                        1e-6 * (double)sc.vehicle_steps / s.mean, vehicles, 100.0 * s.sd / s.mean);
+                first = false;
+            }
+        }
+        topology_free(&topo);
+    }
+    fprintf(f, "\n  ]");
+    return 0;
+}
+
+/* ---- options ---- */
+
+static const char* get_arg(int argc, char** argv, const char* key, const char* def) {
+    for (int i=1;i<argc-1;i++) {
+        if (strcmp(argv[i], key)==0) return argv[i+1];
+    }
+    return def;
+}
+
+/* comma-separated list; -1 if empty, too long or malformed */
+static int parse_list(const char* s, double* v, int max) {
+    int n = 0;
+    while (*s) {
+        char* end;
+        if (n == max) return -1;
+        v[n++] = strtod(s, &end);
+        if (end == s || (*end && *end != ',')) return -1;
+        s = *end ? end + 1 : end;
+    }
+    return n ? n : -1;
+}
+
+static int parse_ctrls(const char* s, int* v, int max) {
+    int n = 0;
+    while (*s) {
+        size_t len = strcspn(s, ",");
+        int c = -1;
+        for (int k=0; k<3; k++)
+            if (strlen(ctrl_name[k]) == len && strncmp(s, ctrl_name[k], len) == 0) c = k;
+        if (c < 0 || n == max) return -1;
+        v[n++] = c;
+        s += len;
+        if (*s) s++;
+    }
+    return n ? n : -1;
+}
+
+int main(int argc, char** argv) {
+    BenchOpts o;
+    memset(&o, 0, sizeof(o));
+    o.out = get_arg(argc, argv, "--out", "bench.json");
+    o.warmup = atoi(get_arg(argc, argv, "--warmup", "2"));
+    o.reps = atoi(get_arg(argc, argv, "--reps", "5"));
+    o.steps = atoi(get_arg(argc, argv, "--steps", "200"));
+    o.warm_steps = atoi(get_arg(argc, argv, "--warm-steps", "1200"));
+    o.threads = atoi(get_arg(argc, argv, "--threads", "1"));
+    o.micro_size = atoi(get_arg(argc, argv, "--micro-size", "20"));
+    const char* only = get_arg(argc, argv, "--only", NULL);
+    o.micro = !only || strcmp(only, "micro") == 0;
+    o.macro = !only || strcmp(only, "macro") == 0;
+
+    double v[BENCH_MAX_LIST];
+    o.n_sizes = parse_list(get_arg(argc, argv, "--sizes", "6,20,100"), v, BENCH_MAX_LIST);
+    for (int i=0; i<o.n_sizes; i++) o.sizes[i] = (int)v[i];
+    o.n_rates = parse_list(get_arg(argc, argv, "--rates", "0.1,0.25,0.5"), o.rates, BENCH_MAX_LIST);
+    o.n_ctrls = parse_ctrls(get_arg(argc, argv, "--controllers", "fixed,actuated,max_pressure"), o.ctrls, BENCH_MAX_LIST);
+
+    if (o.n_sizes < 0 || o.n_rates < 0 || o.n_ctrls < 0 || o.reps < 1 || o.reps > 64 || o.warmup < 0
+        || o.steps < 1 || o.warm_steps < 0 || o.threads < 1 || o.micro_size < 1 || (!o.micro && !o.macro)) {
+        fprintf(stderr, "Usage: %s [--out bench.json] [--config base.kv] [--only micro|macro]\n"
+                        "       [--sizes 6,20,100] [--rates 0.1,0.25,0.5] [--controllers fixed,actuated,max_pressure]\n"
+                        "       [--micro-size 20] [--warmup N] [--reps N (1..64)] [--steps N] [--warm-steps N] [--threads N]\n", argv[0]);
+        return 1;
+    }
+
+    Config base;
+    const char* cfg_path = get_arg(argc, argv, "--config", NULL);
+    if (cfg_path) {
+        if (config_load_kv(&base, cfg_path) != 0) {
+            fprintf(stderr, "Failed to load config: %s\n", cfg_path);
+            return 1;
+        }
+    } else {
+        config_set_defaults(&base);
+    }
+    base.duration = 1e12;   /* never stops before --steps */
+
+    FILE* f = fopen(o.out, "w");
+    if (!f) {
+        fprintf(stderr, "bench: cannot create %s\n", o.out);
+        return 1;
+    }
+    const char* kernel;
+    nasch_kernel(&kernel);
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(f, "{\n  \"schema\": \"ts_bench/1\",\n  \"date\": \"%s\",\n", stamp);
+    fprintf(f, "  \"host\": {\"cpus\": %ld, \"compiler\": \"%s\", \"nasch_kernel\": \"%s\"},\n",
+            sysconf(_SC_NPROCESSORS_ONLN),
+#ifdef __VERSION__
+            __VERSION__,
+#else
+            "unknown",
+#endif
+            kernel);
+    fprintf(f, "  \"settings\": {\"config\": \"%s\", \"warmup\": %d, \"reps\": %d, \"steps\": %d, \"warm_steps\": %d, "
+               "\"time_step\": %g, \"slowdown_probability\": %g, \"vmax_cells_per_step\": %d, \"link_length_cells\": %d, "
+               "\"lanes_per_direction\": %d, \"random_seed\": %llu}",
+            cfg_path ? cfg_path : "", o.warmup, o.reps, o.steps, o.warm_steps, base.time_step, base.slowdown_probability,
+            base.vmax_cells_per_step, base.link_length_cells, base.lanes_per_direction,
+            (unsigned long long)base.random_seed);
+
+    int rc = 0;
+    if (o.micro) {
+        fprintf(f, ",\n");
+        rc = bench_micro(f, &o, &base);
+    }
+    if (rc == 0 && o.macro) {
+        fprintf(stderr, "macro: %d steps x %d reps per scenario after %d warm-up steps\n", o.steps, o.reps, o.warm_steps);
+        fprintf(f, ",\n");
+        rc = bench_macro(f, &o, &base);
+    }
+    fprintf(f, "\n}\n");
+    if (fclose(f) != 0) rc = -1;
+    if (rc != 0) {
+        fprintf(stderr, "Benchmark failed.\n");
+        return 1;
+    }
+    fprintf(stderr, "bench: wrote %s\n", o.out);
+    return 0;
+}
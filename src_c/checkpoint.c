@@ -0,0 +1,477 @@
+// checkpoint.c
+#include "checkpoint.h"
+#include "demand.h"
+#include "occupancy.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+_Static_assert(sizeof(int) == sizeof(int32_t), "pool id lists are stored as int32");
+
+/* growing output buffer; a failed allocation sticks */
+typedef struct {
+    char* p;
+    size_t n, cap;
+    bool failed;
+} Out;
+
+static void put(Out* o, const void* v, size_t n) {
+    if (o->failed || n == 0) return;
+    if (o->n + n > o->cap) {
+        size_t cap = o->cap ? o->cap : 4096;
+        while (cap < o->n + n) cap *= 2;
+        char* q = (char*)realloc(o->p, cap);
+        if (!q) {
+            o->failed = true;
+            return;
+        }
+        o->p = q;
+        o->cap = cap;
+    }
+    memcpy(o->p + o->n, v, n);
+    o->n += n;
+}
+
+/* bounded reader over one section; reading past its end sticks */
+typedef struct {
+    const char* p;
+    size_t at, end;
+    bool bad;
+} In;
+
+static void get(In* in, void* v, size_t n) {
+    if (in->bad || n > in->end - in->at) {
+        in->bad = true;
+        memset(v, 0, n);
+        return;
+    }
+    memcpy(v, in->p + in->at, n);
+    in->at += n;
+}
+
+static In section(const TsCheckpoint* ck, uint64_t from, uint64_t to) {
+    In in = { ck->data, (size_t)from, (size_t)to, false };
+    return in;
+}
+
+static uint64_t fnv1a(uint64_t h, const void* p, size_t n) {
+    const unsigned char* b = (const unsigned char*)p;
+    for (size_t k=0; k<n; k++) {
+        h ^= b[k];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+static uint64_t network_hash(const Grid* g) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    h = fnv1a(h, g->intersections, sizeof(Intersection) * (size_t)g->n_intersections);
+    return fnv1a(h, g->links, sizeof(Link) * (size_t)g->n_links);
+}
+
+static int fail(const char* why) {
+    fprintf(stderr, "checkpoint: %s\n", why);
+    return -1;
+}
+
+/* ---------------- capture ---------------- */
+
+int checkpoint_capture(TsCheckpoint** out, const Grid* g, const VehiclePool* vp, const Stats* s,
+                       const Engine* e, const Config* cfg, double t, int step) {
+    *out = NULL;
+    Out o = {0};
+    CkptHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+    h.version = CKPT_VERSION;
+    h.byte_order = BYTE_ORDER_MARK;
+    h.light_bytes = (uint32_t)sizeof(TrafficLight);
+    h.n_intersections = g->n_intersections;
+    h.n_links = g->n_links;
+    h.step = step;
+    h.n_cells = g->n_cells;
+    h.network_hash = network_hash(g);
+    h.t = t;
+    h.time_step = cfg->time_step;
+    h.seed = cfg->random_seed;
+    h.vehicle_cap = vp->cap;
+    h.n_vehicles = vp->n_used;
+    h.n_free = vp->n_free;
+    h.peak_vehicles = vp->peak_used;
+    h.k_cells = g->k_cells;
+    put(&o, &h, sizeof(h));
+
+    h.off_lights = o.n;
+    put(&o, g->lights, sizeof(TrafficLight) * (size_t)g->n_intersections);
+    for (int k=0; k<g->n_intersections; k++) {
+        uint8_t d = atomic_load_explicit(&g->light_dirty[k], memory_order_relaxed);
+        put(&o, &d, 1);
+    }
+
+    /* vehicles: per-field blocks in pool order */
+    h.off_vehicles = o.n;
+    int n = vp->n_used;
+    put(&o, vp->active, sizeof(int32_t) * (size_t)n);
+    put(&o, vp->free_ids, sizeof(int32_t) * (size_t)vp->n_free);
+    char* col = (char*)malloc(sizeof(double) * (size_t)(n ? n : 1));
+    if (!col) o.failed = true;
+    for (int f=0; f<7 && col; f++) {
+        size_t w = 0;
+        for (int k=0; k<n; k++) {
+            int id = vp->active[k];
+            switch (f) {
+            case 0: w = 4; memcpy(col + k * w, &vp->link[id], w); break;
+            case 1: w = 4; memcpy(col + k * w, &vp->cell_idx[id], w); break;
+            case 2: w = 1; memcpy(col + k * w, &vp->speed[id], w); break;
+            case 3: w = 1; memcpy(col + k * w, &vp->vmax[id], w); break;
+            case 4: w = 2; memcpy(col + k * w, &vp->destination[id], w); break;
+            case 5: w = 8; memcpy(col + k * w, &vp->entry_time[id], w); break;
+            default: w = 8; memcpy(col + k * w, &vp->stopped_time[id], w); break;
+            }
+        }
+        put(&o, col, w * (size_t)n);
+    }
+    free(col);
+
+    h.off_stats = o.n;
+    int64_t counters[4] = { s->spawned, s->exited, s->blocked_entries, s->queue_samples };
+    put(&o, counters, sizeof(counters));
+    put(&o, s->queue_sum, sizeof(double) * (size_t)g->n_intersections);
+    put(&o, s->queue_max, sizeof(double) * (size_t)g->n_intersections);
+    const QSketch* q = &s->tt;
+    uint64_t qh[4] = { q->n, q->total_ms, q->min_ms, q->max_ms };
+    put(&o, qh, sizeof(qh));
+    uint32_t n_buckets = 0;
+    for (int b=0; b<QS_N_BUCKETS; b++) n_buckets += (q->counts[b] != 0);
+    put(&o, &n_buckets, sizeof(n_buckets));
+    for (int b=0; b<QS_N_BUCKETS; b++) {
+        if (!q->counts[b]) continue;
+        uint32_t idx = (uint32_t)b;
+        put(&o, &idx, sizeof(idx));
+        put(&o, &q->counts[b], sizeof(uint64_t));
+        put(&o, &q->sums_ms[b], sizeof(uint64_t));
+    }
+
+    /* static tables follow from the network and config; re-weighted ones do not */
+    h.off_routing = o.n;
+    uint8_t kind = (e->routed && e->reweight_steps > 0) ? 1 : 0;
+    put(&o, &kind, 1);
+    if (kind) {
+        const Routing* r = &e->route;
+        size_t cells = (size_t)r->n_dest * (size_t)r->n_links;
+        put(&o, &r->n_dest, sizeof(int32_t));
+        put(&o, r->dest_node, sizeof(int32_t) * (size_t)r->n_dest);
+        put(&o, r->weight, sizeof(float) * (size_t)r->n_links);
+        put(&o, r->hop, cells);
+        put(&o, r->dist, sizeof(float) * cells);
+        put(&o, &e->reweight_steps, sizeof(int32_t));
+        put(&o, e->occ_steps, sizeof(int64_t) * (size_t)g->n_links);
+        put(&o, e->departures, sizeof(int32_t) * (size_t)g->n_links);
+    }
+
+    /* arrivals already drawn; none before the first step */
+    h.off_demand = o.n;
+    const Demand* d = e->demand;
+    kind = (d && d->started) ? 1 : 0;
+    put(&o, &kind, 1);
+    if (kind) {
+        put(&o, &d->hash, sizeof(uint64_t));
+        put(&o, &d->n_origins, sizeof(int32_t));
+        put(&o, &d->period, sizeof(int32_t));
+        put(&o, d->next, sizeof(int32_t) * (size_t)d->n_origins);
+    }
+
+    h.bytes = o.n;
+    TsCheckpoint* ck = (TsCheckpoint*)malloc(sizeof(TsCheckpoint));
+    if (o.failed || !ck) {
+        free(o.p);
+        free(ck);
+        return fail("out of memory");
+    }
+    memcpy(o.p, &h, sizeof(h));
+    ck->h = h;
+    ck->data = o.p;
+    *out = ck;
+    return 0;
+}
+
+/* ---------------- restore ---------------- */
+
+/* the light's settings from the configuration, i.e. what grid_light_init sets */
+static bool same_plan(const TrafficLight* a, const TrafficLight* b) {
+    return a->type == b->type && a->cycle_time == b->cycle_time && a->green_ns == b->green_ns
+        && a->min_green == b->min_green && a->max_green == b->max_green
+        && a->queue_threshold == b->queue_threshold;
+}
+
+static int restore_lights(const TsCheckpoint* ck, Grid* g, const Config* cfg, int step) {
+    In in = section(ck, ck->h.off_lights, ck->h.off_vehicles);
+    get(&in, g->lights, sizeof(TrafficLight) * (size_t)g->n_intersections);
+    bool recount = (ck->h.k_cells != g->k_cells);
+    for (int k=0; k<g->n_intersections; k++) {
+        uint8_t d;
+        get(&in, &d, 1);
+        TrafficLight* tl = &g->lights[k];
+        if (tl->phase != PHASE_NS && tl->phase != PHASE_EW) in.bad = true;
+
+        TrafficLight fresh;
+        grid_light_init(&fresh, cfg);
+        if (!same_plan(tl, &fresh)) {
+            /* another controller or timing: keep what is showing, decide now */
+            fresh.phase = tl->phase;
+            fresh.phase_start = tl->phase_start;
+            fresh.next_eval = step;
+            *tl = fresh;
+            d = 1;
+        }
+        atomic_store_explicit(&g->light_dirty[k], (recount || d) ? 1 : 0, memory_order_relaxed);
+    }
+    return in.bad ? fail("bad light section") : 0;
+}
+
+static int restore_vehicles(const TsCheckpoint* ck, Grid* g, VehiclePool* vp) {
+    const CkptHeader* h = &ck->h;
+    if (h->vehicle_cap < 1 || h->n_vehicles < 0 || h->n_free < 0
+        || (int64_t)h->n_vehicles + h->n_free != h->vehicle_cap || h->peak_vehicles < h->n_vehicles)
+        return fail("bad vehicle counts");
+    vp_free(vp);
+    if (vp_init(vp, h->vehicle_cap) != 0) return fail("out of memory");
+
+    In in = section(ck, h->off_vehicles, h->off_stats);
+    int n = h->n_vehicles;
+    vp->n_used = n;
+    vp->n_free = h->n_free;
+    vp->peak_used = h->peak_vehicles;
+    get(&in, vp->active, sizeof(int32_t) * (size_t)n);
+    get(&in, vp->free_ids, sizeof(int32_t) * (size_t)vp->n_free);
+    if (in.bad) return fail("truncated vehicle section");
+
+    /* every id exactly once, live or free */
+    for (int id=0; id<vp->cap; id++) vp->active_pos[id] = -1;
+    for (int k=0; k<n; k++) {
+        int id = vp->active[k];
+        if (id < 0 || id >= vp->cap || vp->active_pos[id] != -1) return fail("bad live vehicle list");
+        vp->active_pos[id] = k;
+    }
+    for (int k=0; k<vp->n_free; k++) {
+        int id = vp->free_ids[k];
+        if (id < 0 || id >= vp->cap || vp->active_pos[id] != -1) return fail("bad free vehicle list");
+        vp->active_pos[id] = -2;
+    }
+    for (int k=0; k<vp->n_free; k++) vp->active_pos[vp->free_ids[k]] = -1;
+
+    for (int k=0; k<n; k++) get(&in, &vp->link[vp->active[k]], sizeof(int32_t));
+    for (int k=0; k<n; k++) get(&in, &vp->cell_idx[vp->active[k]], sizeof(int32_t));
+    for (int k=0; k<n; k++) get(&in, &vp->speed[vp->active[k]], 1);
+    for (int k=0; k<n; k++) get(&in, &vp->vmax[vp->active[k]], 1);
+    for (int k=0; k<n; k++) get(&in, &vp->destination[vp->active[k]], sizeof(uint16_t));
+    for (int k=0; k<n; k++) get(&in, &vp->entry_time[vp->active[k]], sizeof(double));
+    for (int k=0; k<n; k++) get(&in, &vp->stopped_time[vp->active[k]], sizeof(double));
+    if (in.bad) return fail("truncated vehicle section");
+
+    /* cells and occupancy from the vehicles, then the windows */
+    for (int k=0; k<n; k++) {
+        int id = vp->active[k];
+        int32_t l = vp->link[id];
+        if (l < 0 || l >= g->n_links) return fail("vehicle on a link that does not exist");
+        const Link* L = &g->links[l];
+        int c = vp->cell_idx[id];
+        if (c < 0 || c >= link_slots(L) || link_occupied(g, L, c)) return fail("vehicle on a bad or shared cell");
+        g->cells[L->cell_off + c].vehicle_id = id;
+        g->occ[L->occ_off + (c >> 6)] |= (uint64_t)1 << (c & 63);
+        vp->planned_move[id] = MOVE_STAY;
+        vp->planned_next_link[id] = INVALID_ID;
+    }
+    for (int l=0; l<g->n_links; l++) {
+        const Link* L = &g->links[l];
+        g->stop_count[l] = link_count_range(g, L, (L->n_cells - g->k_cells) * L->n_lanes, link_slots(L));
+        g->head_count[l] = link_count_range(g, L, 0, g->k_cells * L->n_lanes);
+    }
+    return 0;
+}
+
+static int restore_stats(const TsCheckpoint* ck, const Grid* g, Stats* s) {
+    In in = section(ck, ck->h.off_stats, ck->h.off_routing);
+    int64_t counters[4];
+    get(&in, counters, sizeof(counters));
+    s->spawned = (long)counters[0];
+    s->exited = (long)counters[1];
+    s->blocked_entries = (long)counters[2];
+    s->queue_samples = (long)counters[3];
+    get(&in, s->queue_sum, sizeof(double) * (size_t)g->n_intersections);
+    get(&in, s->queue_max, sizeof(double) * (size_t)g->n_intersections);
+
+    QSketch* q = &s->tt;
+    qs_init(q);
+    uint64_t qh[4];
+    get(&in, qh, sizeof(qh));
+    q->n = qh[0];
+    q->total_ms = qh[1];
+    q->min_ms = qh[2];
+    q->max_ms = qh[3];
+    uint32_t n_buckets = 0;
+    get(&in, &n_buckets, sizeof(n_buckets));
+    for (uint32_t k=0; k<n_buckets && !in.bad; k++) {
+        uint32_t b;
+        get(&in, &b, sizeof(b));
+        if (b >= QS_N_BUCKETS) in.bad = true;
+        else {
+            get(&in, &q->counts[b], sizeof(uint64_t));
+            get(&in, &q->sums_ms[b], sizeof(uint64_t));
+        }
+    }
+    return in.bad ? fail("bad stats section") : 0;
+}
+
+int checkpoint_restore_state(const TsCheckpoint* ck, Grid* g, VehiclePool* vp, Stats* s,
+                             const Config* cfg, double* t, int* step) {
+    const CkptHeader* h = &ck->h;
+    if (h->n_intersections != g->n_intersections || h->n_links != g->n_links || h->n_cells != g->n_cells
+        || h->network_hash != network_hash(g))
+        return fail("saved on another road network");
+    if (h->time_step != cfg->time_step) return fail("simulation.time_step differs from the saved run");
+
+    *t = h->t;
+    *step = h->step;
+    if (restore_lights(ck, g, cfg, h->step) != 0 || restore_vehicles(ck, g, vp) != 0
+        || restore_stats(ck, g, s) != 0)
+        return -1;
+    return 0;
+}
+
+/* pending arrivals of the same OD tables; else the engine draws them at
+   its first step */
+static int restore_demand(const TsCheckpoint* ck, Engine* e) {
+    Demand* d = e->demand;
+    In in = section(ck, ck->h.off_demand, ck->h.bytes);
+    uint8_t kind = 0;
+    get(&in, &kind, 1);
+    if (in.bad) return fail("truncated demand section");
+    if (kind == 0 || !d) return 0;
+
+    uint64_t hash = 0;
+    int32_t n = 0, period = 0;
+    get(&in, &hash, sizeof(hash));
+    get(&in, &n, sizeof(n));
+    get(&in, &period, sizeof(period));
+    if (in.bad) return fail("truncated demand section");
+    if (hash != d->hash || n != d->n_origins) return 0;
+    int32_t* next = (int32_t*)malloc(sizeof(int32_t) * (size_t)(n ? n : 1));
+    if (!next) return fail("out of memory");
+    get(&in, next, sizeof(int32_t) * (size_t)n);
+    int rc = 0;
+    if (in.bad || period < 0 || period >= d->n_periods) rc = fail("bad demand section");
+    else if (demand_resume(d, period, next) != 0) rc = fail("out of memory");
+    free(next);
+    return rc;
+}
+
+int checkpoint_restore_engine(const TsCheckpoint* ck, Engine* e) {
+    const VehiclePool* vp = e->vp;
+    int n_dest = e->routed ? e->route.n_dest : ROUTE_SIDES;
+    for (int k=0; k<vp->n_used; k++)
+        if (vp->destination[vp->active[k]] >= n_dest)
+            return fail("vehicles head for routing destinations this configuration does not have");
+
+    if (restore_demand(ck, e) != 0) return -1;
+
+    In in = section(ck, ck->h.off_routing, ck->h.off_demand);
+    uint8_t kind = 0;
+    get(&in, &kind, 1);
+    if (in.bad) return fail("truncated routing section");
+    /* saved static tables, or none: the new engine's are what the run had */
+    if (kind == 0 || !e->routed) return 0;
+
+    const Grid* g = e->g;
+    int32_t saved_dest = 0;
+    get(&in, &saved_dest, sizeof(saved_dest));
+    if (in.bad || saved_dest < ROUTE_SIDES || saved_dest > UINT16_MAX + 1) return fail("bad routing section");
+    size_t cells = (size_t)saved_dest * (size_t)g->n_links;
+    int32_t* dest_node = (int32_t*)malloc(sizeof(int32_t) * (size_t)saved_dest);
+    float* weight = (float*)malloc(sizeof(float) * (size_t)(g->n_links ? g->n_links : 1));
+    uint8_t* hop = (uint8_t*)malloc(cells ? cells : 1);
+    float* dist = (float*)malloc(sizeof(float) * (cells ? cells : 1));
+    int rc = -1;
+    if (dest_node && weight && hop && dist) {
+        int32_t reweight_steps = 0;
+        get(&in, dest_node, sizeof(int32_t) * (size_t)saved_dest);
+        get(&in, weight, sizeof(float) * (size_t)g->n_links);
+        get(&in, hop, cells);
+        get(&in, dist, sizeof(float) * cells);
+        get(&in, &reweight_steps, sizeof(reweight_steps));
+        if (in.bad) {
+            rc = fail("truncated routing section");
+        } else {
+            rc = routing_restore(&e->route, g, saved_dest, dest_node, weight, hop, dist);
+            /* a measurement interval of the same length carries on */
+            if (rc == 0 && e->reweight_steps == reweight_steps) {
+                get(&in, e->occ_steps, sizeof(int64_t) * (size_t)g->n_links);
+                get(&in, e->departures, sizeof(int32_t) * (size_t)g->n_links);
+                if (in.bad) rc = fail("truncated routing section");
+            }
+        }
+    } else {
+        fail("out of memory");
+    }
+    free(dest_node);
+    free(weight);
+    free(hop);
+    free(dist);
+    return rc;
+}
+
+/* ---------------- files ---------------- */
+
+int ts_checkpoint_save(const TsCheckpoint* ck, const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+    int ok = fwrite(ck->data, 1, (size_t)ck->h.bytes, f) == ck->h.bytes;
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+static TsCheckpoint* load_fail(const char* path, const char* why, FILE* f, char* data) {
+    fprintf(stderr, "checkpoint %s: %s\n", path, why);
+    if (f) fclose(f);
+    free(data);
+    return NULL;
+}
+
+TsCheckpoint* ts_checkpoint_load(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return load_fail(path, "cannot open", NULL, NULL);
+    CkptHeader h;
+    if (fread(&h, 1, sizeof(h), f) != sizeof(h)) return load_fail(path, "too short", f, NULL);
+    if (memcmp(h.magic, CKPT_MAGIC, sizeof(h.magic)) != 0) return load_fail(path, "not a checkpoint", f, NULL);
+    if (h.version != CKPT_VERSION || h.byte_order != BYTE_ORDER_MARK || h.light_bytes != sizeof(TrafficLight))
+        return load_fail(path, "written by an incompatible version", f, NULL);
+    if (!(sizeof(h) <= h.off_lights && h.off_lights <= h.off_vehicles && h.off_vehicles <= h.off_stats
+          && h.off_stats <= h.off_routing && h.off_routing <= h.off_demand && h.off_demand <= h.bytes
+          && h.bytes <= SIZE_MAX))
+        return load_fail(path, "bad section offsets", f, NULL);
+
+    char* data = (char*)malloc((size_t)h.bytes);
+    if (!data) return load_fail(path, "out of memory", f, NULL);
+    memcpy(data, &h, sizeof(h));
+    size_t rest = (size_t)h.bytes - sizeof(h);
+    if (fread(data + sizeof(h), 1, rest, f) != rest || fgetc(f) != EOF)
+        return load_fail(path, "truncated or trailing data", f, data);
+    fclose(f);
+
+    TsCheckpoint* ck = (TsCheckpoint*)malloc(sizeof(TsCheckpoint));
+    if (!ck) return load_fail(path, "out of memory", NULL, data);
+    ck->h = h;
+    ck->data = data;
+    return ck;
+}
+
+void ts_checkpoint_free(TsCheckpoint* ck) {
+    if (!ck) return;
+    free(ck->data);
+    free(ck);
+}
+
+double ts_checkpoint_time(const TsCheckpoint* ck) {
+    return ck->h.t;
+}
@@ -3,32 +3,48 @@
 #include <string.h>
 #include <stdlib.h>
 
-static ControllerType parse_controller(const char* s) {
+/* -1 for unknown names */
+static int parse_controller(const char* s) {
     if (strcmp(s, "fixed") == 0) return CTRL_FIXED;
     if (strcmp(s, "actuated") == 0) return CTRL_ACTUATED;
     if (strcmp(s, "max_pressure") == 0) return CTRL_MAX_PRESSURE;
-    return CTRL_FIXED;
+    return -1;
 }
 
-static void set_defaults(Config* c) {
+static int parse_routing(const char* s) {
+    if (strcmp(s, "manhattan") == 0) return ROUTING_MANHATTAN;
+    if (strcmp(s, "shortest_path") == 0) return ROUTING_SHORTEST_PATH;
+    return -1;
+}
+
+void config_set_defaults(Config* c) {
     c->time_step = 0.5;
     c->duration = 7200;
     c->warmup = 1200;
     c->random_seed = 42;
+    c->threads = 1;
 
     c->grid_size = 6;
     c->cell_length_m = 7.5;
     c->link_length_cells = 20;
     c->lanes_per_direction = 1;
+    c->network_file[0] = '\0';
 
     c->vmax_cells_per_step = 1;
     c->slowdown_probability = 0.2;
     c->vehicle_length_cells = 1;
+    c->lane_change_probability = 0.5;
 
     c->arrival_rate = 0.25;
     c->routing_randomness = 0.1;
+    c->routing_type = ROUTING_MANHATTAN;
+    c->routing_update_interval = 0;
+    c->routing_reweight_threshold = 0.1;
+    c->routing_destinations[0] = '\0';
+    c->od_file[0] = '\0';
 
     c->controller = CTRL_FIXED;
+    c->queue_window_cells = 5;
     c->cycle_time = 60;
     c->green_ns = 30;
 
@@ -40,12 +56,75 @@ static void set_defaults(Config* c) {
     c->mp_max_green = 45;
 
     c->export_interval = 1.0;
-    c->save_queue_snapshots = 1;
+    c->save_queue_snapshots = 0;
     c->save_vehicle_trajectories = 0;
 }
 
+int config_set(Config* cfg, const char* key, const char* val) {
+    if (strcmp(key, "simulation.time_step")==0) cfg->time_step = atof(val);
+    else if (strcmp(key, "simulation.duration")==0) cfg->duration = atof(val);
+    else if (strcmp(key, "simulation.warmup")==0) cfg->warmup = atof(val);
+    else if (strcmp(key, "simulation.random_seed")==0) cfg->random_seed = (uint64_t)strtoull(val, NULL, 10);
+    else if (strcmp(key, "simulation.threads")==0) cfg->threads = atoi(val);
+
+    else if (strcmp(key, "network.grid_size")==0) cfg->grid_size = atoi(val);
+    else if (strcmp(key, "network.cell_length")==0) cfg->cell_length_m = atof(val);
+    else if (strcmp(key, "network.link_length_cells")==0) cfg->link_length_cells = atoi(val);
+    else if (strcmp(key, "network.lanes_per_direction")==0) cfg->lanes_per_direction = atoi(val);
+    else if (strcmp(key, "network.file")==0) {
+        if (strlen(val) >= sizeof(cfg->network_file)) return -1;
+        strcpy(cfg->network_file, val);
+    }
+
+    else if (strcmp(key, "vehicles.vmax_cells_per_step")==0) cfg->vmax_cells_per_step = atoi(val);
+    else if (strcmp(key, "vehicles.slowdown_probability")==0) cfg->slowdown_probability = atof(val);
+    else if (strcmp(key, "vehicles.vehicle_length_cells")==0) cfg->vehicle_length_cells = atoi(val);
+    else if (strcmp(key, "vehicles.lane_change_probability")==0) cfg->lane_change_probability = atof(val);
+
+    else if (strcmp(key, "demand.arrival_rate")==0) cfg->arrival_rate = atof(val);
+    else if (strcmp(key, "demand.routing_randomness")==0) cfg->routing_randomness = atof(val);
+    else if (strcmp(key, "demand.routing_type")==0) {
+        int r = parse_routing(val);
+        if (r < 0) return -1;
+        cfg->routing_type = (RoutingType)r;
+    }
+    else if (strcmp(key, "demand.routing_update_interval")==0) cfg->routing_update_interval = atof(val);
+    else if (strcmp(key, "demand.routing_reweight_threshold")==0) cfg->routing_reweight_threshold = atof(val);
+    else if (strcmp(key, "demand.routing_destinations")==0) {
+        if (strlen(val) >= sizeof(cfg->routing_destinations)) return -1;
+        strcpy(cfg->routing_destinations, val);
+    }
+    else if (strcmp(key, "demand.od_file")==0) {
+        if (strlen(val) >= sizeof(cfg->od_file)) return -1;
+        strcpy(cfg->od_file, val);
+    }
+
+    else if (strcmp(key, "traffic_lights.controller")==0) {
+        int c = parse_controller(val);
+        if (c < 0) return -1;
+        cfg->controller = (ControllerType)c;
+    }
+    else if (strcmp(key, "traffic_lights.queue_window_cells")==0) cfg->queue_window_cells = atoi(val);
+
+    else if (strcmp(key, "traffic_lights.fixed.cycle_time")==0) cfg->cycle_time = atof(val);
+    else if (strcmp(key, "traffic_lights.fixed.green_ns")==0) cfg->green_ns = atof(val);
+
+    else if (strcmp(key, "traffic_lights.actuated.min_green")==0) cfg->act_min_green = atof(val);
+    else if (strcmp(key, "traffic_lights.actuated.max_green")==0) cfg->act_max_green = atof(val);
+    else if (strcmp(key, "traffic_lights.actuated.queue_threshold")==0) cfg->act_queue_threshold = atoi(val);
+
+    else if (strcmp(key, "traffic_lights.max_pressure.min_green")==0) cfg->mp_min_green = atof(val);
+    else if (strcmp(key, "traffic_lights.max_pressure.max_green")==0) cfg->mp_max_green = atof(val);
+
+    else if (strcmp(key, "output.export_interval")==0) cfg->export_interval = atof(val);
+    else if (strcmp(key, "output.save_queue_snapshots")==0) cfg->save_queue_snapshots = atoi(val);
+    else if (strcmp(key, "output.save_vehicle_trajectories")==0) cfg->save_vehicle_trajectories = atoi(val);
+    else return -1;
+    return 0;
+}
+
 int config_load_kv(Config* cfg, const char* path) {
-    set_defaults(cfg);
+    config_set_defaults(cfg);
 
     FILE* f = fopen(path, "r");
     if (!f) return -1;
@@ -64,38 +143,7 @@ int config_load_kv(Config* cfg, const char* path) {
         char* nl = strchr(val, '\n');
         if (nl) *nl = '\0';
 
-        if (strcmp(key, "simulation.time_step")==0) cfg->time_step = atof(val);
-        else if (strcmp(key, "simulation.duration")==0) cfg->duration = atof(val);
-        else if (strcmp(key, "simulation.warmup")==0) cfg->warmup = atof(val);
-        else if (strcmp(key, "simulation.random_seed")==0) cfg->random_seed = (uint64_t)strtoull(val, NULL, 10);
-
-        else if (strcmp(key, "network.grid_size")==0) cfg->grid_size = atoi(val);
-        else if (strcmp(key, "network.cell_length")==0) cfg->cell_length_m = atof(val);
-        else if (strcmp(key, "network.link_length_cells")==0) cfg->link_length_cells = atoi(val);
-        else if (strcmp(key, "network.lanes_per_direction")==0) cfg->lanes_per_direction = atoi(val);
-
-        else if (strcmp(key, "vehicles.vmax_cells_per_step")==0) cfg->vmax_cells_per_step = atoi(val);
-        else if (strcmp(key, "vehicles.slowdown_probability")==0) cfg->slowdown_probability = atof(val);
-        else if (strcmp(key, "vehicles.vehicle_length_cells")==0) cfg->vehicle_length_cells = atoi(val);
-
-        else if (strcmp(key, "demand.arrival_rate")==0) cfg->arrival_rate = atof(val);
-        else if (strcmp(key, "demand.routing_randomness")==0) cfg->routing_randomness = atof(val);
-
-        else if (strcmp(key, "traffic_lights.controller")==0) cfg->controller = parse_controller(val);
-
-        else if (strcmp(key, "traffic_lights.fixed.cycle_time")==0) cfg->cycle_time = atof(val);
-        else if (strcmp(key, "traffic_lights.fixed.green_ns")==0) cfg->green_ns = atof(val);
-
-        else if (strcmp(key, "traffic_lights.actuated.min_green")==0) cfg->act_min_green = atof(val);
-        else if (strcmp(key, "traffic_lights.actuated.max_green")==0) cfg->act_max_green = atof(val);
-        else if (strcmp(key, "traffic_lights.actuated.queue_threshold")==0) cfg->act_queue_threshold = atoi(val);
-
-        else if (strcmp(key, "traffic_lights.max_pressure.min_green")==0) cfg->mp_min_green = atof(val);
-        else if (strcmp(key, "traffic_lights.max_pressure.max_green")==0) cfg->mp_max_green = atof(val);
-
-        else if (strcmp(key, "output.export_interval")==0) cfg->export_interval = atof(val);
-        else if (strcmp(key, "output.save_queue_snapshots")==0) cfg->save_queue_snapshots = atoi(val);
-        else if (strcmp(key, "output.save_vehicle_trajectories")==0) cfg->save_vehicle_trajectories = atoi(val);
+        config_set(cfg, key, val);
     }
 
     fclose(f);
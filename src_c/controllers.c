@@ -1,110 +1,211 @@
 // controllers.c
 #include "controllers.h"
+#include "occupancy.h"
 #include <math.h>
-
-static bool is_green_for_dir(Phase ph, Direction dir) {
-    /* NS green allows DIR_N and DIR_S movements into the intersection */
-    if (ph == PHASE_NS) return (dir == DIR_N || dir == DIR_S);
-    return (dir == DIR_E || dir == DIR_W);
-}
-
-int queue_in_dir(const Intersection* inter, Direction dir, int k_cells) {
-    const Link* in = inter->in[dir];
-    if (!in) return 0;
-    int count = 0;
-    int start = in->n_cells - k_cells;
-    if (start < 0) start = 0;
-    for (int c=start; c<in->n_cells; c++) {
-        if (in->cells[c].vehicle_id != INVALID_ID) count++;
+#include <stdlib.h>
+#include <string.h>
+
+int queue_for_group(const Grid* g, const Intersection* inter, Phase ph) {
+    int q = 0;
+    for (int32_t k=g->in_off[inter->id]; k<g->in_off[inter->id + 1]; k++) {
+        const Link* L = &g->links[g->in_links[k]];
+        if (L->group == ph) q += link_lane_queue(g, L);
     }
-    return count;
+    return q;
 }
 
-int pressure_for_phase(const Intersection* inter, Phase ph, int k_cells) {
-    /* upstream queues on approaches that would be green */
+int pressure_for_phase(const Grid* g, const Intersection* inter, Phase ph) {
+    /* upstream queues on approaches that would be green, all lanes: a phase
+       serving more lanes discharges more vehicles per step */
     int upstream = 0;
-    int downstream = 0;
+    for (int32_t k=g->in_off[inter->id]; k<g->in_off[inter->id + 1]; k++) {
+        const Link* L = &g->links[g->in_links[k]];
+        if (L->group == ph) upstream += link_stop_count(g, L);
+    }
 
-    for (int d=0; d<4; d++) {
-        Direction dir = (Direction)d;
-        if (!is_green_for_dir(ph, dir)) continue;
+    /* downstream: approximate congestion on outgoing links of the same
+       signal group (the straight movements) */
+    int downstream = 0;
+    for (int32_t k=g->out_off[inter->id]; k<g->out_off[inter->id + 1]; k++) {
+        const Link* L = &g->links[g->out_links[k]];
+        if (L->group == ph) downstream += link_head_count(g, L);
+    }
+    return upstream - downstream;
+}
 
-        upstream += queue_in_dir(inter, dir, k_cells);
+/* smallest k >= 1 with k * dt >= x: a phase that began at step s has lasted
+   x seconds from step s + k on */
+static int32_t steps_for(double x, double dt) {
+    if (!(x > dt)) return 1;
+    double k = ceil(x / dt);
+    if (!(k < (double)(1 << 30))) return 1 << 30;
+    int32_t n = (int32_t)k;
+    while (n > 1 && (double)(n - 1) * dt >= x) n--;
+    while ((double)n * dt < x) n++;
+    return n;
+}
 
-        /* downstream: approximate congestion on outgoing link of same dir (straight movement) */
-        const Link* out = inter->out[dir];
-        if (!out) continue;
-        int start = 0;
-        int end = k_cells;
-        if (end > out->n_cells) end = out->n_cells;
-        for (int c=start; c<end; c++) {
-            if (out->cells[c].vehicle_id != INVALID_ID) downstream++;
-        }
+static int slot_push(LightSlot* l, int32_t v) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 16;
+        int32_t* p = (int32_t*)realloc(l->v, sizeof(int32_t) * (size_t)cap);
+        if (!p) return -1;
+        l->v = p;
+        l->cap = cap;
     }
-    return upstream - downstream;
+    l->v[l->n++] = v;
+    return 0;
+}
+
+static int schedule(LightSched* ls, TrafficLight* tl, int idx, int32_t step) {
+    tl->next_eval = step;
+    if (step == LIGHT_NEVER) return 0;
+    return slot_push(&ls->slots[step & (ls->n_slots - 1)], idx);
 }
 
-static void tl_fixed(TrafficLight* tl, double t) {
+static int tl_fixed(LightSched* ls, TrafficLight* tl, int idx, int step, double t, double dt) {
     double C = tl->cycle_time;
     double gNS = tl->green_ns;
     double x = fmod(t, C);
     tl->phase = (x < gNS) ? PHASE_NS : PHASE_EW;
-}
 
-static void tl_actuated(Intersection* inter, TrafficLight* tl, double dt) {
-    tl->phase_elapsed += dt;
-
-    int qNS = queue_in_dir(inter, DIR_N, 5) + queue_in_dir(inter, DIR_S, 5);
-    int qEW = queue_in_dir(inter, DIR_E, 5) + queue_in_dir(inter, DIR_W, 5);
+    if (!(C > 0.0 && gNS > 0.0 && gNS < C)) {
+        /* a plan with a single phase never switches */
+        return schedule(ls, tl, idx, LIGHT_NEVER);
+    }
+    /* the switch is ceil(rem / dt) steps ahead; wake up one step before it
+       and let that step look again, so rounding in t never makes it late */
+    double rem = ((tl->phase == PHASE_NS) ? gNS : C) - x;
+    double k = ceil(rem / dt) - 1.0;
+    if (k > (double)(1 << 30)) k = (double)(1 << 30);
+    return schedule(ls, tl, idx, step + ((k >= 1.0) ? (int32_t)k : 1));
+}
 
-    if (tl->phase_elapsed < tl->min_green) return;
+/* decisions of an armed light; true if a new phase (possibly the same
+   one, for max-pressure) begins */
+static bool tl_actuated(const Grid* g, const Intersection* inter, TrafficLight* tl, bool force) {
+    int qNS = queue_for_group(g, inter, PHASE_NS);
+    int qEW = queue_for_group(g, inter, PHASE_EW);
 
-    bool force = (tl->phase_elapsed >= tl->max_green);
     bool wantNS = (qNS - qEW) > tl->queue_threshold;
     bool wantEW = (qEW - qNS) > tl->queue_threshold;
 
     if (force || (tl->phase == PHASE_EW && wantNS) || (tl->phase == PHASE_NS && wantEW)) {
         tl->phase = (tl->phase == PHASE_NS) ? PHASE_EW : PHASE_NS;
-        tl->phase_elapsed = 0.0;
+        return true;
     }
+    return false;
 }
 
-static void tl_max_pressure(Intersection* inter, TrafficLight* tl, double dt) {
-    tl->phase_elapsed += dt;
-
-    if (tl->phase_elapsed < tl->min_green) return;
-
-    int pNS = pressure_for_phase(inter, PHASE_NS, 5);
-    int pEW = pressure_for_phase(inter, PHASE_EW, 5);
+static bool tl_max_pressure(const Grid* g, const Intersection* inter, TrafficLight* tl, bool force) {
+    int pNS = pressure_for_phase(g, inter, PHASE_NS);
+    int pEW = pressure_for_phase(g, inter, PHASE_EW);
     Phase best = (pNS >= pEW) ? PHASE_NS : PHASE_EW;
 
-    bool force = (tl->phase_elapsed >= tl->max_green);
-
     if (force || best != tl->phase) {
         tl->phase = best;
-        tl->phase_elapsed = 0.0;
+        return true;
     }
+    return false;
 }
 
-void update_traffic_lights(Grid* g, const Config* cfg, double t, double dt) {
-    for (int k=0; k<g->n_intersections; k++) {
-        Intersection* inter = &g->intersections[k];
-        TrafficLight* tl = &inter->tl;
-        tl->type = cfg->controller;
-
-        if (cfg->controller == CTRL_FIXED) {
-            tl->cycle_time = cfg->cycle_time;
-            tl->green_ns = cfg->green_ns;
-            tl_fixed(tl, t);
-        } else if (cfg->controller == CTRL_ACTUATED) {
-            tl->min_green = cfg->act_min_green;
-            tl->max_green = cfg->act_max_green;
-            tl->queue_threshold = cfg->act_queue_threshold;
-            tl_actuated(inter, tl, dt);
-        } else {
-            tl->min_green = cfg->mp_min_green;
-            tl->max_green = cfg->mp_max_green;
-            tl_max_pressure(inter, tl, dt);
+static int eval_adaptive(LightSched* ls, Grid* g, int idx, int step, double dt) {
+    TrafficLight* tl = &g->lights[idx];
+    const Intersection* inter = &g->intersections[idx];
+    atomic_store_explicit(&g->light_dirty[idx], 0, memory_order_relaxed);
+
+    int32_t force_at = tl->phase_start + steps_for(tl->max_green, dt);
+    bool force = (step >= force_at);
+    bool restart = (tl->type == CTRL_ACTUATED) ? tl_actuated(g, inter, tl, force)
+                                               : tl_max_pressure(g, inter, tl, force);
+    if (restart) {
+        tl->phase_start = step;
+        tl->armed = false;
+        return schedule(ls, tl, idx, step + steps_for(tl->min_green, dt));
+    }
+    if (tl->next_eval != force_at) return schedule(ls, tl, idx, force_at);
+    return 0;
+}
+
+/* scheduled decision of light idx at step */
+static int light_due(LightSched* ls, Grid* g, int idx, int step, double t, double dt) {
+    TrafficLight* tl = &g->lights[idx];
+    if (tl->type == CTRL_FIXED) return tl_fixed(ls, tl, idx, step, t, dt);
+    int32_t arm_at = tl->phase_start + steps_for(tl->min_green, dt);
+    if (step < arm_at) return schedule(ls, tl, idx, arm_at);
+    if (!tl->armed) {
+        tl->armed = true;
+        ls->armed[ls->n_armed++] = idx;
+    }
+    return eval_adaptive(ls, g, idx, step, dt);
+}
+
+int light_sched_init(LightSched* ls, Grid* g, const int32_t* ids, int n, double dt) {
+    memset(ls, 0, sizeof(*ls));
+
+    /* decisions are scheduled at most one cycle / max_green ahead; farther
+       ones (huge plans) just go round the wheel again */
+    int32_t horizon = 1;
+    for (int k=0; k<n; k++) {
+        const TrafficLight* tl = &g->lights[ids[k]];
+        int32_t h = (tl->type == CTRL_FIXED) ? steps_for(tl->cycle_time, dt) : steps_for(tl->max_green, dt);
+        int32_t h_min = steps_for(tl->min_green, dt);
+        if (tl->type != CTRL_FIXED && h_min > h) h = h_min;
+        if (h > horizon) horizon = h;
+    }
+    ls->n_slots = 64;
+    while (ls->n_slots <= horizon && ls->n_slots < 4096) ls->n_slots *= 2;
+
+    ls->slots = (LightSlot*)calloc((size_t)ls->n_slots, sizeof(LightSlot));
+    ls->armed = (int32_t*)malloc(sizeof(int32_t) * (size_t)(n ? n : 1));
+    if (!ls->slots || !ls->armed) return -1;
+
+    for (int k=0; k<n; k++) {
+        const TrafficLight* tl = &g->lights[ids[k]];
+        if (tl->armed) ls->armed[ls->n_armed++] = ids[k];
+        if (tl->next_eval != LIGHT_NEVER
+            && slot_push(&ls->slots[tl->next_eval & (ls->n_slots - 1)], ids[k]) != 0) return -1;
+    }
+    return 0;
+}
+
+int light_sched_step(LightSched* ls, Grid* g, int step, double t, double dt) {
+    /* drain this step's slot; entries whose light was rescheduled since are
+       stale and dropped, entries a lap or more ahead go round again. A slot
+       that cannot grow fails the step, but the other lights are still
+       decided */
+    int rc = 0;
+    LightSlot* slot = &ls->slots[step & (ls->n_slots - 1)];
+    LightSlot due = *slot;
+    *slot = ls->due;
+    ls->due = due;
+    for (int k=0; k<due.n; k++) {
+        int idx = due.v[k];
+        int32_t at = g->lights[idx].next_eval;
+        if (at == step) {
+            if (light_due(ls, g, idx, step, t, dt) != 0) rc = -1;
+        } else if (at != LIGHT_NEVER && at > step && at - step >= ls->n_slots) {
+            if (slot_push(slot, idx) != 0) rc = -1;
         }
     }
+    ls->due.n = 0;
+
+    /* armed lights whose detector windows changed since their last decision */
+    int n = 0;
+    for (int k=0; k<ls->n_armed; k++) {
+        int idx = ls->armed[k];
+        if (g->lights[idx].armed && atomic_load_explicit(&g->light_dirty[idx], memory_order_relaxed)
+            && eval_adaptive(ls, g, idx, step, dt) != 0) rc = -1;
+        if (g->lights[idx].armed) ls->armed[n++] = idx;
+    }
+    ls->n_armed = n;
+    return rc;
+}
+
+void light_sched_free(LightSched* ls) {
+    for (int s=0; s<ls->n_slots && ls->slots; s++) free(ls->slots[s].v);
+    free(ls->slots);
+    free(ls->due.v);
+    free(ls->armed);
+    memset(ls, 0, sizeof(*ls));
 }
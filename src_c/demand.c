@@ -0,0 +1,388 @@
+// demand.c
+#include "demand.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int32_t period, origin;
+    int32_t dest;
+    double rate;
+} OdPair;
+
+typedef struct {
+    OdPair* v;
+    int n, cap;
+} OdList;
+
+static int od_push(OdList* l, int period, int origin, int dest, double rate) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        OdPair* p = (OdPair*)realloc(l->v, sizeof(OdPair) * (size_t)cap);
+        if (!p) return -1;
+        l->v = p;
+        l->cap = cap;
+    }
+    l->v[l->n++] = (OdPair){ period, origin, dest, rate };
+    return 0;
+}
+
+static int cmp_pair(const void* a, const void* b) {
+    const OdPair* x = (const OdPair*)a;
+    const OdPair* y = (const OdPair*)b;
+    if (x->period != y->period) return (x->period < y->period) ? -1 : 1;
+    if (x->origin != y->origin) return (x->origin < y->origin) ? -1 : 1;
+    return (x->dest < y->dest) ? -1 : (x->dest > y->dest);
+}
+
+static int side_of(const char* s) {
+    if (s[1] != '\0') return -1;
+    switch (s[0]) {
+    case 'N': return DIR_N;
+    case 'E': return DIR_E;
+    case 'S': return DIR_S;
+    case 'W': return DIR_W;
+    default: return -1;
+    }
+}
+
+/* non-negative integer, -1 otherwise */
+static long id_of(const char* s) {
+    if (!isdigit((unsigned char)*s)) return -1;
+    char* end;
+    long v = strtol(s, &end, 10);
+    return *end ? -1 : v;
+}
+
+static int bad(const char* path, int line, const char* why, const char* tok) {
+    fprintf(stderr, "demand %s line %d: %s%s%s\n", path, line, why, tok ? ": " : "", tok ? tok : "");
+    return -1;
+}
+
+/* the pairs of the file, origins expanded to entry link indices */
+static int read_pairs(const char* path, const Grid* g, const Routing* route, OdList* pairs, double** t0, int* n_periods) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "demand: cannot open %s\n", path);
+        return -1;
+    }
+    int32_t* entry_of = (int32_t*)malloc(sizeof(int32_t) * (size_t)(g->n_links ? g->n_links : 1));
+    if (!entry_of) {
+        fclose(f);
+        return -1;
+    }
+    for (int l=0; l<g->n_links; l++) entry_of[l] = INVALID_ID;
+    for (int k=0; k<g->n_entry_links; k++) entry_of[g->entry_links[k]] = k;
+
+    char buf[512];
+    int line = 0, rc = 0, cap = 0;
+    *n_periods = 0;
+    while (rc == 0 && fgets(buf, sizeof(buf), f)) {
+        line++;
+        char* hash = strchr(buf, '#');
+        if (hash) *hash = '\0';
+        char* tok[4];
+        int n = 0;
+        for (char* t=strtok(buf, " \t\r\n"); t && n<4; t=strtok(NULL, " \t\r\n")) tok[n++] = t;
+        if (n == 0) continue;
+
+        char* end;
+        if (strcmp(tok[0], "at") == 0) {
+            double at = (n == 2) ? strtod(tok[1], &end) : 0.0;
+            if (n != 2 || *end || !(at >= 0.0)) {
+                rc = bad(path, line, "expected \"at <seconds>\"", NULL);
+            } else if (*n_periods == 0 ? at != 0.0 : !(at > (*t0)[*n_periods - 1])) {
+                rc = bad(path, line, *n_periods ? "periods must start in increasing time" : "the first period must start at 0", tok[1]);
+            } else {
+                if (*n_periods == cap) {
+                    cap = cap ? cap * 2 : 16;
+                    double* p = (double*)realloc(*t0, sizeof(double) * (size_t)cap);
+                    if (!p) {
+                        rc = -1;
+                        break;
+                    }
+                    *t0 = p;
+                }
+                (*t0)[(*n_periods)++] = at;
+            }
+            continue;
+        }
+        if (n != 3) {
+            rc = bad(path, line, "expected \"<origin> <destination> <rate>\"", NULL);
+            continue;
+        }
+        if (*n_periods == 0) {
+            rc = bad(path, line, "rates before the first \"at\"", NULL);
+            continue;
+        }
+
+        double rate = strtod(tok[2], &end);
+        if (*end || !(rate >= 0.0) || !isfinite(rate)) {
+            rc = bad(path, line, "bad rate", tok[2]);
+            continue;
+        }
+
+        int dest = side_of(tok[1]);
+        if (dest < 0) {
+            long node = id_of(tok[1]);
+            if (node < 0 || node >= g->n_intersections) {
+                rc = bad(path, line, "destination is neither a side (N/E/S/W) nor a node", tok[1]);
+                continue;
+            }
+            for (int k=ROUTE_SIDES; route && k<route->n_dest && dest<0; k++)
+                if (route->dest_node[k] == node) dest = k;
+            if (dest < 0) {
+                rc = bad(path, line, "node destinations need shortest_path routing with the node in demand.routing_destinations", tok[1]);
+                continue;
+            }
+        }
+
+        int p = *n_periods - 1;
+        int side = side_of(tok[0]);
+        if (side >= 0) {
+            /* entry links from that side point away from it */
+            for (int k=0; k<g->n_entry_links && rc==0; k++)
+                if (g->links[g->entry_links[k]].dir == ((side + 2) & 3)) rc = od_push(pairs, p, k, dest, rate);
+        } else {
+            long l = id_of(tok[0]);
+            if (l < 0 || l >= g->n_links || entry_of[l] == INVALID_ID)
+                rc = bad(path, line, "origin is neither a side (N/E/S/W) nor an entry link", tok[0]);
+            else
+                rc = od_push(pairs, p, entry_of[l], dest, rate);
+        }
+    }
+    if (rc == 0 && *n_periods == 0) rc = bad(path, line, "no \"at\" period", NULL);
+    free(entry_of);
+    fclose(f);
+    return rc;
+}
+
+static uint64_t fnv1a(uint64_t h, const void* p, size_t n) {
+    const unsigned char* b = (const unsigned char*)p;
+    for (size_t k=0; k<n; k++) {
+        h ^= b[k];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+static int slot_push(DemandSlot* l, int32_t v) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 16;
+        int32_t* p = (int32_t*)realloc(l->v, sizeof(int32_t) * (size_t)cap);
+        if (!p) return -1;
+        l->v = p;
+        l->cap = cap;
+    }
+    l->v[l->n++] = v;
+    return 0;
+}
+
+static int schedule(Demand* d, int k) {
+    if (d->next[k] == DEMAND_NEVER) return 0;
+    return slot_push(&d->slots[d->next[k] & (d->n_slots - 1)], k);
+}
+
+int demand_init(Demand* d, const Grid* g, const Config* cfg, const Routing* route) {
+    memset(d, 0, sizeof(*d));
+    d->n_origins = g->n_entry_links;
+    d->origin_link = g->entry_links;
+    d->dt = cfg->time_step;
+    d->rng = rng_key(cfg->random_seed);
+
+    OdList pairs = {0};
+    if (read_pairs(cfg->od_file, g, route, &pairs, &d->t0, &d->n_periods) != 0) {
+        free(pairs.v);
+        demand_free(d);
+        return -1;
+    }
+    if (pairs.n > 1) qsort(pairs.v, (size_t)pairs.n, sizeof(OdPair), cmp_pair);
+
+    size_t n_rows = (size_t)d->n_periods * (size_t)d->n_origins;
+    d->row_off = (int32_t*)calloc(n_rows + 1, sizeof(int32_t));
+    d->dest = (uint16_t*)malloc(sizeof(uint16_t) * (size_t)(pairs.n ? pairs.n : 1));
+    d->cum = (double*)malloc(sizeof(double) * (size_t)(pairs.n ? pairs.n : 1));
+    d->next = (int32_t*)malloc(sizeof(int32_t) * (size_t)(d->n_origins ? d->n_origins : 1));
+    d->arrival = (int32_t*)malloc(sizeof(int32_t) * (size_t)(d->n_origins ? d->n_origins : 1));
+    d->arrival_dest = (uint16_t*)malloc(sizeof(uint16_t) * (size_t)(d->n_origins ? d->n_origins : 1));
+    if (!d->row_off || !d->dest || !d->cum || !d->next || !d->arrival || !d->arrival_dest) {
+        free(pairs.v);
+        demand_free(d);
+        return -1;
+    }
+
+    /* merge repeated pairs, drop zero rates, accumulate per row */
+    int n = 0;
+    for (int k=0; k<pairs.n; ) {
+        const OdPair* x = &pairs.v[k];
+        double rate = 0.0;
+        int j = k;
+        for (; j<pairs.n && cmp_pair(&pairs.v[j], x) == 0; j++) rate += pairs.v[j].rate;
+        if (rate > 0.0) {
+            size_t row = (size_t)x->period * (size_t)d->n_origins + (size_t)x->origin;
+            bool same_row = n > 0 && d->row_off[row + 1] > 0;
+            d->dest[n] = (uint16_t)x->dest;
+            d->cum[n] = (same_row ? d->cum[n - 1] : 0.0) + rate;
+            d->row_off[row + 1]++;
+            n++;
+        }
+        k = j;
+    }
+    free(pairs.v);
+    d->n_pairs = n;
+    for (size_t r=0; r<n_rows; r++) d->row_off[r + 1] += d->row_off[r];
+
+    /* a wheel that holds about two mean gaps of the sparsest origin */
+    double gap = 1.0;
+    for (size_t r=0; r<n_rows; r++) {
+        if (d->row_off[r] == d->row_off[r + 1]) continue;
+        double p = d->cum[d->row_off[r + 1] - 1] * d->dt;
+        if (p < 1.0 && 1.0 / p > gap) gap = 1.0 / p;
+    }
+    d->n_slots = 64;
+    while (d->n_slots < 2.0 * gap && d->n_slots < 4096) d->n_slots *= 2;
+    d->slots = (DemandSlot*)calloc((size_t)d->n_slots, sizeof(DemandSlot));
+    if (!d->slots) {
+        demand_free(d);
+        return -1;
+    }
+
+    uint64_t h = 0xCBF29CE484222325ull;
+    h = fnv1a(h, &d->n_origins, sizeof(int));
+    h = fnv1a(h, &d->n_periods, sizeof(int));
+    h = fnv1a(h, d->t0, sizeof(double) * (size_t)d->n_periods);
+    h = fnv1a(h, d->row_off, sizeof(int32_t) * (n_rows + 1));
+    h = fnv1a(h, d->dest, sizeof(uint16_t) * (size_t)n);
+    d->hash = fnv1a(h, d->cum, sizeof(double) * (size_t)n);
+    return 0;
+}
+
+void demand_free(Demand* d) {
+    for (int s=0; s<d->n_slots && d->slots; s++) free(d->slots[s].v);
+    free(d->slots);
+    free(d->due.v);
+    free(d->t0);
+    free(d->row_off);
+    free(d->dest);
+    free(d->cum);
+    free(d->next);
+    free(d->arrival);
+    free(d->arrival_dest);
+    memset(d, 0, sizeof(*d));
+}
+
+int demand_period_at(const Demand* d, double t) {
+    /* last period starting at most half a step after t */
+    int lo = 0, hi = d->n_periods - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (d->t0[mid] <= t + 0.5 * d->dt) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+int32_t demand_next_arrival(const Demand* d, int p, int k, int32_t from, uint32_t index) {
+    int32_t a = d->row_off[(size_t)p * (size_t)d->n_origins + (size_t)k];
+    int32_t b = d->row_off[(size_t)p * (size_t)d->n_origins + (size_t)k + 1];
+    if (a == b || from == DEMAND_NEVER) return DEMAND_NEVER;
+    double prob = d->cum[b - 1] * d->dt;
+    if (prob >= 1.0) return from;
+    /* failures before the first success, P(gap >= n) = (1 - prob)^n */
+    double u = rng_cb_uniform01(d->rng, (uint32_t)from, (uint32_t)d->origin_link[k], RNG_DEMAND, index);
+    double gap = floor(log1p(-u) / log1p(-prob));
+    if (!(gap < (double)(DEMAND_NEVER - from))) return DEMAND_NEVER;
+    return from + (int32_t)gap;
+}
+
+int demand_destination(const Demand* d, int p, int k, int32_t step) {
+    int32_t a = d->row_off[(size_t)p * (size_t)d->n_origins + (size_t)k];
+    int32_t b = d->row_off[(size_t)p * (size_t)d->n_origins + (size_t)k + 1];
+    if (b - a == 1) return d->dest[a];
+    double x = rng_cb_uniform01(d->rng, (uint32_t)step, (uint32_t)d->origin_link[k], RNG_DEMAND, 1) * d->cum[b - 1];
+    /* first entry whose cumulative rate exceeds x */
+    int32_t lo = a, hi = b - 1;
+    while (lo < hi) {
+        int32_t mid = (lo + hi) / 2;
+        if (d->cum[mid] > x) hi = mid;
+        else lo = mid + 1;
+    }
+    return d->dest[lo];
+}
+
+/* every origin's next arrival drawn afresh from step on (memoryless, so
+   valid at any step); the wheel is rebuilt so no stale entry is left */
+static int restart(Demand* d, int step) {
+    int rc = 0;
+    for (int s=0; s<d->n_slots; s++) d->slots[s].n = 0;
+    for (int k=0; k<d->n_origins; k++) {
+        d->next[k] = demand_next_arrival(d, d->period, k, step, 2);
+        if (schedule(d, k) != 0) rc = -1;
+    }
+    d->started = true;
+    d->n_restarts++;
+    return rc;
+}
+
+int demand_resume(Demand* d, int period, const int32_t* next) {
+    if (period < 0 || period >= d->n_periods) return -1;
+    d->period = period;
+    for (int s=0; s<d->n_slots; s++) d->slots[s].n = 0;
+    int rc = 0;
+    for (int k=0; k<d->n_origins; k++) {
+        d->next[k] = next[k];
+        if (schedule(d, k) != 0) rc = -1;
+    }
+    d->started = true;
+    return rc;
+}
+
+int demand_step(Demand* d, int step, double t) {
+    int rc = 0;
+    d->n_arrivals = 0;
+    int p = demand_period_at(d, t);
+    if (!d->started || p != d->period) {
+        d->period = p;
+        if (restart(d, step) != 0) rc = -1;
+    }
+
+    /* drain this step's slot: due origins arrive, the others are a lap
+       or more ahead and go round again. A slot that cannot grow fails the
+       step, but this step's arrivals are still drawn */
+    DemandSlot* slot = &d->slots[step & (d->n_slots - 1)];
+    DemandSlot due = *slot;
+    *slot = d->due;
+    d->due = due;
+    for (int i=0; i<due.n; i++) {
+        int k = due.v[i];
+        if (d->next[k] == step) {
+            d->arrival[d->n_arrivals++] = k;
+        } else {
+            if (slot_push(slot, k) != 0) rc = -1;
+            d->n_requeues++;
+        }
+    }
+    d->due.n = 0;
+
+    /* origin order (what the spawn order and so vehicle ids follow) */
+    for (int i=1; i<d->n_arrivals; i++) {
+        int32_t k = d->arrival[i];
+        int j = i;
+        for (; j>0 && d->arrival[j - 1] > k; j--) d->arrival[j] = d->arrival[j - 1];
+        d->arrival[j] = k;
+    }
+    for (int i=0; i<d->n_arrivals; i++) {
+        int k = d->arrival[i];
+        d->arrival_dest[i] = (uint16_t)demand_destination(d, p, k, step);
+        d->next[k] = demand_next_arrival(d, p, k, step + 1, 0);
+        if (schedule(d, k) != 0) rc = -1;
+    }
+    d->n_total_arrivals += d->n_arrivals;
+    return rc;
+}
+
+void demand_report(const Demand* d, FILE* f) {
+    fprintf(f, "demand: %d periods, %d origins, %d OD pairs; %ld arrivals, %ld wheel re-queues (%d slots), %ld restarts\n",
+            d->n_periods, d->n_origins, d->n_pairs, d->n_total_arrivals, d->n_requeues, d->n_slots, d->n_restarts);
+}
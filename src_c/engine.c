@@ -0,0 +1,877 @@
+// engine.c
+#include "engine.h"
+#include "controllers.h"
+#include "demand.h"
+#include "occupancy.h"
+#include "routing.h"
+#include "traj.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int intents_push(IntentList* l, const CrossIntent* x) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        CrossIntent* p = (CrossIntent*)realloc(l->v, sizeof(CrossIntent) * (size_t)cap);
+        if (!p) return -1;
+        l->v = p;
+        l->cap = cap;
+    }
+    l->v[l->n++] = *x;
+    return 0;
+}
+
+static int idx_push(IdxList* l, int32_t v) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        int32_t* p = (int32_t*)realloc(l->v, sizeof(int32_t) * (size_t)cap);
+        if (!p) return -1;
+        l->v = p;
+        l->cap = cap;
+    }
+    l->v[l->n++] = v;
+    return 0;
+}
+
+static int exits_push(ExitList* l, int32_t link, int32_t id) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        ExitRec* p = (ExitRec*)realloc(l->v, sizeof(ExitRec) * (size_t)cap);
+        if (!p) return -1;
+        l->v = p;
+        l->cap = cap;
+    }
+    l->v[l->n].link = link;
+    l->v[l->n].id = id;
+    l->n++;
+    return 0;
+}
+
+static int vehicle_create(VehiclePool* vp, double entry_time, int dest, int vmax) {
+    int id = vp_alloc(vp);
+    if (id < 0) return -1;
+
+    vp->speed[id] = 0;
+    vp->vmax[id] = (uint8_t)vmax;
+    vp->planned_move[id] = MOVE_STAY;
+    vp->planned_next_link[id] = INVALID_ID;
+
+    vp->destination[id] = (uint16_t)dest;
+    vp->entry_time[id] = entry_time;
+    vp->stopped_time[id] = 0.0;
+    return id;
+}
+
+static Direction opposite_side(Direction entry_dir) {
+    /* entry_dir here is direction of travel on entry link (DIR_S means came from north boundary) */
+    if (entry_dir == DIR_S) return DIR_S; /* wants to exit south */
+    if (entry_dir == DIR_N) return DIR_N; /* exit north */
+    if (entry_dir == DIR_E) return DIR_E; /* exit east */
+    return DIR_W; /* exit west */
+}
+
+static bool link_is_boundary_exit(const Link* link, const Grid* g, Direction dest_exit) {
+    if (link->to == INVALID_ID) return true;
+    /* vehicle reached an intersection where it may leave towards its destination side */
+    return (g->intersections[link->to].exit_mask >> dest_exit) & 1u;
+}
+
+/* first link L allows turning into that heads towards d, or INVALID_ID */
+static int turn_toward(const Grid* g, const Link* L, int d) {
+    for (int32_t k=g->turn_off[L->id]; k<g->turn_off[L->id + 1]; k++) {
+        int32_t l = g->turns[k];
+        if (g->links[l].dir == d) return l;
+    }
+    return INVALID_ID;
+}
+
+static int choose_out_link_simple(const Engine* e, int id, Direction want, const Link* L, double rnd) {
+    /* goal: move toward boundary exit side */
+    const Grid* g = e->g;
+
+    /* with small probability, pick a random heading among the allowed turns to add diversity */
+    if (rng_cb_uniform01(e->rng, (uint32_t)e->step, (uint32_t)id, RNG_ROUTE, 0) < rnd) {
+        for (int tries=0; tries<4; tries++) {
+            int d = (int)(rng_cb_uniform01(e->rng, (uint32_t)e->step, (uint32_t)id, RNG_ROUTE, 1u + (uint32_t)tries) * 4.0);
+            int out = turn_toward(g, L, d);
+            if (out != INVALID_ID) return out;
+        }
+    }
+
+    /* Prefer the direction "want" if exists */
+    int out = turn_toward(g, L, want);
+    if (out != INVALID_ID) return out;
+
+    /* Otherwise the first allowed turn (fallback) */
+    if (g->turn_off[L->id] < g->turn_off[L->id + 1]) return g->turns[g->turn_off[L->id]];
+    return INVALID_ID;
+}
+
+/* the vehicle leaves the network at the end of L */
+static bool vehicle_arrives(const Engine* e, const Link* L, int dest) {
+    if (L->to == INVALID_ID) return true;
+    if (e->routed) return routing_hop(&e->route, dest, L->id) == ROUTE_ARRIVE;
+    return link_is_boundary_exit(L, e->g, (Direction)dest);
+}
+
+static int choose_out_link(const Engine* e, int id, int dest, const Link* L) {
+    const Grid* g = e->g;
+    if (e->routed) {
+        uint8_t hop = routing_hop(&e->route, dest, L->id);
+        if (hop != ROUTE_NONE) return g->turns[g->turn_off[L->id] + hop];
+        /* unreachable from here: sides fall back to the heuristic, nodes to the first turn */
+        if (dest >= ROUTE_SIDES) return (g->turn_off[L->id] < g->turn_off[L->id + 1]) ? g->turns[g->turn_off[L->id]] : INVALID_ID;
+    }
+    return choose_out_link_simple(e, id, (Direction)dest, L, e->cfg->routing_randomness);
+}
+
+/* adds link l to its tile's worklist; only the owning tile (or the serial
+   spawn phase) may call this */
+static void link_activate(Engine* e, int32_t l) {
+    if (e->link_active[l]) return;
+    e->link_active[l] = 1;
+    Tile* tile = &e->tiles[e->link_tile[l]];
+    tile->active[tile->n_active++] = l;
+}
+
+static bool link_empty(const Grid* g, const Link* L) {
+    const uint64_t* occ = link_occ(g, L);
+    for (int w=0; w<occ_words_for(link_slots(L)); w++) if (occ[w]) return false;
+    return true;
+}
+
+/* a vehicle for dest at the start of entry link L, in its first free
+   lane; lost if there is none. -1 if the pool could not grow */
+static int spawn_on(Engine* e, const Link* L, int dest, double t) {
+    Grid* g = e->g;
+    VehiclePool* vp = e->vp;
+    int lane = 0;
+    while (lane < L->n_lanes && link_occupied(g, L, lane)) lane++;
+    if (lane == L->n_lanes) {
+        e->s->blocked_entries++;
+        return 0;
+    }
+    int id = vehicle_create(vp, t, dest, e->cfg->vmax_cells_per_step);
+    if (id < 0) return -1;
+    vp->link[id] = L->id;
+    vp->cell_idx[id] = lane;
+    link_place(g, L, lane, id);
+    link_activate(e, L->id);
+    if (e->traj) traj_spawned(e->traj, vp, e->link_tile[L->id], id);
+    e->s->spawned++;
+    return 0;
+}
+
+/* -1 if the pool or the demand's wheel (demand.h) could not grow */
+static int spawn_vehicles(Engine* e, double t) {
+    const Grid* g = e->g;
+
+    if (e->demand) {
+        Demand* d = e->demand;
+        int rc = demand_step(d, e->step, t);
+        for (int k=0; k<d->n_arrivals; k++)
+            if (spawn_on(e, &g->links[g->entry_links[d->arrival[k]]], d->arrival_dest[k], t) != 0) rc = -1;
+        return rc;
+    }
+
+    int rc = 0;
+    double p = e->cfg->arrival_rate * e->cfg->time_step;
+    rng_cb_fill_uniform01(e->rng, (uint32_t)e->step, RNG_SPAWN, g->entry_links, g->n_entry_links, e->spawn_u);
+    for (int k=0; k<g->n_entry_links; k++) {
+        const Link* L = &g->links[g->entry_links[k]];
+        if (e->spawn_u[k] < p && spawn_on(e, L, opposite_side((Direction)L->dir), t) != 0) rc = -1;
+    }
+    return rc;
+}
+
+static int apply_slowdown(int sp, double u, double p) {
+    return (sp > 0 && u < p) ? sp - 1 : sp;
+}
+
+/* move vehicle `id` from slot s forward by sp positions if that slot is
+   free; returns 1 if moved */
+static int move_within_link(Grid* g, const Link* L, VehiclePool* vp, int id, int s, int sp, int step) {
+    int tgt = s + sp * L->n_lanes;
+    if (link_occupied(g, L, tgt)) return 0;
+    link_vacate(g, L, s);
+    link_place(g, L, tgt, id);
+    vp->cell_idx[id] = tgt;
+    if (s < L->n_lanes) {
+        if (g->head_vacated_step[L->id] != step) {
+            g->head_vacated_step[L->id] = step;
+            g->head_vacated_lanes[L->id] = 0;
+        }
+        g->head_vacated_lanes[L->id] |= (uint8_t)(1u << s);
+    }
+    return 1;
+}
+
+/* Phase B, one vehicle (Nagel-Schreckenberg rules): `id` at position c of
+   `lane` (lane0 before a lane change this step), with `gap` free positions
+   up to the start-of-step position of the vehicle ahead in its lane. Crossings and exits are queued; whether a
+   crossing's target slot was free at step start is only decided in phase
+   C1, because that link may belong to another tile that is sweeping it
+   concurrently. A crossing keeps its lane where the next link has it,
+   else takes that link's outermost lane. */
+static inline void update_vehicle(Engine* e, Tile* tile, const Link* L, int id, int c, int lane, int lane0, int gap) {
+    Grid* g = e->g;
+    VehiclePool* vp = e->vp;
+    const Config* cfg = e->cfg;
+    int step = e->step;
+    int s = c * L->n_lanes + lane;
+
+    int vmax = vp->vmax[id];
+
+    /* 1) accel */
+    int sp = vp->speed[id] + 1;
+    if (sp > vmax) sp = vmax;
+
+    /* 2) obstacle distance: gap */
+
+    /* 3) stopline / intersection handling if would reach end */
+    int dist_to_end = L->stopline_cell - c;
+    bool may_reach_inter = (sp > dist_to_end);
+
+    int allowed = gap;
+    if (allowed > dist_to_end) allowed = dist_to_end; /* default: can't pass stopline unless crossing */
+
+    if (may_reach_inter) {
+        int dest = vp->destination[id];
+        if (L->to != INVALID_ID && g->lights[L->to].phase != (Phase)L->group) {
+            /* red: stop at stopline */
+            allowed = dist_to_end;
+        } else if (vehicle_arrives(e, L, dest)) {
+            /* green (or an exit link): leaves the network */
+            vp->planned_move[id] = MOVE_EXIT;
+            vp->speed[id] = 0; /* will be removed */
+            if (exits_push(&tile->exits, L->id, id) != 0) tile->failed = true;
+            return;
+        } else {
+            /* green: attempt crossing */
+            int out = choose_out_link(e, id, dest, L);
+            if (out == INVALID_ID) {
+                allowed = dist_to_end;
+            } else {
+                /* crossing ignores speed since we place at cell 0 of out link (dt captures junction);
+                   if out is blocked, brake to the stopline instead */
+                int sp_blocked = (sp > dist_to_end) ? dist_to_end : sp;
+                double u = rng_cb_uniform01(e->rng, (uint32_t)step, (uint32_t)id, RNG_SLOWDOWN, 0);
+                int out_lanes = g->links[out].n_lanes;
+
+                CrossIntent x;
+                x.id = id;
+                x.src_link = L->id;
+                x.src_cell = s;
+                x.dst_link = out;
+                x.key = ((int64_t)L->id << 32) | (uint32_t)(INT32_MAX - s);
+                x.sp_cross = (uint8_t)apply_slowdown(sp, u, cfg->slowdown_probability);
+                x.sp_blocked = (uint8_t)apply_slowdown(sp_blocked, u, cfg->slowdown_probability);
+                x.dst_lane = (uint8_t)(lane < out_lanes ? lane : out_lanes - 1);
+                x.src_lane0 = (uint8_t)lane0;
+                x.outcome = CROSS_BLOCKED;
+                /* the outbox only ever indexes intents that were stored */
+                if (intents_push(&tile->intents, &x) != 0
+                    || idx_push(&tile->outbox[e->link_tile[out]], tile->intents.n - 1) != 0)
+                    tile->failed = true;
+                vp->planned_move[id] = MOVE_CROSS;
+                vp->planned_next_link[id] = out;
+                return;
+            }
+        }
+    }
+
+    /* 4) safety braking within link */
+    if (sp > allowed) sp = allowed;
+
+    /* 5) random slowdown */
+    if (sp > 0 && rng_cb_uniform01(e->rng, (uint32_t)step, (uint32_t)id, RNG_SLOWDOWN, 0) < cfg->slowdown_probability) sp -= 1;
+
+    int sp0 = vp->speed[id];
+    vp->speed[id] = (uint8_t)sp;
+
+    int moved = 0;
+    if (sp > 0) {
+        /* 6) move: the target is inside the start-of-step gap except when a
+           red light clamps to the stopline (vmax>1); then, as before, a
+           vehicle only moves if the target is free */
+        moved = move_within_link(g, L, vp, id, s, sp, step);
+        vp->planned_move[id] = MOVE_WITHIN_LINK;
+    } else {
+        vp->planned_move[id] = MOVE_STAY;
+        vp->stopped_time[id] += cfg->time_step;
+    }
+    if (e->traj)
+        traj_moved(e->traj, (int)(tile - e->tiles), step, id, c * L->n_lanes + lane0, sp0,
+                   moved ? s + sp * L->n_lanes : s, sp, L->n_lanes);
+}
+
+/* Lane change ahead of the move (the symmetric rules of Rickert et al.,
+   for any number of lanes). A vehicle whose lane does not leave room for
+   its next speed moves sideways to the adjacent lane with the most room
+   ahead, if that lane has more, its slot is free, and no vehicle sits
+   within vmax positions behind it there; it does so with probability
+   vehicles.lane_change_probability. Returns the lane it ends up in. */
+static int change_lane(Engine* e, const Link* L, int id, int c, int lane, const int* next_occ) {
+    Grid* g = e->g;
+    VehiclePool* vp = e->vp;
+    int nl = L->n_lanes;
+
+    int want = vp->speed[id] + 1;
+    if (want > vp->vmax[id]) want = vp->vmax[id];
+    int best = lane;
+    int best_gap = next_occ[lane] - c - 1;
+    if (best_gap >= want) return lane;
+
+    int back = e->cfg->vmax_cells_per_step;
+    for (int k=lane-1; k<=lane+1; k+=2) {
+        if (k < 0 || k >= nl) continue;
+        int gap = next_occ[k] - c - 1;
+        if (gap <= best_gap || link_occupied(g, L, c * nl + k)) continue;
+        bool clear = true;
+        for (int b=1; b<=back && b<=c && clear; b++) clear = !link_occupied(g, L, (c - b) * nl + k);
+        if (!clear) continue;
+        best = k;
+        best_gap = gap;
+    }
+    if (best == lane) return lane;
+    if (rng_cb_uniform01(e->rng, (uint32_t)e->step, (uint32_t)id, RNG_LANE, 0) >= e->cfg->lane_change_probability) return lane;
+
+    link_shift_lane(g, L, c * nl + lane, c * nl + best);
+    vp->cell_idx[id] = c * nl + best;
+    return best;
+}
+
+/* Phase B, the vehicles at positions 0..top of a single-lane link, none of
+   which can reach the stopline: gather them in order, update them all at
+   once (nasch.h), then move them. next_occ is the start-of-step position
+   of the vehicle ahead of top. Same result as update_vehicle on each. */
+static void sweep_run(Engine* e, Tile* tile, const Link* L, int top, int next_occ) {
+    Grid* g = e->g;
+    VehiclePool* vp = e->vp;
+    NaschRun* r = &tile->run;
+    const uint64_t* occ = link_occ(g, L);
+
+    int n = 0;
+    for (int w=0; w<=top>>6; w++) {
+        uint64_t bits = occ[w];
+        if (w == top >> 6) bits &= occ_mask(0, (top & 63) + 1);
+        for (; bits; bits &= bits - 1) {
+            int c = (w << 6) + __builtin_ctzll(bits);
+            int id = link_vehicle(g, L, c);
+            r->pos[n] = c;
+            r->id[n] = id;
+            r->speed[n] = vp->speed[id];
+            r->vmax[n] = vp->vmax[id];
+            n++;
+        }
+    }
+    r->pos[n] = next_occ;
+    r->n = n;
+    e->kernel(&e->nasch, r);
+
+    int w = (int)(tile - e->tiles);
+    for (int i=0; i<n; i++) {
+        int id = r->id[i];
+        int sp = r->speed[i];
+        int sp0 = vp->speed[id];
+        vp->speed[id] = (uint8_t)sp;
+        int moved = 0;
+        if (sp > 0) {
+            moved = move_within_link(g, L, vp, id, r->pos[i], sp, e->step);
+            vp->planned_move[id] = MOVE_WITHIN_LINK;
+        } else {
+            vp->planned_move[id] = MOVE_STAY;
+            vp->stopped_time[id] += e->cfg->time_step;
+        }
+        if (e->traj) traj_moved(e->traj, w, e->step, id, r->pos[i], sp0, r->pos[i] + moved * sp, sp, 1);
+    }
+}
+
+/* Phase B: plan and move every vehicle of one link. Vehicles are visited
+   from downstream to upstream by scanning the occupancy bitset; next_occ
+   is the pre-move position of the vehicle ahead (per lane), so gaps are
+   those of the start-of-step state and within-link moves can be applied
+   in place. On a multi-lane link the scan stops once per position and
+   handles all its lanes there: lane changes first, then the move. */
+static void sweep_link(Engine* e, Tile* tile, const Link* L) {
+    Grid* g = e->g;
+
+    if (L->n_lanes == 1) {
+        /* vehicles within vmax of the stopline may meet the light or cross */
+        int edge = L->stopline_cell - e->cfg->vmax_cells_per_step;
+        int next_occ = L->n_cells;
+        int c = link_prev_occupied(g, L, L->n_cells);
+        for (; c>=0 && c>edge; c=link_prev_occupied(g, L, c)) {
+            int gap = next_occ - c - 1;
+            next_occ = c;
+            update_vehicle(e, tile, L, link_vehicle(g, L, c), c, 0, 0, gap);
+        }
+        if (c >= 0) sweep_run(e, tile, L, c, next_occ);
+        return;
+    }
+
+    int nl = L->n_lanes;
+    int next_occ[MAX_LANES];
+    for (int k=0; k<nl; k++) next_occ[k] = L->n_cells;
+    for (int s=link_prev_occupied(g, L, link_slots(L)); s>=0; ) {
+        int c = s / nl;
+        /* lanes occupied at c before any change here: a vehicle that moves
+           sideways is not visited twice */
+        unsigned lanes = link_lanes_at(g, L, c);
+        for (int k=nl-1; k>=0; k--) {
+            if (!((lanes >> k) & 1u)) continue;
+            int id = link_vehicle(g, L, c * nl + k);
+            int lane = change_lane(e, L, id, c, k, next_occ);
+            int gap = next_occ[lane] - c - 1;
+            next_occ[lane] = c;
+            update_vehicle(e, tile, L, id, c, lane, k, gap);
+        }
+        s = link_prev_occupied(g, L, c * nl);
+    }
+}
+
+/* Phase C1: accept crossings into links owned by tile `d`. The target
+   lane's position 0 must have been free at step start, or emptied by a
+   lane change this step: the sweep only vacates it otherwise by moving
+   downstream, and stamps the lane when it does. */
+static void accept_crossings(Engine* e, int d) {
+    Grid* g = e->g;
+    VehiclePool* vp = e->vp;
+    int step = e->step;
+
+    for (int s=0; s<e->n_tiles; s++) {
+        Tile* src = &e->tiles[s];
+        const IdxList* in = &src->outbox[d];
+        for (int k=0; k<in->n; k++) {
+            CrossIntent* x = &src->intents.v[in->v[k]];
+            const Link* out = &g->links[x->dst_link];
+            if (link_occupied(g, out, x->dst_lane)
+                || (g->head_vacated_step[x->dst_link] == step && ((g->head_vacated_lanes[x->dst_link] >> x->dst_lane) & 1u))) {
+                x->outcome = CROSS_BLOCKED;
+                continue;
+            }
+            x->outcome = CROSS_LOST;
+            int64_t* claim = &e->claim[e->lane_off[x->dst_link] + x->dst_lane];
+            if (x->key < *claim) *claim = x->key;
+        }
+    }
+
+    for (int s=0; s<e->n_tiles; s++) {
+        Tile* src = &e->tiles[s];
+        const IdxList* in = &src->outbox[d];
+        for (int k=0; k<in->n; k++) {
+            CrossIntent* x = &src->intents.v[in->v[k]];
+            if (x->outcome == CROSS_BLOCKED) continue;
+            if (e->claim[e->lane_off[x->dst_link] + x->dst_lane] == x->key) {
+                x->outcome = CROSS_WON;
+                link_place(g, &g->links[x->dst_link], x->dst_lane, x->id);
+                link_activate(e, x->dst_link);
+                vp->link[x->id] = x->dst_link;
+                vp->cell_idx[x->id] = x->dst_lane;
+                /* here rather than in C2: the vehicle is this tile's now */
+                vp->speed[x->id] = x->sp_cross;
+                if (e->traj) traj_enter(e->traj, d, step, x->id, x->dst_link, x->dst_lane, x->sp_cross);
+            }
+        }
+    }
+
+    for (int s=0; s<e->n_tiles; s++) {
+        Tile* src = &e->tiles[s];
+        const IdxList* in = &src->outbox[d];
+        for (int k=0; k<in->n; k++) {
+            const CrossIntent* x = &src->intents.v[in->v[k]];
+            e->claim[e->lane_off[x->dst_link] + x->dst_lane] = INT64_MAX;
+        }
+    }
+}
+
+/* Phase C2: source-side completion of this tile's crossings and exits,
+   in sweep order (ascending link, downstream first). */
+static void finish_own_moves(Engine* e, Tile* tile) {
+    Grid* g = e->g;
+    VehiclePool* vp = e->vp;
+    const Config* cfg = e->cfg;
+
+    for (int k=0; k<tile->intents.n; k++) {
+        const CrossIntent* x = &tile->intents.v[k];
+        const Link* src = &g->links[x->src_link];
+        if (x->outcome == CROSS_WON) {
+            link_vacate(g, src, x->src_cell);
+            if (e->departures) e->departures[x->src_link]++;
+            if (e->served) e->served[src->to]++;
+            continue;
+        }
+        int sp0 = vp->speed[x->id];
+        int slot = x->src_cell;
+        if (x->outcome == CROSS_LOST) {
+            /* lost cell 0 to another crossing: stays at the stopline */
+            vp->speed[x->id] = x->sp_cross;
+        } else {
+            vp->speed[x->id] = x->sp_blocked;
+            if (x->sp_blocked > 0) {
+                if (move_within_link(g, src, vp, x->id, x->src_cell, x->sp_blocked, e->step))
+                    slot += x->sp_blocked * src->n_lanes;
+                vp->planned_move[x->id] = MOVE_WITHIN_LINK;
+            } else {
+                vp->planned_move[x->id] = MOVE_STAY;
+                vp->stopped_time[x->id] += cfg->time_step;
+            }
+        }
+        if (e->traj)
+            traj_moved(e->traj, (int)(tile - e->tiles), e->step, x->id,
+                       x->src_cell - x->src_cell % src->n_lanes + x->src_lane0, sp0, slot, vp->speed[x->id], src->n_lanes);
+    }
+    tile->intents.n = 0;
+    for (int d=0; d<e->n_tiles; d++) tile->outbox[d].n = 0;
+
+    for (int k=0; k<tile->exits.n; k++) {
+        const ExitRec* x = &tile->exits.v[k];
+        link_vacate(g, &g->links[x->link], e->vp->cell_idx[x->id]);
+        if (e->departures) e->departures[x->link]++;
+    }
+}
+
+/* drops links emptied this step from the worklist; with routing updates,
+   also counts the vehicle-steps spent on each link */
+static void retire_links(Engine* e, Tile* tile) {
+    int n = 0;
+    for (int k=0; k<tile->n_active; k++) {
+        int32_t l = tile->active[k];
+        const Link* L = &e->g->links[l];
+        if (link_empty(e->g, L)) {
+            e->link_active[l] = 0;
+            continue;
+        }
+        tile->active[n++] = l;
+        if (e->occ_steps) e->occ_steps[l] += link_count_range(e->g, L, 0, link_slots(L));
+    }
+    tile->n_active = n;
+}
+
+static void tile_sync(Engine* e, int w) {
+    if (e->n_tiles > 1) {
+        pthread_barrier_wait(&e->barrier);
+        PROF_END(e, w, PROF_WAIT);
+    }
+    (void)w;
+}
+
+static void run_tile_phases(Engine* e, int w) {
+    Tile* tile = &e->tiles[w];
+    Grid* g = e->g;
+
+    if (light_sched_step(&tile->lights, g, e->step, e->t, e->cfg->time_step) != 0) tile->failed = true;
+    PROF_END(e, w, PROF_LIGHTS);
+    tile_sync(e, w);
+
+    for (int k=0; k<tile->n_active; k++) sweep_link(e, tile, &g->links[tile->active[k]]);
+    PROF_END(e, w, PROF_SWEEP);
+    tile_sync(e, w);
+
+    accept_crossings(e, w);
+    PROF_END(e, w, PROF_CROSS);
+    tile_sync(e, w);
+
+    finish_own_moves(e, tile);
+    retire_links(e, tile);
+    PROF_END(e, w, PROF_FINISH);
+    /* queues read only links owned by this tile: no barrier needed */
+    if (e->sample_queues) {
+        stats_sample_link_queues(e->s, g, tile->active, tile->n_active);
+        PROF_END(e, w, PROF_STATS);
+    }
+    if (e->traj) {
+        traj_record_tile(e->traj, e, w);
+        PROF_END(e, w, PROF_TRAJ);
+    }
+}
+
+static void* worker_main(void* arg) {
+    EngineWorker* wk = (EngineWorker*)arg;
+    Engine* e = wk->e;
+    /* held until every worker is up; quit means one could not start */
+    pthread_mutex_lock(&e->start_lock);
+    pthread_mutex_unlock(&e->start_lock);
+    if (e->quit) return NULL;
+    for (;;) {
+        pthread_barrier_wait(&e->barrier); /* step start */
+        if (e->quit) break;
+        PROF_END(e, wk->tile, PROF_WAIT);
+        run_tile_phases(e, wk->tile);
+        pthread_barrier_wait(&e->barrier); /* step end */
+        PROF_END(e, wk->tile, PROF_WAIT);
+    }
+    return NULL;
+}
+
+static int cmp_exit(const void* a, const void* b) {
+    const ExitRec* x = (const ExitRec*)a;
+    const ExitRec* y = (const ExitRec*)b;
+    if (x->link != y->link) return (x->link < y->link) ? -1 : 1;
+    return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+/* serial: stats and pool release for this step's exits, in link order;
+   -1 if the merged list could not grow (the exits left out stay allocated) */
+static int release_exits(Engine* e) {
+    int rc = 0;
+    ExitList* m = &e->exits_merged;
+    m->n = 0;
+    for (int w=0; w<e->n_tiles; w++) {
+        ExitList* x = &e->tiles[w].exits;
+        for (int k=0; k<x->n; k++)
+            if (exits_push(m, x->v[k].link, x->v[k].id) != 0) rc = -1;
+        x->n = 0;
+    }
+    if (m->n > 1) qsort(m->v, (size_t)m->n, sizeof(ExitRec), cmp_exit);
+
+    for (int k=0; k<m->n; k++) {
+        int id = m->v[k].id;
+        double tt = e->t - e->vp->entry_time[id];
+        if (e->t >= e->cfg->warmup) stats_on_exit(e->s, tt);
+        vp_release(e->vp, id);
+    }
+    return rc;
+}
+
+int engine_step(Engine* e, double t, int step) {
+    e->t = t;
+    e->step = step;
+    e->nasch.step = (uint32_t)step;
+    e->sample_queues = (t >= e->cfg->warmup);
+    PROF_BEGIN(e, 0);
+
+    if (e->reweight_steps > 0 && step > 0 && step % e->reweight_steps == 0) {
+        routing_reweight(&e->route, e->g, e->occ_steps, e->departures, e->cfg->time_step,
+                         e->reweight_steps * e->cfg->time_step);
+        memset(e->occ_steps, 0, sizeof(int64_t) * (size_t)e->g->n_links);
+        memset(e->departures, 0, sizeof(int32_t) * (size_t)e->g->n_links);
+        PROF_END(e, 0, PROF_ROUTING);
+    }
+
+    int rc = spawn_vehicles(e, t);
+    PROF_END(e, 0, PROF_SPAWN);
+
+    if (e->n_tiles > 1) pthread_barrier_wait(&e->barrier);
+    run_tile_phases(e, 0);
+    if (e->n_tiles > 1) {
+        pthread_barrier_wait(&e->barrier);
+        PROF_END(e, 0, PROF_WAIT);
+    }
+
+    if (release_exits(e) != 0) rc = -1;
+    if (e->sample_queues) e->s->queue_samples++;
+    PROF_END(e, 0, PROF_STATS);
+    if (e->traj) {
+        traj_end_step(e->traj, e->vp, step);
+        PROF_END(e, 0, PROF_TRAJ);
+    }
+
+    for (int w=0; w<e->n_tiles; w++) {
+        if (e->tiles[w].failed) rc = -1;
+        e->tiles[w].failed = false;
+    }
+    return rc;
+}
+
+/* near-square factorization tx * ty of the tile count, both sides <= N */
+static void choose_tiling(int n, int N, int* tx, int* ty) {
+    if (n > N * N) n = N * N;
+    for (;; n--) {
+        int best = -1;
+        for (int x=1; x<=n; x++) {
+            if (n % x || x > N || n / x > N) continue;
+            if (best < 0 || abs(x - n / x) < abs(best - n / best)) best = x;
+        }
+        if (best > 0) { *tx = best; *ty = n / best; return; }
+    }
+}
+
+/* tile 0 runs on the calling thread. The barrier counts every tile, so
+   workers wait at start_lock until all are created: if one cannot be, the
+   started ones leave without reaching the barrier and are joined here */
+static int start_workers(Engine* e) {
+    if (pthread_barrier_init(&e->barrier, NULL, (unsigned)e->n_tiles) != 0) return -1;
+    e->threads = (pthread_t*)calloc((size_t)e->n_tiles, sizeof(pthread_t));
+    e->workers = (EngineWorker*)calloc((size_t)e->n_tiles, sizeof(EngineWorker));
+    if (!e->threads || !e->workers || pthread_mutex_init(&e->start_lock, NULL) != 0) {
+        pthread_barrier_destroy(&e->barrier);
+        return -1;
+    }
+    pthread_mutex_lock(&e->start_lock);
+    int n = 1;
+    for (; n<e->n_tiles; n++) {
+        e->workers[n].e = e;
+        e->workers[n].tile = n;
+        if (pthread_create(&e->threads[n], NULL, worker_main, &e->workers[n]) != 0) break;
+    }
+    e->quit = (n < e->n_tiles);
+    pthread_mutex_unlock(&e->start_lock);
+    if (e->quit) {
+        for (int w=1; w<n; w++) pthread_join(e->threads[w], NULL);
+        pthread_mutex_destroy(&e->start_lock);
+        pthread_barrier_destroy(&e->barrier);
+        e->quit = false;
+        return -1;
+    }
+    e->running = true;
+    return 0;
+}
+
+int engine_init(Engine* e, Grid* g, VehiclePool* vp, Stats* s, const Config* cfg, int n_threads) {
+    memset(e, 0, sizeof(*e));
+    e->g = g;
+    e->vp = vp;
+    e->s = s;
+    e->cfg = cfg;
+
+    int N = g->grid_size;
+    choose_tiling(n_threads < 1 ? 1 : n_threads, N, &e->tiles_x, &e->tiles_y);
+    e->n_tiles = e->tiles_x * e->tiles_y;
+
+    e->tiles = (Tile*)calloc((size_t)e->n_tiles, sizeof(Tile));
+    e->link_tile = (int32_t*)malloc(sizeof(int32_t) * (size_t)g->n_links);
+    e->link_active = (uint8_t*)calloc((size_t)(g->n_links ? g->n_links : 1), 1);
+    e->lane_off = (int32_t*)malloc(sizeof(int32_t) * ((size_t)g->n_links + 1));
+    int32_t* inter_tile = (int32_t*)malloc(sizeof(int32_t) * (size_t)g->n_intersections);
+    if (!e->tiles || !e->link_tile || !e->link_active || !e->lane_off || !inter_tile) { free(inter_tile); return -1; }
+    e->lane_off[0] = 0;
+    for (int l=0; l<g->n_links; l++) e->lane_off[l + 1] = e->lane_off[l] + g->links[l].n_lanes;
+    e->claim = (int64_t*)malloc(sizeof(int64_t) * (size_t)(e->lane_off[g->n_links] ? e->lane_off[g->n_links] : 1));
+    if (!e->claim) { free(inter_tile); return -1; }
+    for (int k=0; k<e->lane_off[g->n_links]; k++) e->claim[k] = INT64_MAX;
+
+    for (int k=0; k<g->n_intersections; k++) {
+        const Intersection* I = &g->intersections[k];
+        int bi = I->i * e->tiles_y / N;
+        int bj = I->j * e->tiles_x / N;
+        inter_tile[k] = bi * e->tiles_x + bj;
+        e->tiles[inter_tile[k]].n_inters++;
+    }
+    for (int l=0; l<g->n_links; l++) {
+        const Link* L = &g->links[l];
+        int owner = (L->to != INVALID_ID) ? L->to : L->from;
+        e->link_tile[l] = inter_tile[owner];
+        e->tiles[e->link_tile[l]].n_links++;
+    }
+
+    for (int w=0; w<e->n_tiles; w++) {
+        Tile* tile = &e->tiles[w];
+        tile->inters = (int32_t*)malloc(sizeof(int32_t) * (size_t)(tile->n_inters ? tile->n_inters : 1));
+        tile->links = (int32_t*)malloc(sizeof(int32_t) * (size_t)(tile->n_links ? tile->n_links : 1));
+        tile->active = (int32_t*)malloc(sizeof(int32_t) * (size_t)(tile->n_links ? tile->n_links : 1));
+        tile->outbox = (IdxList*)calloc((size_t)e->n_tiles, sizeof(IdxList));
+        if (!tile->inters || !tile->links || !tile->active || !tile->outbox) { free(inter_tile); return -1; }
+        tile->n_inters = tile->n_links = 0;
+    }
+    for (int k=0; k<g->n_intersections; k++) {
+        Tile* tile = &e->tiles[inter_tile[k]];
+        tile->inters[tile->n_inters++] = k;
+    }
+    for (int l=0; l<g->n_links; l++) {
+        Tile* tile = &e->tiles[e->link_tile[l]];
+        tile->links[tile->n_links++] = l;
+    }
+    free(inter_tile);
+    int run_cap = 1;
+    for (int l=0; l<g->n_links; l++)
+        if (g->links[l].n_lanes == 1 && g->links[l].n_cells + 1 > run_cap) run_cap = g->links[l].n_cells + 1;
+    run_cap += NASCH_WIDTH;
+    for (int w=0; w<e->n_tiles; w++) {
+        NaschRun* r = &e->tiles[w].run;
+        r->pos = (int32_t*)calloc((size_t)run_cap, sizeof(int32_t));
+        r->id = (int32_t*)calloc((size_t)run_cap, sizeof(int32_t));
+        r->speed = (int32_t*)calloc((size_t)run_cap, sizeof(int32_t));
+        r->vmax = (int32_t*)calloc((size_t)run_cap, sizeof(int32_t));
+        if (!r->pos || !r->id || !r->speed || !r->vmax) return -1;
+    }
+    /* links already holding vehicles (a grid that did not start empty) */
+    for (int l=0; l<g->n_links; l++) if (!link_empty(g, &g->links[l])) link_activate(e, l);
+    for (int w=0; w<e->n_tiles; w++) {
+        Tile* tile = &e->tiles[w];
+        if (light_sched_init(&tile->lights, g, tile->inters, tile->n_inters, cfg->time_step) != 0) return -1;
+    }
+
+    if (cfg->routing_type == ROUTING_SHORTEST_PATH) {
+        if (routing_init(&e->route, g, cfg, n_threads) != 0) return -1;
+        e->routed = true;
+        if (cfg->routing_update_interval > 0) {
+            e->reweight_steps = (int)(cfg->routing_update_interval / cfg->time_step + 0.5);
+            if (e->reweight_steps < 1) e->reweight_steps = 1;
+            e->occ_steps = (int64_t*)calloc((size_t)(g->n_links ? g->n_links : 1), sizeof(int64_t));
+            e->departures = (int32_t*)calloc((size_t)(g->n_links ? g->n_links : 1), sizeof(int32_t));
+            if (!e->occ_steps || !e->departures) return -1;
+        }
+    }
+
+    if (cfg->od_file[0]) {
+        e->demand = (Demand*)malloc(sizeof(Demand));
+        if (!e->demand || demand_init(e->demand, g, cfg, e->routed ? &e->route : NULL) != 0) {
+            free(e->demand);
+            e->demand = NULL;
+            return -1;
+        }
+    }
+
+    e->rng = rng_key(cfg->random_seed);
+    e->kernel = nasch_kernel(&e->kernel_name);
+    e->nasch.key = e->rng;
+    e->nasch.p = cfg->slowdown_probability;
+    e->nasch.slow_below = rng_threshold53(cfg->slowdown_probability);
+    e->spawn_u = (double*)malloc(sizeof(double) * (size_t)(g->n_entry_links ? g->n_entry_links : 1));
+    if (!e->spawn_u) return -1;
+#ifdef TS_PROFILE
+    e->prof = (Prof*)malloc(sizeof(Prof));
+    if (!e->prof || prof_init(e->prof, e->n_tiles) != 0) {
+        free(e->prof);
+        e->prof = NULL;
+        return -1;
+    }
+#endif
+
+    if (e->n_tiles > 1 && start_workers(e) != 0) return -1;
+    return 0;
+}
+
+void engine_free(Engine* e) {
+    if (e->running) {
+        e->quit = true;
+        pthread_barrier_wait(&e->barrier);
+        for (int w=1; w<e->n_tiles; w++) pthread_join(e->threads[w], NULL);
+        pthread_mutex_destroy(&e->start_lock);
+        pthread_barrier_destroy(&e->barrier);
+    }
+    for (int w=0; w<e->n_tiles && e->tiles; w++) {
+        Tile* tile = &e->tiles[w];
+        for (int d=0; d<e->n_tiles && tile->outbox; d++) free(tile->outbox[d].v);
+        free(tile->outbox);
+        free(tile->intents.v);
+        free(tile->exits.v);
+        light_sched_free(&tile->lights);
+        free(tile->inters);
+        free(tile->links);
+        free(tile->active);
+        free(tile->run.pos);
+        free(tile->run.id);
+        free(tile->run.speed);
+        free(tile->run.vmax);
+    }
+    free(e->tiles);
+    free(e->link_tile);
+    free(e->link_active);
+    free(e->claim);
+    free(e->lane_off);
+    routing_free(&e->route);
+    free(e->occ_steps);
+    free(e->departures);
+    if (e->demand) demand_free(e->demand);
+    free(e->demand);
+    free(e->exits_merged.v);
+    free(e->spawn_u);
+    free(e->threads);
+    free(e->workers);
+#ifdef TS_PROFILE
+    if (e->prof) prof_free(e->prof);
+    free(e->prof);
+#endif
+    memset(e, 0, sizeof(*e));
+}
@@ -1,12 +1,33 @@
 // grid.c
 #include "grid.h"
+#include "netfile.h"
+#include "occupancy.h"
 #include <stdlib.h>
 #include <string.h>
 
-static void init_light(TrafficLight* tl, const Config* cfg) {
+#define ARENA_ALIGN 64
+
+static size_t align_up(size_t n) {
+    return (n + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* calloc'ed block of n bytes aligned to ARENA_ALIGN; *raw receives the pointer to free */
+static char* arena_alloc(void** raw, size_t n) {
+    /* calloc: large arenas come straight from zeroed pages, so cells and
+       occupancy words cost nothing until a vehicle first touches them */
+    char* p = (char*)calloc(1, n + ARENA_ALIGN);
+    *raw = p;
+    if (!p) return NULL;
+    return p + (ARENA_ALIGN - ((uintptr_t)p & (ARENA_ALIGN - 1))) % ARENA_ALIGN;
+}
+
+void grid_light_init(TrafficLight* tl, const Config* cfg) {
+    memset(tl, 0, sizeof(*tl));
     tl->type = cfg->controller;
     tl->phase = PHASE_NS;
-    tl->phase_elapsed = 0.0;
+    /* as if the phase began just before step 0, so one step has elapsed at step 0 */
+    tl->phase_start = -1;
+    tl->next_eval = 0;
 
     tl->cycle_time = cfg->cycle_time;
     tl->green_ns = cfg->green_ns;
@@ -16,115 +37,293 @@ static void init_light(TrafficLight* tl, const Config* cfg) {
     tl->queue_threshold = cfg->act_queue_threshold;
 }
 
-static Link* new_link(Grid* g, int id, Intersection* from, Intersection* to, Direction dir, int n_cells) {
-    Link* L = &g->links[id];
+static Link* new_link(Topology* t, int id, int from, int to, Direction dir, int n_cells, int n_lanes) {
+    Link* L = &t->links[id];
     L->id = id;
     L->from = from;
     L->to = to;
-    L->dir = dir;
+    L->dir = (uint8_t)dir;
+    L->group = (uint8_t)((dir == DIR_N || dir == DIR_S) ? PHASE_NS : PHASE_EW);
     L->n_cells = n_cells;
+    L->n_lanes = (uint8_t)n_lanes;
     L->stopline_cell = n_cells - 1;
-    L->cells = (Cell*)malloc(sizeof(Cell) * (size_t)n_cells);
-    for (int i=0;i<n_cells;i++) L->cells[i].vehicle_id = INVALID_ID;
+    L->cell_off = (int32_t)((int64_t)id * n_cells * n_lanes);
+    L->occ_off = id * occ_words_for(n_cells * n_lanes);
     return L;
 }
 
-int grid_init(Grid* g, const Config* cfg) {
-    memset(g, 0, sizeof(*g));
-    g->grid_size = cfg->grid_size;
-    g->n_intersections = cfg->grid_size * cfg->grid_size;
+static void connect(Topology* t, int from, int to, Direction dir, int* lid, int n_cells, int n_lanes) {
+    new_link(t, (*lid)++, from, to, dir, n_cells, n_lanes);
+}
 
-    g->intersections = (Intersection*)malloc(sizeof(Intersection) * (size_t)g->n_intersections);
-    for (int idx=0; idx<g->n_intersections; idx++) {
-        Intersection* I = &g->intersections[idx];
-        I->id = idx;
-        I->i = idx / cfg->grid_size;
-        I->j = idx % cfg->grid_size;
-        for (int d=0; d<4; d++) { I->in[d]=NULL; I->out[d]=NULL; }
-        init_light(&I->tl, cfg);
+size_t topology_layout(Topology* t, char* base) {
+    size_t n_inter = (size_t)t->n_intersections;
+    size_t n_links = (size_t)t->n_links;
+
+    /* one arena: intersections | links | entry list | node CSR | turn CSR */
+    size_t off_inter    = 0;
+    size_t off_links    = off_inter    + align_up(sizeof(Intersection) * n_inter);
+    size_t off_entry    = off_links    + align_up(sizeof(Link) * n_links);
+    size_t off_in_off   = off_entry    + align_up(sizeof(int32_t) * (size_t)t->n_entry_links);
+    size_t off_in       = off_in_off   + align_up(sizeof(int32_t) * (n_inter + 1));
+    size_t off_out_off  = off_in       + align_up(sizeof(int32_t) * (size_t)t->n_in_links);
+    size_t off_out      = off_out_off  + align_up(sizeof(int32_t) * (n_inter + 1));
+    size_t off_turn_off = off_out      + align_up(sizeof(int32_t) * (size_t)t->n_out_links);
+    size_t off_turns    = off_turn_off + align_up(sizeof(int32_t) * (n_links + 1));
+    size_t total        = off_turns    + align_up(sizeof(int32_t) * (size_t)t->n_turns);
+
+    if (base) {
+        t->intersections = (Intersection*)(base + off_inter);
+        t->links = (Link*)(base + off_links);
+        t->entry_links = (int32_t*)(base + off_entry);
+        t->in_off = (int32_t*)(base + off_in_off);
+        t->in_links = (int32_t*)(base + off_in);
+        t->out_off = (int32_t*)(base + off_out_off);
+        t->out_links = (int32_t*)(base + off_out);
+        t->turn_off = (int32_t*)(base + off_turn_off);
+        t->turns = (int32_t*)(base + off_turns);
+    }
+    return total;
+}
+
+int topology_alloc(Topology* t) {
+    size_t total = topology_layout(t, NULL);
+    char* base = arena_alloc(&t->arena, total);
+    if (!base) return -1;
+    t->arena_bytes = total;
+    topology_layout(t, base);
+    return 0;
+}
+
+/* insertion sort of a node's (short) link list by (dir, id) */
+static void sort_by_dir(const Link* links, int32_t* v, int n) {
+    for (int a=1; a<n; a++) {
+        int32_t x = v[a];
+        int b = a;
+        while (b > 0 && (links[v[b-1]].dir > links[x].dir
+                         || (links[v[b-1]].dir == links[x].dir && v[b-1] > x))) {
+            v[b] = v[b-1];
+            b--;
+        }
+        v[b] = x;
+    }
+}
+
+/* counting sort of the link ends by node into off/list; off[] ends up as
+   the CSR offsets */
+static void csr_by_node(Topology* t, int32_t* off, int32_t* list, bool by_to) {
+    int n = t->n_intersections;
+    memset(off, 0, sizeof(int32_t) * (size_t)(n + 1));
+    for (int l=0; l<t->n_links; l++) {
+        int32_t node = by_to ? t->links[l].to : t->links[l].from;
+        if (node != INVALID_ID) off[node + 1]++;
+    }
+    for (int k=0; k<n; k++) off[k + 1] += off[k];
+    /* off[k] is now the start of node k; use it as the fill cursor... */
+    for (int l=0; l<t->n_links; l++) {
+        int32_t node = by_to ? t->links[l].to : t->links[l].from;
+        if (node != INVALID_ID) list[off[node]++] = l;
     }
+    /* ...so now off[k] is the end of node k: shift back to starts */
+    memmove(off + 1, off, sizeof(int32_t) * (size_t)n);
+    off[0] = 0;
+    for (int k=0; k<n; k++) sort_by_dir(t->links, list + off[k], off[k + 1] - off[k]);
+}
+
+void topology_index(Topology* t) {
+    csr_by_node(t, t->in_off, t->in_links, true);
+    csr_by_node(t, t->out_off, t->out_links, false);
+}
+
+void topology_all_turns(Topology* t) {
+    int32_t n = 0;
+    for (int l=0; l<t->n_links; l++) {
+        t->turn_off[l] = n;
+        int32_t to = t->links[l].to;
+        if (to == INVALID_ID) continue;
+        for (int32_t k=t->out_off[to]; k<t->out_off[to + 1]; k++) t->turns[n++] = t->out_links[k];
+    }
+    t->turn_off[t->n_links] = n;
+}
+
+int topology_init(Topology* t, const Config* cfg) {
+    if (cfg->network_file[0]) return topology_map(t, cfg->network_file);
+
+    memset(t, 0, sizeof(*t));
+    int N = cfg->grid_size;
+    int n_cells = cfg->link_length_cells;
+    int n_lanes = cfg->lanes_per_direction;
+    if (N < 1 || n_cells < 1 || n_lanes < 1 || n_lanes > MAX_LANES) return -1;
+
+    t->grid_size = N;
 
     /* Links: for each adjacent pair we create 2 directed links (both directions).
        Grid has (N*(N-1)) horizontal adjacencies and same vertical. Each adjacency => 2 links.
        Total internal directed links = 2*(N*(N-1) + N*(N-1)) = 4*N*(N-1).
        Plus boundary entry links: 4*N (entering from each side).
-       Plus boundary exit links are represented by internal links having to=NULL; we won't create them separately.
-       Simpler: create entry links only (from=NULL to=boundary row/col intersection).
+       There are no exit links: a vehicle leaves at a boundary intersection
+       that has no out link towards its destination side (exit_mask).
     */
-    int N = cfg->grid_size;
-    int internal = 4 * N * (N - 1);
-    int entries = 4 * N;
-    g->n_links = internal + entries;
-    g->links = (Link*)malloc(sizeof(Link) * (size_t)g->n_links);
+    int64_t n_intersections = (int64_t)N * N;
+    int64_t internal = 4LL * N * (N - 1);
+    int64_t entries = 4LL * N;
+    int64_t n_links = internal + entries;
+    int64_t link_cells = (int64_t)n_cells * n_lanes;
+    /* every intersection has one in link per side (internal or entry), so
+       each internal link is a turn of 4 links */
+    if (n_intersections > INT32_MAX || n_links > INT32_MAX || link_cells > INT32_MAX
+        || n_links * link_cells > INT32_MAX || 4 * internal > INT32_MAX) return -1; /* int32 indices */
+    t->n_cells = n_links * link_cells;
+    t->n_occ_words = n_links * occ_words_for((int)link_cells);
 
-    g->entry_links = (Link**)malloc(sizeof(Link*) * (size_t)entries);
-    g->n_entry_links = entries;
+    t->n_intersections = (int)n_intersections;
+    t->n_links = (int)n_links;
+    t->n_entry_links = (int)entries;
+    t->n_in_links = (int)n_links;
+    t->n_out_links = (int)internal;
+    t->n_turns = (int)(4 * internal);
+    if (topology_alloc(t) != 0) return -1;
+
+    for (int idx=0; idx<t->n_intersections; idx++) {
+        Intersection* I = &t->intersections[idx];
+        I->id = idx;
+        I->i = idx / N;
+        I->j = idx % N;
+    }
 
     int lid = 0;
     /* internal vertical links */
     for (int i=0;i<N-1;i++) for (int j=0;j<N;j++) {
-        Intersection* A = &g->intersections[i*N + j];
-        Intersection* B = &g->intersections[(i+1)*N + j];
-        /* A -> B is DIR_S (going down) */
-        Link* L1 = new_link(g, lid++, A, B, DIR_S, cfg->link_length_cells);
-        /* B -> A is DIR_N (going up) */
-        Link* L2 = new_link(g, lid++, B, A, DIR_N, cfg->link_length_cells);
-        A->out[DIR_S] = L1; B->in[DIR_S] = L1;
-        B->out[DIR_N] = L2; A->in[DIR_N] = L2;
+        int A = i*N + j;
+        int B = (i+1)*N + j;
+        connect(t, A, B, DIR_S, &lid, n_cells, n_lanes); /* A -> B is DIR_S (going down) */
+        connect(t, B, A, DIR_N, &lid, n_cells, n_lanes); /* B -> A is DIR_N (going up) */
     }
     /* internal horizontal links */
     for (int i=0;i<N;i++) for (int j=0;j<N-1;j++) {
-        Intersection* A = &g->intersections[i*N + j];
-        Intersection* B = &g->intersections[i*N + (j+1)];
-        /* A -> B is DIR_E */
-        Link* L1 = new_link(g, lid++, A, B, DIR_E, cfg->link_length_cells);
-        /* B -> A is DIR_W */
-        Link* L2 = new_link(g, lid++, B, A, DIR_W, cfg->link_length_cells);
-        A->out[DIR_E] = L1; B->in[DIR_E] = L1;
-        B->out[DIR_W] = L2; A->in[DIR_W] = L2;
+        int A = i*N + j;
+        int B = i*N + (j+1);
+        connect(t, A, B, DIR_E, &lid, n_cells, n_lanes); /* A -> B is DIR_E */
+        connect(t, B, A, DIR_W, &lid, n_cells, n_lanes); /* B -> A is DIR_W */
     }
 
     /* boundary entry links */
     int eidx = 0;
     /* Enter from North going South into row 0 */
     for (int j=0;j<N;j++) {
-        Intersection* to = &g->intersections[0*N + j];
-        Link* L = new_link(g, lid++, NULL, to, DIR_S, cfg->link_length_cells);
-        to->in[DIR_S] = L;
-        g->entry_links[eidx++] = L;
+        t->entry_links[eidx++] = lid;
+        connect(t, INVALID_ID, 0*N + j, DIR_S, &lid, n_cells, n_lanes);
     }
     /* Enter from South going North into row N-1 */
     for (int j=0;j<N;j++) {
-        Intersection* to = &g->intersections[(N-1)*N + j];
-        Link* L = new_link(g, lid++, NULL, to, DIR_N, cfg->link_length_cells);
-        to->in[DIR_N] = L;
-        g->entry_links[eidx++] = L;
+        t->entry_links[eidx++] = lid;
+        connect(t, INVALID_ID, (N-1)*N + j, DIR_N, &lid, n_cells, n_lanes);
     }
     /* Enter from West going East into col 0 */
     for (int i=0;i<N;i++) {
-        Intersection* to = &g->intersections[i*N + 0];
-        Link* L = new_link(g, lid++, NULL, to, DIR_E, cfg->link_length_cells);
-        to->in[DIR_E] = L;
-        g->entry_links[eidx++] = L;
+        t->entry_links[eidx++] = lid;
+        connect(t, INVALID_ID, i*N + 0, DIR_E, &lid, n_cells, n_lanes);
     }
     /* Enter from East going West into col N-1 */
     for (int i=0;i<N;i++) {
-        Intersection* to = &g->intersections[i*N + (N-1)];
-        Link* L = new_link(g, lid++, NULL, to, DIR_W, cfg->link_length_cells);
-        to->in[DIR_W] = L;
-        g->entry_links[eidx++] = L;
+        t->entry_links[eidx++] = lid;
+        connect(t, INVALID_ID, i*N + (N-1), DIR_W, &lid, n_cells, n_lanes);
+    }
+
+    topology_index(t);
+    topology_all_turns(t);
+
+    /* vehicles leave at the boundary, towards a side with no out link */
+    for (int idx=0; idx<t->n_intersections; idx++) {
+        uint8_t mask = 0xF;
+        for (int32_t k=t->out_off[idx]; k<t->out_off[idx + 1]; k++) mask &= (uint8_t)~(1u << t->links[t->out_links[k]].dir);
+        t->intersections[idx].exit_mask = mask;
     }
+    return 0;
+}
 
+void topology_free(Topology* t) {
+    if (!t) return;
+    if (t->map) topology_unmap(t);
+    else free(t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+bool topology_matches(const Topology* t, const Config* cfg) {
+    if (strcmp(t->file, cfg->network_file) != 0) return false;
+    if (t->file[0]) return true;
+    return t->grid_size == cfg->grid_size
+        && t->n_links > 0 && t->links[0].n_cells == cfg->link_length_cells
+        && t->links[0].n_lanes == cfg->lanes_per_direction;
+}
+
+int grid_init(Grid* g, const Topology* topo, const Config* cfg) {
+    memset(g, 0, sizeof(*g));
+    g->topo = topo;
+    g->grid_size = topo->grid_size;
+    g->n_intersections = topo->n_intersections;
+    g->n_links = topo->n_links;
+    g->intersections = topo->intersections;
+    g->links = topo->links;
+    g->entry_links = topo->entry_links;
+    g->n_entry_links = topo->n_entry_links;
+    g->in_off = topo->in_off;
+    g->in_links = topo->in_links;
+    g->out_off = topo->out_off;
+    g->out_links = topo->out_links;
+    g->turn_off = topo->turn_off;
+    g->turns = topo->turns;
+    g->n_cells = topo->n_cells;
+    g->n_occ_words = topo->n_occ_words;
+
+    /* one arena: cells | occupancy | head stamps | window counters | dirty flags | lights */
+    size_t off_cells = 0;
+    size_t off_occ   = off_cells + align_up(sizeof(Cell) * (size_t)g->n_cells);
+    size_t off_head  = off_occ   + align_up(sizeof(uint64_t) * (size_t)g->n_occ_words);
+    size_t off_headl = off_head  + align_up(sizeof(int32_t) * (size_t)g->n_links);
+    size_t off_stopc = off_headl + align_up(sizeof(uint8_t) * (size_t)g->n_links);
+    size_t off_headc = off_stopc + align_up(sizeof(int32_t) * (size_t)g->n_links);
+    size_t off_dirty = off_headc + align_up(sizeof(int32_t) * (size_t)g->n_links);
+    size_t off_light = off_dirty + align_up(sizeof(atomic_uchar) * (size_t)g->n_intersections);
+    size_t total     = off_light + align_up(sizeof(TrafficLight) * (size_t)g->n_intersections);
+
+    char* base = arena_alloc(&g->arena, total);
+    if (!base) return -1;
+    g->arena_bytes = total;
+
+    g->cells = (Cell*)(base + off_cells);
+    g->occ = (uint64_t*)(base + off_occ);
+    g->head_vacated_step = (int32_t*)(base + off_head);
+    g->head_vacated_lanes = (uint8_t*)(base + off_headl);
+    g->stop_count = (int32_t*)(base + off_stopc);
+    g->head_count = (int32_t*)(base + off_headc);
+    g->light_dirty = (atomic_uchar*)(base + off_dirty);
+    g->lights = (TrafficLight*)(base + off_light);
+    g->k_cells = (cfg->queue_window_cells > 0) ? cfg->queue_window_cells : 1;
+
+    for (int l=0; l<g->n_links; l++) g->head_vacated_step[l] = -1;
+    for (int k=0; k<g->n_intersections; k++) {
+        grid_light_init(&g->lights[k], cfg);
+        atomic_init(&g->light_dirty[k], 1);
+    }
     return 0;
 }
 
 void grid_free(Grid* g) {
     if (!g) return;
-    if (g->links) {
-        for (int i=0;i<g->n_links;i++) free(g->links[i].cells);
-        free(g->links);
-    }
-    free(g->intersections);
-    free(g->entry_links);
+    free(g->arena);
     memset(g, 0, sizeof(*g));
 }
+
+void topology_report(const Topology* t, double build_ms, FILE* f) {
+    double cells_per_link = t->n_links ? (double)t->n_cells / (double)t->n_links : 0.0;
+    double cell_bytes = (double)sizeof(Cell) + (double)t->n_occ_words * sizeof(uint64_t) / (double)(t->n_cells ? t->n_cells : 1);
+    if (t->file[0]) fprintf(f, "grid: %s, tiled on %dx%d, ", t->file, t->grid_size, t->grid_size);
+    else fprintf(f, "grid: %dx%d, ", t->grid_size, t->grid_size);
+    fprintf(f, "%d intersections x %zu B, %d links x %zu B, %lld cells x %.2f B (%.1f cells/link), %d turns\n",
+            t->n_intersections, sizeof(Intersection),
+            t->n_links, sizeof(Link),
+            (long long)t->n_cells, cell_bytes, cells_per_link, t->n_turns);
+    fprintf(f, "grid: shared topology %.2f MiB, %s in %.2f ms\n",
+            (double)t->arena_bytes / (1024.0 * 1024.0), t->map ? "mapped" : "built", build_ms);
+}
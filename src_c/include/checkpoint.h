@@ -0,0 +1,81 @@
+// checkpoint.h
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "engine.h"
+#include "trafficsim.h"
+
+/* Binary checkpoint of one simulation between two steps (native byte
+   order, like the network file). Only state that cannot be derived is
+   stored; everything else is rebuilt on restore:
+
+     header     counts, time, step, seed and a hash of the network
+     lights     TrafficLight per intersection, then its dirty flag
+     vehicles   pool capacity, live ids in pool order, the free-id stack,
+                then per live vehicle (pool order) link, slot, speed,
+                vmax, destination, entry and stopped time, field by field
+     stats      counters, queue sums / maxima, the non-empty buckets of
+                the travel-time sketch
+     routing    when the tables are re-weighted: link costs, next hops and
+                costs-to-go, and the current measurement interval
+     demand     with an OD file: a hash of its tables, the period and every
+                origin's next arrival step
+
+   Cells, occupancy bits and window counters follow from the vehicles,
+   the light schedule from the lights, the active-link worklists from the
+   occupancy, and the random streams from (seed, step). Restoring into the
+   same configuration continues the run exactly as if it had not stopped.
+
+   A restore may use a different configuration on the same network and
+   time step, which branches a scenario off the saved state: lights whose
+   controller or timings changed keep their current phase and are
+   re-evaluated at the first step; another queue window recounts the
+   windows; another random_seed draws a new future; demand and vehicle
+   settings apply to what happens next; pending arrivals are kept only
+   for the same OD tables and drawn afresh otherwise. Routing tables are reused when the
+   destinations are the same, else rebuilt from the saved link costs. */
+
+#define CKPT_MAGIC "TSCKPT\r\n"
+#define CKPT_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;     /* 0x01020304 as written */
+    uint32_t light_bytes;    /* sizeof(TrafficLight) */
+    int32_t n_intersections;
+    int32_t n_links;
+    int32_t step;
+    int64_t n_cells;
+    uint64_t network_hash;   /* FNV-1a of the Intersection and Link arrays */
+    double t;
+    double time_step;
+    uint64_t seed;
+    int32_t vehicle_cap;
+    int32_t n_vehicles;
+    int32_t n_free;
+    int32_t peak_vehicles;
+    int32_t k_cells;         /* queue window the dirty flags refer to */
+    int32_t reserved;
+    uint64_t off_lights;     /* section offsets from the start of the file */
+    uint64_t off_vehicles;
+    uint64_t off_stats;
+    uint64_t off_routing;
+    uint64_t off_demand;
+    uint64_t bytes;          /* file size */
+} CkptHeader;
+
+struct TsCheckpoint {
+    CkptHeader h;
+    char* data;              /* the whole file, header included */
+};
+
+int checkpoint_capture(TsCheckpoint** out, const Grid* g, const VehiclePool* vp, const Stats* s,
+                       const Engine* e, const Config* cfg, double t, int step);
+/* before engine_init: network state, lights, vehicles and stats for cfg;
+   -1 (with a message on stderr) if ck does not fit g or cfg */
+int checkpoint_restore_state(const TsCheckpoint* ck, Grid* g, VehiclePool* vp, Stats* s,
+                             const Config* cfg, double* t, int* step);
+/* after engine_init: routing tables and the link costs being measured */
+int checkpoint_restore_engine(const TsCheckpoint* ck, Engine* e);
+
+#endif
@@ -9,24 +9,33 @@ typedef struct {
     double duration;
     double warmup;
     uint64_t random_seed;
+    int threads;
 
     /* network */
     int grid_size;
     double cell_length_m;
     int link_length_cells;
     int lanes_per_direction;
+    char network_file[256];   /* binary network (netfile.h); "" = grid_size lattice */
 
     /* vehicles */
     int vmax_cells_per_step;
     double slowdown_probability;
     int vehicle_length_cells;
+    double lane_change_probability;
 
     /* demand */
     double arrival_rate;
     double routing_randomness;
+    RoutingType routing_type;          /* manhattan: head for the exit side; shortest_path: routing.h */
+    double routing_update_interval;    /* s between re-weights from measured travel times, 0 = never */
+    double routing_reweight_threshold; /* relative link cost change that triggers recomputation */
+    char routing_destinations[256];    /* extra destination node ids, e.g. "12,40" */
+    char od_file[256];                 /* time-varying OD matrices (demand.h); "" = arrival_rate everywhere */
 
     /* traffic lights */
     ControllerType controller;
+    int queue_window_cells;   /* stopline/head window for queues and pressure */
 
     /* fixed */
     double cycle_time;
@@ -48,6 +57,10 @@ typedef struct {
 
 } Config;
 
+void config_set_defaults(Config* cfg);
+/* defaults, then every key=value line of the file */
 int config_load_kv(Config* cfg, const char* path);
+/* set one "section.key" value; returns -1 if the key (or controller name) is unknown */
+int config_set(Config* cfg, const char* key, const char* val);
 
 #endif
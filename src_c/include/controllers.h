@@ -3,10 +3,46 @@
 #define CONTROLLERS_H
 #include "grid.h"
 
-void update_traffic_lights(Grid* g, const Config* cfg, double t, double dt);
+/* Event-driven light scheduling.
 
-/* helpers for queues/pressure */
-int queue_in_dir(const Intersection* inter, Direction dir, int k_cells);
-int pressure_for_phase(const Intersection* inter, Phase ph, int k_cells);
+   A light only needs a decision at a few known steps: a fixed-time light
+   when its plan switches, an adaptive (actuated / max-pressure) light once
+   its min_green has elapsed and again at max_green. Each light keeps that
+   step in TrafficLight.next_eval and sits in a timing wheel slot for it.
+   Once past min_green an adaptive light is "armed": between scheduled
+   steps its decision can only change when a detector window it reads
+   changes, so armed lights are re-evaluated only when Grid.light_dirty is
+   set. Steps where nothing is due cost nothing per light. */
+
+#define LIGHT_NEVER INT32_MAX
+
+typedef struct {
+    int32_t* v;
+    int n;
+    int cap;
+} LightSlot;
+
+typedef struct {
+    LightSlot* slots;    /* [n_slots], lights due at step == slot (mod n_slots) */
+    int n_slots;         /* power of two */
+    LightSlot due;       /* scratch: the slot being drained */
+    int32_t* armed;      /* armed lights, compacted every step */
+    int n_armed;
+} LightSched;
+
+/* schedules the lights ids[0..n) (one engine tile) from their current state */
+int light_sched_init(LightSched* ls, Grid* g, const int32_t* ids, int n, double dt);
+/* decisions due at step (time t) and for armed lights whose detectors
+   changed; -1 if a wheel slot could not grow (out of memory), after which
+   a light may never be decided again */
+int light_sched_step(LightSched* ls, Grid* g, int step, double t, double dt);
+void light_sched_free(LightSched* ls);
+
+/* helpers for queues/pressure over the Grid.k_cells windows, O(1) per link;
+   a phase serves the in links whose signal group equals it. The queue is
+   per lane (what actuated thresholds compare), the pressure counts
+   vehicles over all lanes */
+int queue_for_group(const Grid* g, const Intersection* inter, Phase ph);
+int pressure_for_phase(const Grid* g, const Intersection* inter, Phase ph);
 
 #endif
@@ -0,0 +1,105 @@
+// demand.h
+#ifndef DEMAND_H
+#define DEMAND_H
+#include "grid.h"
+#include "routing.h"
+#include "rng.h"
+
+/* Time-varying origin-destination demand (demand.od_file; without one,
+   every entry link spawns at demand.arrival_rate towards the side it
+   points to).
+
+   The file is a sequence of piecewise-constant OD matrices:
+
+     # morning peak
+     at 0              a period starts at t = 0 s (the first one must)
+     N S 0.05          origin destination rate (vehicles per second)
+     W 12 0.02
+     at 3600           the next period, from t = 3600 s on
+     N S 0.01
+
+   An origin is an entry link id, or a side N/E/S/W standing for every
+   entry link that comes from that side (each one gets the rate). A
+   destination is a side (leave the network there) or a node listed in
+   demand.routing_destinations (shortest_path routing). Repeated pairs add
+   up, missing ones have rate 0. A period lasts until the next one starts,
+   the last one to the end of the run; a period starts at the step whose
+   time is nearest to its start time.
+
+   Every origin is a Bernoulli process over steps, p = rate * time_step,
+   with at most one arrival per step, as with the constant rate. It is
+   sampled as geometric gaps: each origin's next arrival step waits in a
+   timing wheel and is only drawn again when it fires or a period starts.
+   A step costs its arrivals plus one re-queue per wheel lap for origins
+   whose next arrival is further away; an origin without demand costs
+   nothing. An arrival draws its destination from its origin's row of the
+   current period. Draws are keyed by (seed, step, entry link, RNG_DEMAND),
+   so the spawn order and the thread count do not change them. A vehicle
+   that finds every lane at the start of its entry link occupied is lost
+   (blocked_entries). */
+
+#define DEMAND_NEVER INT32_MAX
+
+typedef struct {
+    int32_t* v;
+    int n;
+    int cap;
+} DemandSlot;
+
+typedef struct Demand {
+    /* tables, fixed after demand_init */
+    int n_origins;          /* origin k enters on Grid.entry_links[k] */
+    const int32_t* origin_link;
+    int n_periods;
+    double* t0;             /* [n_periods] start times (s), ascending, t0[0] = 0 */
+    int32_t* row_off;       /* row (period p, origin k) is entries row_off[p*n_origins+k] .. [+1] */
+    uint16_t* dest;         /* per entry: side, or ROUTE_SIDES + routing destination */
+    double* cum;            /* per entry: rate of its row up to and including it (veh/s) */
+    int n_pairs;            /* entries with a rate */
+    double dt;
+    RngKey rng;
+    uint64_t hash;          /* of the tables: a checkpoint's demand state is only reused for the same */
+
+    /* state */
+    bool started;           /* next arrivals drawn */
+    int period;
+    int32_t* next;          /* [n_origins] step of the next arrival, or DEMAND_NEVER */
+    DemandSlot* slots;      /* [n_slots] origins whose next arrival is at step == slot (mod n_slots) */
+    int n_slots;            /* power of two */
+    DemandSlot due;         /* scratch: the slot being drained */
+    int32_t* arrival;       /* this step's arrivals, ascending origin */
+    uint16_t* arrival_dest;
+    int n_arrivals;
+
+    /* reported by demand_report */
+    long n_total_arrivals;
+    long n_requeues;
+    long n_restarts;
+} Demand;
+
+/* reads cfg->od_file; route gives the node destinations (NULL: sides
+   only). -1 with a message on stderr for a bad file. */
+int demand_init(Demand* d, const Grid* g, const Config* cfg, const Routing* route);
+void demand_free(Demand* d);
+
+/* arrivals of step (at time t), into arrival / arrival_dest; -1 if a
+   wheel slot could not grow (out of memory), after which an origin may
+   never arrive again */
+int demand_step(Demand* d, int step, double t);
+
+/* continue from saved state (a checkpoint taken with the same tables);
+   -1 for a bad period or out of memory */
+int demand_resume(Demand* d, int period, const int32_t* next);
+
+/* The model in pieces (the reference engine draws with these directly). */
+/* period in force at time t */
+int demand_period_at(const Demand* d, double t);
+/* first arrival step >= from of origin k in period p; index tells apart
+   draws made at the same step (after an arrival 0, at a period start 2) */
+int32_t demand_next_arrival(const Demand* d, int p, int k, int32_t from, uint32_t index);
+/* destination of an arrival of origin k at step */
+int demand_destination(const Demand* d, int p, int k, int32_t step);
+
+void demand_report(const Demand* d, FILE* f);
+
+#endif
@@ -0,0 +1,162 @@
+// engine.h
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <pthread.h>
+#include "controllers.h"
+#include "nasch.h"
+#include "routing.h"
+#include "stats.h"
+#include "vehicle_pool.h"
+#include "prof.h"
+#include "rng.h"
+
+/* Spatially tiled step engine.
+
+   The intersection grid is cut into n_tiles rectangular tiles, one per
+   thread. A tile owns its intersections and every link whose downstream
+   intersection it owns, so lights, link sweeps and queue sampling only write
+   tile-owned state. A step runs as:
+
+     serial    re-weight the routing tables when due, spawn on entry links
+     A  (par)  traffic lights of own intersections that have a decision
+               due (see controllers.h)
+     B  (par)  sweep own active links (lane changes, then moves); on a
+               single-lane link the vehicles that cannot reach the
+               stopline go through the batch kernel (nasch.h); crossings
+               and exits are queued, crossings are also indexed by
+               destination tile
+     C1 (par)  accept crossings into own links: a crossing needs its
+               target lane's first cell free at step start, and among
+               competitors the lowest key (source link, then the most
+               downstream slot) wins
+     C2 (par)  finish own queued crossings/exits on the source side, then
+               retire emptied links, sample queues of own intersections
+               and record trajectory events of own links (traj.h)
+     serial    release exited vehicles, sorted by source link
+
+   Only links holding vehicles are visited: a link joins its tile's active
+   worklist when a vehicle enters it (spawn, or a crossing accepted by the
+   owning tile in C1) and leaves it in C2 once empty, so an empty link
+   costs nothing per step. Barriers separate the parallel phases. Random draws are keyed by
+   (seed, step, entity, purpose) and every conflict rule above is
+   order-free, so results depend on the seed only, not on the thread count. */
+
+typedef enum { CROSS_BLOCKED=0, CROSS_WON=1, CROSS_LOST=2 } CrossOutcome;
+
+typedef struct {
+    int32_t id;
+    int32_t src_link;
+    int32_t src_cell;     /* slot on src_link */
+    int32_t dst_link;
+    int64_t key;          /* conflict priority, lower wins */
+    uint8_t sp_cross;     /* speed if the crossing goes through */
+    uint8_t sp_blocked;   /* speed if the target slot was occupied at step start */
+    uint8_t dst_lane;
+    uint8_t src_lane0;    /* lane at step start, before a lane change */
+    uint8_t outcome;      /* CrossOutcome, set in C1 */
+} CrossIntent;
+
+typedef struct {
+    CrossIntent* v;
+    int n;
+    int cap;
+} IntentList;
+
+typedef struct {
+    int32_t* v;
+    int n;
+    int cap;
+} IdxList;
+
+typedef struct {
+    int32_t link;
+    int32_t id;
+} ExitRec;
+
+typedef struct {
+    ExitRec* v;
+    int n;
+    int cap;
+} ExitList;
+
+typedef struct {
+    int32_t* links;      /* owned links, ascending */
+    int n_links;
+    int32_t* active;     /* owned links holding vehicles (worklist, unordered) */
+    int n_active;
+    int32_t* inters;     /* owned intersections, ascending */
+    int n_inters;
+    LightSched lights;   /* decision schedule of the owned intersections */
+
+    IntentList intents;  /* this step's crossings, in sweep order (per link downstream first) */
+    IdxList* outbox;     /* [n_tiles], indices into intents by destination tile */
+    ExitList exits;
+    NaschRun run;        /* phase B scratch, sized for the longest single-lane link */
+    bool failed;         /* out of memory in this step's phases */
+} Tile;
+
+struct Engine;
+
+typedef struct {
+    struct Engine* e;
+    int tile;
+} EngineWorker;
+
+typedef struct Engine {
+    Grid* g;
+    VehiclePool* vp;
+    Stats* s;
+    const Config* cfg;
+
+    int n_tiles;
+    int tiles_x, tiles_y;
+    Tile* tiles;
+    int32_t* link_tile;  /* link -> owning tile */
+    uint8_t* link_active;/* link is in its tile's active worklist */
+    int32_t* lane_off;   /* [n_links + 1], first lane of each link in claim */
+    int64_t* claim;      /* per lane, best crossing key this step */
+
+    /* demand.routing_type = shortest_path: next hops from the tables; the
+       link travel times they are re-weighted from are measured per link by
+       the owning tile (vehicle-steps in C2, departures when a move completes) */
+    bool routed;
+    Routing route;
+    int reweight_steps;  /* 0 = static tables */
+    int64_t* occ_steps;  /* [n_links], this interval */
+    int32_t* departures; /* [n_links], this interval */
+    int32_t* served;     /* [n_intersections] crossings, counted by the owning
+                            tile while a time series is open (series.h), else NULL */
+    struct Traj* traj;   /* trajectory recorder (traj.h), or NULL */
+    struct Demand* demand; /* OD demand (demand.h), NULL: arrival_rate on every entry link */
+#ifdef TS_PROFILE
+    struct Prof* prof;   /* phase timers (prof.h) */
+#endif
+
+    RngKey rng;
+    NaschKernel kernel;
+    const char* kernel_name;
+    NaschStep nasch;     /* kernel parameters, step set each step */
+    double* spawn_u;     /* per entry link, filled each step (constant rate) */
+    ExitList exits_merged;
+
+    /* current step, published to workers through the start barrier */
+    double t;
+    int step;
+    bool sample_queues;
+
+    pthread_t* threads;
+    EngineWorker* workers;
+    pthread_barrier_t barrier;
+    pthread_mutex_t start_lock; /* held while the workers are created */
+    bool running;        /* workers started, joined by engine_free */
+    bool quit;
+} Engine;
+
+/* n_threads <= 1 runs the same phases inline without spawning threads */
+int engine_init(Engine* e, Grid* g, VehiclePool* vp, Stats* s, const Config* cfg, int n_threads);
+/* -1 if the step ran out of memory: the state is then no longer the model's */
+int engine_step(Engine* e, double t, int step);
+void engine_free(Engine* e);
+
+#endif
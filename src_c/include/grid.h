@@ -2,23 +2,124 @@
 #ifndef GRID_H
 #define GRID_H
 
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
 #include "config_kv.h"
 
+/* Read-only road network. Built once by topology_init and never written
+   afterwards, so any number of Grid instances (on any threads) can share
+   one Topology; it must outlive all of them. topology_init either builds
+   the grid_size x grid_size Manhattan lattice or maps a binary network
+   file (network.file, see netfile.h); both give the same layout. */
 typedef struct {
-    int grid_size;
+    int grid_size;       /* lattice side; for a network file, the tiling lattice */
     int n_intersections;
     int n_links;
 
     Intersection* intersections;
     Link* links;
 
-    /* boundary entry links list */
-    Link** entry_links;
+    /* sizes of the per-instance cell / occupancy blocks */
+    int64_t n_cells;
+    int64_t n_occ_words;
+
+    /* boundary entry links list (link indices) */
+    int32_t* entry_links;
     int n_entry_links;
 
+    /* CSR: links into intersection n are in_links[in_off[n] .. in_off[n+1]),
+       links out of it out_links[out_off[n] ..), each ordered by (dir, id);
+       the links a vehicle on link l may turn into are turns[turn_off[l] ..
+       turn_off[l+1]), ordered the same way */
+    int32_t* in_off;
+    int32_t* in_links;
+    int32_t* out_off;
+    int32_t* out_links;
+    int32_t* turn_off;
+    int32_t* turns;
+    int n_in_links;
+    int n_out_links;
+    int n_turns;
+
+    /* single allocation backing every array above: malloc'd, or the
+       mapped network file */
+    void* arena;
+    size_t arena_bytes;
+    void* map;           /* network file mapping, NULL if built */
+    size_t map_bytes;
+    char file[256];      /* network.file it was mapped from, "" if built */
+} Topology;
+
+/* Mutable network state of one simulation over a (shared) Topology. */
+typedef struct {
+    const Topology* topo;
+
+    /* copied from topo, so hot paths read one struct */
+    int grid_size;
+    int n_intersections;
+    int n_links;
+    const Intersection* intersections;
+    const Link* links;
+    const int32_t* entry_links;
+    int n_entry_links;
+    const int32_t* in_off;
+    const int32_t* in_links;
+    const int32_t* out_off;
+    const int32_t* out_links;
+    const int32_t* turn_off;
+    const int32_t* turns;
+    int64_t n_cells;
+    int64_t n_occ_words;
+
+    /* all links' cells and occupancy bitsets, contiguous;
+       a Cell is only meaningful where its occupancy bit is set */
+    Cell* cells;
+    uint64_t* occ;
+    int32_t* head_vacated_step;  /* per link: last step in which a lane's position 0 was vacated by a move */
+    uint8_t* head_vacated_lanes; /* per link: bit k, lane k was (in head_vacated_step) */
+    TrafficLight* lights;        /* per intersection */
+
+    /* per link, occupied cells in the last / first k_cells cells (the
+       stopline and head windows read by controllers and queue stats);
+       kept up to date by link_place / link_vacate */
+    int k_cells;
+    int32_t* stop_count;
+    int32_t* head_count;
+    /* per intersection: a window its controller reads has changed since the
+       light was last evaluated. Head windows are read by the upstream
+       intersection of a link, which may belong to another engine tile, so
+       the flags are atomic (relaxed; the step barriers order them) */
+    atomic_uchar* light_dirty;
+
+    /* single allocation backing the mutable arrays */
+    void* arena;
+    size_t arena_bytes;
 } Grid;
 
-int grid_init(Grid* g, const Config* cfg);
+int topology_init(Topology* t, const Config* cfg);
+void topology_free(Topology* t);
+
+/* Builders: set the counts (n_intersections, n_links, n_entry_links,
+   n_in_links, n_out_links, n_turns), topology_alloc, fill intersections,
+   links and entry_links, then topology_index for the node CSR.
+   topology_layout points every array into base (NULL: only sizes it) and
+   returns the arena size; a network file holds exactly that arena. */
+size_t topology_layout(Topology* t, char* base);
+int topology_alloc(Topology* t);
+void topology_index(Topology* t);
+/* turns of every link = all links out of its downstream intersection */
+void topology_all_turns(Topology* t);
+
+/* true if cfg builds the same network as t */
+bool topology_matches(const Topology* t, const Config* cfg);
+
+int grid_init(Grid* g, const Topology* topo, const Config* cfg);
 void grid_free(Grid* g);
+/* a light as cfg sets it up at step 0 */
+void grid_light_init(TrafficLight* tl, const Config* cfg);
+
+/* memory per intersection / link / cell and build summary */
+void topology_report(const Topology* t, double build_ms, FILE* f);
 
 #endif
@@ -0,0 +1,52 @@
+// nasch.h
+#ifndef NASCH_H
+#define NASCH_H
+#include <stdint.h>
+#include "rng.h"
+
+/* Parallel-update Nagel-Schreckenberg kernel for a run of vehicles in one
+   lane that cannot reach the stopline this step (the engine keeps the
+   vehicles near the stopline, which need light and crossing rules, on its
+   per-vehicle path).
+
+   Every vehicle of the run is updated from the start-of-step state only:
+
+     gap   = pos[i + 1] - pos[i] - 1       (pos[n]: the vehicle ahead of the run)
+     v     = min(speed + 1, vmax, gap)     (accelerate, brake)
+     v    -= v > 0 && draw(step, id) < p   (randomize, RNG_SLOWDOWN)
+
+   so vehicles are independent, any vmax is exact, and the result equals the
+   per-vehicle sweep. Moving is then a scatter the engine does (pos + v is
+   free: it lies inside the start-of-step gap).
+
+   nasch_kernel() picks an AVX2 version (8 vehicles per iteration, Philox
+   included) when the CPU has it, else a scalar one with the same results.
+   Building with -DTS_NO_SIMD leaves only the scalar one. */
+
+typedef struct {
+    RngKey key;
+    uint32_t step;
+    double p;              /* vehicles.slowdown_probability */
+    uint64_t slow_below;   /* rng_threshold53(p) */
+} NaschStep;
+
+/* vector kernels read whole groups of NASCH_WIDTH: the arrays need that
+   many entries of padding past n (past n + 1 for pos) */
+#define NASCH_WIDTH 8
+
+typedef struct {
+    int n;
+    int32_t* pos;     /* [n + 1], ascending start-of-step positions, see above */
+    int32_t* id;      /* [n] */
+    int32_t* speed;   /* [n], previous speed in, new speed out */
+    int32_t* vmax;    /* [n] */
+} NaschRun;
+
+typedef void (*NaschKernel)(const NaschStep* st, NaschRun* run);
+
+/* best kernel for this CPU; *name (if given) is "avx2" or "scalar" */
+NaschKernel nasch_kernel(const char** name);
+
+void nasch_scalar(const NaschStep* st, NaschRun* run);
+
+#endif
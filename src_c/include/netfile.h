@@ -0,0 +1,51 @@
+// netfile.h
+#ifndef NETFILE_H
+#define NETFILE_H
+#include "grid.h"
+
+/* Binary network file: a fixed-size header followed by the Topology arena
+   exactly as topology_layout lays it out (native byte order, sections
+   aligned to 64 bytes). Loading is one mmap and pointer setup: nothing is
+   parsed or copied, and pages are only read when first used.
+
+     header   NETFILE_HEADER_BYTES: counts and layout checks
+     arena    intersections | links | entry list | in CSR | out CSR | turn CSR
+
+   topology_save writes one; bin/net_convert builds one from a text edge
+   list (or a lattice). Set network.file to run on it. */
+
+#define NETFILE_MAGIC "TSNET\r\n"
+#define NETFILE_VERSION 2   /* 2: Link.n_lanes */
+#define NETFILE_HEADER_BYTES 256
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;   /* 0x01020304 as written */
+    uint32_t link_bytes;   /* sizeof(Link) */
+    uint32_t inter_bytes;  /* sizeof(Intersection) */
+    int32_t grid_size;
+    int32_t n_intersections;
+    int32_t n_links;
+    int32_t n_entry_links;
+    int32_t n_in_links;
+    int32_t n_out_links;
+    int32_t n_turns;
+    int32_t reserved;
+    int64_t n_cells;
+    int64_t n_occ_words;
+    uint64_t arena_bytes;
+} NetFileHeader;
+
+int topology_save(const Topology* t, const char* path);
+/* maps path read-only into t; -1 (with a message on stderr) if it is not a
+   valid network file for this build */
+int topology_map(Topology* t, const char* path);
+void topology_unmap(Topology* t);
+/* index ranges and CSR offsets of t are consistent, links start and end at
+   the intersections that list them, turns continue from a link's end and
+   no two links share cells or occupancy words; msg receives the first
+   problem */
+bool topology_check(const Topology* t, char* msg, size_t msg_len);
+
+#endif
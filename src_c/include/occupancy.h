@@ -0,0 +1,138 @@
+// occupancy.h
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include "grid.h"
+
+/* Per-link occupancy bitset kept next to the Cell id array (both in the Grid
+   arena, addressed through Link.occ_off / Link.cell_off).
+   Everything here is addressed by slot (position * n_lanes + lane, see
+   Link); on a single-lane link a slot is a cell.
+   Bit s of occ[s/64] is set iff cells[s] holds a vehicle, so range counts are
+   popcounts over masked words, and the step kernel finds each vehicle (and
+   the gap behind the one ahead) with a count-leading-zeros per vehicle.
+   Every write to Cell.vehicle_id goes through link_place/link_vacate, which
+   also maintain the per-link stopline/head window counts (Grid.stop_count,
+   Grid.head_count): a move only changes them when it enters or leaves a
+   window, and reading a queue is O(1). A window change also flags the
+   intersection whose controller reads it (Grid.light_dirty): the stopline
+   window of a link feeds its downstream light, the head window its
+   upstream one (max-pressure). */
+
+#define OCC_WORD_BITS 64
+
+static inline int occ_words_for(int n_cells) {
+    return (n_cells + OCC_WORD_BITS - 1) / OCC_WORD_BITS;
+}
+
+static inline int link_slots(const Link* L) {
+    return L->n_cells * L->n_lanes;
+}
+
+static inline const uint64_t* link_occ(const Grid* g, const Link* L) {
+    return g->occ + L->occ_off;
+}
+
+static inline int link_vehicle(const Grid* g, const Link* L, int c) {
+    return g->cells[L->cell_off + c].vehicle_id;
+}
+
+static inline bool link_occupied(const Grid* g, const Link* L, int c) {
+    return (link_occ(g, L)[c >> 6] >> (c & 63)) & 1u;
+}
+
+static inline void link_mark_light(Grid* g, int32_t inter) {
+    if (inter != INVALID_ID) atomic_store_explicit(&g->light_dirty[inter], 1, memory_order_relaxed);
+}
+
+static inline void link_window_add(Grid* g, const Link* L, int c, int d) {
+    if (c >= (L->n_cells - g->k_cells) * L->n_lanes) {
+        g->stop_count[L->id] += d;
+        link_mark_light(g, L->to);
+    }
+    if (c < g->k_cells * L->n_lanes) {
+        g->head_count[L->id] += d;
+        link_mark_light(g, L->from);
+    }
+}
+
+static inline void link_place(Grid* g, const Link* L, int c, int vehicle_id) {
+    g->cells[L->cell_off + c].vehicle_id = vehicle_id;
+    g->occ[L->occ_off + (c >> 6)] |= (uint64_t)1 << (c & 63);
+    link_window_add(g, L, c, +1);
+}
+
+static inline void link_vacate(Grid* g, const Link* L, int c) {
+    g->cells[L->cell_off + c].vehicle_id = INVALID_ID;
+    g->occ[L->occ_off + (c >> 6)] &= ~((uint64_t)1 << (c & 63));
+    link_window_add(g, L, c, -1);
+}
+
+/* lane change at one position: the windows do not change */
+static inline void link_shift_lane(Grid* g, const Link* L, int from, int to) {
+    g->cells[L->cell_off + to].vehicle_id = g->cells[L->cell_off + from].vehicle_id;
+    g->cells[L->cell_off + from].vehicle_id = INVALID_ID;
+    g->occ[L->occ_off + (from >> 6)] &= ~((uint64_t)1 << (from & 63));
+    g->occ[L->occ_off + (to >> 6)] |= (uint64_t)1 << (to & 63);
+}
+
+/* occupied slots in the last / first k_cells positions of the link, all lanes */
+static inline int link_stop_count(const Grid* g, const Link* L) {
+    return g->stop_count[L->id];
+}
+
+static inline int link_head_count(const Grid* g, const Link* L) {
+    return g->head_count[L->id];
+}
+
+/* stopline queue per lane (rounded up): what a lane detector sees */
+static inline int link_lane_queue(const Grid* g, const Link* L) {
+    return (g->stop_count[L->id] + L->n_lanes - 1) / L->n_lanes;
+}
+
+/* mask of bits [lo, hi) within one word, 0 <= lo <= hi <= 64 */
+static inline uint64_t occ_mask(int lo, int hi) {
+    uint64_t up = (hi >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << hi) - 1);
+    return up & ~(((uint64_t)1 << lo) - 1);
+}
+
+/* number of occupied slots in [lo, hi) */
+static inline int link_count_range(const Grid* g, const Link* L, int lo, int hi) {
+    if (lo < 0) lo = 0;
+    if (hi > link_slots(L)) hi = link_slots(L);
+    if (lo >= hi) return 0;
+
+    const uint64_t* occ = link_occ(g, L);
+    int w0 = lo >> 6, w1 = (hi - 1) >> 6;
+    if (w0 == w1) return __builtin_popcountll(occ[w0] & occ_mask(lo & 63, ((hi - 1) & 63) + 1));
+
+    int n = __builtin_popcountll(occ[w0] & occ_mask(lo & 63, 64));
+    for (int w=w0+1; w<w1; w++) n += __builtin_popcountll(occ[w]);
+    n += __builtin_popcountll(occ[w1] & occ_mask(0, ((hi - 1) & 63) + 1));
+    return n;
+}
+
+/* last occupied slot < c, or -1 if none */
+static inline int link_prev_occupied(const Grid* g, const Link* L, int c) {
+    if (c <= 0) return -1;
+    const uint64_t* occ = link_occ(g, L);
+    c--;
+    int w = c >> 6;
+    uint64_t bits = occ[w] & occ_mask(0, (c & 63) + 1);
+    while (!bits) {
+        if (--w < 0) return -1;
+        bits = occ[w];
+    }
+    return (w << 6) + 63 - __builtin_clzll(bits);
+}
+
+/* bit k: lane k is occupied at position c */
+static inline unsigned link_lanes_at(const Grid* g, const Link* L, int c) {
+    const uint64_t* occ = link_occ(g, L);
+    int s = c * L->n_lanes;
+    uint64_t w = occ[s >> 6] >> (s & 63);
+    if ((s & 63) + L->n_lanes > 64) w |= occ[(s >> 6) + 1] << (64 - (s & 63));
+    return (unsigned)(w & (((uint64_t)1 << L->n_lanes) - 1));
+}
+
+#endif
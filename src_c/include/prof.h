@@ -0,0 +1,152 @@
+// prof.h
+#ifndef PROF_H
+#define PROF_H
+
+/* Hot-path instrumentation, compiled in only with -DTS_PROFILE
+   (make PROFILE=1; PROFILE=2 adds hardware counters). Without it every
+   PROF_* macro expands to nothing and no field, call or branch is left in
+   the engine.
+
+   Each engine tile keeps a timestamp, the end of its last phase. PROF_END
+   charges the time since then to a phase and moves the mark, so
+   consecutive phases cost one timer read each. The timer is the TSC where
+   there is one (rdtsc, about 20 cycles), else CLOCK_MONOTONIC. Tile 0 is
+   the stepping thread, which also runs the serial parts of a step.
+
+     routing   re-weighting the routing tables (when due)
+     spawn     spawning on entry links
+     lights    phase A, light decisions
+     sweep     phase B: lane changes, planning (NaSch) and moves within links
+     cross     phase C1, accepting crossings
+     finish    phase C2, finishing own crossings and exits, retiring links
+     stats     queue sampling (C2) and releasing exited vehicles
+     traj      trajectory exits, new vehicles and block hand-off, when open
+               (records of moves are written in sweep, cross and finish)
+     series    time-series sampling, when open
+     wait      barriers: a tile waiting for the others
+
+   Every tile accumulates time, calls and the largest single call per
+   phase. For the last TS_PROFILE_TRACE_STEPS steps it also keeps each call
+   as a trace event. prof_write_trace writes those events as Chrome
+   trace-event JSON (chrome://tracing, Perfetto), one row per tile.
+
+   With TS_PROFILE_COUNTERS, each thread opens CPU cycles, cache misses
+   and branch misses through perf_event_open as one group and reads it at
+   every phase end. That read is a system call (about a microsecond), so
+   use counters for attribution, not for timing. Where perf events are not
+   allowed (perf_event_paranoid, containers) the counters stay off and only
+   the timers run. */
+
+#ifdef TS_PROFILE
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef TS_PROFILE_TRACE_STEPS
+#define TS_PROFILE_TRACE_STEPS 1000
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+static inline uint64_t prof_now(void) { return __rdtsc(); }
+#else
+#include <time.h>
+static inline uint64_t prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+typedef enum {
+    PROF_ROUTING, PROF_SPAWN, PROF_LIGHTS, PROF_SWEEP, PROF_CROSS, PROF_FINISH,
+    PROF_STATS, PROF_TRAJ, PROF_SERIES, PROF_WAIT, PROF_N
+} ProfPhase;
+
+/* most events a tile ends per step: tile 0 runs every phase once in
+   engine_step and run_tile_phases, stats and traj a second time after the
+   step-end barrier, series in ts_step, and waits on 4 barriers (15); the
+   other tiles end 6 phases and 5 waits */
+#define PROF_STEP_EVENTS ((PROF_N - 1) + 2 + 4)
+
+enum { PROF_HW_CYCLES, PROF_HW_CACHE_MISSES, PROF_HW_BRANCH_MISSES, PROF_HW_N };
+
+typedef struct {
+    uint64_t ticks, max_ticks;
+    uint64_t calls;
+    uint64_t hw[PROF_HW_N];
+} ProfAcc;
+
+typedef struct {
+    uint64_t t0, t1;          /* ticks */
+    int32_t step;
+    int32_t phase;
+    uint64_t hw[PROF_HW_N];   /* counter deltas, 0 without counters */
+} ProfEvent;
+
+typedef struct {
+    uint64_t mark;            /* end of the last phase */
+    ProfAcc acc[PROF_N];
+    ProfEvent* ring;          /* trace events, ring of ring_cap */
+    uint64_t n_events;        /* ever recorded; ring holds the last ring_cap */
+    uint32_t ring_cap;
+    int hw_fd;                /* counter group leader, -1 off, -2 not opened yet */
+    int hw_fds[PROF_HW_N];
+    uint64_t hw_mark[PROF_HW_N];
+    char pad[64];             /* tiles are written by different threads */
+} ProfTile;
+
+typedef struct Prof {
+    int n_tiles;
+    ProfTile* tiles;
+    int last_step;
+    /* tick rate, from the ticks and CLOCK_MONOTONIC time since prof_init */
+    uint64_t tick0;
+    double mono0;
+} Prof;
+
+int prof_init(Prof* p, int n_tiles);
+void prof_free(Prof* p);
+/* counter deltas since the tile's last read (opens its counters on first use) */
+void prof_read_hw(ProfTile* pt, uint64_t* delta);
+
+static inline void prof_begin(Prof* p, int w) {
+    p->tiles[w].mark = prof_now();
+}
+
+static inline void prof_end(Prof* p, int w, ProfPhase ph, int step) {
+    ProfTile* pt = &p->tiles[w];
+    uint64_t now = prof_now(), d = now - pt->mark;
+    ProfAcc* a = &pt->acc[ph];
+    a->ticks += d;
+    a->calls++;
+    if (d > a->max_ticks) a->max_ticks = d;
+    ProfEvent* ev = &pt->ring[pt->n_events++ % pt->ring_cap];
+    ev->t0 = pt->mark;
+    ev->t1 = now;
+    ev->step = step;
+    ev->phase = ph;
+#ifdef TS_PROFILE_COUNTERS
+    prof_read_hw(pt, ev->hw);
+    for (int k=0; k<PROF_HW_N; k++) a->hw[k] += ev->hw[k];
+    now = prof_now();    /* leave the read out of the next phase */
+#endif
+    pt->mark = now;
+    if (w == 0) p->last_step = step;
+}
+
+/* Chrome trace-event JSON of the last TS_PROFILE_TRACE_STEPS steps */
+int prof_write_trace(const Prof* p, const char* path);
+/* per-phase table over the whole run */
+void prof_report(const Prof* p, FILE* f);
+
+#define PROF_BEGIN(e, w) prof_begin((e)->prof, (w))
+#define PROF_END(e, w, ph) prof_end((e)->prof, (w), (ph), (e)->step)
+
+#else
+
+#define PROF_BEGIN(e, w) ((void)0)
+#define PROF_END(e, w, ph) ((void)0)
+
+#endif
+#endif
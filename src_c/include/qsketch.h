@@ -0,0 +1,48 @@
+// qsketch.h
+#ifndef QSKETCH_H
+#define QSKETCH_H
+
+#include <stdint.h>
+
+/* Streaming quantile sketch: HDR-style log histogram of values >= 0
+   (travel times in seconds).
+
+   Values are counted in integer milliseconds. Below 2^QS_SUB_BITS ms each
+   ms has its own bucket. Above that, every power-of-two range is split
+   into 2^QS_SUB_BITS buckets, so a bucket is at most 1/2^QS_SUB_BITS
+   (0.2%) of its value wide. Each bucket keeps a count and the exact sum
+   of its values in ms, so a quantile reports its bucket's mean. That is
+   exact whenever the bucket holds a single distinct value, which is the
+   usual case for dt multiples.
+
+   Memory is fixed, insert is O(1), and all fields are integers, so
+   merging is exact and independent of merge order. Values of
+   2^QS_MAX_BITS ms (about 37 h) and above share the top bucket; max
+   still records them exactly. */
+
+#define QS_SUB_BITS 9
+#define QS_MAX_BITS 27
+#define QS_N_BUCKETS ((QS_MAX_BITS + 1 - QS_SUB_BITS) << QS_SUB_BITS)
+
+typedef struct {
+    uint64_t n;
+    uint64_t total_ms;
+    uint64_t min_ms;
+    uint64_t max_ms;
+    uint64_t counts[QS_N_BUCKETS];
+    uint64_t sums_ms[QS_N_BUCKETS];
+} QSketch;
+
+void qs_init(QSketch* q);
+void qs_add(QSketch* q, double v);
+void qs_merge(QSketch* dst, const QSketch* src);
+
+/* 0 for an empty sketch */
+double qs_mean(const QSketch* q);
+/* value of rank floor(p * (n-1)) in sorted order, p in [0,1] */
+double qs_quantile(const QSketch* q, double p);
+
+/* smallest ms value that falls in bucket b */
+uint64_t qs_bucket_lower_ms(int b);
+
+#endif
@@ -0,0 +1,102 @@
+// ref_engine.h
+#ifndef REF_ENGINE_H
+#define REF_ENGINE_H
+
+#include "demand.h"
+#include "grid.h"
+#include "routing.h"
+#include "rng.h"
+
+/* Reference engine: the model of engine.h written the plain way, to check
+   the optimized engine against (ref_check.c).
+
+   One thread visits every link of the network every step. A link is an
+   array of slots holding vehicle ids, and a vehicle is a record. There
+   are no occupancy bitsets, window counters, worklists, tiles, batch
+   kernel or light schedule. Every light is decided every step from queues
+   counted cell by cell, and every vehicle goes through the per-vehicle
+   rules.
+
+   The rules, random draws and vehicle id reuse are the ones engine.c
+   documents (keyed draws, LIFO ids, exits released in (link, id) order),
+   so for one configuration both engines are in the same state after every
+   step: every vehicle in the same slot with the same speed, every light
+   in the same phase. Any difference is a bug in one of them. The cost is
+   O(cells + intersections) per step, so keep the networks small.
+
+   Shortest-path routing uses the same tables (routing.h), fed with link
+   occupancy and departures the reference counts itself. With an OD file
+   every origin's next arrival is checked every step, without the timing
+   wheel, using the draws of demand.h. */
+
+typedef struct {
+    bool live;
+    int32_t link;
+    int32_t slot;        /* position * n_lanes + lane, see Link */
+    int speed;
+    int vmax;
+    int dest;            /* side, or a routing destination */
+    double entry_time;
+} RefVehicle;
+
+typedef struct {
+    int32_t id;
+    int32_t src_link, src_slot;
+    int32_t dst_link, dst_lane;
+    int64_t key;         /* lowest wins the target lane */
+    int sp_cross, sp_blocked;
+    int outcome;         /* CrossOutcome */
+} RefCross;
+
+typedef struct {
+    int32_t link, id;
+} RefExit;
+
+typedef struct {
+    Config cfg;
+    Grid g;              /* topology view (for routing); its cells are unused */
+    int32_t* cells;      /* [n_cells], vehicle id or INVALID_ID, at Link.cell_off */
+    int32_t* vacated_step;   /* per link: last step a vehicle moved off position 0 */
+    uint8_t* vacated_lanes;  /* per link: lanes it did so from in that step */
+    TrafficLight* lights;
+
+    RefVehicle* veh;
+    int veh_cap;
+    int next_id;         /* never handed out yet */
+    int32_t* free_ids;   /* released, handed out again last in first out */
+    int n_free;
+    int n_vehicles;
+
+    RefCross* cross;
+    int n_cross, cap_cross;
+    RefExit* exits;
+    int n_exits, cap_exits;
+
+    bool routed;
+    Routing route;
+    int reweight_steps;
+    int64_t* occ_steps;
+    int32_t* departures;
+
+    bool od;
+    Demand demand;       /* tables only */
+    int od_period;       /* -1 before the first step */
+    int32_t* od_next;    /* per origin, next arrival step */
+
+    RngKey rng;
+    double t;
+    int step;
+    long spawned, exited, blocked_entries;
+} RefSim;
+
+/* cfg is copied; the lattice or network file is built from it, or topo
+   is used when given */
+int ref_init(RefSim* r, const Config* cfg, const Topology* topo);
+void ref_free(RefSim* r);
+void ref_step(RefSim* r);
+
+static inline int ref_vehicle_at(const RefSim* r, const Link* L, int slot) {
+    return r->cells[L->cell_off + slot];
+}
+
+#endif
@@ -2,6 +2,41 @@
 #ifndef RNG_H
 #define RNG_H
 #include <stdint.h>
-void rng_seed(uint64_t seed);
-double rng_uniform01(void);
+
+/* Counter-based generator (Philox4x32-10).
+   Every draw is a pure function of (seed, step, entity, purpose, index), so
+   results do not depend on the order in which loops or threads visit
+   vehicles and links. */
+
+typedef struct {
+    uint32_t k0, k1;
+} RngKey;
+
+/* Philox4x32 multipliers and key schedule (also used by the vector kernel in nasch.c) */
+#define RNG_PHILOX_M0 0xD2511F53u
+#define RNG_PHILOX_M1 0xCD9E8D57u
+#define RNG_PHILOX_W0 0x9E3779B9u
+#define RNG_PHILOX_W1 0xBB67AE85u
+
+typedef enum {
+    RNG_SPAWN = 0,     /* entity: entry link id */
+    RNG_SLOWDOWN = 1,  /* entity: vehicle id */
+    RNG_ROUTE = 2,     /* entity: vehicle id, index: draw number */
+    RNG_LANE = 3,      /* entity: vehicle id */
+    RNG_DEMAND = 4     /* entity: entry link id, index: see demand.h */
+} RngPurpose;
+
+RngKey rng_key(uint64_t seed);
+void rng_philox4x32(const uint32_t ctr[4], RngKey key, uint32_t out[4]);
+
+/* one uniform in [0,1) */
+double rng_cb_uniform01(RngKey key, uint32_t step, uint32_t entity, uint32_t purpose, uint32_t index);
+
+/* rng_cb_uniform01(...) < p  <=>  the draw's 53-bit integer is below
+   rng_threshold53(p); lets integer code test a probability exactly */
+uint64_t rng_threshold53(double p);
+
+/* batched: out[i] = rng_cb_uniform01(key, step, entities[i], purpose, 0) */
+void rng_cb_fill_uniform01(RngKey key, uint32_t step, uint32_t purpose,
+                           const int32_t* entities, int n, double* out);
 #endif
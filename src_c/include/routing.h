@@ -0,0 +1,74 @@
+// routing.h
+#ifndef ROUTING_H
+#define ROUTING_H
+#include "grid.h"
+
+/* Next-hop routing tables (demand.routing_type = shortest_path).
+
+   Destinations are the four network sides (index = Direction: leave the
+   network heading for that side) followed by the nodes listed in
+   demand.routing_destinations. For every destination k and link l the
+   table holds one byte: the index of the best next link in l's turn list
+   (Grid.turns[turn_off[l] + hop]), ROUTE_ARRIVE if the vehicle reaches k
+   at the end of l, or ROUTE_NONE if k cannot be reached from l. A
+   crossing decision is one load.
+
+   Trees are shortest paths over the turn graph with link travel times as
+   costs, one reverse Dijkstra per destination, destinations spread over
+   threads. Costs start at free flow (n_cells / vmax steps); with an
+   update interval the engine feeds measured link travel times back
+   (routing_reweight) and only the destinations whose tree a changed cost
+   can alter are recomputed. */
+
+#define ROUTE_SIDES 4
+#define ROUTE_ARRIVE 0xFF
+#define ROUTE_NONE 0xFE
+#define ROUTE_MAX_TURNS 0xFE   /* turn lists must stay below the sentinels */
+
+typedef struct {
+    int n_dest;
+    int32_t* dest_node;   /* [n_dest], INVALID_ID for the sides */
+    int n_links;
+    uint8_t* hop;         /* [n_dest][n_links] */
+    float* dist;          /* [n_dest][n_links], cost from entering l to arrival (s) */
+    float* weight;        /* [n_links], current link cost (s) */
+    float* free_flow;     /* [n_links] */
+
+    /* turn graph reversed: links p that may turn into l, and where in p's list */
+    int32_t* rev_off;     /* [n_links + 1] */
+    int32_t* rev_link;
+    uint8_t* rev_turn;
+
+    int n_threads;
+    float threshold;      /* relative cost change that counts as changed */
+
+    /* reported by routing_report */
+    long n_updates;
+    long n_links_changed;
+    long n_trees;         /* destination trees computed, initial ones included */
+    double compute_ms;
+} Routing;
+
+/* builds the tables at free-flow costs; -1 on allocation failure, a bad
+   destination list or a node with too many turns */
+int routing_init(Routing* r, const Grid* g, const Config* cfg, int n_threads);
+void routing_free(Routing* r);
+
+static inline uint8_t routing_hop(const Routing* r, int dest, int32_t link) {
+    return r->hop[(size_t)dest * (size_t)r->n_links + (size_t)link];
+}
+
+/* new link costs from one measurement interval: occ_steps[l] vehicle-steps
+   spent on l and departures[l] vehicles that left l (Little's law); links
+   nobody left cost at least the interval. Recomputes the affected trees. */
+void routing_reweight(Routing* r, const Grid* g, const int64_t* occ_steps, const int32_t* departures,
+                      double dt, double interval_s);
+
+/* saved costs and tables (a checkpoint): taken as they are when the
+   destinations match, else the trees are rebuilt from the costs */
+int routing_restore(Routing* r, const Grid* g, int n_dest, const int32_t* dest_node,
+                    const float* weight, const uint8_t* hop, const float* dist);
+
+void routing_report(const Routing* r, FILE* f);
+
+#endif
@@ -0,0 +1,129 @@
+// series.h
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "engine.h"
+
+/* Time-series export: every output.export_interval s of simulated time the
+   stepping thread takes one frame of the network state, and a background
+   thread writes the frames to a columnar binary file.
+
+   A frame is fixed-width (SeriesFrame, then per intersection queue,
+   occupancy, served and phase) and is built in place in a slot of a
+   single-producer single-consumer ring: the stepping thread fills the
+   slot at `head` and publishes it with one release store, the writer
+   consumes up to `head` and frees slots with a release store of `tail`.
+   Neither side takes a lock; the writer sleeps on a semaphore the producer
+   posts once per quarter ring (a wake-up per frame would cost a syscall
+   per frame), and the producer only waits (counted in stalls) when the
+   writer is a whole ring behind.
+
+   Sampling reads only the active links (queue and occupancy are zero on
+   the others), so its cost follows the vehicles, not the network size.
+
+   File (native byte order):
+
+     SeriesHeader
+     SeriesColumn[n_columns]
+     blocks, until the end of the file:
+       uint32 n_frames, uint32 reserved
+       per column in table order: n_frames x count values of elem_bytes,
+       frame-major (count = n_intersections for per-intersection columns,
+       else 1)
+
+   A block holds frames_per_block frames (the last one fewer), so a column
+   of a block is one contiguous array; series_csv converts a file to CSV. */
+
+#define SERIES_MAGIC "TSSERIES"
+#define SERIES_VERSION 1
+
+typedef enum { SERIES_FLOAT=0, SERIES_INT=1, SERIES_UINT=2 } SeriesKind;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_columns;
+    int32_t n_intersections;
+    int32_t frames_per_block;
+    double interval_s;       /* simulated time between frames */
+    double time_step;
+    int64_t n_frames;        /* -1 until the file is closed */
+} SeriesHeader;
+
+typedef struct {
+    char name[24];
+    uint32_t elem_bytes;
+    uint32_t kind;           /* SeriesKind */
+    uint32_t per_intersection;
+    uint32_t reserved;
+} SeriesColumn;
+
+/* network part of a frame; counts are over the interval ending at t */
+typedef struct {
+    double t;
+    int32_t step;
+    int32_t n_vehicles;      /* live at t */
+    int32_t spawned;
+    int32_t exited;
+    int32_t blocked_entries;
+    int32_t reserved;
+} SeriesFrame;
+
+/* per intersection, after the SeriesFrame (values saturate):
+     uint16 queue[n]       vehicles in the stopline windows of its approaches
+     uint16 occupancy[n]   vehicles on its approaches
+     uint16 served[n]      vehicles that crossed it during the interval
+     uint8  phase[n]       Phase of its light at t */
+
+#define SERIES_COLUMNS 10
+
+typedef struct {
+    FILE* f;
+    int n_inters;
+    int every;               /* steps between frames */
+    size_t frame_bytes;
+    SeriesColumn cols[SERIES_COLUMNS];
+    size_t col_src[SERIES_COLUMNS];  /* offset in a frame */
+    size_t col_dst[SERIES_COLUMNS];  /* offset in a block */
+
+    /* ring */
+    char* ring;
+    int n_slots;
+    int wake_every;          /* frames per writer wake-up */
+    _Atomic uint64_t head;   /* frames published */
+    _Atomic uint64_t tail;   /* frames consumed */
+    sem_t ready;
+    atomic_bool closing;
+    pthread_t writer;
+
+    /* producer */
+    int32_t* served;         /* [n_inters], counted by the engine (Engine.served) */
+    long last_spawned, last_blocked;
+    int last_vehicles;
+    long frames;
+    long stalls;
+    double sample_s;         /* time spent sampling */
+
+    /* writer */
+    char* block;             /* frames_per_block frames, column-major */
+    int block_frames;
+    int in_block;
+    int64_t written;
+    bool io_error;
+} Series;
+
+/* creates path and starts the writer, one frame every output.export_interval
+   of e's config from the current state on; e->served is left to the caller */
+int series_open(Series* sr, const char* path, const Engine* e);
+/* takes a frame if step (steps run so far) is a multiple of the interval */
+void series_step(Series* sr, const Engine* e, double t, int step);
+/* writes the remaining frames, stops the writer, closes the file;
+   -1 if any write failed */
+int series_close(Series* sr);
+void series_report(const Series* sr, double loop_s, FILE* f);
+
+#endif
@@ -1,14 +1,19 @@
 // sim.h
 #ifndef SIM_H
 #define SIM_H
-#include "stats.h"
+#include "trafficsim.h"
 
-typedef struct {
-    Vehicle* vehicles;
-    int cap;
-    int n_used;
-} VehiclePool;
-
-int sim_run(const Config* cfg, const char* out_dir);
+/* runs one simulation and writes metrics.csv + queue_heatmap.csv to out_dir
+   (and timeseries.bin with output.save_queue_snapshots, see series.h,
+   trajectories.bin with output.save_vehicle_trajectories, see traj.h);
+   from (optional) is the checkpoint it starts from, save_path (optional)
+   receives a checkpoint of the final state */
+int sim_run(const Config* cfg, const char* out_dir, const TsCheckpoint* from, const char* save_path);
+/* same run without progress output or files; safe to call from several
+   threads. topo may be shared between calls, NULL builds a private one;
+   from as for sim_run; tt (optional) receives the run's travel-time sketch */
+int sim_run_metrics(const Config* cfg, const Topology* topo, const TsCheckpoint* from, SimMetrics* m, QSketch* tt);
+/* runs cfg up to simulation.warmup and returns that state (NULL on failure) */
+TsCheckpoint* sim_warm_up(const Config* cfg, const Topology* topo);
 
 #endif
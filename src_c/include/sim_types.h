@@ -5,15 +5,14 @@
 #include <stdbool.h>
 
 #define INVALID_ID (-1)
+#define MAX_LANES 8
 
 typedef enum { DIR_N=0, DIR_E=1, DIR_S=2, DIR_W=3 } Direction;
 typedef enum { PHASE_NS=0, PHASE_EW=1 } Phase;
 typedef enum { CTRL_FIXED=0, CTRL_ACTUATED=1, CTRL_MAX_PRESSURE=2 } ControllerType;
+typedef enum { ROUTING_MANHATTAN=0, ROUTING_SHORTEST_PATH=1 } RoutingType;
 typedef enum { MOVE_STAY=0, MOVE_WITHIN_LINK=1, MOVE_CROSS=2, MOVE_EXIT=3 } MoveType;
 
-struct Link;
-struct Intersection;
-
 typedef struct {
     int vehicle_id; /* -1 if empty */
 } Cell;
@@ -21,7 +20,9 @@ typedef struct {
 typedef struct {
     ControllerType type;
     Phase phase;
-    double phase_elapsed;
+    int32_t phase_start;  /* step in which the current phase began */
+    int32_t next_eval;    /* step of the next scheduled decision, see controllers.h */
+    bool armed;           /* past min_green: re-evaluated whenever its detectors change */
 
     /* fixed */
     double cycle_time;
@@ -35,41 +36,34 @@ typedef struct {
     int queue_threshold;
 } TrafficLight;
 
-typedef struct {
-    int id;
-    int speed;
-    int vmax;
-
-    struct Link *link;
-    int cell_idx;
-
-    Direction destination_exit;
-    double entry_time;
-    double stopped_time;
-    bool finished;
-
-    MoveType planned_move;
-    struct Link *planned_next_link;
-    int planned_target_cell;
-} Vehicle;
-
+/* Topology is index-based: links and intersections live in flat arrays of
+   the Topology arena and refer to each other by int32 index (INVALID_ID =
+   none). Both are read-only once built; everything that changes during a
+   run (cells, occupancy, lights) lives in the per-instance Grid.
+   Cells and occupancy words of all links are contiguous blocks there;
+   a link owns cells[cell_off .. cell_off+n_cells*n_lanes) and occ[occ_off ..).
+   Lanes are interleaved: position c of lane k is slot c*n_lanes + k, so
+   the lanes at one position sit side by side and a single-lane link's
+   slots are its cells.
+   Which links meet at an intersection, and which turns a link allows, are
+   CSR arrays of the Topology (see grid.h), so a node may have any degree. */
 typedef struct Link {
-    int id;
-    struct Intersection *from; /* NULL => boundary entry */
-    struct Intersection *to;   /* NULL => boundary exit  */
-    Direction dir;
-
-    int n_cells;
-    Cell *cells;
-    int stopline_cell;
+    int32_t id;
+    int32_t from;      /* INVALID_ID => network entry */
+    int32_t to;        /* INVALID_ID => network exit  */
+    int32_t n_cells;   /* positions per lane */
+    int32_t stopline_cell;
+    int32_t cell_off;  /* first cell in Grid.cells */
+    int32_t occ_off;   /* first occupancy word in Grid.occ, see occupancy.h */
+    uint8_t dir;       /* Direction of travel (compass heading) */
+    uint8_t group;     /* signal group at `to`: green while the light's Phase == group */
+    uint8_t n_lanes;   /* 1..MAX_LANES */
 } Link;
 
 typedef struct Intersection {
-    int id;
-    int i, j;
-    TrafficLight tl;
-    Link *in[4];
-    Link *out[4];
+    int32_t id;
+    int32_t i, j;      /* cell of the grid_size x grid_size lattice (tiling, heatmap) */
+    uint8_t exit_mask; /* bit d: a vehicle heading for side d may leave the network here */
 } Intersection;
 
 #endif
@@ -3,25 +3,28 @@
 #define STATS_H
 
 #include "grid.h"
+#include "qsketch.h"
 
 typedef struct {
     long spawned;
     long exited;
     long blocked_entries;
 
-    /* travel times storage (for p95) */
-    double* travel_times;
-    int tt_cap;
-    int tt_n;
+    /* travel times of vehicles exiting after warmup */
+    QSketch tt;
 
     /* queues per intersection */
     double* queue_sum;
     double* queue_max;
+    long* queue_stamp;   /* queue_samples at the intersection's last sample */
     long queue_samples;
 
     /* computed */
     double mean_travel_time_s;
+    double p50_travel_time_s;
+    double p90_travel_time_s;
     double p95_travel_time_s;
+    double p99_travel_time_s;
     double throughput_veh_per_s;
     double avg_queue_veh;
     double max_queue_veh;
@@ -31,7 +34,13 @@ int stats_init(Stats* s, int n_intersections);
 void stats_free(Stats* s);
 void stats_on_exit(Stats* s, double travel_time);
 void stats_collect_queues(Stats* s, const Grid* g);
+/* accumulate, without counting a sample, the queue of every intersection
+   with a vehicle in the stopline window of one of links[0..n). Empty
+   windows add nothing, so passing the non-empty links samples them all */
+void stats_sample_link_queues(Stats* s, const Grid* g, const int32_t* links, int n);
 void stats_finalize(Stats* s, double measured_time_s);
+/* network average of per-intersection mean queues, and the largest queue seen */
+void stats_network_queues(const Stats* s, int n_intersections, double* avg, double* max);
 int stats_export_csv(const Stats* s, const Grid* g, const char* out_dir);
 
 #endif
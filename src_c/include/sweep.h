@@ -0,0 +1,57 @@
+// sweep.h
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "trafficsim.h"
+
+/* In-process parameter sweep.
+
+   A sweep is a base Config plus axes, each a config key and a list of
+   values, e.g.
+
+     demand.arrival_rate=0.05,0.1,0.15;traffic_lights.controller=fixed,actuated;simulation.random_seed=0:5
+
+   (a:b is the integer range a..b-1). Points are the cartesian product of
+   the axes, first axis outermost. They run on a pool of worker threads,
+   one single-threaded simulation per point (with a single worker, runs
+   keep simulation.threads); points that do not change the network share
+   one read-only topology. All metrics go to one CSV with a column per
+   axis, the metrics.csv columns and a status column (ok, or failed with
+   empty metrics). Rows are in point order whatever the number of
+   workers. All points can start from
+   one checkpoint instead of an empty network, so a shared warmup is
+   simulated once rather than once per point.
+
+   Optionally one axis (typically simulation.random_seed) is pooled: the
+   travel-time sketches of all points that differ only in that axis are
+   merged as runs finish, and a second CSV gets one row per group with
+   quantiles of the pooled travel times. No raw samples are kept. */
+
+#define SWEEP_MAX_AXES 8
+
+typedef struct {
+    char key[64];
+    char** values;
+    int n_values;
+} SweepAxis;
+
+typedef struct {
+    SweepAxis axes[SWEEP_MAX_AXES];
+    int n_axes;
+    long n_points;
+    int pool_axis;      /* -1: no pooled output */
+} SweepSpec;
+
+/* returns -1 (with a message on stderr) on syntax errors and unknown keys */
+int sweep_parse(SweepSpec* sp, const char* spec);
+void sweep_free(SweepSpec* sp);
+/* pool replicates over axis `key`; -1 if it is not one of the axes */
+int sweep_set_pool_axis(SweepSpec* sp, const char* key);
+
+/* jobs <= 0 uses one worker per online CPU; pooled_path is only written
+   when a pool axis is set; every point starts from `from` when given (a
+   checkpoint, see trafficsim.h), else from an empty network */
+int sweep_run(const Config* base, const SweepSpec* sp, int jobs,
+              const char* out_path, const char* pooled_path, const TsCheckpoint* from);
+
+#endif
@@ -0,0 +1,160 @@
+// trafficsim.h
+#ifndef TRAFFICSIM_H
+#define TRAFFICSIM_H
+
+#include "grid.h"
+#include "qsketch.h"
+
+/* libtrafficsim: re-entrant simulation API.
+
+   A TsSim holds all state of one simulation (network state, lights,
+   vehicles, stats, engine); there is no process-global state, so any
+   number of instances can live in one process and run on different
+   threads. The road network is a read-only Topology: pass one to
+   ts_create to share it between instances (it must outlive them), or NULL
+   to give the instance a private copy.
+
+     Topology topo;  topology_init(&topo, &cfg);
+     TsSim* a = ts_create(&cfg_a, &topo);
+     TsSim* b = ts_create(&cfg_b, &topo);
+     ts_step(a, 100); ts_step(b, 100);
+     ts_destroy(a); ts_destroy(b); topology_free(&topo);
+
+   Instances sharing a topology must have the same network.file, or for
+   the lattice matching network.grid_size and network.link_length_cells
+   (see topology_matches). */
+
+typedef struct TsSim TsSim;
+
+/* one row of metrics.csv */
+typedef struct {
+    double mean_travel_time_s;
+    double p95_travel_time_s;
+    double throughput_veh_per_s;
+    double avg_queue_veh;
+    double max_queue_veh;
+    long spawned;
+    long exited;
+    long blocked_entries;
+    double p50_travel_time_s;
+    double p90_travel_time_s;
+    double p99_travel_time_s;
+} SimMetrics;
+
+typedef struct {
+    double t;           /* simulated time of the next step */
+    int step;           /* steps run so far */
+    bool done;          /* t >= duration */
+    int n_vehicles;     /* live */
+    long spawned;
+    long exited;
+    long blocked_entries;
+} TsStatus;
+
+/* Zero-copy views of the current state. Pointers stay valid until the
+   next ts_step / ts_destroy on the same instance; per-vehicle arrays are
+   indexed by vehicle id and have vehicle_cap entries, only ids listed in
+   active are live. */
+typedef struct {
+    double t;
+    int step;
+
+    int n_vehicles;
+    int vehicle_cap;
+    const int* active;
+    const int32_t* vehicle_link;
+    const int32_t* vehicle_cell;
+    const uint8_t* vehicle_speed;
+
+    int n_intersections;
+    const Intersection* intersections;
+    const TrafficLight* lights;
+
+    int n_links;
+    const Link* links;
+    int64_t n_cells;
+    const Cell* cells;          /* valid only where the occupancy bit is set */
+    int64_t n_occ_words;
+    const uint64_t* occ;
+    int k_cells;
+    const int32_t* stop_count;  /* [n_links], occupied cells in the last k_cells */
+    const int32_t* head_count;  /* [n_links], occupied cells in the first k_cells */
+
+    /* stats accumulators (fixed for the lifetime of the instance) */
+    const double* queue_sum;    /* [n_intersections], sum over queue samples */
+    const double* queue_max;    /* [n_intersections] */
+    long queue_samples;
+    const QSketch* travel_times; /* histogram of travel times after warmup */
+} TsSnapshot;
+
+/* cfg is copied; returns NULL on allocation failure or a topology mismatch */
+TsSim* ts_create(const Config* cfg, const Topology* topo);
+void ts_destroy(TsSim* ts);
+
+/* runs up to n steps, stopping at simulation.duration; returns steps run,
+   or -1 if a step ran out of memory (the instance can then only be
+   queried and destroyed) */
+int ts_step(TsSim* ts, int n);
+
+void ts_query(const TsSim* ts, TsStatus* st);
+/* metrics over the measured window (after warmup) up to now */
+void ts_metrics(TsSim* ts, SimMetrics* m);
+/* travel-time sketch of the measured window, e.g. to qs_merge replicates */
+const QSketch* ts_travel_times(const TsSim* ts);
+void ts_snapshot(const TsSim* ts, TsSnapshot* snap);
+
+/* Checkpoints (format in checkpoint.h): the state of an instance between
+   two steps. ts_restore starts a new instance from one; with the same
+   configuration it continues the run exactly, with another one (same
+   network and time step) it branches a scenario, e.g. several controllers
+   from one warmed-up state. A checkpoint is read-only once taken, so any
+   number of instances, on any threads, can restore from it.
+
+     TsCheckpoint* ck = ts_checkpoint(warm);
+     TsSim* a = ts_restore(&cfg_fixed, &topo, ck);
+     TsSim* b = ts_restore(&cfg_max_pressure, &topo, ck); */
+typedef struct TsCheckpoint TsCheckpoint;
+
+TsCheckpoint* ts_checkpoint(const TsSim* ts);
+int ts_checkpoint_save(const TsCheckpoint* ck, const char* path);
+/* NULL (with a message on stderr) if path is not a checkpoint of this build */
+TsCheckpoint* ts_checkpoint_load(const char* path);
+void ts_checkpoint_free(TsCheckpoint* ck);
+/* simulated time the checkpoint was taken at */
+double ts_checkpoint_time(const TsCheckpoint* ck);
+/* topo as for ts_create; NULL if ck does not fit the network or cfg */
+TsSim* ts_restore(const Config* cfg, const Topology* topo, const TsCheckpoint* ck);
+/* ts_restore from the current state of ts, sharing its topology if it has
+   a shared one (cfg NULL: ts's own configuration) */
+TsSim* ts_fork(const TsSim* ts, const Config* cfg);
+
+/* Time series (format in series.h): from the next step on, one frame of
+   queues, occupancy, crossings and light phases per intersection every
+   output.export_interval s, written to path by a background thread so
+   stepping does not wait for the disk. -1 if a series is already open,
+   export_interval <= 0 or path cannot be created. ts_series_close (also
+   done by ts_destroy) writes the rest; -1 if a write failed. */
+int ts_series_open(TsSim* ts, const char* path);
+int ts_series_close(TsSim* ts);
+
+/* Vehicle trajectories (format in traj.h): from the next step on, link
+   entries, speed and lane changes and exits of every vehicle, recorded in
+   parallel by the engine tiles and written to path by a background thread
+   in bounded memory; traj_decode rebuilds full trajectories. -1 if already
+   recording or path cannot be created. ts_trajectories_close (also done
+   by ts_destroy) writes the rest; -1 if a write failed or memory ran out. */
+int ts_trajectories_open(TsSim* ts, const char* path);
+int ts_trajectories_close(TsSim* ts);
+
+/* Builds with -DTS_PROFILE (make PROFILE=1, see prof.h) time every engine
+   phase; ts_report then adds a per-phase table and this writes the last
+   steps as a Chrome trace-event JSON file. -1 without TS_PROFILE or if
+   path cannot be written. */
+int ts_profile_write(const TsSim* ts, const char* path);
+
+/* metrics.csv + queue_heatmap.csv */
+int ts_export_csv(TsSim* ts, const char* out_dir);
+/* engine speed (for loop_s seconds of stepping) and memory per instance */
+void ts_report(const TsSim* ts, double loop_s, FILE* f);
+
+#endif
@@ -0,0 +1,160 @@
+// traj.h
+#ifndef TRAJ_H
+#define TRAJ_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "engine.h"
+
+/* Vehicle trajectory recorder.
+
+   A vehicle's path is known between two events without recording it: in
+   the absence of news it stays on its link and moves by its last speed
+   (slot += speed * n_lanes, see Link). The engine records a vehicle only
+   where its update departs from that prediction, at the point it applies
+   the update (phase B moves, C1 crossings, C2 blocked crossings and exits):
+
+     ENTER  the vehicle is on another link (a crossing, a spawn, or the
+            first step recorded): link, slot, speed
+     SET    same link, another slot or speed (acceleration, slowdown, a
+            stop or a start, a lane change, a blocked crossing): the slot
+            relative to the prediction, speed
+     EXIT   it left the network
+
+   A vehicle cruising or standing in a queue costs nothing: recording is
+   O(records), not O(vehicles). Vehicles spawned in a step, and all live
+   ones when recording starts, are recorded as ENTER at the end of that
+   step by the tile owning their link. Records are
+   delta-encoded varints (step relative to the previous record of the same
+   stream, slot relative to the prediction) appended to one stream per
+   tile, so tiles record in parallel without sharing anything.
+
+   Streams live in one of TRAJ_BLOCKS blocks. When a stream passes
+   TRAJ_FLUSH_BYTES the stepping thread hands the block to a writer thread
+   (which deflates it when built with zlib) and records into the next one;
+   it only waits when every block is still being written. Memory is at most
+   TRAJ_BLOCKS x tiles x (TRAJ_FLUSH_BYTES + one step of one tile's
+   records) plus one byte per vehicle id, however long the run.
+
+   File (native byte order):
+
+     TrajHeader, then uint8 n_lanes[n_links]
+     blocks, until the end of the file:
+       TrajBlock, uint32 stream_bytes[n_streams],
+       payload of stored_bytes (the streams back to back, raw or deflated)
+
+   A stream is a sequence of records
+
+     uint8  tag        kind (TrajKind) in bits 0-1, speed in bits 2-7
+                       (63: speed follows as a varint)
+     varint step - previous step (block step0 for the first record)
+     varint vehicle id (ids are reused: a trip runs from ENTER of an id
+            that is not on the network to its EXIT)
+     ENTER: varint link, varint slot
+     SET:   zigzag varint slot - predicted slot
+
+   A block covers steps [step0, step1); the state after step s is at time
+   (s + 1) * time_step. traj_decode rebuilds every vehicle's link, cell,
+   lane and speed at every step. */
+
+#define TRAJ_MAGIC "TSTRAJ\r\n"
+#define TRAJ_VERSION 1
+#define TRAJ_BLOCKS 4
+#define TRAJ_FLUSH_BYTES (256u << 10)
+
+typedef enum { TRAJ_ENTER=0, TRAJ_SET=1, TRAJ_EXIT=2 } TrajKind;
+typedef enum { TRAJ_RAW=0, TRAJ_DEFLATE=1 } TrajCodec;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t n_links;
+    double time_step;
+    int32_t step;            /* steps run when recording started */
+    int32_t reserved;
+} TrajHeader;
+
+typedef struct {
+    int32_t step0, step1;
+    uint32_t n_streams;
+    uint32_t codec;          /* TrajCodec */
+    uint64_t raw_bytes;      /* sum of stream_bytes */
+    uint64_t stored_bytes;
+} TrajBlock;
+
+typedef struct {
+    uint8_t* v;
+    size_t n;
+    size_t cap;
+    int32_t last_step;
+    int64_t records;
+} TrajStream;
+
+typedef struct {
+    int32_t step0, step1;
+    TrajStream* streams;     /* [n_tiles] */
+    int64_t vehicle_steps;   /* vehicles on the network, summed over the steps */
+} TrajBuf;
+
+typedef struct Traj {
+    FILE* f;
+    int n_streams;
+    TrajBuf bufs[TRAJ_BLOCKS];
+
+    /* per vehicle id: on the network but not in the file yet; those are
+       recorded at the end of the step, by tile of their link (born) */
+    uint8_t* fresh;
+    int fresh_cap;
+    IdxList* born;           /* [n_streams] */
+
+    /* handoff ring of bufs: the stepping thread records into
+       bufs[head % TRAJ_BLOCKS] */
+    _Atomic uint64_t head;   /* blocks handed off */
+    _Atomic uint64_t tail;   /* blocks written */
+    sem_t ready;
+    atomic_bool closing;
+    pthread_t writer;
+
+    /* writer */
+    uint8_t* raw;            /* streams of one block, back to back */
+    size_t raw_cap;
+    uint8_t* packed;
+    size_t packed_cap;
+    bool io_error;
+
+    /* producer totals over handed-off blocks */
+    int64_t records, vehicle_steps, bytes;
+    long stalls;
+    atomic_bool failed;      /* out of memory while recording: the file is cut short */
+} Traj;
+
+/* creates path and starts the writer; step = steps run so far. The next
+   step records every live vehicle as ENTER */
+int traj_open(Traj* tr, const char* path, const Engine* e, int step);
+/* spawn phase (serial): vehicle id appeared on a link of tile w */
+void traj_spawned(Traj* tr, const VehiclePool* vp, int w, int id);
+/* C1, tile w owning link: vehicle id crossed into slot of link */
+void traj_enter(Traj* tr, int w, int step, int id, int link, int slot, int speed);
+/* B to C2, tile w owning the vehicle's link: a SET, dslot from the prediction */
+void traj_set(Traj* tr, int w, int step, int id, int dslot, int speed);
+
+/* vehicle id started the step at slot0 with speed0 and ends it at slot
+   with speed, on the same link */
+static inline void traj_moved(Traj* tr, int w, int step, int id, int slot0, int speed0,
+                              int slot, int speed, int n_lanes) {
+    int pred = slot0 + speed0 * n_lanes;
+    if (slot != pred || speed != speed0) traj_set(tr, w, step, id, slot - pred, speed);
+}
+
+/* phase C2, after the tile's moves: records its exits and its vehicles
+   new to the file */
+void traj_record_tile(Traj* tr, const Engine* e, int w);
+/* end of step (serial): hands full streams to the writer */
+void traj_end_step(Traj* tr, const VehiclePool* vp, int step);
+/* writes the rest and closes the file; -1 if anything was lost */
+int traj_close(Traj* tr, int step);
+void traj_report(const Traj* tr, FILE* f);
+
+#endif
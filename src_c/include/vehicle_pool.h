@@ -0,0 +1,62 @@
+// vehicle_pool.h
+#ifndef VEHICLE_POOL_H
+#define VEHICLE_POOL_H
+
+#include <stddef.h>
+#include "sim_types.h"
+
+/* Vehicle storage with stable ids, structure-of-arrays layout.
+   - every per-vehicle array is indexed by id and valid for id < cap
+   - active[0..n_used) is a dense list of live ids, so per-step loops only
+     visit vehicles that exist
+   - free_ids is a LIFO stack of released ids (O(1) alloc/release)
+   - the pool doubles its capacity when no free id is left
+
+   Hot fields are read/written by the step kernel for every live vehicle on
+   every step; cold fields are only touched on spawn, exit and by the
+   stopped-time stats hook.
+*/
+typedef struct {
+    /* hot */
+    int32_t* link;                /* index into Grid.links */
+    int32_t* cell_idx;
+    uint8_t* speed;
+    uint8_t* vmax;
+    uint8_t* planned_move;        /* MoveType */
+    int32_t* planned_next_link;   /* index into Grid.links, INVALID_ID if none */
+
+    /* cold */
+    double*  entry_time;
+    double*  stopped_time;
+    uint16_t* destination;        /* side (Direction), or a routing destination, see routing.h */
+
+    int cap;
+    int n_used;
+
+    int* active;      /* live ids, dense */
+    int* active_pos;  /* id -> index in active, -1 if free */
+
+    int* free_ids;
+    int n_free;
+
+    int peak_used;
+} VehiclePool;
+
+/* bytes of hot state per vehicle (what the step kernel streams through) */
+#define VP_HOT_BYTES_PER_VEHICLE \
+    (3 * sizeof(int32_t) + 3 * sizeof(uint8_t))
+
+int vp_init(VehiclePool* vp, int initial_cap);
+void vp_free(VehiclePool* vp);
+
+/* returns a free id (pool grows if needed), -1 on allocation failure */
+int vp_alloc(VehiclePool* vp);
+void vp_release(VehiclePool* vp, int id);
+
+static inline bool vp_is_live(const VehiclePool* vp, int id) {
+    return vp->active_pos[id] >= 0;
+}
+
+size_t vp_memory_bytes(const VehiclePool* vp);
+
+#endif
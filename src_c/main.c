@@ -1,7 +1,9 @@
 #include "config_kv.h"
 #include "sim.h"
+#include "sweep.h"
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 static const char* get_arg(int argc, char** argv, const char* key, const char* def) {
     for (int i=1;i<argc-1;i++) {
@@ -13,9 +15,19 @@ static const char* get_arg(int argc, char** argv, const char* key, const char* d
 int main(int argc, char** argv) {
     const char* cfg_path = get_arg(argc, argv, "--config", NULL);
     const char* out_dir  = get_arg(argc, argv, "--out", ".");
+    const char* threads  = get_arg(argc, argv, "--threads", NULL);
+    const char* sweep    = get_arg(argc, argv, "--sweep", NULL);
+    const char* jobs     = get_arg(argc, argv, "--jobs", NULL);
+    const char* pool     = get_arg(argc, argv, "--pool", NULL);
+    const char* restore  = get_arg(argc, argv, "--restore", NULL);
+    const char* save     = get_arg(argc, argv, "--save-checkpoint", NULL);
+    bool warm_start = false;
+    for (int i=1; i<argc; i++) warm_start |= (strcmp(argv[i], "--warm-start") == 0);
 
     if (!cfg_path) {
-        fprintf(stderr, "Usage: %s --config path/to/config.kv --out out_dir\n", argv[0]);
+        fprintf(stderr, "Usage: %s --config path/to/config.kv --out out_dir [--threads N]\n"
+                        "       [--restore checkpoint] [--save-checkpoint path]\n"
+                        "       [--sweep 'key=v1,v2;key=a:b;...' [--jobs N] [--pool key] [--warm-start]]\n", argv[0]);
         return 1;
     }
 
@@ -25,7 +37,47 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    int rc = sim_run(&cfg, out_dir);
+    if (threads) cfg.threads = atoi(threads);
+
+    TsCheckpoint* from = NULL;
+    if (restore && !(from = ts_checkpoint_load(restore))) return 1;
+    if (sweep && warm_start && !from) {
+        /* points branch off the base config's state at the end of its warmup */
+        from = sim_warm_up(&cfg, NULL);
+        if (!from) {
+            fprintf(stderr, "Warm-up run failed.\n");
+            return 1;
+        }
+        fprintf(stderr, "sweep: warmed up to t = %.1f s\n", ts_checkpoint_time(from));
+    }
+
+    if (sweep) {
+        SweepSpec sp;
+        if (sweep_parse(&sp, sweep) != 0) {
+            ts_checkpoint_free(from);
+            return 1;
+        }
+        if (pool && sweep_set_pool_axis(&sp, pool) != 0) {
+            sweep_free(&sp);
+            ts_checkpoint_free(from);
+            return 1;
+        }
+
+        char path[512], pooled[512];
+        snprintf(path, sizeof(path), "%s/sweep_metrics.csv", out_dir);
+        snprintf(pooled, sizeof(pooled), "%s/sweep_pooled.csv", out_dir);
+        int rc = sweep_run(&cfg, &sp, jobs ? atoi(jobs) : 0, path, pooled, from);
+        sweep_free(&sp);
+        ts_checkpoint_free(from);
+        if (rc != 0) {
+            fprintf(stderr, "Sweep failed.\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    int rc = sim_run(&cfg, out_dir, from, save);
+    ts_checkpoint_free(from);
     if (rc != 0) {
         fprintf(stderr, "Simulation failed.\n");
         return 1;
@@ -0,0 +1,99 @@
+// nasch.c
+#include "nasch.h"
+#include <stdbool.h>
+
+static inline int32_t nasch_one(const NaschStep* st, const NaschRun* r, int i) {
+    int32_t v = r->speed[i] + 1;
+    if (v > r->vmax[i]) v = r->vmax[i];
+    int32_t gap = r->pos[i + 1] - r->pos[i] - 1;
+    if (v > gap) v = gap;
+    if (v > 0 && rng_cb_uniform01(st->key, st->step, (uint32_t)r->id[i], RNG_SLOWDOWN, 0) < st->p) v--;
+    return v;
+}
+
+void nasch_scalar(const NaschStep* st, NaschRun* r) {
+    for (int i=0; i<r->n; i++) r->speed[i] = nasch_one(st, r, i);
+}
+
+#if !defined(TS_NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define NASCH_AVX2 1
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* 32x32 -> 64 bit products of all 8 lanes: high halves returned, low in *lo */
+AVX2 static inline __m256i mul_hilo(__m256i a, __m256i m, __m256i* lo) {
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    return _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+AVX2 static inline __m256i lt_u32(__m256i a, __m256i b) {
+    const __m256i sign = _mm256_set1_epi32((int)0x80000000u);
+    return _mm256_cmpgt_epi32(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign));
+}
+
+AVX2 static void nasch_avx2(const NaschStep* st, NaschRun* r) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i m0 = _mm256_set1_epi32((int)RNG_PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi32((int)RNG_PHILOX_M1);
+    const __m256i ctr0 = _mm256_set1_epi32((int)st->step);
+    const __m256i ctr2 = _mm256_set1_epi32(RNG_SLOWDOWN);
+
+    /* (hi:lo) >> 11 < slow_below  <=>  (hi:lo) < slow_below << 11, unless
+       slow_below is 2^53 (p >= 1: every draw is below) */
+    const bool always = (st->slow_below >> 53) != 0;
+    const uint64_t lim = st->slow_below << 11;
+    const __m256i lim_hi = _mm256_set1_epi32((int)(uint32_t)(lim >> 32));
+    const __m256i lim_lo = _mm256_set1_epi32((int)(uint32_t)lim);
+
+    /* the last group is partial: lanes past n read padding and are not stored */
+    for (int i=0; i<r->n; i+=8) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i*)(r->pos + i));
+        __m256i p1 = _mm256_loadu_si256((const __m256i*)(r->pos + i + 1));
+        __m256i gap = _mm256_sub_epi32(_mm256_sub_epi32(p1, p0), one);
+        __m256i v = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(r->speed + i)), one);
+        v = _mm256_min_epi32(v, _mm256_loadu_si256((const __m256i*)(r->vmax + i)));
+        v = _mm256_min_epi32(v, gap);
+
+        /* Philox4x32-10 of (step, id, RNG_SLOWDOWN, 0), as rng_philox4x32 */
+        __m256i c0 = ctr0, c1 = _mm256_loadu_si256((const __m256i*)(r->id + i)), c2 = ctr2, c3 = zero;
+        uint32_t k0 = st->key.k0, k1 = st->key.k1;
+        for (int k=0; k<10; k++) {
+            __m256i lo0, lo1;
+            __m256i hi0 = mul_hilo(c0, m0, &lo0);
+            __m256i hi1 = mul_hilo(c2, m1, &lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += RNG_PHILOX_W0;
+            k1 += RNG_PHILOX_W1;
+        }
+        __m256i slow = always ? _mm256_cmpeq_epi32(zero, zero)
+                              : _mm256_or_si256(lt_u32(c0, lim_hi),
+                                                _mm256_and_si256(_mm256_cmpeq_epi32(c0, lim_hi), lt_u32(c1, lim_lo)));
+        slow = _mm256_and_si256(slow, _mm256_cmpgt_epi32(v, zero));
+        v = _mm256_add_epi32(v, slow);   /* slow lanes are -1 */
+        if (i + 8 <= r->n) {
+            _mm256_storeu_si256((__m256i*)(r->speed + i), v);
+        } else {
+            __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32(r->n - i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            _mm256_maskstore_epi32(r->speed + i, live, v);
+        }
+    }
+}
+#endif
+
+NaschKernel nasch_kernel(const char** name) {
+#ifdef NASCH_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        if (name) *name = "avx2";
+        return nasch_avx2;
+    }
+#endif
+    if (name) *name = "scalar";
+    return nasch_scalar;
+}
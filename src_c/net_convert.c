@@ -0,0 +1,387 @@
+// net_convert.c
+// Offline converter to the binary network format (netfile.h).
+//
+//   net_convert [--cell-length M] [--tiles N] [--lanes L] edges.txt out.bin
+//   net_convert --grid N [--link-cells C] [--lanes L] out.bin
+//
+// Edge list: one record per line, '#' starts a comment.
+//
+//   node ID X Y                          ids 0..n-1, coordinates in metres (y = north)
+//   link FROM TO LENGTH [HEADING [GROUP [LANES]]]
+//                                        FROM/TO a node id, or - for a network
+//                                        entry/exit; HEADING N/E/S/W (default:
+//                                        from the coordinates, required when
+//                                        FROM or TO is -; - for the default);
+//                                        GROUP 0 = served by the NS phase,
+//                                        1 = EW (default or -: from the heading);
+//                                        LANES 1..8 (default: --lanes, 1)
+//   turn LINK NEXT                       allowed movement, links numbered by
+//                                        their order in the file; a link with
+//                                        no turn lines may turn into every
+//                                        link out of its downstream node
+//   exit NODE HEADINGS                   e.g. "exit 7 NE": vehicles bound for
+//                                        those sides may leave at that node
+//                                        (after the node's own line)
+//
+// Links are cut into max(1, round(LENGTH / cell-length)) cells. Nodes are
+// placed on a tiles x tiles lattice (default: about one node per tile
+// cell) that only drives the engine's thread tiling and the heatmap.
+#include "netfile.h"
+#include "occupancy.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    double x, y;
+    uint8_t exit_mask;
+    bool seen;
+} NodeRec;
+
+typedef struct {
+    int32_t from, to;
+    double length;
+    int heading;   /* -1: from the coordinates */
+    int group;     /* -1: from the heading */
+    int lanes;     /* 0: --lanes */
+} LinkRec;
+
+typedef struct {
+    int32_t link, next;
+    int next_dir;
+} TurnRec;
+
+typedef struct {
+    NodeRec* nodes;
+    int n_nodes, cap_nodes;
+    LinkRec* links;
+    int n_links, cap_links;
+    TurnRec* turns;
+    int n_turns, cap_turns;
+} EdgeList;
+
+static void* grow(void* p, int* cap, int need, size_t elem) {
+    if (need <= *cap) return p;
+    int cap2 = *cap ? *cap : 1024;
+    while (cap2 < need) cap2 *= 2;
+    void* q = realloc(p, elem * (size_t)cap2);
+    if (!q) {
+        fprintf(stderr, "net_convert: out of memory\n");
+        exit(1);
+    }
+    *cap = cap2;
+    return q;
+}
+
+static int parse_heading(const char* s) {
+    if (strcmp(s, "N") == 0) return DIR_N;
+    if (strcmp(s, "E") == 0) return DIR_E;
+    if (strcmp(s, "S") == 0) return DIR_S;
+    if (strcmp(s, "W") == 0) return DIR_W;
+    if (strcmp(s, "-") == 0) return -1;
+    return -2;
+}
+
+static int32_t parse_node_ref(const char* s) {
+    if (strcmp(s, "-") == 0) return INVALID_ID;
+    char* end;
+    long v = strtol(s, &end, 10);
+    return (*end || v < 0 || v > INT32_MAX) ? -2 : (int32_t)v;
+}
+
+static int read_edges(const char* path, EdgeList* el) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "net_convert: cannot open %s\n", path);
+        return -1;
+    }
+    char line[512];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char* hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char kind[16], a[64], b[64], c[64], d[64], e[64], h[64];
+        int n = sscanf(line, "%15s %63s %63s %63s %63s %63s %63s", kind, a, b, c, d, e, h);
+        if (n <= 0) continue;
+
+        bool ok = false;
+        if (strcmp(kind, "node") == 0 && n == 4) {
+            int32_t id = parse_node_ref(a);
+            if (id >= 0) {
+                if (id >= el->n_nodes) {
+                    el->nodes = grow(el->nodes, &el->cap_nodes, id + 1, sizeof(NodeRec));
+                    memset(el->nodes + el->n_nodes, 0, sizeof(NodeRec) * (size_t)(id + 1 - el->n_nodes));
+                    el->n_nodes = id + 1;
+                }
+                NodeRec* r = &el->nodes[id];
+                ok = !r->seen;
+                r->x = atof(b);
+                r->y = atof(c);
+                r->seen = true;
+            }
+        } else if (strcmp(kind, "link") == 0 && n >= 4) {
+            el->links = grow(el->links, &el->cap_links, el->n_links + 1, sizeof(LinkRec));
+            LinkRec* r = &el->links[el->n_links++];
+            r->from = parse_node_ref(a);
+            r->to = parse_node_ref(b);
+            r->length = atof(c);
+            r->heading = (n >= 5) ? parse_heading(d) : -1;
+            r->group = (n >= 6 && strcmp(e, "-") != 0) ? atoi(e) : -1;
+            r->lanes = (n >= 7) ? atoi(h) : 0;
+            ok = r->from >= INVALID_ID && r->to >= INVALID_ID && r->heading >= -1
+              && (r->group == -1 || r->group == 0 || r->group == 1)
+              && r->lanes >= 0 && r->lanes <= MAX_LANES
+              && !(r->from == INVALID_ID && r->to == INVALID_ID);
+        } else if (strcmp(kind, "turn") == 0 && n == 3) {
+            el->turns = grow(el->turns, &el->cap_turns, el->n_turns + 1, sizeof(TurnRec));
+            TurnRec* r = &el->turns[el->n_turns++];
+            r->link = parse_node_ref(a);
+            r->next = parse_node_ref(b);
+            ok = r->link >= 0 && r->next >= 0;
+        } else if (strcmp(kind, "exit") == 0 && n == 3) {
+            int32_t id = parse_node_ref(a);
+            ok = id >= 0 && id < el->n_nodes && el->nodes[id].seen;
+            for (const char* h = b; ok && *h; h++) {
+                char one[2] = { *h, '\0' };
+                int dir = parse_heading(one);
+                if (dir < 0) ok = false;
+                else el->nodes[id].exit_mask |= (uint8_t)(1u << dir);
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "net_convert: %s:%d: bad record\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int heading_of(const EdgeList* el, const LinkRec* r) {
+    if (r->heading >= 0) return r->heading;
+    const NodeRec* a = &el->nodes[r->from];
+    const NodeRec* b = &el->nodes[r->to];
+    double dx = b->x - a->x;
+    double dy = b->y - a->y;
+    if (fabs(dx) >= fabs(dy)) return (dx >= 0.0) ? DIR_E : DIR_W;
+    return (dy >= 0.0) ? DIR_N : DIR_S;
+}
+
+static int cmp_turn(const void* pa, const void* pb) {
+    const TurnRec* a = (const TurnRec*)pa;
+    const TurnRec* b = (const TurnRec*)pb;
+    if (a->link != b->link) return (a->link < b->link) ? -1 : 1;
+    if (a->next_dir != b->next_dir) return (a->next_dir < b->next_dir) ? -1 : 1;
+    return (a->next > b->next) - (a->next < b->next);
+}
+
+static int build(const EdgeList* el, int tiles, double cell_length, int lanes, Topology* t) {
+    memset(t, 0, sizeof(*t));
+    for (int k=0; k<el->n_nodes; k++) {
+        if (!el->nodes[k].seen) {
+            fprintf(stderr, "net_convert: node ids must be 0..n-1, %d is missing\n", k);
+            return -1;
+        }
+    }
+    if (el->n_nodes == 0) {
+        fprintf(stderr, "net_convert: no nodes\n");
+        return -1;
+    }
+
+    uint8_t* dirs = (uint8_t*)malloc((size_t)(el->n_links ? el->n_links : 1));
+    int32_t* cells = (int32_t*)malloc(sizeof(int32_t) * (size_t)(el->n_links ? el->n_links : 1));
+    uint8_t* n_lanes = (uint8_t*)malloc((size_t)(el->n_links ? el->n_links : 1));
+    int32_t* out_deg = (int32_t*)calloc((size_t)el->n_nodes, sizeof(int32_t));
+    int32_t* explicit_turns = (int32_t*)calloc((size_t)(el->n_links ? el->n_links : 1), sizeof(int32_t));
+    if (!dirs || !cells || !n_lanes || !out_deg || !explicit_turns) {
+        fprintf(stderr, "net_convert: out of memory\n");
+        return -1;
+    }
+
+    int64_t n_cells = 0, n_occ = 0, n_turns = 0;
+    for (int l=0; l<el->n_links; l++) {
+        const LinkRec* r = &el->links[l];
+        if (r->from >= el->n_nodes || r->to >= el->n_nodes) {
+            fprintf(stderr, "net_convert: link %d: unknown node\n", l);
+            return -1;
+        }
+        if ((r->from == INVALID_ID || r->to == INVALID_ID) && r->heading < 0) {
+            fprintf(stderr, "net_convert: link %d: entry/exit links need a heading\n", l);
+            return -1;
+        }
+        dirs[l] = (uint8_t)heading_of(el, r);
+        long c = lround(r->length / cell_length);
+        cells[l] = (int32_t)((c < 1) ? 1 : (c > 1000000 ? 1000000 : c));
+        n_lanes[l] = (uint8_t)(r->lanes ? r->lanes : lanes);
+        n_cells += (int64_t)cells[l] * n_lanes[l];
+        n_occ += occ_words_for(cells[l] * n_lanes[l]);
+        if (r->from != INVALID_ID) out_deg[r->from]++;
+        t->n_entry_links += (r->from == INVALID_ID);
+        t->n_in_links += (r->to != INVALID_ID);
+        t->n_out_links += (r->from != INVALID_ID);
+    }
+
+    TurnRec* turns = el->turns;
+    for (int k=0; k<el->n_turns; k++) {
+        TurnRec* x = &turns[k];
+        if (x->link >= el->n_links || x->next >= el->n_links
+            || el->links[x->link].to == INVALID_ID || el->links[x->next].from != el->links[x->link].to) {
+            fprintf(stderr, "net_convert: turn %d -> %d does not continue at the link's end\n", x->link, x->next);
+            return -1;
+        }
+        x->next_dir = dirs[x->next];
+        explicit_turns[x->link]++;
+    }
+    qsort(turns, (size_t)el->n_turns, sizeof(TurnRec), cmp_turn);
+    for (int l=0; l<el->n_links; l++) {
+        int32_t to = el->links[l].to;
+        n_turns += explicit_turns[l] ? explicit_turns[l] : (to != INVALID_ID ? out_deg[to] : 0);
+    }
+    if (el->n_links > INT32_MAX - 1 || n_cells > INT32_MAX || n_occ > INT32_MAX || n_turns > INT32_MAX) {
+        fprintf(stderr, "net_convert: network too large for int32 indices\n");
+        return -1;
+    }
+
+    t->grid_size = (tiles > 0) ? tiles : (int)ceil(sqrt((double)el->n_nodes));
+    t->n_intersections = el->n_nodes;
+    t->n_links = el->n_links;
+    t->n_turns = (int)n_turns;
+    t->n_cells = n_cells;
+    t->n_occ_words = n_occ;
+    if (topology_alloc(t) != 0) {
+        fprintf(stderr, "net_convert: out of memory\n");
+        return -1;
+    }
+
+    /* lattice cell of each node from its position in the bounding box */
+    double x0 = el->nodes[0].x, x1 = x0, y0 = el->nodes[0].y, y1 = y0;
+    for (int k=1; k<el->n_nodes; k++) {
+        x0 = fmin(x0, el->nodes[k].x); x1 = fmax(x1, el->nodes[k].x);
+        y0 = fmin(y0, el->nodes[k].y); y1 = fmax(y1, el->nodes[k].y);
+    }
+    int N = t->grid_size;
+    for (int k=0; k<el->n_nodes; k++) {
+        Intersection* I = &t->intersections[k];
+        I->id = k;
+        int i = (y1 > y0) ? (int)((y1 - el->nodes[k].y) / (y1 - y0) * N) : 0;
+        int j = (x1 > x0) ? (int)((el->nodes[k].x - x0) / (x1 - x0) * N) : 0;
+        I->i = (i < 0) ? 0 : (i >= N ? N - 1 : i);
+        I->j = (j < 0) ? 0 : (j >= N ? N - 1 : j);
+        I->exit_mask = el->nodes[k].exit_mask;
+    }
+
+    int32_t cell_off = 0, occ_off = 0;
+    int eidx = 0;
+    for (int l=0; l<el->n_links; l++) {
+        const LinkRec* r = &el->links[l];
+        Link* L = &t->links[l];
+        L->id = l;
+        L->from = r->from;
+        L->to = r->to;
+        L->dir = dirs[l];
+        L->group = (uint8_t)((r->group >= 0) ? r->group
+                   : ((L->dir == DIR_N || L->dir == DIR_S) ? PHASE_NS : PHASE_EW));
+        L->n_cells = cells[l];
+        L->n_lanes = n_lanes[l];
+        L->stopline_cell = cells[l] - 1;
+        L->cell_off = cell_off;
+        L->occ_off = occ_off;
+        cell_off += cells[l] * n_lanes[l];
+        occ_off += occ_words_for(cells[l] * n_lanes[l]);
+        if (r->from == INVALID_ID) t->entry_links[eidx++] = l;
+    }
+
+    topology_index(t);
+
+    /* turn CSR: the explicit turns (sorted by link, then like the node lists
+       by (dir, id)), else every link out of the downstream node */
+    int32_t n = 0;
+    int k = 0;
+    for (int l=0; l<t->n_links; l++) {
+        t->turn_off[l] = n;
+        if (explicit_turns[l]) {
+            for (; k < el->n_turns && turns[k].link == l; k++) t->turns[n++] = turns[k].next;
+            continue;
+        }
+        int32_t to = t->links[l].to;
+        if (to == INVALID_ID) continue;
+        for (int32_t o=t->out_off[to]; o<t->out_off[to + 1]; o++) t->turns[n++] = t->out_links[o];
+    }
+    t->turn_off[t->n_links] = n;
+
+    free(dirs);
+    free(cells);
+    free(n_lanes);
+    free(out_deg);
+    free(explicit_turns);
+    return 0;
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [--cell-length M] [--tiles N] [--lanes L] edges.txt out.bin\n"
+                    "       %s --grid N [--link-cells C] [--lanes L] out.bin\n", argv0, argv0);
+}
+
+int main(int argc, char** argv) {
+    double cell_length = 7.5;
+    int tiles = 0, grid = 0, link_cells = 20, lanes = 1;
+    const char* pos[2];
+    int n_pos = 0;
+    for (int i=1; i<argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--cell-length") == 0) cell_length = atof(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--tiles") == 0) tiles = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--grid") == 0) grid = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--link-cells") == 0) link_cells = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--lanes") == 0) lanes = atoi(argv[++i]);
+        else if (n_pos < 2 && argv[i][0] != '-') pos[n_pos++] = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((grid > 0) ? n_pos != 1 : (n_pos != 2 || !(cell_length > 0.0)) || lanes < 1 || lanes > MAX_LANES) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Topology t;
+    if (grid > 0) {
+        Config cfg;
+        config_set_defaults(&cfg);
+        cfg.grid_size = grid;
+        cfg.link_length_cells = link_cells;
+        cfg.lanes_per_direction = lanes;
+        if (topology_init(&t, &cfg) != 0) {
+            fprintf(stderr, "net_convert: cannot build a %dx%d lattice\n", grid, grid);
+            return 1;
+        }
+    } else {
+        EdgeList el;
+        memset(&el, 0, sizeof(el));
+        int rc = read_edges(pos[0], &el);
+        if (rc == 0) rc = build(&el, tiles, cell_length, lanes, &t);
+        free(el.nodes);
+        free(el.links);
+        free(el.turns);
+        if (rc != 0) return 1;
+    }
+
+    char msg[128];
+    if (!topology_check(&t, msg, sizeof(msg))) {
+        fprintf(stderr, "net_convert: %s\n", msg);
+        topology_free(&t);
+        return 1;
+    }
+    const char* out = pos[n_pos - 1];
+    if (topology_save(&t, out) != 0) {
+        fprintf(stderr, "net_convert: cannot write %s\n", out);
+        topology_free(&t);
+        return 1;
+    }
+    topology_report(&t, 0.0, stderr);
+    topology_free(&t);
+    return 0;
+}
@@ -0,0 +1,195 @@
+// netfile.c
+#include "netfile.h"
+#include "occupancy.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+static void header_of(const Topology* t, NetFileHeader* h) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, NETFILE_MAGIC, sizeof(h->magic));
+    h->version = NETFILE_VERSION;
+    h->byte_order = BYTE_ORDER_MARK;
+    h->link_bytes = (uint32_t)sizeof(Link);
+    h->inter_bytes = (uint32_t)sizeof(Intersection);
+    h->grid_size = t->grid_size;
+    h->n_intersections = t->n_intersections;
+    h->n_links = t->n_links;
+    h->n_entry_links = t->n_entry_links;
+    h->n_in_links = t->n_in_links;
+    h->n_out_links = t->n_out_links;
+    h->n_turns = t->n_turns;
+    h->n_cells = t->n_cells;
+    h->n_occ_words = t->n_occ_words;
+    h->arena_bytes = (uint64_t)t->arena_bytes;
+}
+
+int topology_save(const Topology* t, const char* path) {
+    NetFileHeader h;
+    header_of(t, &h);
+    char head[NETFILE_HEADER_BYTES];
+    memset(head, 0, sizeof(head));
+    memcpy(head, &h, sizeof(h));
+
+    /* the arena starts at an aligned pointer inside the malloc'd block */
+    const char* base = (const char*)t->intersections;
+    FILE* f = fopen(path, "wb");
+    if (!f) return -1;
+    int ok = fwrite(head, 1, sizeof(head), f) == sizeof(head)
+          && fwrite(base, 1, t->arena_bytes, f) == t->arena_bytes;
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* CSR offsets off[0..n] start at 0, never decrease and end at total;
+   entries list[0..total) are link ids */
+static bool check_csr(const int32_t* off, int n, const int32_t* list, int total, int n_links) {
+    if (off[0] != 0 || off[n] != total) return false;
+    for (int k=0; k<n; k++) if (off[k + 1] < off[k]) return false;
+    for (int k=0; k<total; k++) if (list[k] < 0 || list[k] >= n_links) return false;
+    return true;
+}
+
+bool topology_check(const Topology* t, char* msg, size_t msg_len) {
+    int n = t->n_intersections;
+    for (int k=0; k<n; k++) {
+        const Intersection* I = &t->intersections[k];
+        if (I->id != k || I->i < 0 || I->i >= t->grid_size || I->j < 0 || I->j >= t->grid_size) {
+            snprintf(msg, msg_len, "intersection %d: bad id or lattice cell", k);
+            return false;
+        }
+    }
+    for (int l=0; l<t->n_links; l++) {
+        const Link* L = &t->links[l];
+        bool ok = L->id == l
+            && L->from >= INVALID_ID && L->from < n
+            && L->to >= INVALID_ID && L->to < n
+            && L->n_cells >= 1 && L->stopline_cell >= 0 && L->stopline_cell < L->n_cells
+            && L->n_lanes >= 1 && L->n_lanes <= MAX_LANES
+            && (int64_t)L->n_cells * L->n_lanes <= INT32_MAX
+            && L->cell_off >= 0 && (int64_t)L->cell_off + (int64_t)L->n_cells * L->n_lanes <= t->n_cells
+            && L->occ_off >= 0 && (int64_t)L->occ_off + occ_words_for(L->n_cells * L->n_lanes) <= t->n_occ_words
+            && L->dir < 4 && L->group < 2;
+        if (!ok) {
+            snprintf(msg, msg_len, "link %d: bad endpoint, cells, lanes or direction", l);
+            return false;
+        }
+        /* tiles write the cells and occupancy words of their own links:
+           ranges are laid out in link order and must not overlap */
+        if (l > 0) {
+            const Link* P = &t->links[l - 1];
+            if ((int64_t)L->cell_off < (int64_t)P->cell_off + (int64_t)P->n_cells * P->n_lanes
+                || (int64_t)L->occ_off < (int64_t)P->occ_off + occ_words_for(P->n_cells * P->n_lanes)) {
+                snprintf(msg, msg_len, "link %d: cells or occupancy words overlap link %d", l, l - 1);
+                return false;
+            }
+        }
+    }
+    for (int k=0; k<t->n_entry_links; k++) {
+        int32_t l = t->entry_links[k];
+        if (l < 0 || l >= t->n_links || t->links[l].from != INVALID_ID) {
+            snprintf(msg, msg_len, "entry %d: not a link without upstream intersection", k);
+            return false;
+        }
+    }
+    if (!check_csr(t->in_off, n, t->in_links, t->n_in_links, t->n_links)
+        || !check_csr(t->out_off, n, t->out_links, t->n_out_links, t->n_links)
+        || !check_csr(t->turn_off, t->n_links, t->turns, t->n_turns, t->n_links)) {
+        snprintf(msg, msg_len, "inconsistent CSR offsets");
+        return false;
+    }
+    for (int k=0; k<n; k++) {
+        for (int32_t m=t->in_off[k]; m<t->in_off[k + 1]; m++) {
+            if (t->links[t->in_links[m]].to != k) {
+                snprintf(msg, msg_len, "intersection %d: in link %d does not end there", k, t->in_links[m]);
+                return false;
+            }
+        }
+        for (int32_t m=t->out_off[k]; m<t->out_off[k + 1]; m++) {
+            if (t->links[t->out_links[m]].from != k) {
+                snprintf(msg, msg_len, "intersection %d: out link %d does not start there", k, t->out_links[m]);
+                return false;
+            }
+        }
+    }
+    for (int l=0; l<t->n_links; l++) {
+        int32_t to = t->links[l].to;
+        for (int32_t m=t->turn_off[l]; m<t->turn_off[l + 1]; m++) {
+            if (to == INVALID_ID || t->links[t->turns[m]].from != to) {
+                snprintf(msg, msg_len, "link %d: turn into link %d, which does not start at its end", l, t->turns[m]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int map_fail(Topology* t, const char* path, const char* why) {
+    fprintf(stderr, "network file %s: %s\n", path, why);
+    if (t->map) munmap(t->map, t->map_bytes);
+    memset(t, 0, sizeof(*t));
+    return -1;
+}
+
+int topology_map(Topology* t, const char* path) {
+    memset(t, 0, sizeof(*t));
+    if (strlen(path) >= sizeof(t->file)) return map_fail(t, path, "path too long");
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return map_fail(t, path, "cannot open");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < NETFILE_HEADER_BYTES) {
+        close(fd);
+        return map_fail(t, path, "too short");
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return map_fail(t, path, "mmap failed");
+    t->map = p;
+    t->map_bytes = (size_t)st.st_size;
+
+    NetFileHeader h;
+    memcpy(&h, p, sizeof(h));
+    if (memcmp(h.magic, NETFILE_MAGIC, sizeof(h.magic)) != 0) return map_fail(t, path, "not a network file");
+    if (h.version != NETFILE_VERSION || h.byte_order != BYTE_ORDER_MARK
+        || h.link_bytes != sizeof(Link) || h.inter_bytes != sizeof(Intersection))
+        return map_fail(t, path, "written by an incompatible version");
+    if (h.grid_size < 1 || h.n_intersections < 1 || h.n_links < 0 || h.n_entry_links < 0
+        || h.n_in_links < 0 || h.n_out_links < 0 || h.n_turns < 0
+        || h.n_cells < 0 || h.n_cells > INT32_MAX || h.n_occ_words < 0)
+        return map_fail(t, path, "bad counts");
+
+    t->grid_size = h.grid_size;
+    t->n_intersections = h.n_intersections;
+    t->n_links = h.n_links;
+    t->n_entry_links = h.n_entry_links;
+    t->n_in_links = h.n_in_links;
+    t->n_out_links = h.n_out_links;
+    t->n_turns = h.n_turns;
+    t->n_cells = h.n_cells;
+    t->n_occ_words = h.n_occ_words;
+
+    size_t need = topology_layout(t, NULL);
+    if (h.arena_bytes != need || t->map_bytes < NETFILE_HEADER_BYTES + need)
+        return map_fail(t, path, "truncated or inconsistent layout");
+    t->arena = (char*)p + NETFILE_HEADER_BYTES;
+    t->arena_bytes = need;
+    topology_layout(t, (char*)t->arena);
+    strcpy(t->file, path);
+
+    /* one linear pass over the mapping; the engine indexes without checks */
+    char msg[128];
+    if (!topology_check(t, msg, sizeof(msg))) return map_fail(t, path, msg);
+    return 0;
+}
+
+void topology_unmap(Topology* t) {
+    munmap(t->map, t->map_bytes);
+    t->map = NULL;
+    t->arena = NULL;
+}
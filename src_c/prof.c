@@ -0,0 +1,213 @@
+// prof.c
+#ifdef TS_PROFILE
+#define _DEFAULT_SOURCE   /* syscall() */
+#include "prof.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const char* phase_name[PROF_N] = {
+    "routing", "spawn", "lights", "sweep", "cross", "finish", "stats", "traj", "series", "wait"
+};
+
+static double mono_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/* ticks per second since prof_init */
+static double tick_hz(const Prof* p) {
+    double dt = mono_s() - p->mono0;
+    return dt > 0.0 ? (double)(prof_now() - p->tick0) / dt : 1e9;
+}
+
+int prof_init(Prof* p, int n_tiles) {
+    memset(p, 0, sizeof(*p));
+    p->tiles = (ProfTile*)calloc((size_t)n_tiles, sizeof(ProfTile));
+    if (!p->tiles) return -1;
+    p->n_tiles = n_tiles;
+    p->tick0 = prof_now();
+    p->mono0 = mono_s();
+    for (int w=0; w<n_tiles; w++) {
+        ProfTile* pt = &p->tiles[w];
+        pt->ring_cap = (uint32_t)TS_PROFILE_TRACE_STEPS * PROF_STEP_EVENTS;
+        pt->ring = (ProfEvent*)calloc(pt->ring_cap, sizeof(ProfEvent));
+        if (!pt->ring) {
+            prof_free(p);
+            return -1;
+        }
+        pt->mark = p->tick0;
+#ifdef TS_PROFILE_COUNTERS
+        pt->hw_fd = -2;
+#else
+        pt->hw_fd = -1;
+#endif
+        for (int k=0; k<PROF_HW_N; k++) pt->hw_fds[k] = -1;
+    }
+    return 0;
+}
+
+void prof_free(Prof* p) {
+    for (int w=0; w<p->n_tiles && p->tiles; w++) {
+        ProfTile* pt = &p->tiles[w];
+        for (int k=0; k<PROF_HW_N; k++)
+            if (pt->hw_fds[k] >= 0) close(pt->hw_fds[k]);
+        free(pt->ring);
+    }
+    free(p->tiles);
+    memset(p, 0, sizeof(*p));
+}
+
+#ifdef __linux__
+/* the calling thread's counter group, user space only; -1 if not allowed */
+static int open_hw(ProfTile* pt) {
+    static const uint64_t config[PROF_HW_N] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    int leader = -1;
+    for (int k=0; k<PROF_HW_N; k++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config[k];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd < 0) {
+            for (int j=0; j<k; j++) {
+                close(pt->hw_fds[j]);
+                pt->hw_fds[j] = -1;
+            }
+            return -1;
+        }
+        pt->hw_fds[k] = fd;
+        if (k == 0) leader = fd;
+    }
+    return leader;
+}
+#endif
+
+void prof_read_hw(ProfTile* pt, uint64_t* delta) {
+    memset(delta, 0, sizeof(uint64_t) * PROF_HW_N);
+#ifdef __linux__
+    if (pt->hw_fd == -2) {
+        pt->hw_fd = open_hw(pt);
+        if (pt->hw_fd < 0) return;
+        prof_read_hw(pt, delta);   /* sets hw_mark */
+        memset(delta, 0, sizeof(uint64_t) * PROF_HW_N);
+        return;
+    }
+    if (pt->hw_fd < 0) return;
+    uint64_t buf[1 + PROF_HW_N];
+    if (read(pt->hw_fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[0] != PROF_HW_N) return;
+    for (int k=0; k<PROF_HW_N; k++) {
+        delta[k] = buf[1 + k] - pt->hw_mark[k];
+        pt->hw_mark[k] = buf[1 + k];
+    }
+#endif
+}
+
+static bool have_hw(const Prof* p) {
+    for (int w=0; w<p->n_tiles; w++)
+        if (p->tiles[w].hw_fd >= 0) return true;
+    return false;
+}
+
+int prof_write_trace(const Prof* p, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+    double us = 1e6 / tick_hz(p);
+    int first_step = p->last_step - TS_PROFILE_TRACE_STEPS + 1;
+    bool hw = have_hw(p);
+
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"trafficsim engine\"}}");
+    for (int w=0; w<p->n_tiles; w++)
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"tile %d%s\"}}",
+                w, w, w ? "" : " (stepping thread)");
+
+    for (int w=0; w<p->n_tiles; w++) {
+        const ProfTile* pt = &p->tiles[w];
+        uint64_t n = pt->n_events < pt->ring_cap ? pt->n_events : pt->ring_cap;
+        uint64_t start = pt->n_events - n;
+        /* tile 0 also gets one enclosing event per step */
+        int step = INT32_MIN;
+        uint64_t step_t0 = 0, step_t1 = 0;
+        for (uint64_t i=start; i<=start + n; i++) {
+            const ProfEvent* ev = (i < start + n) ? &pt->ring[i % pt->ring_cap] : NULL;
+            if (ev && ev->step < first_step) continue;
+            if (w == 0 && (!ev || ev->step != step)) {
+                if (step != INT32_MIN)
+                    fprintf(f, ",\n{\"name\": \"step\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"step\": %d}}",
+                            (double)(step_t0 - p->tick0) * us, (double)(step_t1 - step_t0) * us, step);
+                if (ev) {
+                    step = ev->step;
+                    step_t0 = ev->t0;
+                }
+            }
+            if (!ev) break;
+            step_t1 = ev->t1;
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"step\": %d",
+                    phase_name[ev->phase], w, (double)(ev->t0 - p->tick0) * us, (double)(ev->t1 - ev->t0) * us, ev->step);
+            if (hw)
+                fprintf(f, ", \"cycles\": %llu, \"cache_misses\": %llu, \"branch_misses\": %llu",
+                        (unsigned long long)ev->hw[PROF_HW_CYCLES], (unsigned long long)ev->hw[PROF_HW_CACHE_MISSES],
+                        (unsigned long long)ev->hw[PROF_HW_BRANCH_MISSES]);
+            fprintf(f, "}}");
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void prof_report(const Prof* p, FILE* f) {
+    double ms = 1e3 / tick_hz(p);
+    long steps = (long)p->tiles[0].acc[PROF_SPAWN].calls;
+    bool hw = have_hw(p);
+    ProfAcc sum[PROF_N];
+    uint64_t total = 0;
+    memset(sum, 0, sizeof(sum));
+    for (int w=0; w<p->n_tiles; w++) {
+        for (int ph=0; ph<PROF_N; ph++) {
+            const ProfAcc* a = &p->tiles[w].acc[ph];
+            sum[ph].ticks += a->ticks;
+            sum[ph].calls += a->calls;
+            if (a->max_ticks > sum[ph].max_ticks) sum[ph].max_ticks = a->max_ticks;
+            for (int k=0; k<PROF_HW_N; k++) sum[ph].hw[k] += a->hw[k];
+            total += a->ticks;
+        }
+    }
+    fprintf(f, "profile: %ld steps, %d tiles, %.2f GHz ticks, counters %s; time summed over tiles\n",
+            steps, p->n_tiles, tick_hz(p) * 1e-9,
+#ifdef TS_PROFILE_COUNTERS
+            hw ? "on" : "unavailable"
+#else
+            "off"
+#endif
+            );
+    fprintf(f, "  %-8s %11s %7s %10s %10s", "phase", "total ms", "share", "us/step", "max us");
+    if (hw) fprintf(f, " %12s %12s %12s", "cycles/step", "cmiss/step", "bmiss/step");
+    fputc('\n', f);
+    for (int ph=0; ph<PROF_N; ph++) {
+        if (!sum[ph].calls) continue;
+        double t = (double)sum[ph].ticks * ms;
+        fprintf(f, "  %-8s %11.2f %6.1f%% %10.2f %10.1f", phase_name[ph], t,
+                total ? 100.0 * (double)sum[ph].ticks / (double)total : 0.0,
+                steps ? 1e3 * t / (double)steps : 0.0, 1e3 * (double)sum[ph].max_ticks * ms);
+        if (hw)
+            fprintf(f, " %12.0f %12.1f %12.1f", steps ? (double)sum[ph].hw[PROF_HW_CYCLES] / (double)steps : 0.0,
+                    steps ? (double)sum[ph].hw[PROF_HW_CACHE_MISSES] / (double)steps : 0.0,
+                    steps ? (double)sum[ph].hw[PROF_HW_BRANCH_MISSES] / (double)steps : 0.0);
+        fputc('\n', f);
+    }
+}
+#endif
@@ -0,0 +1,415 @@
+// py_trafficsim.c
+/* CPython extension over libtrafficsim (module _trafficsim).
+
+   Sim(config: dict) runs one instance in-process (from a saved checkpoint
+   with checkpoint=path; sim.fork(config) branches a running one). State arrays are
+   exported as read-only buffer objects (PEP 3118) that point straight into
+   the engine's memory and keep the Sim alive, so numpy.asarray(sim.view(n))
+   is a zero-copy array. Nothing here depends on numpy at build time. */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stddef.h>
+#include "trafficsim.h"
+
+_Static_assert(sizeof(Phase) == sizeof(int), "light.phase is exported as int32");
+_Static_assert(sizeof(Cell) == sizeof(int32_t), "cells are exported as int32");
+
+typedef struct {
+    PyObject_HEAD
+    TsSim* ts;
+    bool busy;   /* stepping with the GIL released */
+} SimObject;
+
+static bool sim_ready(SimObject* self) {
+    if (!self->ts) {
+        PyErr_SetString(PyExc_RuntimeError, "Sim is not initialized");
+        return false;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Sim is being stepped by another thread");
+        return false;
+    }
+    return true;
+}
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* owner;   /* the Sim whose memory buf points into */
+    char* buf;
+    Py_ssize_t n;
+    Py_ssize_t stride;
+    Py_ssize_t itemsize;
+    const char* format;
+} ViewObject;
+
+/* ---------------- views ---------------- */
+
+static int view_getbuffer(PyObject* self, Py_buffer* b, int flags) {
+    ViewObject* v = (ViewObject*)self;
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "simulator views are read-only");
+        return -1;
+    }
+    bool contiguous = (v->stride == v->itemsize);
+    if (!contiguous && !(flags & PyBUF_STRIDES)) {
+        PyErr_SetString(PyExc_BufferError, "view is strided");
+        return -1;
+    }
+    b->buf = v->buf;
+    b->obj = self;
+    Py_INCREF(self);
+    b->len = v->n * v->itemsize;
+    b->itemsize = v->itemsize;
+    b->readonly = 1;
+    b->ndim = 1;
+    b->format = (flags & PyBUF_FORMAT) ? (char*)v->format : NULL;
+    b->shape = (flags & PyBUF_ND) ? &v->n : NULL;
+    b->strides = (flags & PyBUF_STRIDES) ? &v->stride : NULL;
+    b->suboffsets = NULL;
+    b->internal = NULL;
+    return 0;
+}
+
+static void view_dealloc(ViewObject* v) {
+    Py_XDECREF(v->owner);
+    Py_TYPE(v)->tp_free((PyObject*)v);
+}
+
+static Py_ssize_t view_len(PyObject* self) {
+    return ((ViewObject*)self)->n;
+}
+
+static PyBufferProcs view_as_buffer = { view_getbuffer, NULL };
+static PySequenceMethods view_as_sequence = { .sq_length = view_len };
+
+static PyTypeObject ViewType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_trafficsim.View",
+    .tp_basicsize = sizeof(ViewObject),
+    .tp_dealloc = (destructor)view_dealloc,
+    .tp_as_buffer = &view_as_buffer,
+    .tp_as_sequence = &view_as_sequence,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "read-only buffer into simulator memory",
+};
+
+typedef enum {
+    SRC_OCC, SRC_CELLS, SRC_LINKS, SRC_INTERS, SRC_LIGHTS,
+    SRC_STOP_COUNT, SRC_HEAD_COUNT, SRC_QUEUE_SUM, SRC_QUEUE_MAX, SRC_TT_COUNTS, SRC_TT_SUMS
+} ViewSource;
+
+typedef struct {
+    const char* name;
+    ViewSource src;
+    size_t offset;      /* field offset within a struct element */
+    const char* format;
+    Py_ssize_t itemsize;
+} ViewDef;
+
+static const ViewDef VIEWS[] = {
+    { "occupancy",           SRC_OCC,          0,                                     "Q", 8 },
+    { "cells",               SRC_CELLS,        offsetof(Cell, vehicle_id),            "i", 4 },
+    { "link.from",           SRC_LINKS,        offsetof(Link, from),                  "i", 4 },
+    { "link.to",             SRC_LINKS,        offsetof(Link, to),                    "i", 4 },
+    { "link.n_cells",        SRC_LINKS,        offsetof(Link, n_cells),               "i", 4 },
+    { "link.cell_off",       SRC_LINKS,        offsetof(Link, cell_off),              "i", 4 },
+    { "link.occ_off",        SRC_LINKS,        offsetof(Link, occ_off),               "i", 4 },
+    { "link.dir",            SRC_LINKS,        offsetof(Link, dir),                   "B", 1 },
+    { "link.group",          SRC_LINKS,        offsetof(Link, group),                 "B", 1 },
+    { "link.n_lanes",        SRC_LINKS,        offsetof(Link, n_lanes),               "B", 1 },
+    { "link.stop_count",     SRC_STOP_COUNT,   0,                                     "i", 4 },
+    { "link.head_count",     SRC_HEAD_COUNT,   0,                                     "i", 4 },
+    { "inter.i",             SRC_INTERS,       offsetof(Intersection, i),             "i", 4 },
+    { "inter.j",             SRC_INTERS,       offsetof(Intersection, j),             "i", 4 },
+    { "light.phase",         SRC_LIGHTS,       offsetof(TrafficLight, phase),         "i", 4 },
+    { "light.phase_start",   SRC_LIGHTS,       offsetof(TrafficLight, phase_start),   "i", 4 },
+    { "light.next_eval",     SRC_LIGHTS,       offsetof(TrafficLight, next_eval),     "i", 4 },
+    { "queue_sum",           SRC_QUEUE_SUM,    0,                                     "d", 8 },
+    { "queue_max",           SRC_QUEUE_MAX,    0,                                     "d", 8 },
+    { "tt.counts",           SRC_TT_COUNTS,    0,                                     "Q", 8 },
+    { "tt.sums_ms",          SRC_TT_SUMS,      0,                                     "Q", 8 },
+};
+#define N_VIEWS ((int)(sizeof(VIEWS) / sizeof(VIEWS[0])))
+
+static PyObject* make_view(SimObject* owner, const ViewDef* d) {
+    TsSnapshot s;
+    ts_snapshot(owner->ts, &s);
+
+    const char* base = NULL;
+    Py_ssize_t n = 0, stride = d->itemsize;
+    switch (d->src) {
+    case SRC_OCC:          base = (const char*)s.occ;   n = (Py_ssize_t)s.n_occ_words; break;
+    case SRC_CELLS:        base = (const char*)s.cells; n = (Py_ssize_t)s.n_cells; stride = sizeof(Cell); break;
+    case SRC_LINKS:        base = (const char*)s.links; n = s.n_links; stride = sizeof(Link); break;
+    case SRC_INTERS:       base = (const char*)s.intersections; n = s.n_intersections; stride = sizeof(Intersection); break;
+    case SRC_LIGHTS:       base = (const char*)s.lights; n = s.n_intersections; stride = sizeof(TrafficLight); break;
+    case SRC_STOP_COUNT:   base = (const char*)s.stop_count; n = s.n_links; break;
+    case SRC_HEAD_COUNT:   base = (const char*)s.head_count; n = s.n_links; break;
+    case SRC_QUEUE_SUM:    base = (const char*)s.queue_sum; n = s.n_intersections; break;
+    case SRC_QUEUE_MAX:    base = (const char*)s.queue_max; n = s.n_intersections; break;
+    case SRC_TT_COUNTS:    base = (const char*)s.travel_times->counts; n = QS_N_BUCKETS; break;
+    case SRC_TT_SUMS:      base = (const char*)s.travel_times->sums_ms; n = QS_N_BUCKETS; break;
+    }
+
+    ViewObject* v = PyObject_New(ViewObject, &ViewType);
+    if (!v) return NULL;
+    Py_INCREF(owner);
+    v->owner = (PyObject*)owner;
+    v->buf = (char*)base + d->offset;
+    v->n = n;
+    v->stride = stride;
+    v->itemsize = d->itemsize;
+    v->format = d->format;
+    return (PyObject*)v;
+}
+
+/* ---------------- Sim ---------------- */
+
+static PyTypeObject SimType;
+
+/* defaults overridden by a {key: value} dict (may be NULL) */
+static int config_from_dict(Config* cfg, PyObject* dict) {
+    config_set_defaults(cfg);
+
+    PyObject *key, *val;
+    Py_ssize_t pos = 0;
+    while (dict && PyDict_Next(dict, &pos, &key, &val)) {
+        PyObject* sval = PyObject_Str(val);
+        if (!sval) return -1;
+        const char* k = PyUnicode_AsUTF8(key);
+        const char* v = PyUnicode_AsUTF8(sval);
+        int rc = (k && v) ? config_set(cfg, k, v) : -1;
+        Py_DECREF(sval);
+        if (rc != 0) {
+            if (!PyErr_Occurred()) PyErr_Format(PyExc_ValueError, "unknown config key or value: %S=%S", key, val);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int sim_init(SimObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = { "config", "checkpoint", NULL };
+    PyObject* dict = NULL;
+    const char* ck_path = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O!z", kwlist, &PyDict_Type, &dict, &ck_path)) return -1;
+    if (self->ts) {
+        /* views may still point into the current instance */
+        PyErr_SetString(PyExc_RuntimeError, "Sim is already initialized");
+        return -1;
+    }
+
+    Config cfg;
+    if (config_from_dict(&cfg, dict) != 0) return -1;
+
+    if (ck_path) {
+        TsCheckpoint* ck = ts_checkpoint_load(ck_path);
+        if (!ck) {
+            PyErr_Format(PyExc_ValueError, "cannot load checkpoint %s", ck_path);
+            return -1;
+        }
+        self->ts = ts_restore(&cfg, NULL, ck);
+        ts_checkpoint_free(ck);
+        if (!self->ts) {
+            PyErr_SetString(PyExc_ValueError, "checkpoint does not fit this configuration (see stderr)");
+            return -1;
+        }
+        return 0;
+    }
+
+    self->ts = ts_create(&cfg, NULL);
+    if (!self->ts) {
+        PyErr_SetString(PyExc_MemoryError, "ts_create failed");
+        return -1;
+    }
+    return 0;
+}
+
+static void sim_dealloc(SimObject* self) {
+    ts_destroy(self->ts);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* sim_step(SimObject* self, PyObject* args) {
+    int n = 1;
+    if (!PyArg_ParseTuple(args, "|i", &n) || !sim_ready(self)) return NULL;
+    /* other Python threads (and other Sims) run while this one steps */
+    int done;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    done = ts_step(self->ts, n);
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (done < 0) return PyErr_NoMemory();
+    return PyLong_FromLong(done);
+}
+
+static PyObject* sim_status(SimObject* self, PyObject* Py_UNUSED(ignored)) {
+    if (!sim_ready(self)) return NULL;
+    TsStatus st;
+    ts_query(self->ts, &st);
+    return Py_BuildValue("{s:d,s:i,s:O,s:i,s:l,s:l,s:l}",
+                         "t", st.t, "step", st.step, "done", st.done ? Py_True : Py_False,
+                         "n_vehicles", st.n_vehicles, "spawned", st.spawned,
+                         "exited", st.exited, "blocked_entries", st.blocked_entries);
+}
+
+static PyObject* sim_metrics(SimObject* self, PyObject* Py_UNUSED(ignored)) {
+    if (!sim_ready(self)) return NULL;
+    SimMetrics m;
+    ts_metrics(self->ts, &m);
+    return Py_BuildValue("{s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:l,s:l,s:l}",
+                         "mean_travel_time_s", m.mean_travel_time_s,
+                         "p50_travel_time_s", m.p50_travel_time_s,
+                         "p90_travel_time_s", m.p90_travel_time_s,
+                         "p95_travel_time_s", m.p95_travel_time_s,
+                         "p99_travel_time_s", m.p99_travel_time_s,
+                         "throughput_veh_per_s", m.throughput_veh_per_s,
+                         "avg_queue_veh", m.avg_queue_veh,
+                         "max_queue_veh", m.max_queue_veh,
+                         "spawned", m.spawned, "exited", m.exited,
+                         "blocked_entries", m.blocked_entries);
+}
+
+static PyObject* sim_view(SimObject* self, PyObject* args) {
+    const char* name;
+    if (!PyArg_ParseTuple(args, "s", &name) || !sim_ready(self)) return NULL;
+    for (int k=0; k<N_VIEWS; k++) {
+        if (strcmp(VIEWS[k].name, name) == 0) return make_view(self, &VIEWS[k]);
+    }
+    PyErr_Format(PyExc_KeyError, "no view named '%s'", name);
+    return NULL;
+}
+
+static PyObject* sim_view_names(SimObject* Py_UNUSED(self), PyObject* Py_UNUSED(ignored)) {
+    PyObject* l = PyList_New(N_VIEWS);
+    if (!l) return NULL;
+    for (int k=0; k<N_VIEWS; k++) PyList_SET_ITEM(l, k, PyUnicode_FromString(VIEWS[k].name));
+    return l;
+}
+
+static PyObject* sim_tt_bucket_lower_ms(SimObject* Py_UNUSED(self), PyObject* Py_UNUSED(ignored)) {
+    PyObject* l = PyList_New(QS_N_BUCKETS);
+    if (!l) return NULL;
+    for (int b=0; b<QS_N_BUCKETS; b++) PyList_SET_ITEM(l, b, PyLong_FromUnsignedLongLong(qs_bucket_lower_ms(b)));
+    return l;
+}
+
+static PyObject* sim_export_csv(SimObject* self, PyObject* args) {
+    const char* out_dir;
+    if (!PyArg_ParseTuple(args, "s", &out_dir) || !sim_ready(self)) return NULL;
+    if (ts_export_csv(self->ts, out_dir) != 0) return PyErr_SetFromErrnoWithFilename(PyExc_OSError, out_dir);
+    Py_RETURN_NONE;
+}
+
+static PyObject* sim_save_checkpoint(SimObject* self, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path) || !sim_ready(self)) return NULL;
+    TsCheckpoint* ck = ts_checkpoint(self->ts);
+    if (!ck) return PyErr_NoMemory();
+    int rc = ts_checkpoint_save(ck, path);
+    ts_checkpoint_free(ck);
+    if (rc != 0) return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+    Py_RETURN_NONE;
+}
+
+static PyObject* sim_fork(SimObject* self, PyObject* args) {
+    PyObject* dict = NULL;
+    if (!PyArg_ParseTuple(args, "|O!", &PyDict_Type, &dict) || !sim_ready(self)) return NULL;
+    Config cfg;
+    if (dict && config_from_dict(&cfg, dict) != 0) return NULL;
+
+    SimObject* branch = (SimObject*)SimType.tp_alloc(&SimType, 0);
+    if (!branch) return NULL;
+    branch->ts = ts_fork(self->ts, dict ? &cfg : NULL);
+    if (!branch->ts) {
+        Py_DECREF(branch);
+        PyErr_SetString(PyExc_ValueError, "cannot branch with this configuration (see stderr)");
+        return NULL;
+    }
+    return (PyObject*)branch;
+}
+
+static PyObject* sim_series_open(SimObject* self, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path) || !sim_ready(self)) return NULL;
+    if (ts_series_open(self->ts, path) != 0) {
+        PyErr_Format(PyExc_OSError, "cannot open time series %s (already open, export_interval <= 0 or unwritable)", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* sim_series_close(SimObject* self, PyObject* Py_UNUSED(ignored)) {
+    if (!sim_ready(self)) return NULL;
+    if (ts_series_close(self->ts) != 0) {
+        PyErr_SetString(PyExc_OSError, "time series: write error");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* sim_trajectories_open(SimObject* self, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path) || !sim_ready(self)) return NULL;
+    if (ts_trajectories_open(self->ts, path) != 0) {
+        PyErr_Format(PyExc_OSError, "cannot record trajectories to %s (already recording or unwritable)", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* sim_trajectories_close(SimObject* self, PyObject* Py_UNUSED(ignored)) {
+    if (!sim_ready(self)) return NULL;
+    if (ts_trajectories_close(self->ts) != 0) {
+        PyErr_SetString(PyExc_OSError, "trajectories: write error or out of memory");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef sim_methods[] = {
+    { "step", (PyCFunction)sim_step, METH_VARARGS, "step(n=1) -> steps run (stops at simulation.duration)" },
+    { "status", (PyCFunction)sim_status, METH_NOARGS, "time, step count, live vehicles and counters" },
+    { "metrics", (PyCFunction)sim_metrics, METH_NOARGS, "metrics.csv row over the measured window so far" },
+    { "view", (PyCFunction)sim_view, METH_VARARGS, "view(name) -> read-only buffer into engine memory" },
+    { "view_names", (PyCFunction)sim_view_names, METH_NOARGS, "names accepted by view()" },
+    { "tt_bucket_lower_ms", (PyCFunction)sim_tt_bucket_lower_ms, METH_NOARGS, "lower edge (ms) of each tt.counts bucket" },
+    { "export_csv", (PyCFunction)sim_export_csv, METH_VARARGS, "write metrics.csv and queue_heatmap.csv to a directory" },
+    { "save_checkpoint", (PyCFunction)sim_save_checkpoint, METH_VARARGS, "save_checkpoint(path): state for Sim(config, checkpoint=path)" },
+    { "series_open", (PyCFunction)sim_series_open, METH_VARARGS, "series_open(path): time series from the next step on (see series.h)" },
+    { "series_close", (PyCFunction)sim_series_close, METH_NOARGS, "flush and close the time series" },
+    { "trajectories_open", (PyCFunction)sim_trajectories_open, METH_VARARGS, "trajectories_open(path): record vehicle trajectories from the next step on (see traj.h)" },
+    { "trajectories_close", (PyCFunction)sim_trajectories_close, METH_NOARGS, "flush and close the trajectory file" },
+    { "fork", (PyCFunction)sim_fork, METH_VARARGS, "fork(config=None) -> new Sim from this state (config: full dict, None: the same)" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject SimType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_trafficsim.Sim",
+    .tp_basicsize = sizeof(SimObject),
+    .tp_dealloc = (destructor)sim_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Sim(config: dict, checkpoint: str = None) - one in-process simulation; keys as in config.kv",
+    .tp_methods = sim_methods,
+    .tp_init = (initproc)sim_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef trafficsim_module = {
+    PyModuleDef_HEAD_INIT, "_trafficsim", "in-process traffic simulator", -1, NULL, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__trafficsim(void) {
+    if (PyType_Ready(&ViewType) < 0 || PyType_Ready(&SimType) < 0) return NULL;
+    PyObject* m = PyModule_Create(&trafficsim_module);
+    if (!m) return NULL;
+    Py_INCREF(&SimType);
+    if (PyModule_AddObject(m, "Sim", (PyObject*)&SimType) < 0) {
+        Py_DECREF(&SimType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
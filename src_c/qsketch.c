@@ -0,0 +1,72 @@
+// qsketch.c
+#include "qsketch.h"
+#include <math.h>
+#include <string.h>
+
+#define QS_SUB ((uint64_t)1 << QS_SUB_BITS)
+#define QS_TOP (((uint64_t)1 << QS_MAX_BITS) - 1)
+
+/* x < 2^SUB_BITS: bucket x. Otherwise shift = msb(x) - SUB_BITS and the
+   bucket is (shift << SUB_BITS) + (x >> shift), which continues the
+   linear range and is dense */
+static int bucket_of(uint64_t x) {
+    if (x > QS_TOP) x = QS_TOP;
+    if (x < QS_SUB) return (int)x;
+    int shift = 63 - __builtin_clzll(x) - QS_SUB_BITS;
+    return (int)(((uint64_t)shift << QS_SUB_BITS) + (x >> shift));
+}
+
+uint64_t qs_bucket_lower_ms(int b) {
+    if ((uint64_t)b < 2 * QS_SUB) return (uint64_t)b;
+    int shift = (int)((uint64_t)b >> QS_SUB_BITS) - 1;
+    uint64_t mant = (uint64_t)b - ((uint64_t)shift << QS_SUB_BITS);
+    return mant << shift;
+}
+
+void qs_init(QSketch* q) {
+    memset(q, 0, sizeof(*q));
+    q->min_ms = UINT64_MAX;
+}
+
+void qs_add(QSketch* q, double v) {
+    uint64_t x = (v > 0.0) ? (uint64_t)llround(v * 1000.0) : 0;
+    int b = bucket_of(x);
+    q->counts[b]++;
+    q->sums_ms[b] += x;
+    q->n++;
+    q->total_ms += x;
+    if (x < q->min_ms) q->min_ms = x;
+    if (x > q->max_ms) q->max_ms = x;
+}
+
+void qs_merge(QSketch* dst, const QSketch* src) {
+    for (int b=0; b<QS_N_BUCKETS; b++) {
+        dst->counts[b] += src->counts[b];
+        dst->sums_ms[b] += src->sums_ms[b];
+    }
+    dst->n += src->n;
+    dst->total_ms += src->total_ms;
+    if (src->min_ms < dst->min_ms) dst->min_ms = src->min_ms;
+    if (src->max_ms > dst->max_ms) dst->max_ms = src->max_ms;
+}
+
+double qs_mean(const QSketch* q) {
+    if (q->n == 0) return 0.0;
+    return (double)q->total_ms / 1000.0 / (double)q->n;
+}
+
+double qs_quantile(const QSketch* q, double p) {
+    if (q->n == 0) return 0.0;
+    if (p < 0.0) p = 0.0;
+    if (p > 1.0) p = 1.0;
+
+    uint64_t rank = (uint64_t)(p * (double)(q->n - 1));
+    if (rank == q->n - 1) return (double)q->max_ms / 1000.0;
+
+    uint64_t seen = 0;
+    for (int b=0; b<QS_N_BUCKETS; b++) {
+        seen += q->counts[b];
+        if (seen > rank) return (double)q->sums_ms[b] / (double)q->counts[b] / 1000.0;
+    }
+    return (double)q->max_ms / 1000.0;
+}
@@ -0,0 +1,324 @@
+// ref_check.c
+// Differential check of the engine against the reference engine
+// (ref_engine.h): both run the same configuration step by step and every
+// step is compared, slot by slot (vehicle id and speed), light by light
+// (phase), plus the stopline / head window counts and the spawn and exit
+// counters. The first step that differs is reported with the link,
+// position and lane, and with the configuration as key=value lines that
+// --config takes back.
+//
+//   ref_check [--cases 50] [--seed 1] [--steps 600] [--threads N]
+//   ref_check --config case.kv [--steps N] [--threads N]
+//
+// Without --config every case draws its own configuration: grid size,
+// link length, lanes, vmax, arrival rate, slowdown and lane change
+// probabilities, routing (with or without re-weighting), controller and
+// its timing, detector window, seed and thread count. About a third of
+// the cases use a random OD file (demand.h) with period switches inside
+// the run, written next to the system's temporary files and kept when
+// the case diverges. Exit status 1 on the first divergence.
+#include "config_kv.h"
+#include "ref_engine.h"
+#include "trafficsim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_MAX_LINES 8
+
+static const char* ctrl_name[] = { "fixed", "actuated", "max_pressure" };
+static const char* routing_name[] = { "manhattan", "shortest_path" };
+static const char dir_name[] = "NESW";
+
+static void print_config(FILE* f, const Config* c) {
+    fprintf(f, "simulation.time_step=%.17g\nsimulation.duration=%.17g\nsimulation.warmup=%.17g\n",
+            c->time_step, c->duration, c->warmup);
+    fprintf(f, "simulation.random_seed=%llu\nsimulation.threads=%d\n", (unsigned long long)c->random_seed, c->threads);
+    if (c->network_file[0]) fprintf(f, "network.file=%s\n", c->network_file);
+    fprintf(f, "network.grid_size=%d\nnetwork.link_length_cells=%d\nnetwork.lanes_per_direction=%d\n",
+            c->grid_size, c->link_length_cells, c->lanes_per_direction);
+    fprintf(f, "vehicles.vmax_cells_per_step=%d\nvehicles.slowdown_probability=%.17g\n"
+               "vehicles.lane_change_probability=%.17g\n",
+            c->vmax_cells_per_step, c->slowdown_probability, c->lane_change_probability);
+    fprintf(f, "demand.arrival_rate=%.17g\ndemand.routing_randomness=%.17g\ndemand.routing_type=%s\n",
+            c->arrival_rate, c->routing_randomness, routing_name[c->routing_type]);
+    fprintf(f, "demand.routing_update_interval=%.17g\ndemand.routing_reweight_threshold=%.17g\n",
+            c->routing_update_interval, c->routing_reweight_threshold);
+    if (c->routing_destinations[0]) fprintf(f, "demand.routing_destinations=%s\n", c->routing_destinations);
+    if (c->od_file[0]) fprintf(f, "demand.od_file=%s\n", c->od_file);
+    fprintf(f, "traffic_lights.controller=%s\ntraffic_lights.queue_window_cells=%d\n",
+            ctrl_name[c->controller], c->queue_window_cells);
+    fprintf(f, "traffic_lights.fixed.cycle_time=%.17g\ntraffic_lights.fixed.green_ns=%.17g\n", c->cycle_time, c->green_ns);
+    fprintf(f, "traffic_lights.actuated.min_green=%.17g\ntraffic_lights.actuated.max_green=%.17g\n"
+               "traffic_lights.actuated.queue_threshold=%d\n",
+            c->act_min_green, c->act_max_green, c->act_queue_threshold);
+    fprintf(f, "traffic_lights.max_pressure.min_green=%.17g\ntraffic_lights.max_pressure.max_green=%.17g\n",
+            c->mp_min_green, c->mp_max_green);
+}
+
+/* ---- random cases ---- */
+
+typedef struct {
+    RngKey key;
+    uint32_t ctr, n;
+} Draws;
+
+static double draw(Draws* d) {
+    return rng_cb_uniform01(d->key, d->ctr, d->n++, 0, 0);
+}
+
+static int draw_int(Draws* d, int lo, int hi) {
+    return lo + (int)(draw(d) * (double)(hi - lo + 1));
+}
+
+/* one of a few round values, so reported cases are easy to read */
+static double draw_of(Draws* d, const double* v, int n) {
+    return v[draw_int(d, 0, n - 1)];
+}
+
+/* periods switching within the first steps, origins by side and by entry
+   link, sides and routing destinations as destinations, rates up to
+   above one vehicle per step; -1 if the file cannot be written */
+static int random_od(Draws* d, const Config* c, int steps, const char* path) {
+    static const double rates[] = { 0.0, 0.02, 0.1, 0.3, 0.6, 3.0 };
+    static const char sides[] = "NESW";
+    Topology topo;
+    if (topology_init(&topo, c) != 0) return -1;
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        topology_free(&topo);
+        return -1;
+    }
+    long node = c->routing_destinations[0] ? atol(c->routing_destinations) : -1;
+    int n_periods = draw_int(d, 1, 3);
+    double at = 0.0;
+    for (int p=0; p<n_periods; p++) {
+        fprintf(f, "at %.17g\n", at);
+        int n = draw_int(d, 1, 6);
+        for (int i=0; i<n; i++) {
+            if (draw(d) < 0.7) fprintf(f, "%c ", sides[draw_int(d, 0, 3)]);
+            else fprintf(f, "%d ", topo.entry_links[draw_int(d, 0, topo.n_entry_links - 1)]);
+            if (node >= 0 && draw(d) < 0.4) fprintf(f, "%ld ", node);
+            else fprintf(f, "%c ", sides[draw_int(d, 0, 3)]);
+            fprintf(f, "%g\n", draw_of(d, rates, 6));
+        }
+        at += c->time_step * (double)draw_int(d, 1, steps / n_periods + 1);
+    }
+    topology_free(&topo);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+static void random_config(Config* c, uint64_t seed, int k, int steps, const char* od_path) {
+    static const double rates[] = { 0.02, 0.05, 0.1, 0.2, 0.35, 0.5, 0.8 };
+    static const double probs[] = { 0.0, 0.1, 0.2, 0.3, 0.5 };
+    static const double dts[] = { 0.5, 1.0, 0.25, 0.7 };
+    Draws d = { rng_key(seed), (uint32_t)k, 0 };
+
+    config_set_defaults(c);
+    c->time_step = draw_of(&d, dts, 4);
+    c->duration = 1e9;
+    c->warmup = 0;
+    c->random_seed = (uint64_t)draw_int(&d, 1, 1000000);
+    c->threads = draw_int(&d, 1, 4);
+
+    c->grid_size = draw_int(&d, 1, 8);
+    c->link_length_cells = draw_int(&d, 3, 40);
+    c->lanes_per_direction = (draw(&d) < 0.5) ? 1 : draw_int(&d, 2, 3);
+
+    c->vmax_cells_per_step = draw_int(&d, 1, 5);
+    c->slowdown_probability = draw_of(&d, probs, 5);
+    c->lane_change_probability = (draw(&d) < 0.3) ? 1.0 : draw_of(&d, probs, 5);
+
+    c->arrival_rate = draw_of(&d, rates, 7);
+    c->routing_randomness = draw_of(&d, probs, 5);
+    c->routing_type = (draw(&d) < 0.5) ? ROUTING_MANHATTAN : ROUTING_SHORTEST_PATH;
+    if (c->routing_type == ROUTING_SHORTEST_PATH && draw(&d) < 0.6)
+        c->routing_update_interval = (double)draw_int(&d, 1, 60);
+
+    c->controller = (ControllerType)draw_int(&d, 0, 2);
+    c->queue_window_cells = draw_int(&d, 0, 8);
+    c->cycle_time = (double)draw_int(&d, 4, 90);
+    c->green_ns = c->cycle_time * draw(&d);
+    c->act_min_green = (double)draw_int(&d, 0, 15);
+    c->act_max_green = c->act_min_green + (double)draw_int(&d, 0, 40);
+    c->act_queue_threshold = draw_int(&d, 0, 6);
+    c->mp_min_green = (double)draw_int(&d, 0, 10);
+    c->mp_max_green = c->mp_min_green + (double)draw_int(&d, 0, 45);
+
+    if (c->routing_type == ROUTING_SHORTEST_PATH && draw(&d) < 0.5)
+        snprintf(c->routing_destinations, sizeof(c->routing_destinations), "%d",
+                 draw_int(&d, 0, c->grid_size * c->grid_size - 1));
+    if (draw(&d) < 0.35 && random_od(&d, c, steps, od_path) == 0)
+        snprintf(c->od_file, sizeof(c->od_file), "%s", od_path);
+}
+
+/* ---- comparison ---- */
+
+static bool snap_occupied(const TsSnapshot* s, const Link* L, int slot) {
+    return (s->occ[L->occ_off + (slot >> 6)] >> (slot & 63)) & 1u;
+}
+
+static int ref_count(const RefSim* r, const Link* L, int lo, int hi) {
+    if (lo < 0) lo = 0;
+    if (hi > L->n_cells) hi = L->n_cells;
+    int n = 0;
+    for (int s=lo * L->n_lanes; s<hi * L->n_lanes; s++) n += (ref_vehicle_at(r, L, s) != INVALID_ID);
+    return n;
+}
+
+static void link_name(char* buf, size_t n, const Link* L) {
+    char from[16] = "entry", to[16] = "exit";
+    if (L->from != INVALID_ID) snprintf(from, sizeof(from), "%d", L->from);
+    if (L->to != INVALID_ID) snprintf(to, sizeof(to), "%d", L->to);
+    snprintf(buf, n, "link %d (%s -> %s, heading %c, %d lanes)", L->id, from, to, dir_name[L->dir & 3], L->n_lanes);
+}
+
+/* number of differences after the step just run, the first few printed
+   to f unless it is NULL */
+static int compare(const TsSim* ts, const RefSim* r, FILE* f) {
+    TsSnapshot s;
+    ts_snapshot(ts, &s);
+    int n = 0;
+    char name[96];
+
+    for (int l=0; l<s.n_links; l++) {
+        const Link* L = &s.links[l];
+        for (int slot=0; slot<L->n_cells * L->n_lanes; slot++) {
+            int a = snap_occupied(&s, L, slot) ? s.cells[L->cell_off + slot].vehicle_id : INVALID_ID;
+            int b = ref_vehicle_at(r, L, slot);
+            int va = (a >= 0) ? s.vehicle_speed[a] : -1;
+            int vb = (b >= 0) ? r->veh[b].speed : -1;
+            if (a == b && va == vb) continue;
+            if (n++ < CHECK_MAX_LINES && f) {
+                link_name(name, sizeof(name), L);
+                fprintf(f, "  %s, position %d lane %d: engine ", name, slot / L->n_lanes, slot % L->n_lanes);
+                if (a >= 0) fprintf(f, "vehicle %d speed %d", a, va);
+                else fprintf(f, "empty");
+                fprintf(f, ", reference ");
+                if (b >= 0) fprintf(f, "vehicle %d speed %d\n", b, vb);
+                else fprintf(f, "empty\n");
+            }
+        }
+        int stop = ref_count(r, L, L->n_cells - s.k_cells, L->n_cells);
+        int head = ref_count(r, L, 0, s.k_cells);
+        if (s.stop_count[l] != stop || s.head_count[l] != head) {
+            if (n++ < CHECK_MAX_LINES && f) {
+                link_name(name, sizeof(name), L);
+                fprintf(f, "  %s windows: engine stop %d head %d, reference stop %d head %d\n",
+                        name, s.stop_count[l], s.head_count[l], stop, head);
+            }
+        }
+    }
+    for (int i=0; i<s.n_intersections; i++) {
+        if (s.lights[i].phase == r->lights[i].phase) continue;
+        if (n++ < CHECK_MAX_LINES && f)
+            fprintf(f, "  light %d: engine %s, reference %s (phase began at step %d / %d)\n", i,
+                    s.lights[i].phase == PHASE_NS ? "NS" : "EW", r->lights[i].phase == PHASE_NS ? "NS" : "EW",
+                    s.lights[i].phase_start, r->lights[i].phase_start);
+    }
+
+    TsStatus st;
+    ts_query(ts, &st);
+    if (st.spawned != r->spawned || st.exited != r->exited || st.blocked_entries != r->blocked_entries
+        || st.n_vehicles != r->n_vehicles) {
+        if (n++ < CHECK_MAX_LINES && f)
+            fprintf(f, "  counters: engine %d live, %ld spawned, %ld exited, %ld blocked; "
+                       "reference %d, %ld, %ld, %ld\n",
+                    st.n_vehicles, st.spawned, st.exited, st.blocked_entries,
+                    r->n_vehicles, r->spawned, r->exited, r->blocked_entries);
+    }
+    if (n > CHECK_MAX_LINES && f) fprintf(f, "  ... %d differences in all\n", n);
+    return n;
+}
+
+/* 0 if both engines agree for steps steps, 1 on a divergence, -1 if the
+   case could not be set up */
+static int run_case(const Config* cfg, int steps, const char* label, long* vehicle_steps) {
+    Topology topo;
+    if (topology_init(&topo, cfg) != 0) {
+        fprintf(stderr, "%s: cannot build the network\n", label);
+        return -1;
+    }
+    TsSim* ts = ts_create(cfg, &topo);
+    RefSim ref;
+    if (!ts || ref_init(&ref, cfg, &topo) != 0) {
+        fprintf(stderr, "%s: cannot set up the engines\n", label);
+        ts_destroy(ts);
+        topology_free(&topo);
+        return -1;
+    }
+
+    int rc = 0;
+    for (int k=0; k<steps; k++) {
+        double t = ref.t;
+        int ran = ts_step(ts, 1);
+        if (ran < 0) {
+            fprintf(stderr, "%s: engine step failed at step %d\n", label, k);
+            rc = -1;
+            break;
+        }
+        if (ran != 1) break;
+        ref_step(&ref);
+        *vehicle_steps += ref.n_vehicles;
+        if (compare(ts, &ref, NULL) != 0) {
+            printf("%s: diverged at step %d (t = %g s), the first step that differs\n", label, k, t);
+            compare(ts, &ref, stdout);
+            printf("config:\n");
+            print_config(stdout, cfg);
+            rc = 1;
+            break;
+        }
+    }
+    ref_free(&ref);
+    ts_destroy(ts);
+    topology_free(&topo);
+    return rc;
+}
+
+static const char* get_arg(int argc, char** argv, const char* key, const char* def) {
+    for (int i=1;i<argc-1;i++) {
+        if (strcmp(argv[i], key)==0) return argv[i+1];
+    }
+    return def;
+}
+
+int main(int argc, char** argv) {
+    const char* cfg_path = get_arg(argc, argv, "--config", NULL);
+    int cases = atoi(get_arg(argc, argv, "--cases", "50"));
+    uint64_t seed = (uint64_t)strtoull(get_arg(argc, argv, "--seed", "1"), NULL, 10);
+    int steps = atoi(get_arg(argc, argv, "--steps", "600"));
+    int threads = atoi(get_arg(argc, argv, "--threads", "0"));
+    if (cases < 1 || steps < 1 || threads < 0) {
+        fprintf(stderr, "usage: %s [--cases N] [--seed S] [--steps N] [--threads N] [--config case.kv]\n", argv[0]);
+        return 2;
+    }
+
+    long vehicle_steps = 0;
+    if (cfg_path) {
+        Config cfg;
+        if (config_load_kv(&cfg, cfg_path) != 0) {
+            fprintf(stderr, "Failed to load config: %s\n", cfg_path);
+            return 2;
+        }
+        if (threads) cfg.threads = threads;
+        int rc = run_case(&cfg, steps, cfg_path, &vehicle_steps);
+        if (rc == 0) printf("%s: %d steps agree (%ld vehicle-steps)\n", cfg_path, steps, vehicle_steps);
+        return rc == 0 ? 0 : (rc > 0 ? 1 : 2);
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    for (int k=0; k<cases; k++) {
+        Config cfg;
+        char od_path[200];
+        snprintf(od_path, sizeof(od_path), "%s/ref_check_%ld_%d.od", tmp ? tmp : "/tmp", (long)getpid(), k);
+        random_config(&cfg, seed, k, steps, od_path);
+        if (threads) cfg.threads = threads;
+        char label[64];
+        snprintf(label, sizeof(label), "case %d (--seed %llu)", k, (unsigned long long)seed);
+        int rc = run_case(&cfg, steps, label, &vehicle_steps);
+        if (cfg.od_file[0] && rc == 0) remove(cfg.od_file);
+        if (rc != 0) return rc > 0 ? 1 : 2;
+    }
+    printf("ref_check: %d cases x %d steps agree (%ld vehicle-steps)\n", cases, steps, vehicle_steps);
+    return 0;
+}
@@ -0,0 +1,485 @@
+// ref_engine.c
+#include "ref_engine.h"
+#include "engine.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int grow(void** p, int* cap, int need, size_t elem) {
+    if (need <= *cap) return 0;
+    int c = *cap ? *cap : 64;
+    while (c < need) c *= 2;
+    void* q = realloc(*p, elem * (size_t)c);
+    if (!q) return -1;
+    *p = q;
+    *cap = c;
+    return 0;
+}
+
+/* ---------- vehicles ---------- */
+
+static int ref_alloc(RefSim* r) {
+    if (r->n_free > 0) return r->free_ids[--r->n_free];
+    if (r->next_id == r->veh_cap) {
+        int cap = r->veh_cap;
+        if (grow((void**)&r->veh, &cap, r->next_id + 1, sizeof(RefVehicle)) != 0) return -1;
+        int32_t* f = (int32_t*)realloc(r->free_ids, sizeof(int32_t) * (size_t)cap);
+        if (!f) return -1;
+        r->free_ids = f;
+        r->veh_cap = cap;
+    }
+    return r->next_id++;
+}
+
+static void ref_release(RefSim* r, int id) {
+    r->veh[id].live = false;
+    r->free_ids[r->n_free++] = id;
+    r->n_vehicles--;
+}
+
+static void ref_place(RefSim* r, const Link* L, int slot, int id) {
+    r->cells[L->cell_off + slot] = id;
+    r->veh[id].link = L->id;
+    r->veh[id].slot = slot;
+}
+
+static void ref_vacate(RefSim* r, const Link* L, int slot) {
+    r->cells[L->cell_off + slot] = INVALID_ID;
+}
+
+/* ---------- counting, for the lights ---------- */
+
+/* vehicles at positions [lo, hi) of L, all lanes */
+static int count_positions(const RefSim* r, const Link* L, int lo, int hi) {
+    if (lo < 0) lo = 0;
+    if (hi > L->n_cells) hi = L->n_cells;
+    int n = 0;
+    for (int s=lo * L->n_lanes; s<hi * L->n_lanes; s++) n += (ref_vehicle_at(r, L, s) != INVALID_ID);
+    return n;
+}
+
+static int stop_count(const RefSim* r, const Link* L) {
+    return count_positions(r, L, L->n_cells - r->g.k_cells, L->n_cells);
+}
+
+static int head_count(const RefSim* r, const Link* L) {
+    return count_positions(r, L, 0, r->g.k_cells);
+}
+
+static int group_queue(const RefSim* r, int node, Phase ph) {
+    const Grid* g = &r->g;
+    int q = 0;
+    for (int32_t k=g->in_off[node]; k<g->in_off[node + 1]; k++) {
+        const Link* L = &g->links[g->in_links[k]];
+        if (L->group == ph) q += (stop_count(r, L) + L->n_lanes - 1) / L->n_lanes;
+    }
+    return q;
+}
+
+static int group_pressure(const RefSim* r, int node, Phase ph) {
+    const Grid* g = &r->g;
+    int p = 0;
+    for (int32_t k=g->in_off[node]; k<g->in_off[node + 1]; k++) {
+        const Link* L = &g->links[g->in_links[k]];
+        if (L->group == ph) p += stop_count(r, L);
+    }
+    for (int32_t k=g->out_off[node]; k<g->out_off[node + 1]; k++) {
+        const Link* L = &g->links[g->out_links[k]];
+        if (L->group == ph) p -= head_count(r, L);
+    }
+    return p;
+}
+
+/* smallest k >= 1 with k * dt >= x */
+static int32_t steps_for(double x, double dt) {
+    if (!(x > dt)) return 1;
+    int32_t n = 1;
+    while ((double)n * dt < x && n < (1 << 30)) n++;
+    return n;
+}
+
+/* every light, every step: fixed plans from the clock, adaptive lights
+   from counted queues once min_green has passed */
+static void ref_lights(RefSim* r) {
+    double dt = r->cfg.time_step;
+    for (int i=0; i<r->g.n_intersections; i++) {
+        TrafficLight* tl = &r->lights[i];
+        if (tl->type == CTRL_FIXED) {
+            tl->phase = (fmod(r->t, tl->cycle_time) < tl->green_ns) ? PHASE_NS : PHASE_EW;
+            continue;
+        }
+        if (r->step < tl->phase_start + steps_for(tl->min_green, dt)) continue;
+        bool force = r->step >= tl->phase_start + steps_for(tl->max_green, dt);
+        Phase next;
+        bool restart;
+        if (tl->type == CTRL_ACTUATED) {
+            int qNS = group_queue(r, i, PHASE_NS), qEW = group_queue(r, i, PHASE_EW);
+            Phase other = (tl->phase == PHASE_NS) ? PHASE_EW : PHASE_NS;
+            int lead = (other == PHASE_NS) ? qNS - qEW : qEW - qNS;
+            restart = force || lead > tl->queue_threshold;
+            next = other;
+        } else {
+            int pNS = group_pressure(r, i, PHASE_NS), pEW = group_pressure(r, i, PHASE_EW);
+            next = (pNS >= pEW) ? PHASE_NS : PHASE_EW;
+            restart = force || next != tl->phase;
+        }
+        if (restart) {
+            tl->phase = next;
+            tl->phase_start = r->step;
+        }
+    }
+}
+
+/* ---------- routes ---------- */
+
+static int turn_toward(const Grid* g, const Link* L, int d) {
+    for (int32_t k=g->turn_off[L->id]; k<g->turn_off[L->id + 1]; k++)
+        if (g->links[g->turns[k]].dir == d) return g->turns[k];
+    return INVALID_ID;
+}
+
+static int first_turn(const Grid* g, const Link* L) {
+    return (g->turn_off[L->id] < g->turn_off[L->id + 1]) ? g->turns[g->turn_off[L->id]] : INVALID_ID;
+}
+
+static bool arrives(const RefSim* r, const Link* L, int dest) {
+    if (L->to == INVALID_ID) return true;
+    if (r->routed) return routing_hop(&r->route, dest, L->id) == ROUTE_ARRIVE;
+    return (r->g.intersections[L->to].exit_mask >> dest) & 1u;
+}
+
+static int choose_out(const RefSim* r, int id, int dest, const Link* L) {
+    const Grid* g = &r->g;
+    uint32_t step = (uint32_t)r->step;
+    if (r->routed) {
+        uint8_t hop = routing_hop(&r->route, dest, L->id);
+        if (hop != ROUTE_NONE) return g->turns[g->turn_off[L->id] + hop];
+        if (dest >= ROUTE_SIDES) return first_turn(g, L);
+    }
+    if (rng_cb_uniform01(r->rng, step, (uint32_t)id, RNG_ROUTE, 0) < r->cfg.routing_randomness) {
+        for (int tries=0; tries<4; tries++) {
+            int d = (int)(rng_cb_uniform01(r->rng, step, (uint32_t)id, RNG_ROUTE, 1u + (uint32_t)tries) * 4.0);
+            int out = turn_toward(g, L, d);
+            if (out != INVALID_ID) return out;
+        }
+    }
+    int out = turn_toward(g, L, dest);
+    return (out != INVALID_ID) ? out : first_turn(g, L);
+}
+
+/* ---------- one step ---------- */
+
+static void ref_spawn_on(RefSim* r, const Link* L, int dest) {
+    int lane = 0;
+    while (lane < L->n_lanes && ref_vehicle_at(r, L, lane) != INVALID_ID) lane++;
+    if (lane == L->n_lanes) {
+        r->blocked_entries++;
+        return;
+    }
+    int id = ref_alloc(r);
+    if (id < 0) return;
+    RefVehicle* v = &r->veh[id];
+    v->live = true;
+    v->speed = 0;
+    v->vmax = r->cfg.vmax_cells_per_step;
+    v->dest = dest;
+    v->entry_time = r->t;
+    ref_place(r, L, lane, id);
+    r->n_vehicles++;
+    r->spawned++;
+}
+
+static void ref_spawn(RefSim* r) {
+    const Grid* g = &r->g;
+    if (r->od) {
+        const Demand* d = &r->demand;
+        int p = demand_period_at(d, r->t);
+        if (p != r->od_period) {
+            r->od_period = p;
+            for (int k=0; k<g->n_entry_links; k++) r->od_next[k] = demand_next_arrival(d, p, k, r->step, 2);
+        }
+        for (int k=0; k<g->n_entry_links; k++) {
+            if (r->od_next[k] != r->step) continue;
+            ref_spawn_on(r, &g->links[g->entry_links[k]], demand_destination(d, p, k, r->step));
+            r->od_next[k] = demand_next_arrival(d, p, k, r->step + 1, 0);
+        }
+        return;
+    }
+
+    double p = r->cfg.arrival_rate * r->cfg.time_step;
+    for (int k=0; k<g->n_entry_links; k++) {
+        const Link* L = &g->links[g->entry_links[k]];
+        if (rng_cb_uniform01(r->rng, (uint32_t)r->step, (uint32_t)L->id, RNG_SPAWN, 0) < p)
+            ref_spawn_on(r, L, L->dir);   /* the side its entry link points to */
+    }
+}
+
+/* forward by sp positions if the target slot is free */
+static void ref_move(RefSim* r, const Link* L, int id, int s, int sp) {
+    int tgt = s + sp * L->n_lanes;
+    if (ref_vehicle_at(r, L, tgt) != INVALID_ID) return;
+    ref_vacate(r, L, s);
+    ref_place(r, L, tgt, id);
+    if (s < L->n_lanes) {
+        if (r->vacated_step[L->id] != r->step) {
+            r->vacated_step[L->id] = r->step;
+            r->vacated_lanes[L->id] = 0;
+        }
+        r->vacated_lanes[L->id] |= (uint8_t)(1u << s);
+    }
+}
+
+static int slowdown(const RefSim* r, int sp, double u) {
+    return (sp > 0 && u < r->cfg.slowdown_probability) ? sp - 1 : sp;
+}
+
+/* the vehicle at position c of lane with gap free positions ahead */
+static void ref_update(RefSim* r, const Link* L, int id, int c, int lane, int gap) {
+    RefVehicle* v = &r->veh[id];
+    int s = c * L->n_lanes + lane;
+    int sp = v->speed + 1 < v->vmax ? v->speed + 1 : v->vmax;
+    int dist = L->stopline_cell - c;
+    int allowed = gap < dist ? gap : dist;
+    double u = rng_cb_uniform01(r->rng, (uint32_t)r->step, (uint32_t)id, RNG_SLOWDOWN, 0);
+
+    if (sp > dist) {
+        if (L->to != INVALID_ID && r->lights[L->to].phase != (Phase)L->group) {
+            allowed = dist;
+        } else if (arrives(r, L, v->dest)) {
+            v->speed = 0;
+            if (grow((void**)&r->exits, &r->cap_exits, r->n_exits + 1, sizeof(RefExit)) == 0)
+                r->exits[r->n_exits++] = (RefExit){ L->id, id };
+            return;
+        } else {
+            int out = choose_out(r, id, v->dest, L);
+            if (out == INVALID_ID) {
+                allowed = dist;
+            } else {
+                int out_lanes = r->g.links[out].n_lanes;
+                if (grow((void**)&r->cross, &r->cap_cross, r->n_cross + 1, sizeof(RefCross)) != 0) return;
+                RefCross* x = &r->cross[r->n_cross++];
+                x->id = id;
+                x->src_link = L->id;
+                x->src_slot = s;
+                x->dst_link = out;
+                x->dst_lane = lane < out_lanes ? lane : out_lanes - 1;
+                x->key = ((int64_t)L->id << 32) | (uint32_t)(INT32_MAX - s);
+                x->sp_cross = slowdown(r, sp, u);
+                x->sp_blocked = slowdown(r, sp < dist ? sp : dist, u);
+                x->outcome = CROSS_BLOCKED;
+                return;
+            }
+        }
+    }
+
+    if (sp > allowed) sp = allowed;
+    sp = slowdown(r, sp, u);
+    v->speed = sp;
+    if (sp > 0) ref_move(r, L, id, s, sp);
+}
+
+static bool lane_clear_behind(const RefSim* r, const Link* L, int c, int k) {
+    for (int b=1; b<=r->cfg.vmax_cells_per_step && b<=c; b++)
+        if (ref_vehicle_at(r, L, (c - b) * L->n_lanes + k) != INVALID_ID) return false;
+    return true;
+}
+
+/* the lane the vehicle at position c of lane drives on this step */
+static int ref_change_lane(RefSim* r, const Link* L, int id, int c, int lane, const int* next_occ) {
+    const RefVehicle* v = &r->veh[id];
+    int nl = L->n_lanes;
+    int want = v->speed + 1 < v->vmax ? v->speed + 1 : v->vmax;
+    int best = lane, best_gap = next_occ[lane] - c - 1;
+    if (best_gap >= want) return lane;
+    for (int k=lane-1; k<=lane+1; k+=2) {
+        if (k < 0 || k >= nl) continue;
+        int gap = next_occ[k] - c - 1;
+        if (gap > best_gap && ref_vehicle_at(r, L, c * nl + k) == INVALID_ID && lane_clear_behind(r, L, c, k)) {
+            best = k;
+            best_gap = gap;
+        }
+    }
+    if (best == lane
+        || rng_cb_uniform01(r->rng, (uint32_t)r->step, (uint32_t)id, RNG_LANE, 0) >= r->cfg.lane_change_probability)
+        return lane;
+    ref_vacate(r, L, c * nl + lane);
+    ref_place(r, L, c * nl + best, id);
+    return best;
+}
+
+/* every vehicle of L, downstream first; gaps are to the start-of-step
+   position of the vehicle ahead in the lane */
+static void ref_sweep_link(RefSim* r, const Link* L) {
+    int nl = L->n_lanes;
+    int next_occ[MAX_LANES];
+    for (int k=0; k<nl; k++) next_occ[k] = L->n_cells;
+    for (int c=L->n_cells-1; c>=0; c--) {
+        int ids[MAX_LANES];
+        for (int k=0; k<nl; k++) ids[k] = ref_vehicle_at(r, L, c * nl + k);
+        for (int k=nl-1; k>=0; k--) {
+            if (ids[k] == INVALID_ID) continue;
+            int lane = (nl > 1) ? ref_change_lane(r, L, ids[k], c, k, next_occ) : k;
+            int gap = next_occ[lane] - c - 1;
+            next_occ[lane] = c;
+            ref_update(r, L, ids[k], c, lane, gap);
+        }
+    }
+}
+
+/* crossings: a target lane must be free (and not emptied by a move this
+   step); of the crossings into one lane the lowest key wins */
+static void ref_cross(RefSim* r) {
+    for (int k=0; k<r->n_cross; k++) {
+        RefCross* x = &r->cross[k];
+        const Link* out = &r->g.links[x->dst_link];
+        bool vacated = r->vacated_step[out->id] == r->step && ((r->vacated_lanes[out->id] >> x->dst_lane) & 1u);
+        x->outcome = (ref_vehicle_at(r, out, x->dst_lane) != INVALID_ID || vacated) ? CROSS_BLOCKED : CROSS_LOST;
+    }
+    for (int k=0; k<r->n_cross; k++) {
+        RefCross* x = &r->cross[k];
+        if (x->outcome == CROSS_BLOCKED) continue;
+        bool best = true;
+        for (int j=0; j<r->n_cross && best; j++) {
+            const RefCross* y = &r->cross[j];
+            best = !(y->outcome != CROSS_BLOCKED && y->dst_link == x->dst_link && y->dst_lane == x->dst_lane
+                     && y->key < x->key);
+        }
+        if (best) x->outcome = CROSS_WON;
+    }
+    for (int k=0; k<r->n_cross; k++) {
+        const RefCross* x = &r->cross[k];
+        if (x->outcome != CROSS_WON) continue;
+        ref_place(r, &r->g.links[x->dst_link], x->dst_lane, x->id);
+        r->veh[x->id].speed = x->sp_cross;
+    }
+    for (int k=0; k<r->n_cross; k++) {
+        const RefCross* x = &r->cross[k];
+        const Link* src = &r->g.links[x->src_link];
+        if (x->outcome == CROSS_WON) {
+            ref_vacate(r, src, x->src_slot);
+            if (r->departures) r->departures[x->src_link]++;
+        } else if (x->outcome == CROSS_LOST) {
+            r->veh[x->id].speed = x->sp_cross;
+        } else {
+            r->veh[x->id].speed = x->sp_blocked;
+            if (x->sp_blocked > 0) ref_move(r, src, x->id, x->src_slot, x->sp_blocked);
+        }
+    }
+    r->n_cross = 0;
+}
+
+static int cmp_exit(const void* a, const void* b) {
+    const RefExit* x = (const RefExit*)a;
+    const RefExit* y = (const RefExit*)b;
+    if (x->link != y->link) return (x->link < y->link) ? -1 : 1;
+    return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+void ref_step(RefSim* r) {
+    const Grid* g = &r->g;
+
+    if (r->reweight_steps > 0 && r->step > 0 && r->step % r->reweight_steps == 0) {
+        routing_reweight(&r->route, g, r->occ_steps, r->departures, r->cfg.time_step,
+                         r->reweight_steps * r->cfg.time_step);
+        memset(r->occ_steps, 0, sizeof(int64_t) * (size_t)g->n_links);
+        memset(r->departures, 0, sizeof(int32_t) * (size_t)g->n_links);
+    }
+
+    ref_spawn(r);
+    ref_lights(r);
+    for (int l=0; l<g->n_links; l++) ref_sweep_link(r, &g->links[l]);
+    ref_cross(r);
+
+    for (int k=0; k<r->n_exits; k++) {
+        const RefExit* x = &r->exits[k];
+        ref_vacate(r, &g->links[x->link], r->veh[x->id].slot);
+        if (r->departures) r->departures[x->link]++;
+    }
+    if (r->occ_steps)
+        for (int l=0; l<g->n_links; l++)
+            r->occ_steps[l] += count_positions(r, &g->links[l], 0, g->links[l].n_cells);
+
+    if (r->n_exits > 1) qsort(r->exits, (size_t)r->n_exits, sizeof(RefExit), cmp_exit);
+    for (int k=0; k<r->n_exits; k++) {
+        ref_release(r, r->exits[k].id);
+        r->exited++;
+    }
+    r->n_exits = 0;
+
+    r->t += r->cfg.time_step;
+    r->step++;
+}
+
+/* ---------- setup ---------- */
+
+int ref_init(RefSim* r, const Config* cfg, const Topology* topo) {
+    memset(r, 0, sizeof(*r));
+    r->cfg = *cfg;
+    if (grid_init(&r->g, topo, &r->cfg) != 0) return -1;
+    const Grid* g = &r->g;
+
+    size_t nl = (size_t)(g->n_links ? g->n_links : 1);
+    size_t ni = (size_t)(g->n_intersections ? g->n_intersections : 1);
+    r->cells = (int32_t*)malloc(sizeof(int32_t) * (size_t)(g->n_cells ? g->n_cells : 1));
+    r->vacated_step = (int32_t*)malloc(sizeof(int32_t) * nl);
+    r->vacated_lanes = (uint8_t*)calloc(nl, 1);
+    r->lights = (TrafficLight*)malloc(sizeof(TrafficLight) * ni);
+    if (!r->cells || !r->vacated_step || !r->vacated_lanes || !r->lights) {
+        ref_free(r);
+        return -1;
+    }
+    for (int64_t k=0; k<g->n_cells; k++) r->cells[k] = INVALID_ID;
+    for (int l=0; l<g->n_links; l++) r->vacated_step[l] = -1;
+    for (int i=0; i<g->n_intersections; i++) grid_light_init(&r->lights[i], cfg);
+
+    if (cfg->routing_type == ROUTING_SHORTEST_PATH) {
+        if (routing_init(&r->route, g, cfg, 1) != 0) {
+            ref_free(r);
+            return -1;
+        }
+        r->routed = true;
+        if (cfg->routing_update_interval > 0) {
+            r->reweight_steps = (int)(cfg->routing_update_interval / cfg->time_step + 0.5);
+            if (r->reweight_steps < 1) r->reweight_steps = 1;
+            r->occ_steps = (int64_t*)calloc(nl, sizeof(int64_t));
+            r->departures = (int32_t*)calloc(nl, sizeof(int32_t));
+            if (!r->occ_steps || !r->departures) {
+                ref_free(r);
+                return -1;
+            }
+        }
+    }
+    if (cfg->od_file[0]) {
+        if (demand_init(&r->demand, g, cfg, r->routed ? &r->route : NULL) != 0) {
+            ref_free(r);
+            return -1;
+        }
+        r->od = true;
+        r->od_period = -1;
+        r->od_next = (int32_t*)malloc(sizeof(int32_t) * (size_t)(g->n_entry_links ? g->n_entry_links : 1));
+        if (!r->od_next) {
+            ref_free(r);
+            return -1;
+        }
+    }
+    r->rng = rng_key(cfg->random_seed);
+    return 0;
+}
+
+void ref_free(RefSim* r) {
+    if (r->od) demand_free(&r->demand);
+    free(r->od_next);
+    if (r->routed) routing_free(&r->route);
+    grid_free(&r->g);
+    free(r->cells);
+    free(r->vacated_step);
+    free(r->vacated_lanes);
+    free(r->lights);
+    free(r->veh);
+    free(r->free_ids);
+    free(r->cross);
+    free(r->exits);
+    free(r->occ_steps);
+    free(r->departures);
+    memset(r, 0, sizeof(*r));
+}
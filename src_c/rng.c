@@ -1,19 +1,59 @@
-// rng.c (xorshift64*)
+// rng.c (Philox4x32-10 counter-based generator)
 #include "rng.h"
+#include <math.h>
 
-static uint64_t g_state = 88172645463325252ull;
+RngKey rng_key(uint64_t seed) {
+    RngKey k;
+    k.k0 = (uint32_t)seed;
+    k.k1 = (uint32_t)(seed >> 32);
+    return k;
+}
 
-void rng_seed(uint64_t seed) {
-    g_state = (seed ? seed : 88172645463325252ull);
+void rng_philox4x32(const uint32_t ctr[4], RngKey key, uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key.k0, k1 = key.k1;
+    for (int r=0; r<10; r++) {
+        uint64_t p0 = (uint64_t)RNG_PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)RNG_PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += RNG_PHILOX_W0;
+        k1 += RNG_PHILOX_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
 }
 
-double rng_uniform01(void) {
-    uint64_t x = g_state;
-    x ^= x >> 12;
-    x ^= x << 25;
-    x ^= x >> 27;
-    g_state = x;
-    uint64_t r = x * 2685821657736338717ull;
+static double to_unit(uint32_t hi, uint32_t lo) {
     /* map to [0,1) using 53 bits */
+    uint64_t r = ((uint64_t)hi << 32) | lo;
     return (r >> 11) * (1.0 / 9007199254740992.0);
 }
+
+double rng_cb_uniform01(RngKey key, uint32_t step, uint32_t entity, uint32_t purpose, uint32_t index) {
+    /* one Philox block yields two uniforms: index pairs share a block */
+    uint32_t ctr[4] = { step, entity, purpose, index >> 1 };
+    uint32_t out[4];
+    rng_philox4x32(ctr, key, out);
+    return (index & 1u) ? to_unit(out[2], out[3]) : to_unit(out[0], out[1]);
+}
+
+uint64_t rng_threshold53(double p) {
+    /* u = m * 2^-53 exactly, so u < p  <=>  m < p * 2^53  <=>  m < ceil(p * 2^53) */
+    if (!(p > 0.0)) return 0;
+    if (p >= 1.0) return (uint64_t)1 << 53;
+    return (uint64_t)ceil(p * 9007199254740992.0);
+}
+
+void rng_cb_fill_uniform01(RngKey key, uint32_t step, uint32_t purpose,
+                           const int32_t* entities, int n, double* out) {
+    for (int i=0; i<n; i++) {
+        uint32_t ctr[4] = { step, (uint32_t)entities[i], purpose, 0 };
+        uint32_t r[4];
+        rng_philox4x32(ctr, key, r);
+        out[i] = to_unit(r[0], r[1]);
+    }
+}
@@ -0,0 +1,357 @@
+// routing.c
+#include "routing.h"
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec * 1e-6;
+}
+
+/* binary min-heap of (cost, link) with lazy deletion */
+typedef struct {
+    float d;
+    int32_t l;
+} HeapItem;
+
+typedef struct {
+    HeapItem* v;
+    int n;
+    int cap;
+} Heap;
+
+static int heap_push(Heap* h, float d, int32_t l) {
+    if (h->n == h->cap) {
+        int cap = h->cap ? h->cap * 2 : 1024;
+        HeapItem* p = (HeapItem*)realloc(h->v, sizeof(HeapItem) * (size_t)cap);
+        if (!p) return -1;
+        h->v = p;
+        h->cap = cap;
+    }
+    int k = h->n++;
+    while (k > 0) {
+        int up = (k - 1) / 2;
+        if (h->v[up].d <= d) break;
+        h->v[k] = h->v[up];
+        k = up;
+    }
+    h->v[k].d = d;
+    h->v[k].l = l;
+    return 0;
+}
+
+static HeapItem heap_pop(Heap* h) {
+    HeapItem top = h->v[0];
+    HeapItem last = h->v[--h->n];
+    int k = 0;
+    for (;;) {
+        int c = 2 * k + 1;
+        if (c >= h->n) break;
+        if (c + 1 < h->n && h->v[c + 1].d < h->v[c].d) c++;
+        if (last.d <= h->v[c].d) break;
+        h->v[k] = h->v[c];
+        k = c;
+    }
+    if (h->n > 0) h->v[k] = last;
+    return top;
+}
+
+/* the vehicle reaches destination k at the end of L */
+static bool is_terminal(const Routing* r, const Grid* g, const Link* L, int k) {
+    if (k >= ROUTE_SIDES) return L->to == r->dest_node[k];
+    if (L->to == INVALID_ID) return L->dir == k;
+    return (g->intersections[L->to].exit_mask >> k) & 1u;
+}
+
+/* one reverse Dijkstra from the terminal links of destination k */
+static int compute_tree(Routing* r, const Grid* g, int k, Heap* h) {
+    int n = r->n_links;
+    float* dist = r->dist + (size_t)k * (size_t)n;
+    uint8_t* hop = r->hop + (size_t)k * (size_t)n;
+
+    h->n = 0;
+    for (int l=0; l<n; l++) {
+        if (is_terminal(r, g, &g->links[l], k)) {
+            dist[l] = r->weight[l];
+            hop[l] = ROUTE_ARRIVE;
+            if (heap_push(h, dist[l], l) != 0) return -1;
+        } else {
+            dist[l] = INFINITY;
+            hop[l] = ROUTE_NONE;
+        }
+    }
+    while (h->n > 0) {
+        HeapItem it = heap_pop(h);
+        if (it.d > dist[it.l]) continue;
+        for (int32_t q=r->rev_off[it.l]; q<r->rev_off[it.l + 1]; q++) {
+            int32_t p = r->rev_link[q];
+            if (hop[p] == ROUTE_ARRIVE) continue;
+            float nd = r->weight[p] + it.d;
+            if (nd < dist[p]) {
+                dist[p] = nd;
+                hop[p] = r->rev_turn[q];
+                if (heap_push(h, nd, p) != 0) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    int32_t l;
+    float delta;
+} CostChange;
+
+/* Applies cost changes to the tree of destination k in place when none of
+   them can move a next hop; false means recompute it (dist is then left
+   half-updated). A change of link l by delta shifts the cost-to-go of
+   exactly l's upstream subtree S, the links whose path runs through l.
+   The tree stays optimal unless
+   - delta > 0 and a link of S now has a strictly cheaper turn, or
+   - delta < 0 and a link that may turn into S now finds that cheaper
+     than its current choice.
+   Past n_links walked links a recompute is cheaper, so that is the limit. */
+static bool repair_tree(Routing* r, const Grid* g, int k, const CostChange* changes, int n_changes, int32_t* sub) {
+    size_t base = (size_t)k * (size_t)r->n_links;
+    float* dist = r->dist + base;
+    const uint8_t* hop = r->hop + base;
+    long budget = r->n_links;
+
+    for (int c=0; c<n_changes; c++) {
+        int32_t l = changes[c].l;
+        float delta = changes[c].delta;
+        if (isinf(dist[l])) continue;
+
+        /* S breadth-first: the children of m are the links whose next hop is m */
+        int n = 0;
+        sub[n++] = l;
+        for (int q=0; q<n; q++) {
+            int32_t m = sub[q];
+            dist[m] += delta;
+            for (int32_t e=r->rev_off[m]; e<r->rev_off[m + 1]; e++)
+                if (hop[r->rev_link[e]] == r->rev_turn[e]) sub[n++] = r->rev_link[e];
+        }
+        budget -= n;
+        if (budget < 0) return false;
+
+        for (int q=0; q<n; q++) {
+            int32_t m = sub[q];
+            if (delta > 0.0f) {
+                if (hop[m] == ROUTE_ARRIVE) continue;
+                float chosen = dist[g->turns[g->turn_off[m] + hop[m]]];
+                for (int32_t t=g->turn_off[m]; t<g->turn_off[m + 1]; t++)
+                    if (dist[g->turns[t]] < chosen) return false;
+            } else {
+                for (int32_t e=r->rev_off[m]; e<r->rev_off[m + 1]; e++) {
+                    int32_t p = r->rev_link[e];
+                    if (hop[p] == ROUTE_ARRIVE) continue;
+                    if (hop[p] == ROUTE_NONE || dist[m] < dist[g->turns[g->turn_off[p] + hop[p]]]) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    Routing* r;
+    const Grid* g;
+    const CostChange* changes;  /* NULL: compute every tree */
+    int n_changes;
+    atomic_int next;
+    atomic_int n_computed;
+    atomic_int failed;
+} TreeJobs;
+
+static void* tree_worker(void* arg) {
+    TreeJobs* jobs = (TreeJobs*)arg;
+    Routing* r = jobs->r;
+    Heap h = {0};
+    int32_t* sub = jobs->changes ? (int32_t*)malloc(sizeof(int32_t) * (size_t)r->n_links) : NULL;
+    for (;;) {
+        int k = atomic_fetch_add(&jobs->next, 1);
+        if (k >= r->n_dest) break;
+        if (sub && repair_tree(r, jobs->g, k, jobs->changes, jobs->n_changes, sub)) continue;
+        atomic_fetch_add(&jobs->n_computed, 1);
+        if (compute_tree(r, jobs->g, k, &h) != 0) atomic_store(&jobs->failed, 1);
+    }
+    free(sub);
+    free(h.v);
+    return NULL;
+}
+
+/* repairs or recomputes every tree; trees are independent, so any thread
+   count gives the same tables */
+static int update_trees(Routing* r, const Grid* g, const CostChange* changes, int n_changes) {
+    double t0 = now_ms();
+    TreeJobs jobs;
+    jobs.r = r;
+    jobs.g = g;
+    jobs.changes = changes;
+    jobs.n_changes = n_changes;
+    atomic_init(&jobs.next, 0);
+    atomic_init(&jobs.n_computed, 0);
+    atomic_init(&jobs.failed, 0);
+
+    int n_workers = r->n_threads < r->n_dest ? r->n_threads : r->n_dest;
+    pthread_t threads[64];
+    if (n_workers > 64) n_workers = 64;
+    int started = 1;
+    /* the calling thread is worker 0 */
+    for (; started<n_workers; started++)
+        if (pthread_create(&threads[started], NULL, tree_worker, &jobs) != 0) break;
+    tree_worker(&jobs);
+    for (int w=1; w<started; w++) pthread_join(threads[w], NULL);
+
+    r->n_trees += atomic_load(&jobs.n_computed);
+    r->compute_ms += now_ms() - t0;
+    return atomic_load(&jobs.failed) ? -1 : 0;
+}
+
+static int build_reverse(Routing* r, const Grid* g) {
+    int n = r->n_links;
+    int n_turns = g->turn_off[n];
+    r->rev_off = (int32_t*)calloc((size_t)n + 1, sizeof(int32_t));
+    r->rev_link = (int32_t*)malloc(sizeof(int32_t) * (size_t)(n_turns ? n_turns : 1));
+    r->rev_turn = (uint8_t*)malloc((size_t)(n_turns ? n_turns : 1));
+    if (!r->rev_off || !r->rev_link || !r->rev_turn) return -1;
+
+    for (int p=0; p<n; p++) {
+        if (g->turn_off[p + 1] - g->turn_off[p] > ROUTE_MAX_TURNS) {
+            fprintf(stderr, "routing: link %d allows more than %d turns\n", p, ROUTE_MAX_TURNS);
+            return -1;
+        }
+        for (int32_t q=g->turn_off[p]; q<g->turn_off[p + 1]; q++) r->rev_off[g->turns[q] + 1]++;
+    }
+    for (int l=0; l<n; l++) r->rev_off[l + 1] += r->rev_off[l];
+
+    int32_t* fill = (int32_t*)malloc(sizeof(int32_t) * (size_t)(n ? n : 1));
+    if (!fill) return -1;
+    memcpy(fill, r->rev_off, sizeof(int32_t) * (size_t)n);
+    /* ascending p within each list: the Dijkstra order, and so ties, are fixed */
+    for (int p=0; p<n; p++) {
+        for (int32_t q=g->turn_off[p]; q<g->turn_off[p + 1]; q++) {
+            int32_t at = fill[g->turns[q]]++;
+            r->rev_link[at] = p;
+            r->rev_turn[at] = (uint8_t)(q - g->turn_off[p]);
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/* "12, 40 7" -> extra destination nodes after the sides */
+static int parse_destinations(Routing* r, const Grid* g, const char* s) {
+    int n = ROUTE_SIDES;
+    for (const char* c=s; *c; c++) if (isdigit((unsigned char)*c) && (c == s || !isdigit((unsigned char)c[-1]))) n++;
+    if (n > UINT16_MAX + 1) {
+        fprintf(stderr, "routing: more than %d destinations\n", UINT16_MAX + 1);
+        return -1;
+    }
+    r->dest_node = (int32_t*)malloc(sizeof(int32_t) * (size_t)n);
+    if (!r->dest_node) return -1;
+    for (int k=0; k<ROUTE_SIDES; k++) r->dest_node[k] = INVALID_ID;
+    r->n_dest = ROUTE_SIDES;
+
+    const char* c = s;
+    for (;;) {
+        while (*c == ' ' || *c == ',') c++;
+        if (!*c) break;
+        char* end;
+        long v = strtol(c, &end, 10);
+        if (end == c || v < 0 || v >= g->n_intersections) {
+            fprintf(stderr, "routing: bad destination node in \"%s\"\n", s);
+            return -1;
+        }
+        r->dest_node[r->n_dest++] = (int32_t)v;
+        c = end;
+    }
+    return 0;
+}
+
+int routing_init(Routing* r, const Grid* g, const Config* cfg, int n_threads) {
+    memset(r, 0, sizeof(*r));
+    r->n_links = g->n_links;
+    r->n_threads = n_threads < 1 ? 1 : n_threads;
+    r->threshold = (float)cfg->routing_reweight_threshold;
+    if (parse_destinations(r, g, cfg->routing_destinations) != 0 || build_reverse(r, g) != 0) return -1;
+
+    size_t n = (size_t)(r->n_links ? r->n_links : 1);
+    r->hop = (uint8_t*)malloc(n * (size_t)r->n_dest);
+    r->dist = (float*)malloc(sizeof(float) * n * (size_t)r->n_dest);
+    r->weight = (float*)malloc(sizeof(float) * n);
+    r->free_flow = (float*)malloc(sizeof(float) * n);
+    if (!r->hop || !r->dist || !r->weight || !r->free_flow) return -1;
+
+    int vmax = cfg->vmax_cells_per_step < 1 ? 1 : cfg->vmax_cells_per_step;
+    for (int l=0; l<r->n_links; l++) {
+        r->free_flow[l] = (float)(ceil((double)g->links[l].n_cells / vmax) * cfg->time_step);
+        r->weight[l] = r->free_flow[l];
+    }
+    return update_trees(r, g, NULL, 0);
+}
+
+int routing_restore(Routing* r, const Grid* g, int n_dest, const int32_t* dest_node,
+                    const float* weight, const uint8_t* hop, const float* dist) {
+    memcpy(r->weight, weight, sizeof(float) * (size_t)r->n_links);
+    bool same = (n_dest == r->n_dest);
+    for (int k=0; same && k<n_dest; k++) same = (dest_node[k] == r->dest_node[k]);
+    if (!same) return update_trees(r, g, NULL, 0);
+    size_t n = (size_t)r->n_links * (size_t)r->n_dest;
+    memcpy(r->hop, hop, n);
+    memcpy(r->dist, dist, sizeof(float) * n);
+    return 0;
+}
+
+void routing_free(Routing* r) {
+    free(r->dest_node);
+    free(r->hop);
+    free(r->dist);
+    free(r->weight);
+    free(r->free_flow);
+    free(r->rev_off);
+    free(r->rev_link);
+    free(r->rev_turn);
+    memset(r, 0, sizeof(*r));
+}
+
+void routing_reweight(Routing* r, const Grid* g, const int64_t* occ_steps, const int32_t* departures,
+                      double dt, double interval_s) {
+    CostChange* changes = (CostChange*)malloc(sizeof(CostChange) * (size_t)(r->n_links ? r->n_links : 1));
+    if (!changes) return;
+
+    int n_changes = 0;
+    for (int l=0; l<r->n_links; l++) {
+        double est;
+        if (departures[l] > 0) est = (double)occ_steps[l] * dt / departures[l];
+        else if (occ_steps[l] > 0) est = interval_s;
+        else est = r->free_flow[l];
+        if (est < r->free_flow[l]) est = r->free_flow[l];
+        /* halfway towards the measurement: one noisy interval does not flip routes */
+        float w = (float)(0.5 * (r->weight[l] + est));
+        if (fabsf(w - r->weight[l]) > r->threshold * r->weight[l]) {
+            changes[n_changes].l = l;
+            changes[n_changes].delta = w - r->weight[l];
+            n_changes++;
+            r->weight[l] = w;
+        }
+    }
+    if (n_changes > 0 && update_trees(r, g, changes, n_changes) != 0)
+        fprintf(stderr, "routing: out of memory, some next hops are stale\n");
+
+    r->n_updates++;
+    r->n_links_changed += n_changes;
+    free(changes);
+}
+
+void routing_report(const Routing* r, FILE* f) {
+    double mib = (double)r->n_links * (double)r->n_dest * (1.0 + sizeof(float)) / (1024.0 * 1024.0);
+    fprintf(f, "routing: %d destinations, %.2f MiB tables, %ld trees in %.1f ms, %ld updates (%ld link costs changed)\n",
+            r->n_dest, mib, r->n_trees, r->compute_ms, r->n_updates, r->n_links_changed);
+}
@@ -0,0 +1,243 @@
+// series.c
+#include "series.h"
+#include "occupancy.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* about 1 MiB of frames per block, at most 8 MiB of ring */
+#define SERIES_BLOCK_BYTES (1u << 20)
+#define SERIES_RING_BYTES (8u << 20)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline uint16_t sat16(uint32_t v) {
+    return (v > 0xFFFFu) ? 0xFFFFu : (uint16_t)v;
+}
+
+static size_t col_bytes(const Series* sr, int c) {
+    return (size_t)sr->cols[c].elem_bytes * (sr->cols[c].per_intersection ? (size_t)sr->n_inters : 1);
+}
+
+static void add_col(Series* sr, int* k, const char* name, uint32_t elem, SeriesKind kind, bool per, size_t src) {
+    SeriesColumn* c = &sr->cols[*k];
+    memset(c, 0, sizeof(*c));
+    strncpy(c->name, name, sizeof(c->name) - 1);
+    c->elem_bytes = elem;
+    c->kind = (uint32_t)kind;
+    c->per_intersection = per;
+    sr->col_src[*k] = src;
+    (*k)++;
+}
+
+static char* slot(const Series* sr, uint64_t frame) {
+    return sr->ring + (size_t)(frame % (uint64_t)sr->n_slots) * sr->frame_bytes;
+}
+
+/* ---- writer thread ---- */
+
+static void flush_block(Series* sr) {
+    if (sr->in_block == 0) return;
+    uint32_t hd[2] = { (uint32_t)sr->in_block, 0 };
+    bool ok = fwrite(hd, sizeof(hd), 1, sr->f) == 1;
+    for (int c=0; c<SERIES_COLUMNS && ok; c++) {
+        ok = fwrite(sr->block + sr->col_dst[c], col_bytes(sr, c), (size_t)sr->in_block, sr->f) == (size_t)sr->in_block;
+    }
+    if (!ok) sr->io_error = true;
+    sr->written += sr->in_block;
+    sr->in_block = 0;
+}
+
+/* row-major frame -> column-major block */
+static void consume(Series* sr, const char* fr) {
+    for (int c=0; c<SERIES_COLUMNS; c++) {
+        size_t n = col_bytes(sr, c);
+        memcpy(sr->block + sr->col_dst[c] + (size_t)sr->in_block * n, fr + sr->col_src[c], n);
+    }
+    if (++sr->in_block == sr->block_frames) flush_block(sr);
+}
+
+static void* writer_main(void* arg) {
+    Series* sr = (Series*)arg;
+    uint64_t tail = atomic_load_explicit(&sr->tail, memory_order_relaxed);
+    for (;;) {
+        while (sem_wait(&sr->ready) != 0) {}   /* EINTR */
+        /* closing is set after the last publish: head read after it is final */
+        bool closing = atomic_load_explicit(&sr->closing, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&sr->head, memory_order_acquire);
+        for (; tail < head; tail++) {
+            consume(sr, slot(sr, tail));
+            atomic_store_explicit(&sr->tail, tail + 1, memory_order_release);
+        }
+        if (closing) break;
+    }
+    flush_block(sr);
+    return NULL;
+}
+
+/* ---- stepping thread ---- */
+
+int series_open(Series* sr, const char* path, const Engine* e) {
+    memset(sr, 0, sizeof(*sr));
+    const Grid* g = e->g;
+    const Config* cfg = e->cfg;
+    int n = g->n_intersections;
+    sr->n_inters = n;
+    sr->every = (int)(cfg->export_interval / cfg->time_step + 0.5);
+    if (sr->every < 1) sr->every = 1;
+
+    size_t off = sizeof(SeriesFrame);
+    int k = 0;
+    add_col(sr, &k, "t", 8, SERIES_FLOAT, false, offsetof(SeriesFrame, t));
+    add_col(sr, &k, "step", 4, SERIES_INT, false, offsetof(SeriesFrame, step));
+    add_col(sr, &k, "n_vehicles", 4, SERIES_INT, false, offsetof(SeriesFrame, n_vehicles));
+    add_col(sr, &k, "spawned", 4, SERIES_INT, false, offsetof(SeriesFrame, spawned));
+    add_col(sr, &k, "exited", 4, SERIES_INT, false, offsetof(SeriesFrame, exited));
+    add_col(sr, &k, "blocked_entries", 4, SERIES_INT, false, offsetof(SeriesFrame, blocked_entries));
+    add_col(sr, &k, "queue", 2, SERIES_UINT, true, off);
+    add_col(sr, &k, "occupancy", 2, SERIES_UINT, true, off + 2 * (size_t)n);
+    add_col(sr, &k, "served", 2, SERIES_UINT, true, off + 4 * (size_t)n);
+    add_col(sr, &k, "phase", 1, SERIES_UINT, true, off + 6 * (size_t)n);
+    sr->frame_bytes = (off + 7 * (size_t)n + 7) & ~(size_t)7;
+
+    size_t data_bytes = 0;
+    for (int c=0; c<SERIES_COLUMNS; c++) data_bytes += col_bytes(sr, c);
+    sr->block_frames = (int)(SERIES_BLOCK_BYTES / data_bytes);
+    if (sr->block_frames < 1) sr->block_frames = 1;
+    if (sr->block_frames > 4096) sr->block_frames = 4096;
+    for (int c=0, dst=0; c<SERIES_COLUMNS; c++) {
+        sr->col_dst[c] = (size_t)dst;
+        dst += (int)col_bytes(sr, c) * sr->block_frames;
+    }
+    sr->n_slots = (int)(SERIES_RING_BYTES / sr->frame_bytes);
+    if (sr->n_slots < 4) sr->n_slots = 4;
+    if (sr->n_slots > 1024) sr->n_slots = 1024;
+    sr->wake_every = sr->n_slots / 4;
+
+    sr->ring = (char*)calloc((size_t)sr->n_slots, sr->frame_bytes);
+    sr->block = (char*)malloc(data_bytes * (size_t)sr->block_frames);
+    sr->served = (int32_t*)calloc((size_t)(n ? n : 1), sizeof(int32_t));
+    if (!sr->ring || !sr->block || !sr->served) goto fail;
+
+    sr->last_spawned = e->s->spawned;
+    sr->last_blocked = e->s->blocked_entries;
+    sr->last_vehicles = e->vp->n_used;
+
+    sr->f = fopen(path, "wb");
+    if (!sr->f) goto fail;
+    SeriesHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SERIES_MAGIC, sizeof(h.magic));
+    h.version = SERIES_VERSION;
+    h.n_columns = SERIES_COLUMNS;
+    h.n_intersections = n;
+    h.frames_per_block = sr->block_frames;
+    h.interval_s = sr->every * cfg->time_step;
+    h.time_step = cfg->time_step;
+    h.n_frames = -1;
+    if (fwrite(&h, sizeof(h), 1, sr->f) != 1 || fwrite(sr->cols, sizeof(SeriesColumn), SERIES_COLUMNS, sr->f) != SERIES_COLUMNS) goto fail;
+
+    if (sem_init(&sr->ready, 0, 0) != 0) goto fail;
+    if (pthread_create(&sr->writer, NULL, writer_main, sr) != 0) {
+        sem_destroy(&sr->ready);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (sr->f) fclose(sr->f);
+    free(sr->ring);
+    free(sr->block);
+    free(sr->served);
+    memset(sr, 0, sizeof(*sr));
+    return -1;
+}
+
+void series_step(Series* sr, const Engine* e, double t, int step) {
+    if (step % sr->every != 0) return;
+    double t0 = now_s();
+
+    uint64_t h = atomic_load_explicit(&sr->head, memory_order_relaxed);
+    while (h - atomic_load_explicit(&sr->tail, memory_order_acquire) >= (uint64_t)sr->n_slots) {
+        sr->stalls++;
+        struct timespec nap = { 0, 50000 };
+        nanosleep(&nap, NULL);
+    }
+
+    const Grid* g = e->g;
+    const Stats* s = e->s;
+    int n = sr->n_inters;
+    char* fr = slot(sr, h);
+    SeriesFrame* hd = (SeriesFrame*)fr;
+    hd->t = t;
+    hd->step = step;
+    hd->n_vehicles = e->vp->n_used;
+    hd->spawned = (int32_t)(s->spawned - sr->last_spawned);
+    /* Stats only counts exits after warmup; live vehicles are conserved */
+    hd->exited = sr->last_vehicles + hd->spawned - hd->n_vehicles;
+    hd->blocked_entries = (int32_t)(s->blocked_entries - sr->last_blocked);
+    hd->reserved = 0;
+    sr->last_spawned = s->spawned;
+    sr->last_blocked = s->blocked_entries;
+    sr->last_vehicles = hd->n_vehicles;
+
+    uint16_t* queue = (uint16_t*)(fr + sr->col_src[6]);
+    uint16_t* occ = (uint16_t*)(fr + sr->col_src[7]);
+    uint16_t* served = (uint16_t*)(fr + sr->col_src[8]);
+    uint8_t* phase = (uint8_t*)(fr + sr->col_src[9]);
+    memset(queue, 0, 2 * sizeof(uint16_t) * (size_t)n);
+    for (int w=0; w<e->n_tiles; w++) {
+        const Tile* tile = &e->tiles[w];
+        for (int k=0; k<tile->n_active; k++) {
+            const Link* L = &g->links[tile->active[k]];
+            if (L->to == INVALID_ID) continue;
+            queue[L->to] = sat16((uint32_t)queue[L->to] + (uint32_t)link_stop_count(g, L));
+            occ[L->to] = sat16((uint32_t)occ[L->to] + (uint32_t)link_count_range(g, L, 0, link_slots(L)));
+        }
+    }
+    for (int k=0; k<n; k++) {
+        served[k] = sat16((uint32_t)sr->served[k]);
+        phase[k] = (uint8_t)g->lights[k].phase;
+    }
+    memset(sr->served, 0, sizeof(int32_t) * (size_t)n);
+
+    atomic_store_explicit(&sr->head, h + 1, memory_order_release);
+    /* waking the writer is a syscall: once per quarter ring */
+    if ((h + 1) % (uint64_t)sr->wake_every == 0) sem_post(&sr->ready);
+    sr->frames++;
+    sr->sample_s += now_s() - t0;
+}
+
+int series_close(Series* sr) {
+    if (!sr->f) return 0;
+    atomic_store_explicit(&sr->closing, true, memory_order_release);
+    sem_post(&sr->ready);
+    pthread_join(sr->writer, NULL);
+    sem_destroy(&sr->ready);
+
+    if (!sr->io_error) {
+        int64_t n_frames = sr->written;
+        if (fseek(sr->f, (long)offsetof(SeriesHeader, n_frames), SEEK_SET) != 0
+            || fwrite(&n_frames, sizeof(n_frames), 1, sr->f) != 1) sr->io_error = true;
+    }
+    if (fclose(sr->f) != 0) sr->io_error = true;
+    int rc = sr->io_error ? -1 : 0;
+    free(sr->ring);
+    free(sr->block);
+    free(sr->served);
+    sr->f = NULL;
+    sr->ring = sr->block = NULL;
+    sr->served = NULL;
+    return rc;
+}
+
+void series_report(const Series* sr, double loop_s, FILE* f) {
+    fprintf(f, "series: %ld frames (every %d steps), %.2f us/frame sampling = %.3f%% of the loop, %ld ring stalls\n",
+            sr->frames, sr->every, sr->frames ? sr->sample_s * 1e6 / (double)sr->frames : 0.0,
+            (loop_s > 0.0) ? 100.0 * sr->sample_s / loop_s : 0.0, sr->stalls);
+}
@@ -0,0 +1,156 @@
+// series_csv.c
+// Converts a time-series file (series.h) to CSV.
+//
+//   series_csv timeseries.bin network.csv [intersections.csv]
+//
+// network.csv gets one row per frame with the network columns (t, step,
+// n_vehicles, ...); intersections.csv, if given, one row per frame and
+// intersection with t, step, intersection and the per-intersection columns
+// (queue, occupancy, ...). Columns are read from the file's column table,
+// so files with more columns convert the same way. A file whose run did
+// not finish converts up to its last complete block.
+#include "series.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s timeseries.bin network.csv [intersections.csv]\n", argv0);
+}
+
+static double value(const SeriesColumn* c, const char* p) {
+    if (c->kind == SERIES_FLOAT) {
+        if (c->elem_bytes == 4) { float v; memcpy(&v, p, 4); return v; }
+        double v; memcpy(&v, p, 8); return v;
+    }
+    uint64_t u = 0;
+    memcpy(&u, p, c->elem_bytes);   /* little-endian hosts, like the writer */
+    if (c->kind == SERIES_INT && c->elem_bytes < 8) {
+        int shift = 64 - 8 * (int)c->elem_bytes;
+        return (double)((int64_t)(u << shift) >> shift);
+    }
+    return (double)u;
+}
+
+static void put(FILE* f, const SeriesColumn* c, const char* p) {
+    if (c->kind == SERIES_FLOAT) fprintf(f, "%.6f", value(c, p));
+    else fprintf(f, "%.0f", value(c, p));
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3 && argc != 4) {
+        usage(argv[0]);
+        return 1;
+    }
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "series_csv: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    SeriesHeader h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, SERIES_MAGIC, sizeof(h.magic)) != 0
+        || h.version != SERIES_VERSION || h.n_columns == 0 || h.n_columns > 256
+        || h.n_intersections < 0 || h.frames_per_block < 1) {
+        fprintf(stderr, "series_csv: %s is not a time-series file of this version\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+    int nc = (int)h.n_columns, n = h.n_intersections;
+    SeriesColumn* cols = (SeriesColumn*)calloc((size_t)nc, sizeof(SeriesColumn));
+    size_t* width = (size_t*)calloc((size_t)nc, sizeof(size_t));   /* bytes per frame */
+    size_t* off = (size_t*)calloc((size_t)nc, sizeof(size_t));     /* in the block buffer */
+    if (!cols || !width || !off || fread(cols, sizeof(SeriesColumn), (size_t)nc, in) != (size_t)nc) {
+        fprintf(stderr, "series_csv: truncated column table\n");
+        fclose(in);
+        return 1;
+    }
+    int c_t = -1, c_step = -1;
+    size_t frame_bytes = 0;
+    for (int c=0; c<nc; c++) {
+        cols[c].name[sizeof(cols[c].name) - 1] = '\0';
+        if (cols[c].elem_bytes != 1 && cols[c].elem_bytes != 2 && cols[c].elem_bytes != 4 && cols[c].elem_bytes != 8) {
+            fprintf(stderr, "series_csv: column %s: bad width\n", cols[c].name);
+            fclose(in);
+            return 1;
+        }
+        width[c] = cols[c].elem_bytes * (cols[c].per_intersection ? (size_t)n : 1);
+        frame_bytes += width[c];
+        if (!cols[c].per_intersection && strcmp(cols[c].name, "t") == 0) c_t = c;
+        if (!cols[c].per_intersection && strcmp(cols[c].name, "step") == 0) c_step = c;
+    }
+    char* block = (char*)malloc(frame_bytes * (size_t)h.frames_per_block);
+    FILE* net = fopen(argv[2], "w");
+    FILE* inter = (argc == 4) ? fopen(argv[3], "w") : NULL;
+    if (!block || !net || (argc == 4 && !inter)) {
+        fprintf(stderr, "series_csv: cannot write output\n");
+        fclose(in);
+        return 1;
+    }
+
+    bool first = true;
+    for (int c=0; c<nc; c++) {
+        if (cols[c].per_intersection) continue;
+        fprintf(net, "%s%s", first ? "" : ",", cols[c].name);
+        first = false;
+    }
+    fputc('\n', net);
+    if (inter) {
+        fprintf(inter, "t,step,intersection");
+        for (int c=0; c<nc; c++) if (cols[c].per_intersection) fprintf(inter, ",%s", cols[c].name);
+        fputc('\n', inter);
+    }
+
+    int64_t frames = 0;
+    uint32_t bh[2];
+    while (fread(bh, sizeof(bh), 1, in) == 1) {
+        int nf = (int)bh[0];
+        if (nf < 1 || nf > h.frames_per_block) break;
+        size_t pos = 0;
+        for (int c=0; c<nc; c++) {
+            off[c] = pos;
+            pos += width[c] * (size_t)nf;
+        }
+        if (fread(block, 1, pos, in) != pos) break;
+
+        for (int f=0; f<nf; f++) {
+            first = true;
+            for (int c=0; c<nc; c++) {
+                if (cols[c].per_intersection) continue;
+                if (!first) fputc(',', net);
+                put(net, &cols[c], block + off[c] + width[c] * (size_t)f);
+                first = false;
+            }
+            fputc('\n', net);
+
+            for (int k=0; inter && k<n; k++) {
+                if (c_t >= 0) put(inter, &cols[c_t], block + off[c_t] + width[c_t] * (size_t)f);
+                fputc(',', inter);
+                if (c_step >= 0) put(inter, &cols[c_step], block + off[c_step] + width[c_step] * (size_t)f);
+                fprintf(inter, ",%d", k);
+                for (int c=0; c<nc; c++) {
+                    if (!cols[c].per_intersection) continue;
+                    fputc(',', inter);
+                    put(inter, &cols[c], block + off[c] + width[c] * (size_t)f + cols[c].elem_bytes * (size_t)k);
+                }
+                fputc('\n', inter);
+            }
+        }
+        frames += nf;
+    }
+    fclose(in);
+
+    int rc = 0;
+    if (fclose(net) != 0) rc = 1;
+    if (inter && fclose(inter) != 0) rc = 1;
+    if (h.n_frames >= 0 && frames != h.n_frames) {
+        fprintf(stderr, "series_csv: %s: %lld of %lld frames readable\n", argv[1], (long long)frames, (long long)h.n_frames);
+        rc = 1;
+    } else {
+        fprintf(stderr, "series_csv: %lld frames, %d intersections, every %.3g s%s\n", (long long)frames, n, h.interval_s,
+                h.n_frames < 0 ? " (file not closed)" : "");
+    }
+    free(block);
+    free(cols);
+    free(width);
+    free(off);
+    return rc;
+}
@@ -1,79 +1,79 @@
 // stats.c
 #include "stats.h"
+#include "occupancy.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-static int cmp_double(const void* a, const void* b) {
-    double x = *(const double*)a;
-    double y = *(const double*)b;
-    return (x<y) ? -1 : (x>y);
-}
-
 int stats_init(Stats* s, int n_intersections) {
     memset(s, 0, sizeof(*s));
-    s->tt_cap = 100000;
-    s->travel_times = (double*)malloc(sizeof(double) * (size_t)s->tt_cap);
+    qs_init(&s->tt);
     s->queue_sum = (double*)calloc((size_t)n_intersections, sizeof(double));
     s->queue_max = (double*)calloc((size_t)n_intersections, sizeof(double));
-    return (s->travel_times && s->queue_sum && s->queue_max) ? 0 : -1;
+    s->queue_stamp = (long*)malloc(sizeof(long) * (size_t)(n_intersections ? n_intersections : 1));
+    if (!s->queue_sum || !s->queue_max || !s->queue_stamp) return -1;
+    for (int k=0; k<n_intersections; k++) s->queue_stamp[k] = -1;
+    return 0;
 }
 
 void stats_free(Stats* s) {
-    free(s->travel_times);
     free(s->queue_sum);
     free(s->queue_max);
+    free(s->queue_stamp);
     memset(s, 0, sizeof(*s));
 }
 
 void stats_on_exit(Stats* s, double travel_time) {
-    if (s->tt_n >= s->tt_cap) return;
-    s->travel_times[s->tt_n++] = travel_time;
+    qs_add(&s->tt, travel_time);
     s->exited++;
 }
 
-void stats_collect_queues(Stats* s, const Grid* g) {
-    for (int k=0; k<g->n_intersections; k++) {
-        const Intersection* inter = &g->intersections[k];
-        int q = 0;
-        for (int d=0; d<4; d++) {
-            const Link* in = inter->in[d];
-            if (!in) continue;
-            /* queue = occupied cells in last 5 cells */
-            int start = in->n_cells - 5;
-            if (start < 0) start = 0;
-            for (int c=start; c<in->n_cells; c++) if (in->cells[c].vehicle_id != INVALID_ID) q++;
-        }
-        s->queue_sum[k] += (double)q;
-        if ((double)q > s->queue_max[k]) s->queue_max[k] = (double)q;
+static void sample_queue(Stats* s, const Grid* g, int idx) {
+    int q = 0;
+    for (int32_t k=g->in_off[idx]; k<g->in_off[idx + 1]; k++) {
+        /* queue = occupied cells in the stopline window */
+        q += link_stop_count(g, &g->links[g->in_links[k]]);
+    }
+    s->queue_sum[idx] += (double)q;
+    if ((double)q > s->queue_max[idx]) s->queue_max[idx] = (double)q;
+    s->queue_stamp[idx] = s->queue_samples;
+}
+
+void stats_sample_link_queues(Stats* s, const Grid* g, const int32_t* links, int n) {
+    for (int k=0; k<n; k++) {
+        const Link* L = &g->links[links[k]];
+        if (L->to == INVALID_ID || link_stop_count(g, L) == 0) continue;
+        if (s->queue_stamp[L->to] != s->queue_samples) sample_queue(s, g, L->to);
     }
+}
+
+void stats_collect_queues(Stats* s, const Grid* g) {
+    for (int k=0; k<g->n_intersections; k++) sample_queue(s, g, k);
     s->queue_samples++;
 }
 
 void stats_finalize(Stats* s, double measured_time_s) {
-    if (s->tt_n > 0) {
-        double sum = 0.0;
-        for (int i=0;i<s->tt_n;i++) sum += s->travel_times[i];
-        s->mean_travel_time_s = sum / (double)s->tt_n;
-
-        /* p95 */
-        qsort(s->travel_times, (size_t)s->tt_n, sizeof(double), cmp_double);
-        int idx = (int)(0.95 * (double)(s->tt_n - 1));
-        if (idx < 0) idx = 0;
-        s->p95_travel_time_s = s->travel_times[idx];
-    }
+    s->mean_travel_time_s = qs_mean(&s->tt);
+    s->p50_travel_time_s = qs_quantile(&s->tt, 0.50);
+    s->p90_travel_time_s = qs_quantile(&s->tt, 0.90);
+    s->p95_travel_time_s = qs_quantile(&s->tt, 0.95);
+    s->p99_travel_time_s = qs_quantile(&s->tt, 0.99);
 
     s->throughput_veh_per_s = (measured_time_s > 0.0) ? ((double)s->exited / measured_time_s) : 0.0;
+}
 
-    /* network queue stats */
-    double sum_avg = 0.0;
+void stats_network_queues(const Stats* s, int n_intersections, double* avg, double* max) {
+    double avgq = 0.0;
     double maxq = 0.0;
-    if (s->queue_samples > 0) {
-        for (int k=0; ; k++) { /* break by sentinel via stored arrays elsewhere? handled in export with grid */
-            break;
+    if (s->queue_samples > 0 && n_intersections > 0) {
+        for (int k=0; k<n_intersections; k++) {
+            avgq += s->queue_sum[k] / (double)s->queue_samples;
+            if (s->queue_max[k] > maxq) maxq = s->queue_max[k];
         }
+        avgq /= (double)n_intersections;
     }
-    (void)sum_avg; (void)maxq; /* computed in export using grid size */
+    *avg = avgq;
+    *max = maxq;
 }
 
 int stats_export_csv(const Stats* s, const Grid* g, const char* out_dir) {
@@ -82,26 +82,21 @@ int stats_export_csv(const Stats* s, const Grid* g, const char* out_dir) {
     FILE* f = fopen(path1, "w");
     if (!f) return -1;
 
-    /* Compute avg/max queue across intersections */
-    double avgq_network = 0.0;
-    double maxq_network = 0.0;
-    if (s->queue_samples > 0) {
-        for (int k=0; k<g->n_intersections; k++) {
-            double avgk = s->queue_sum[k] / (double)s->queue_samples;
-            avgq_network += avgk;
-            if (s->queue_max[k] > maxq_network) maxq_network = s->queue_max[k];
-        }
-        avgq_network /= (double)g->n_intersections;
-    }
+    double avgq_network, maxq_network;
+    stats_network_queues(s, g->n_intersections, &avgq_network, &maxq_network);
 
-    fprintf(f, "mean_travel_time_s,p95_travel_time_s,throughput_veh_per_s,avg_queue_veh,max_queue_veh,spawned,exited,blocked_entries\n");
-    fprintf(f, "%.6f,%.6f,%.6f,%.6f,%.6f,%ld,%ld,%ld\n",
+    fprintf(f, "mean_travel_time_s,p95_travel_time_s,throughput_veh_per_s,avg_queue_veh,max_queue_veh,spawned,exited,blocked_entries,"
+               "p50_travel_time_s,p90_travel_time_s,p99_travel_time_s\n");
+    fprintf(f, "%.6f,%.6f,%.6f,%.6f,%.6f,%ld,%ld,%ld,%.6f,%.6f,%.6f\n",
             s->mean_travel_time_s,
             s->p95_travel_time_s,
             s->throughput_veh_per_s,
             avgq_network,
             maxq_network,
-            s->spawned, s->exited, s->blocked_entries);
+            s->spawned, s->exited, s->blocked_entries,
+            s->p50_travel_time_s,
+            s->p90_travel_time_s,
+            s->p99_travel_time_s);
     fclose(f);
 
     /* Heatmap */
@@ -0,0 +1,347 @@
+// sweep.c
+#include "sweep.h"
+#include "sim.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_ms(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec * 1e-6;
+}
+
+static int axis_push(SweepAxis* ax, const char* v) {
+    char** q = (char**)realloc(ax->values, sizeof(char*) * (size_t)(ax->n_values + 1));
+    if (!q) return -1;
+    ax->values = q;
+    size_t n = strlen(v) + 1;
+    char* copy = (char*)malloc(n);
+    if (!copy) return -1;
+    memcpy(copy, v, n);
+    ax->values[ax->n_values++] = copy;
+    return 0;
+}
+
+/* one value, or an integer range a:b expanded to a..b-1 */
+static int axis_add_item(SweepAxis* ax, const char* item) {
+    const char* colon = strchr(item, ':');
+    if (!colon) return axis_push(ax, item);
+
+    char* end;
+    long lo = strtol(item, &end, 10);
+    if (end != colon) return -1;
+    long hi = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || hi <= lo) return -1;
+
+    char buf[32];
+    for (long v=lo; v<hi; v++) {
+        snprintf(buf, sizeof(buf), "%ld", v);
+        if (axis_push(ax, buf) != 0) return -1;
+    }
+    return 0;
+}
+
+static int parse_axis(SweepSpec* sp, char* text) {
+    char* eq = strchr(text, '=');
+    if (!eq || eq == text) {
+        fprintf(stderr, "sweep: expected key=v1,v2,... in '%s'\n", text);
+        return -1;
+    }
+    *eq = '\0';
+    if (sp->n_axes >= SWEEP_MAX_AXES || strlen(text) >= sizeof(sp->axes[0].key)) {
+        fprintf(stderr, "sweep: too many axes or key too long: %s\n", text);
+        return -1;
+    }
+
+    SweepAxis* ax = &sp->axes[sp->n_axes++];
+    strcpy(ax->key, text);
+
+    char* save = NULL;
+    for (char* item = strtok_r(eq + 1, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (axis_add_item(ax, item) != 0) {
+            fprintf(stderr, "sweep: bad value '%s' for %s\n", item, ax->key);
+            return -1;
+        }
+    }
+    if (ax->n_values == 0) {
+        fprintf(stderr, "sweep: no values for %s\n", ax->key);
+        return -1;
+    }
+
+    /* reject unknown keys/values now rather than after hours of runs */
+    Config scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    for (int v=0; v<ax->n_values; v++) {
+        if (config_set(&scratch, ax->key, ax->values[v]) != 0) {
+            fprintf(stderr, "sweep: unknown key or value %s=%s\n", ax->key, ax->values[v]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int sweep_parse(SweepSpec* sp, const char* spec) {
+    memset(sp, 0, sizeof(*sp));
+    sp->pool_axis = -1;
+
+    size_t n = strlen(spec) + 1;
+    char* text = (char*)malloc(n);
+    if (!text) return -1;
+    memcpy(text, spec, n);
+
+    int rc = 0;
+    char* save = NULL;
+    for (char* axis = strtok_r(text, ";", &save); axis && rc == 0; axis = strtok_r(NULL, ";", &save)) {
+        rc = parse_axis(sp, axis);
+    }
+    free(text);
+
+    if (rc == 0 && sp->n_axes == 0) {
+        fprintf(stderr, "sweep: no axes given\n");
+        rc = -1;
+    }
+    if (rc != 0) {
+        sweep_free(sp);
+        return -1;
+    }
+
+    sp->n_points = 1;
+    for (int a=0; a<sp->n_axes; a++) sp->n_points *= sp->axes[a].n_values;
+    return 0;
+}
+
+void sweep_free(SweepSpec* sp) {
+    for (int a=0; a<sp->n_axes; a++) {
+        for (int v=0; v<sp->axes[a].n_values; v++) free(sp->axes[a].values[v]);
+        free(sp->axes[a].values);
+    }
+    memset(sp, 0, sizeof(*sp));
+}
+
+int sweep_set_pool_axis(SweepSpec* sp, const char* key) {
+    for (int a=0; a<sp->n_axes; a++) {
+        if (strcmp(sp->axes[a].key, key) == 0) {
+            sp->pool_axis = a;
+            return 0;
+        }
+    }
+    fprintf(stderr, "sweep: pool axis %s is not a sweep axis\n", key);
+    return -1;
+}
+
+/* value index on each axis for point p, last axis fastest */
+static void point_coords(const SweepSpec* sp, long p, int* coord) {
+    for (int a=sp->n_axes-1; a>=0; a--) {
+        coord[a] = (int)(p % sp->axes[a].n_values);
+        p /= sp->axes[a].n_values;
+    }
+}
+
+/* index of p's group: its coordinates without the pool axis */
+static long point_group(const SweepSpec* sp, const int* coord) {
+    long g = 0;
+    for (int a=0; a<sp->n_axes; a++) {
+        if (a == sp->pool_axis) continue;
+        g = g * sp->axes[a].n_values + coord[a];
+    }
+    return g;
+}
+
+typedef struct {
+    const Config* base;
+    const Topology* topo;  /* built from base, NULL if that failed */
+    const TsCheckpoint* from;
+    const SweepSpec* sp;
+    bool run_alone;        /* one worker: runs keep their configured threads */
+    SimMetrics* results;
+    int* status;
+    atomic_long next;
+    atomic_long done;
+
+    /* pooled travel times per group and the runs merged into each, under pool_lock */
+    QSketch* pooled;
+    int* merged;
+    long n_groups;
+    pthread_mutex_t pool_lock;
+} SweepShared;
+
+static void* sweep_worker(void* arg) {
+    SweepShared* sh = (SweepShared*)arg;
+    const SweepSpec* sp = sh->sp;
+    int coord[SWEEP_MAX_AXES];
+    QSketch* tt = sh->pooled ? (QSketch*)malloc(sizeof(QSketch)) : NULL;
+
+    for (;;) {
+        long p = atomic_fetch_add(&sh->next, 1);
+        if (p >= sp->n_points) break;
+
+        Config cfg = *sh->base;
+        point_coords(sp, p, coord);
+        for (int a=0; a<sp->n_axes; a++) config_set(&cfg, sp->axes[a].key, sp->axes[a].values[coord[a]]);
+        /* with several workers, parallelism is across points and each run
+           stays single-threaded */
+        if (!sh->run_alone) cfg.threads = 1;
+
+        /* points that keep the base network share its topology */
+        const Topology* topo = (sh->topo && topology_matches(sh->topo, &cfg)) ? sh->topo : NULL;
+        if (sh->pooled && !tt) {
+            sh->status[p] = -1;  /* no scratch sketch: count as failed */
+            atomic_fetch_add(&sh->done, 1);
+            continue;
+        }
+        sh->status[p] = sim_run_metrics(&cfg, topo, sh->from, &sh->results[p], tt);
+        if (tt && sh->status[p] == 0) {
+            /* integer sketch: the merge order does not change the result */
+            pthread_mutex_lock(&sh->pool_lock);
+            long grp = point_group(sp, coord);
+            qs_merge(&sh->pooled[grp], tt);
+            sh->merged[grp]++;
+            pthread_mutex_unlock(&sh->pool_lock);
+        }
+        atomic_fetch_add(&sh->done, 1);
+    }
+    free(tt);
+    return NULL;
+}
+
+/* one row per point in point order; a failed point keeps its row with
+   status "failed" and empty metrics */
+static int write_results(const SweepSpec* sp, const SimMetrics* r, const int* status, const char* out_path) {
+    FILE* f = fopen(out_path, "w");
+    if (!f) return -1;
+
+    for (int a=0; a<sp->n_axes; a++) fprintf(f, "%s,", sp->axes[a].key);
+    fprintf(f, "mean_travel_time_s,p95_travel_time_s,throughput_veh_per_s,avg_queue_veh,max_queue_veh,spawned,exited,blocked_entries,"
+               "p50_travel_time_s,p90_travel_time_s,p99_travel_time_s,status\n");
+
+    int coord[SWEEP_MAX_AXES];
+    for (long p=0; p<sp->n_points; p++) {
+        point_coords(sp, p, coord);
+        for (int a=0; a<sp->n_axes; a++) fprintf(f, "%s,", sp->axes[a].values[coord[a]]);
+        if (status[p] != 0) {
+            fprintf(f, ",,,,,,,,,,,failed\n");
+            continue;
+        }
+        fprintf(f, "%.6f,%.6f,%.6f,%.6f,%.6f,%ld,%ld,%ld,%.6f,%.6f,%.6f,ok\n",
+                r[p].mean_travel_time_s,
+                r[p].p95_travel_time_s,
+                r[p].throughput_veh_per_s,
+                r[p].avg_queue_veh,
+                r[p].max_queue_veh,
+                r[p].spawned, r[p].exited, r[p].blocked_entries,
+                r[p].p50_travel_time_s,
+                r[p].p90_travel_time_s,
+                r[p].p99_travel_time_s);
+    }
+    return (fclose(f) == 0) ? 0 : -1;
+}
+
+static int write_pooled(const SweepSpec* sp, const QSketch* pooled, const int* merged, const char* out_path) {
+    FILE* f = fopen(out_path, "w");
+    if (!f) return -1;
+
+    for (int a=0; a<sp->n_axes; a++) {
+        if (a != sp->pool_axis) fprintf(f, "%s,", sp->axes[a].key);
+    }
+    fprintf(f, "replicates,exited,mean_travel_time_s,p50_travel_time_s,p90_travel_time_s,p95_travel_time_s,p99_travel_time_s\n");
+
+    /* one row per group: the points whose pool-axis coordinate is 0;
+       replicates counts the runs that succeeded */
+    int coord[SWEEP_MAX_AXES];
+    for (long p=0; p<sp->n_points; p++) {
+        point_coords(sp, p, coord);
+        if (coord[sp->pool_axis] != 0) continue;
+        long grp = point_group(sp, coord);
+        const QSketch* q = &pooled[grp];
+        for (int a=0; a<sp->n_axes; a++) {
+            if (a != sp->pool_axis) fprintf(f, "%s,", sp->axes[a].values[coord[a]]);
+        }
+        fprintf(f, "%d,%llu,%.6f,%.6f,%.6f,%.6f,%.6f\n",
+                merged[grp], (unsigned long long)q->n, qs_mean(q),
+                qs_quantile(q, 0.50), qs_quantile(q, 0.90),
+                qs_quantile(q, 0.95), qs_quantile(q, 0.99));
+    }
+    return (fclose(f) == 0) ? 0 : -1;
+}
+
+int sweep_run(const Config* base, const SweepSpec* sp, int jobs,
+              const char* out_path, const char* pooled_path, const TsCheckpoint* from) {
+    if (jobs <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = (ncpu > 0) ? (int)ncpu : 1;
+    }
+    if ((long)jobs > sp->n_points) jobs = (int)sp->n_points;
+    if (jobs > 1 && base->threads > 1)
+        fprintf(stderr, "sweep: %d workers, each run single-threaded (simulation.threads = %d ignored)\n",
+                jobs, base->threads);
+
+    Topology topo;
+    bool have_topo = (topology_init(&topo, base) == 0);
+
+    SweepShared sh;
+    sh.base = base;
+    sh.topo = have_topo ? &topo : NULL;
+    sh.from = from;
+    sh.sp = sp;
+    sh.run_alone = (jobs == 1);
+    sh.results = (SimMetrics*)calloc((size_t)sp->n_points, sizeof(SimMetrics));
+    sh.status = (int*)calloc((size_t)sp->n_points, sizeof(int));
+    atomic_init(&sh.next, 0);
+    atomic_init(&sh.done, 0);
+    sh.pooled = NULL;
+    sh.merged = NULL;
+    sh.n_groups = 0;
+    bool pooling = (sp->pool_axis >= 0 && pooled_path);
+    if (pooling) {
+        sh.n_groups = sp->n_points / sp->axes[sp->pool_axis].n_values;
+        sh.pooled = (QSketch*)malloc(sizeof(QSketch) * (size_t)sh.n_groups);
+        for (long k=0; sh.pooled && k<sh.n_groups; k++) qs_init(&sh.pooled[k]);
+        sh.merged = (int*)calloc((size_t)sh.n_groups, sizeof(int));
+        pthread_mutex_init(&sh.pool_lock, NULL);
+    }
+    pthread_t* threads = (pthread_t*)calloc((size_t)jobs, sizeof(pthread_t));
+    if (!sh.results || !sh.status || !threads || (pooling && (!sh.pooled || !sh.merged))) {
+        free(sh.results); free(sh.status); free(threads); free(sh.pooled); free(sh.merged);
+        if (have_topo) topology_free(&topo);
+        return -1;
+    }
+
+    fprintf(stderr, "sweep: %ld points on %d workers\n", sp->n_points, jobs);
+    double t0 = now_ms();
+
+    /* the calling thread is worker 0 */
+    int started = 1;
+    for (int w=1; w<jobs; w++) {
+        if (pthread_create(&threads[w], NULL, sweep_worker, &sh) != 0) break;
+        started++;
+    }
+    sweep_worker(&sh);
+    for (int w=1; w<started; w++) pthread_join(threads[w], NULL);
+
+    long failed = 0;
+    for (long p=0; p<sp->n_points; p++) failed += (sh.status[p] != 0);
+
+    double secs = (now_ms() - t0) * 1e-3;
+    fprintf(stderr, "sweep: %ld points in %.2f s (%.1f points/s), %ld failed\n",
+            (long)atomic_load(&sh.done), secs,
+            (secs > 0.0) ? (double)sp->n_points / secs : 0.0, failed);
+
+    int rc = write_results(sp, sh.results, sh.status, out_path);
+    if (pooling) {
+        if (write_pooled(sp, sh.pooled, sh.merged, pooled_path) != 0) rc = -1;
+        pthread_mutex_destroy(&sh.pool_lock);
+        free(sh.pooled);
+        free(sh.merged);
+    }
+
+    free(threads);
+    free(sh.results);
+    free(sh.status);
+    if (have_topo) topology_free(&topo);
+    return (rc == 0 && failed == 0) ? 0 : -1;
+}
@@ -0,0 +1,261 @@
+// trafficsim.c
+#include "trafficsim.h"
+#include "checkpoint.h"
+#include "demand.h"
+#include "engine.h"
+#include "series.h"
+#include "traj.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct TsSim {
+    Config cfg;
+    Topology* own_topo;  /* NULL when the topology is shared */
+
+    Grid g;
+    VehiclePool vp;
+    Stats s;
+    Engine eng;
+    Series* series;      /* open time-series export, or NULL */
+    Traj* traj;          /* open trajectory recorder, or NULL */
+
+    double t;
+    int step;
+    bool failed;         /* a step ran out of memory: no further steps or checkpoints */
+};
+
+static TsSim* ts_build(const Config* cfg, const Topology* topo, const TsCheckpoint* ck) {
+    TsSim* ts = (TsSim*)calloc(1, sizeof(TsSim));
+    if (!ts) return NULL;
+    ts->cfg = *cfg;
+
+    if (!topo) {
+        ts->own_topo = (Topology*)calloc(1, sizeof(Topology));
+        if (!ts->own_topo || topology_init(ts->own_topo, cfg) != 0) {
+            free(ts->own_topo);
+            free(ts);
+            return NULL;
+        }
+        topo = ts->own_topo;
+    } else if (!topology_matches(topo, cfg)) {
+        free(ts);
+        return NULL;
+    }
+
+    /* each stage only runs if the previous ones succeeded; ts_destroy
+       copes with the partially built instance */
+    int ok = grid_init(&ts->g, topo, &ts->cfg) == 0
+          /* grows on demand; only a few hundred vehicles are alive on a 6x6 grid */
+          && vp_init(&ts->vp, 1024) == 0
+          && stats_init(&ts->s, ts->g.n_intersections) == 0
+          /* the engine schedules lights and activates links from the restored state */
+          && (!ck || checkpoint_restore_state(ck, &ts->g, &ts->vp, &ts->s, &ts->cfg, &ts->t, &ts->step) == 0)
+          && engine_init(&ts->eng, &ts->g, &ts->vp, &ts->s, &ts->cfg, ts->cfg.threads) == 0
+          && (!ck || checkpoint_restore_engine(ck, &ts->eng) == 0);
+    if (!ok) {
+        ts_destroy(ts);
+        return NULL;
+    }
+    return ts;
+}
+
+TsSim* ts_create(const Config* cfg, const Topology* topo) {
+    return ts_build(cfg, topo, NULL);
+}
+
+TsSim* ts_restore(const Config* cfg, const Topology* topo, const TsCheckpoint* ck) {
+    return ts_build(cfg, topo, ck);
+}
+
+TsCheckpoint* ts_checkpoint(const TsSim* ts) {
+    TsCheckpoint* ck;
+    if (ts->failed) return NULL;
+    if (checkpoint_capture(&ck, &ts->g, &ts->vp, &ts->s, &ts->eng, &ts->cfg, ts->t, ts->step) != 0) return NULL;
+    return ck;
+}
+
+TsSim* ts_fork(const TsSim* ts, const Config* cfg) {
+    TsCheckpoint* ck = ts_checkpoint(ts);
+    if (!ck) return NULL;
+    TsSim* branch = ts_build(cfg ? cfg : &ts->cfg, ts->own_topo ? NULL : ts->g.topo, ck);
+    ts_checkpoint_free(ck);
+    return branch;
+}
+
+void ts_destroy(TsSim* ts) {
+    if (!ts) return;
+    ts_series_close(ts);
+    ts_trajectories_close(ts);
+    if (ts->eng.tiles) engine_free(&ts->eng);
+    stats_free(&ts->s);
+    vp_free(&ts->vp);
+    grid_free(&ts->g);
+    if (ts->own_topo) {
+        topology_free(ts->own_topo);
+        free(ts->own_topo);
+    }
+    free(ts);
+}
+
+int ts_step(TsSim* ts, int n) {
+    if (ts->failed) return -1;
+    int done = 0;
+    while (done < n && ts->t < ts->cfg.duration) {
+        if (engine_step(&ts->eng, ts->t, ts->step) != 0) {
+            fprintf(stderr, "engine: out of memory at step %d\n", ts->step);
+            ts->failed = true;
+            return -1;
+        }
+        ts->t += ts->cfg.time_step;
+        ts->step++;
+        if (ts->series) {
+            series_step(ts->series, &ts->eng, ts->t, ts->step);
+            PROF_END(&ts->eng, 0, PROF_SERIES);
+        }
+        done++;
+    }
+    return done;
+}
+
+int ts_series_open(TsSim* ts, const char* path) {
+    if (ts->series || ts->cfg.export_interval <= 0.0) return -1;
+    ts->series = (Series*)malloc(sizeof(Series));
+    if (!ts->series || series_open(ts->series, path, &ts->eng) != 0) {
+        free(ts->series);
+        ts->series = NULL;
+        return -1;
+    }
+    ts->eng.served = ts->series->served;
+    return 0;
+}
+
+int ts_trajectories_open(TsSim* ts, const char* path) {
+    if (ts->traj) return -1;
+    ts->traj = (Traj*)malloc(sizeof(Traj));
+    if (!ts->traj || traj_open(ts->traj, path, &ts->eng, ts->step) != 0) {
+        free(ts->traj);
+        ts->traj = NULL;
+        return -1;
+    }
+    ts->eng.traj = ts->traj;
+    return 0;
+}
+
+int ts_trajectories_close(TsSim* ts) {
+    if (!ts->traj) return 0;
+    ts->eng.traj = NULL;
+    int rc = traj_close(ts->traj, ts->step);
+    free(ts->traj);
+    ts->traj = NULL;
+    return rc;
+}
+
+int ts_series_close(TsSim* ts) {
+    if (!ts->series) return 0;
+    ts->eng.served = NULL;
+    int rc = series_close(ts->series);
+    free(ts->series);
+    ts->series = NULL;
+    return rc;
+}
+
+void ts_query(const TsSim* ts, TsStatus* st) {
+    st->t = ts->t;
+    st->step = ts->step;
+    st->done = !(ts->t < ts->cfg.duration);
+    st->n_vehicles = ts->vp.n_used;
+    st->spawned = ts->s.spawned;
+    st->exited = ts->s.exited;
+    st->blocked_entries = ts->s.blocked_entries;
+}
+
+void ts_metrics(TsSim* ts, SimMetrics* m) {
+    double measured_time = ts->t - ts->cfg.warmup;
+    if (measured_time < 0) measured_time = 0;
+    stats_finalize(&ts->s, measured_time);
+
+    m->mean_travel_time_s = ts->s.mean_travel_time_s;
+    m->p95_travel_time_s = ts->s.p95_travel_time_s;
+    m->throughput_veh_per_s = ts->s.throughput_veh_per_s;
+    stats_network_queues(&ts->s, ts->g.n_intersections, &m->avg_queue_veh, &m->max_queue_veh);
+    m->spawned = ts->s.spawned;
+    m->exited = ts->s.exited;
+    m->blocked_entries = ts->s.blocked_entries;
+    m->p50_travel_time_s = ts->s.p50_travel_time_s;
+    m->p90_travel_time_s = ts->s.p90_travel_time_s;
+    m->p99_travel_time_s = ts->s.p99_travel_time_s;
+}
+
+const QSketch* ts_travel_times(const TsSim* ts) {
+    return &ts->s.tt;
+}
+
+void ts_snapshot(const TsSim* ts, TsSnapshot* snap) {
+    const Grid* g = &ts->g;
+    const VehiclePool* vp = &ts->vp;
+
+    snap->t = ts->t;
+    snap->step = ts->step;
+
+    snap->n_vehicles = vp->n_used;
+    snap->vehicle_cap = vp->cap;
+    snap->active = vp->active;
+    snap->vehicle_link = vp->link;
+    snap->vehicle_cell = vp->cell_idx;
+    snap->vehicle_speed = vp->speed;
+
+    snap->n_intersections = g->n_intersections;
+    snap->intersections = g->intersections;
+    snap->lights = g->lights;
+
+    snap->n_links = g->n_links;
+    snap->links = g->links;
+    snap->n_cells = g->n_cells;
+    snap->cells = g->cells;
+    snap->n_occ_words = g->n_occ_words;
+    snap->occ = g->occ;
+    snap->k_cells = g->k_cells;
+    snap->stop_count = g->stop_count;
+    snap->head_count = g->head_count;
+
+    snap->queue_sum = ts->s.queue_sum;
+    snap->queue_max = ts->s.queue_max;
+    snap->queue_samples = ts->s.queue_samples;
+    snap->travel_times = &ts->s.tt;
+}
+
+int ts_export_csv(TsSim* ts, const char* out_dir) {
+    SimMetrics m;
+    ts_metrics(ts, &m); /* fills the computed Stats fields */
+    return stats_export_csv(&ts->s, &ts->g, out_dir);
+}
+
+void ts_report(const TsSim* ts, double loop_s, FILE* f) {
+    const Engine* e = &ts->eng;
+    fprintf(f, "engine: %d threads (%dx%d tiles), %s kernel, %d steps in %.3f s, %.0f steps/s\n",
+            e->n_tiles, e->tiles_x, e->tiles_y, e->kernel_name, ts->step, loop_s,
+            (loop_s > 0.0) ? (double)ts->step / loop_s : 0.0);
+    fprintf(f, "vehicle pool: peak %d live, cap %d, %.1f KiB, %d hot bytes/vehicle-step\n",
+            ts->vp.peak_used, ts->vp.cap, (double)vp_memory_bytes(&ts->vp) / 1024.0,
+            (int)VP_HOT_BYTES_PER_VEHICLE);
+    fprintf(f, "instance: %.2f MiB network state (cells, occupancy, lights)%s\n",
+            (double)ts->g.arena_bytes / (1024.0 * 1024.0),
+            ts->own_topo ? "" : ", topology shared");
+    if (e->routed) routing_report(&e->route, f);
+    if (e->demand) demand_report(e->demand, f);
+    if (ts->series) series_report(ts->series, loop_s, f);
+    if (ts->traj) traj_report(ts->traj, f);
+#ifdef TS_PROFILE
+    prof_report(e->prof, f);
+#endif
+}
+
+int ts_profile_write(const TsSim* ts, const char* path) {
+#ifdef TS_PROFILE
+    return prof_write_trace(ts->eng.prof, path);
+#else
+    (void)ts;
+    (void)path;
+    return -1;
+#endif
+}
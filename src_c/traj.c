@@ -0,0 +1,343 @@
+// traj.c
+#include "traj.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef TS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static inline size_t put_varint(uint8_t* p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static TrajBuf* current(Traj* tr) {
+    return &tr->bufs[atomic_load_explicit(&tr->head, memory_order_relaxed) % TRAJ_BLOCKS];
+}
+
+static void buf_reset(Traj* tr, TrajBuf* b, int step0) {
+    b->step0 = b->step1 = step0;
+    b->vehicle_steps = 0;
+    for (int w=0; w<tr->n_streams; w++) {
+        TrajStream* st = &b->streams[w];
+        st->n = 0;
+        st->last_step = step0;
+        st->records = 0;
+    }
+}
+
+/* room for one more record (at most 1 + 4 * 10 bytes) */
+static bool stream_reserve(Traj* tr, TrajStream* st) {
+    if (st->n + 48 <= st->cap) return true;
+    size_t cap = st->cap ? 2 * st->cap : TRAJ_FLUSH_BYTES + 4096;
+    uint8_t* v = (uint8_t*)realloc(st->v, cap);
+    if (!v) {
+        atomic_store_explicit(&tr->failed, true, memory_order_relaxed);
+        return false;
+    }
+    st->v = v;
+    st->cap = cap;
+    return true;
+}
+
+static uint8_t* record_head(TrajStream* st, TrajKind kind, int step, int id, int speed) {
+    uint8_t* p = st->v + st->n;
+    size_t n = 0;
+    p[n++] = (uint8_t)(kind | ((speed < 63 ? speed : 63) << 2));
+    if (speed >= 63) n += put_varint(p + n, (uint64_t)speed);
+    n += put_varint(p + n, (uint64_t)(step - st->last_step));
+    n += put_varint(p + n, (uint64_t)id);
+    st->last_step = step;
+    st->records++;
+    st->n += n;
+    return st->v + st->n;
+}
+
+/* ---- writer thread ---- */
+
+static bool grow(uint8_t** p, size_t* cap, size_t need) {
+    if (need <= *cap) return true;
+    uint8_t* q = (uint8_t*)realloc(*p, need);
+    if (!q) return false;
+    *p = q;
+    *cap = need;
+    return true;
+}
+
+static void write_block(Traj* tr, const TrajBuf* b) {
+    uint32_t* lens = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)tr->n_streams);
+    size_t raw = 0;
+    for (int w=0; w<tr->n_streams; w++) raw += b->streams[w].n;
+    if (!lens || !grow(&tr->raw, &tr->raw_cap, raw ? raw : 1)) {
+        free(lens);
+        tr->io_error = true;
+        return;
+    }
+    size_t pos = 0;
+    for (int w=0; w<tr->n_streams; w++) {
+        const TrajStream* st = &b->streams[w];
+        lens[w] = (uint32_t)st->n;
+        memcpy(tr->raw + pos, st->v, st->n);
+        pos += st->n;
+    }
+
+    TrajBlock hb;
+    memset(&hb, 0, sizeof(hb));
+    hb.step0 = b->step0;
+    hb.step1 = b->step1;
+    hb.n_streams = (uint32_t)tr->n_streams;
+    hb.codec = TRAJ_RAW;
+    hb.raw_bytes = raw;
+    hb.stored_bytes = raw;
+    const uint8_t* payload = tr->raw;
+#ifdef TS_HAVE_ZLIB
+    uLongf packed = compressBound((uLong)raw);
+    if (grow(&tr->packed, &tr->packed_cap, packed)
+        && compress2(tr->packed, &packed, tr->raw, (uLong)raw, Z_BEST_SPEED) == Z_OK && packed < raw) {
+        hb.codec = TRAJ_DEFLATE;
+        hb.stored_bytes = packed;
+        payload = tr->packed;
+    }
+#endif
+    bool ok = fwrite(&hb, sizeof(hb), 1, tr->f) == 1
+           && fwrite(lens, sizeof(uint32_t), (size_t)tr->n_streams, tr->f) == (size_t)tr->n_streams
+           && fwrite(payload, 1, (size_t)hb.stored_bytes, tr->f) == (size_t)hb.stored_bytes;
+    if (!ok) tr->io_error = true;
+    free(lens);
+}
+
+static void* writer_main(void* arg) {
+    Traj* tr = (Traj*)arg;
+    uint64_t tail = atomic_load_explicit(&tr->tail, memory_order_relaxed);
+    for (;;) {
+        while (sem_wait(&tr->ready) != 0) {}   /* EINTR */
+        bool closing = atomic_load_explicit(&tr->closing, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&tr->head, memory_order_acquire);
+        for (; tail < head; tail++) {
+            write_block(tr, &tr->bufs[tail % TRAJ_BLOCKS]);
+            atomic_store_explicit(&tr->tail, tail + 1, memory_order_release);
+        }
+        if (closing) break;
+    }
+    return NULL;
+}
+
+/* ---- stepping thread ---- */
+
+static void free_bufs(Traj* tr) {
+    for (int b=0; b<TRAJ_BLOCKS; b++) {
+        if (!tr->bufs[b].streams) continue;
+        for (int w=0; w<tr->n_streams; w++) free(tr->bufs[b].streams[w].v);
+        free(tr->bufs[b].streams);
+    }
+    for (int w=0; tr->born && w<tr->n_streams; w++) free(tr->born[w].v);
+    free(tr->born);
+    free(tr->fresh);
+    free(tr->raw);
+    free(tr->packed);
+}
+
+/* serial: fresh covers every pool id */
+static bool fresh_reserve(Traj* tr, const VehiclePool* vp) {
+    if (vp->cap <= tr->fresh_cap) return true;
+    uint8_t* fresh = (uint8_t*)realloc(tr->fresh, (size_t)vp->cap);
+    if (!fresh) {
+        atomic_store(&tr->failed, true);
+        return false;
+    }
+    memset(fresh + tr->fresh_cap, 0, (size_t)(vp->cap - tr->fresh_cap));
+    tr->fresh = fresh;
+    tr->fresh_cap = vp->cap;
+    return true;
+}
+
+static void born_push(Traj* tr, int w, int id) {
+    IdxList* l = &tr->born[w];
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        int32_t* v = (int32_t*)realloc(l->v, sizeof(int32_t) * (size_t)cap);
+        if (!v) {
+            atomic_store(&tr->failed, true);
+            return;
+        }
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n++] = id;
+    tr->fresh[id] = 1;
+}
+
+int traj_open(Traj* tr, const char* path, const Engine* e, int step) {
+    memset(tr, 0, sizeof(*tr));
+    const Grid* g = e->g;
+    tr->n_streams = e->n_tiles;
+    for (int b=0; b<TRAJ_BLOCKS; b++) {
+        tr->bufs[b].streams = (TrajStream*)calloc((size_t)tr->n_streams, sizeof(TrajStream));
+        if (!tr->bufs[b].streams) goto fail;
+    }
+    buf_reset(tr, current(tr), step);
+    tr->born = (IdxList*)calloc((size_t)tr->n_streams, sizeof(IdxList));
+    if (!tr->born || !fresh_reserve(tr, e->vp)) goto fail;
+    for (int k=0; k<e->vp->n_used; k++) {
+        int id = e->vp->active[k];
+        born_push(tr, e->link_tile[e->vp->link[id]], id);
+    }
+    if (atomic_load(&tr->failed)) goto fail;
+
+    uint8_t* lanes = (uint8_t*)malloc((size_t)(g->n_links ? g->n_links : 1));
+    if (!lanes) goto fail;
+    for (int l=0; l<g->n_links; l++) lanes[l] = g->links[l].n_lanes;
+    TrajHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRAJ_MAGIC, sizeof(h.magic));
+    h.version = TRAJ_VERSION;
+    h.n_links = g->n_links;
+    h.time_step = e->cfg->time_step;
+    h.step = step;
+    tr->f = fopen(path, "wb");
+    bool ok = tr->f && fwrite(&h, sizeof(h), 1, tr->f) == 1
+           && fwrite(lanes, 1, (size_t)g->n_links, tr->f) == (size_t)g->n_links;
+    free(lanes);
+    if (!ok) goto fail;
+
+    if (sem_init(&tr->ready, 0, 0) != 0) goto fail;
+    if (pthread_create(&tr->writer, NULL, writer_main, tr) != 0) {
+        sem_destroy(&tr->ready);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (tr->f) fclose(tr->f);
+    free_bufs(tr);
+    memset(tr, 0, sizeof(*tr));
+    return -1;
+}
+
+void traj_spawned(Traj* tr, const VehiclePool* vp, int w, int id) {
+    if (fresh_reserve(tr, vp)) born_push(tr, w, id);
+}
+
+void traj_enter(Traj* tr, int w, int step, int id, int link, int slot, int speed) {
+    if (tr->fresh[id] || atomic_load_explicit(&tr->failed, memory_order_relaxed)) return;
+    TrajStream* st = &current(tr)->streams[w];
+    if (!stream_reserve(tr, st)) return;
+    uint8_t* p = record_head(st, TRAJ_ENTER, step, id, speed);
+    p += put_varint(p, (uint64_t)link);
+    p += put_varint(p, (uint64_t)slot);
+    st->n = (size_t)(p - st->v);
+}
+
+void traj_set(Traj* tr, int w, int step, int id, int dslot, int speed) {
+    if (tr->fresh[id] || atomic_load_explicit(&tr->failed, memory_order_relaxed)) return;
+    TrajStream* st = &current(tr)->streams[w];
+    if (!stream_reserve(tr, st)) return;
+    uint8_t* p = record_head(st, TRAJ_SET, step, id, speed);
+    p += put_varint(p, zigzag(dslot));
+    st->n = (size_t)(p - st->v);
+}
+
+void traj_record_tile(Traj* tr, const Engine* e, int w) {
+    /* once a reserve has failed nothing more is recorded, but the born
+       list and the fresh flags are still cleared */
+    bool ok = !atomic_load_explicit(&tr->failed, memory_order_relaxed);
+    IdxList* born = &tr->born[w];
+    const VehiclePool* vp = e->vp;
+    const Tile* tile = &e->tiles[w];
+    TrajStream* st = &current(tr)->streams[w];
+    int step = e->step;
+
+    for (int k=0; k<tile->exits.n; k++) {
+        int id = tile->exits.v[k].id;
+        if (tr->fresh[id]) {
+            tr->fresh[id] = 0;   /* left in the step it appeared */
+            continue;
+        }
+        ok = ok && stream_reserve(tr, st);
+        if (ok) record_head(st, TRAJ_EXIT, step, id, 0);
+    }
+
+    /* a vehicle that crossed into another tile this step is still
+       recorded here: nothing else touches it until the next step */
+    for (int k=0; k<born->n; k++) {
+        int id = born->v[k];
+        if (!tr->fresh[id]) continue;
+        tr->fresh[id] = 0;
+        ok = ok && stream_reserve(tr, st);
+        if (!ok) continue;
+        uint8_t* p = record_head(st, TRAJ_ENTER, step, id, vp->speed[id]);
+        p += put_varint(p, (uint64_t)vp->link[id]);
+        p += put_varint(p, (uint64_t)vp->cell_idx[id]);
+        st->n = (size_t)(p - st->v);
+    }
+    born->n = 0;
+}
+
+/* hands the current block (steps up to `end`) to the writer and records
+   into the next one, waiting while every block is queued */
+static void hand_off(Traj* tr, int end) {
+    TrajBuf* b = current(tr);
+    b->step1 = end;
+    tr->vehicle_steps += b->vehicle_steps;
+    for (int w=0; w<tr->n_streams; w++) {
+        tr->records += b->streams[w].records;
+        tr->bytes += (int64_t)b->streams[w].n;
+    }
+    uint64_t h = atomic_load_explicit(&tr->head, memory_order_relaxed) + 1;
+    atomic_store_explicit(&tr->head, h, memory_order_release);
+    sem_post(&tr->ready);
+    while (h - atomic_load_explicit(&tr->tail, memory_order_acquire) >= TRAJ_BLOCKS) {
+        tr->stalls++;
+        struct timespec nap = { 0, 50000 };
+        nanosleep(&nap, NULL);
+    }
+    buf_reset(tr, current(tr), end);
+}
+
+void traj_end_step(Traj* tr, const VehiclePool* vp, int step) {
+    TrajBuf* b = current(tr);
+    b->vehicle_steps += vp->n_used;
+    for (int w=0; w<tr->n_streams; w++) {
+        if (b->streams[w].n >= TRAJ_FLUSH_BYTES) {
+            hand_off(tr, step + 1);
+            return;
+        }
+    }
+}
+
+int traj_close(Traj* tr, int step) {
+    if (!tr->f) return 0;
+    if (step > current(tr)->step0) hand_off(tr, step);
+    atomic_store_explicit(&tr->closing, true, memory_order_release);
+    sem_post(&tr->ready);
+    pthread_join(tr->writer, NULL);
+    sem_destroy(&tr->ready);
+
+    if (fclose(tr->f) != 0) tr->io_error = true;
+    int rc = (tr->io_error || atomic_load(&tr->failed)) ? -1 : 0;
+    free_bufs(tr);
+    tr->f = NULL;
+    return rc;
+}
+
+void traj_report(const Traj* tr, FILE* f) {
+    const TrajBuf* b = &tr->bufs[atomic_load_explicit(&tr->head, memory_order_relaxed) % TRAJ_BLOCKS];
+    int64_t records = tr->records, vsteps = tr->vehicle_steps + b->vehicle_steps, bytes = tr->bytes;
+    for (int w=0; w<tr->n_streams; w++) {
+        records += b->streams[w].records;
+        bytes += (int64_t)b->streams[w].n;
+    }
+    fprintf(f, "trajectories: %lld records for %lld vehicle-steps (%.1f%%), %.2f bytes/record before compression, %ld stalls\n",
+            (long long)records, (long long)vsteps, vsteps ? 100.0 * (double)records / (double)vsteps : 0.0,
+            records ? (double)bytes / (double)records : 0.0, tr->stalls);
+}
@@ -0,0 +1,305 @@
+// traj_decode.c
+// Rebuilds vehicle trajectories from a trajectory file (traj.h).
+//
+//   traj_decode [--events] trajectories.bin out.csv
+//
+// Default: one row per vehicle and step while it is on the network,
+//   step,t,vehicle,link,cell,lane,speed
+// --events: one row per record, with the state it leads to,
+//   step,t,vehicle,event,link,cell,lane,speed
+//
+// vehicle numbers trips in the order they first appear (pool ids are
+// reused); t is the time at the end of the step. Memory follows the
+// vehicles alive at once and the size of one block.
+#include "traj.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef TS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+typedef struct {
+    int32_t step;
+    int32_t id;
+    int32_t link;   /* ENTER */
+    int32_t slot;   /* ENTER: slot, SET: slot - prediction */
+    uint8_t kind;
+    uint8_t speed;
+    int32_t seq;    /* order in the block, for a stable merge of the streams */
+} Ev;
+
+typedef struct {
+    int64_t* trip;  /* per pool id, -1 = not on the network */
+    int32_t* link;
+    int32_t* slot;
+    uint8_t* speed;
+    int cap;
+    int* live;      /* ids on the network */
+    int* live_pos;
+    int n_live;
+    int64_t trips;
+} State;
+
+static const char* EVENT_NAME[3] = { "enter", "set", "exit" };
+
+static bool get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v) {
+    uint64_t x = 0;
+    for (int shift=0; shift<64 && *p < end; shift+=7) {
+        uint8_t b = *(*p)++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int state_reserve(State* s, int id) {
+    if (id < s->cap) return 0;
+    int cap = s->cap ? s->cap : 1024;
+    while (cap <= id) cap *= 2;
+    int64_t* trip = (int64_t*)realloc(s->trip, sizeof(int64_t) * (size_t)cap);
+    if (trip) s->trip = trip;
+    int32_t* link = (int32_t*)realloc(s->link, sizeof(int32_t) * (size_t)cap);
+    if (link) s->link = link;
+    int32_t* slot = (int32_t*)realloc(s->slot, sizeof(int32_t) * (size_t)cap);
+    if (slot) s->slot = slot;
+    uint8_t* speed = (uint8_t*)realloc(s->speed, (size_t)cap);
+    if (speed) s->speed = speed;
+    int* live = (int*)realloc(s->live, sizeof(int) * (size_t)cap);
+    if (live) s->live = live;
+    int* live_pos = (int*)realloc(s->live_pos, sizeof(int) * (size_t)cap);
+    if (live_pos) s->live_pos = live_pos;
+    if (!trip || !link || !slot || !speed || !live || !live_pos) return -1;
+    for (int k=s->cap; k<cap; k++) s->trip[k] = -1;
+    s->cap = cap;
+    return 0;
+}
+
+/* one stream of a block -> events; -1 if it is malformed */
+static int parse_stream(const uint8_t* p, const uint8_t* end, int32_t step0, int n_links, Ev** ev, int* n_ev, int* cap_ev) {
+    int32_t step = step0;
+    while (p < end) {
+        if (*n_ev == *cap_ev) {
+            int cap = *cap_ev ? 2 * *cap_ev : 4096;
+            Ev* q = (Ev*)realloc(*ev, sizeof(Ev) * (size_t)cap);
+            if (!q) return -1;
+            *ev = q;
+            *cap_ev = cap;
+        }
+        Ev* x = &(*ev)[*n_ev];
+        memset(x, 0, sizeof(*x));
+        uint8_t tag = *p++;
+        uint64_t v, ds, id;
+        x->kind = tag & 3;
+        v = tag >> 2;
+        if (v == 63 && !get_varint(&p, end, &v)) return -1;
+        if (x->kind > TRAJ_EXIT || v > 255) return -1;
+        x->speed = (uint8_t)v;
+        if (!get_varint(&p, end, &ds) || !get_varint(&p, end, &id) || id >= (1u << 30)) return -1;
+        step += (int32_t)ds;
+        x->step = step;
+        x->id = (int32_t)id;
+        if (x->kind == TRAJ_ENTER) {
+            uint64_t link, slot;
+            if (!get_varint(&p, end, &link) || !get_varint(&p, end, &slot) || link >= (uint64_t)n_links || slot >= (1u << 30)) return -1;
+            x->link = (int32_t)link;
+            x->slot = (int32_t)slot;
+        } else if (x->kind == TRAJ_SET) {
+            uint64_t z;
+            if (!get_varint(&p, end, &z)) return -1;
+            x->slot = (int32_t)((int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+        }
+        x->seq = *n_ev;
+        (*n_ev)++;
+    }
+    return 0;
+}
+
+static int cmp_ev(const void* a, const void* b) {
+    const Ev* x = (const Ev*)a;
+    const Ev* y = (const Ev*)b;
+    if (x->step != y->step) return (x->step < y->step) ? -1 : 1;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static void put_row(FILE* f, const State* s, const uint8_t* lanes, int id, int32_t step, double dt, const char* event) {
+    int nl = lanes[s->link[id]];
+    fprintf(f, "%d,%.3f,%lld,", step, (step + 1) * dt, (long long)s->trip[id]);
+    if (event) fprintf(f, "%s,", event);
+    fprintf(f, "%d,%d,%d,%d\n", s->link[id], s->slot[id] / nl, s->slot[id] % nl, s->speed[id]);
+}
+
+int main(int argc, char** argv) {
+    bool events = false;
+    const char* pos[2];
+    int n_pos = 0;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--events") == 0) events = true;
+        else if (n_pos < 2 && argv[i][0] != '-') pos[n_pos++] = argv[i];
+        else n_pos = 3;
+    }
+    if (n_pos != 2) {
+        fprintf(stderr, "Usage: %s [--events] trajectories.bin out.csv\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(pos[0], "rb");
+    if (!in) {
+        fprintf(stderr, "traj_decode: cannot open %s\n", pos[0]);
+        return 1;
+    }
+    TrajHeader h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, TRAJ_MAGIC, sizeof(h.magic)) != 0
+        || h.version != TRAJ_VERSION || h.n_links < 0) {
+        fprintf(stderr, "traj_decode: %s is not a trajectory file of this version\n", pos[0]);
+        fclose(in);
+        return 1;
+    }
+    uint8_t* lanes = (uint8_t*)malloc((size_t)(h.n_links ? h.n_links : 1));
+    if (!lanes || fread(lanes, 1, (size_t)h.n_links, in) != (size_t)h.n_links) {
+        fprintf(stderr, "traj_decode: truncated link table\n");
+        fclose(in);
+        return 1;
+    }
+    for (int l=0; l<h.n_links; l++) {
+        if (lanes[l] < 1 || lanes[l] > MAX_LANES) {
+            fprintf(stderr, "traj_decode: bad lane count of link %d\n", l);
+            fclose(in);
+            return 1;
+        }
+    }
+    FILE* out = fopen(pos[1], "w");
+    if (!out) {
+        fprintf(stderr, "traj_decode: cannot write %s\n", pos[1]);
+        fclose(in);
+        return 1;
+    }
+    fprintf(out, events ? "step,t,vehicle,event,link,cell,lane,speed\n" : "step,t,vehicle,link,cell,lane,speed\n");
+
+    State s;
+    memset(&s, 0, sizeof(s));
+    uint8_t *stored = NULL, *raw = NULL;
+    uint32_t* lens = NULL;
+    Ev* ev = NULL;
+    int cap_ev = 0;
+    int64_t n_records = 0, rows = 0;
+    int32_t next_step = h.step;
+    const char* err = NULL;
+
+    TrajBlock b;
+    while (!err && fread(&b, sizeof(b), 1, in) == 1) {
+        if (b.step0 != next_step || b.step1 < b.step0 || b.n_streams < 1 || b.n_streams > (1u << 20)
+            || b.raw_bytes > (1ull << 34) || b.stored_bytes > (1ull << 34)) { err = "bad block header"; break; }
+        next_step = b.step1;
+        uint32_t* l2 = (uint32_t*)realloc(lens, sizeof(uint32_t) * b.n_streams);
+        uint8_t* s2 = (uint8_t*)realloc(stored, (size_t)b.stored_bytes + 1);
+        if (l2) lens = l2;
+        if (s2) stored = s2;
+        if (!l2 || !s2) { err = "out of memory"; break; }
+        if (fread(lens, sizeof(uint32_t), b.n_streams, in) != b.n_streams
+            || fread(stored, 1, (size_t)b.stored_bytes, in) != (size_t)b.stored_bytes) { err = "truncated block"; break; }
+        uint64_t sum = 0;
+        for (uint32_t w=0; w<b.n_streams; w++) sum += lens[w];
+        if (sum != b.raw_bytes) { err = "bad stream lengths"; break; }
+
+        const uint8_t* data = stored;
+        if (b.codec == TRAJ_DEFLATE) {
+#ifdef TS_HAVE_ZLIB
+            uint8_t* r2 = (uint8_t*)realloc(raw, (size_t)b.raw_bytes + 1);
+            if (!r2) { err = "out of memory"; break; }
+            raw = r2;
+            uLongf n = (uLongf)b.raw_bytes;
+            if (uncompress(raw, &n, stored, (uLong)b.stored_bytes) != Z_OK || n != b.raw_bytes) { err = "corrupt deflate data"; break; }
+            data = raw;
+#else
+            err = "deflated block: rebuild traj_decode with zlib";
+            break;
+#endif
+        } else if (b.codec != TRAJ_RAW || b.stored_bytes != b.raw_bytes) {
+            err = "unknown codec";
+            break;
+        }
+
+        int n_ev = 0;
+        const uint8_t* p = data;
+        for (uint32_t w=0; w<b.n_streams && !err; w++) {
+            if (parse_stream(p, p + lens[w], b.step0, h.n_links, &ev, &n_ev, &cap_ev) != 0) err = "corrupt stream";
+            p += lens[w];
+        }
+        if (err) break;
+        qsort(ev, (size_t)n_ev, sizeof(Ev), cmp_ev);
+        n_records += n_ev;
+
+        int k = 0;
+        for (int32_t step=b.step0; step<b.step1 && !err; step++) {
+            /* no news: same link, moved by the last speed */
+            for (int i=0; i<s.n_live; i++) {
+                int id = s.live[i];
+                s.slot[id] += s.speed[id] * lanes[s.link[id]];
+            }
+            for (; k<n_ev && ev[k].step == step; k++) {
+                const Ev* x = &ev[k];
+                if (state_reserve(&s, x->id) != 0) { err = "out of memory"; break; }
+                int id = x->id;
+                bool on = s.trip[id] >= 0;
+                if (x->kind == TRAJ_ENTER) {
+                    if (!on) {
+                        s.trip[id] = s.trips++;
+                        s.live_pos[id] = s.n_live;
+                        s.live[s.n_live++] = id;
+                    }
+                    s.link[id] = x->link;
+                    s.slot[id] = x->slot;
+                } else if (!on) {
+                    err = "record for a vehicle not on the network";
+                    break;
+                } else if (x->kind == TRAJ_SET) {
+                    s.slot[id] += x->slot;
+                }
+                s.speed[id] = x->speed;
+                if (s.slot[id] < 0 || s.slot[id] >= (1 << 30)) { err = "position out of range"; break; }
+                if (events) {
+                    put_row(out, &s, lanes, id, step, h.time_step, EVENT_NAME[x->kind]);
+                    rows++;
+                }
+                if (x->kind == TRAJ_EXIT) {
+                    int last = s.live[--s.n_live];
+                    s.live[s.live_pos[id]] = last;
+                    s.live_pos[last] = s.live_pos[id];
+                    s.trip[id] = -1;
+                }
+            }
+            if (k < n_ev && ev[k].step < step) err = "records out of order";
+            for (int i=0; !events && i<s.n_live; i++) put_row(out, &s, lanes, s.live[i], step, h.time_step, NULL);
+            if (!events) rows += s.n_live;
+        }
+        if (!err && k != n_ev) err = "records past the end of their block";
+    }
+    fclose(in);
+    int rc = 0;
+    if (fclose(out) != 0) {
+        fprintf(stderr, "traj_decode: cannot write %s\n", pos[1]);
+        rc = 1;
+    }
+    if (err) {
+        fprintf(stderr, "traj_decode: %s: %s (rows up to step %d written)\n", pos[0], err, next_step);
+        rc = 1;
+    } else {
+        fprintf(stderr, "traj_decode: steps %d..%d, %lld trips, %lld records -> %lld rows\n",
+                h.step, next_step, (long long)s.trips, (long long)n_records, (long long)rows);
+    }
+    free(lanes);
+    free(stored);
+    free(raw);
+    free(lens);
+    free(ev);
+    free(s.trip);
+    free(s.link);
+    free(s.slot);
+    free(s.speed);
+    free(s.live);
+    free(s.live_pos);
+    return rc;
+}
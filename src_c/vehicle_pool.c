@@ -0,0 +1,96 @@
+// vehicle_pool.c
+#include "vehicle_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* per-id bytes across all parallel arrays (hot + cold + index arrays) */
+#define VP_BYTES_PER_SLOT \
+    (VP_HOT_BYTES_PER_VEHICLE + 2 * sizeof(double) + sizeof(uint16_t) + 3 * sizeof(int))
+
+static int grow_array(void** p, size_t elem, int n) {
+    void* q = realloc(*p, elem * (size_t)n);
+    if (!q) return -1;
+    *p = q;
+    return 0;
+}
+
+static void push_free_range(VehiclePool* vp, int lo, int hi) {
+    /* pushed in reverse so that the lowest id is handed out first */
+    for (int id=hi-1; id>=lo; id--) {
+        vp->active_pos[id] = -1;
+        vp->free_ids[vp->n_free++] = id;
+    }
+}
+
+static int vp_grow(VehiclePool* vp, int new_cap) {
+    int rc = 0;
+    rc |= grow_array((void**)&vp->link, sizeof(int32_t), new_cap);
+    rc |= grow_array((void**)&vp->cell_idx, sizeof(int32_t), new_cap);
+    rc |= grow_array((void**)&vp->speed, sizeof(uint8_t), new_cap);
+    rc |= grow_array((void**)&vp->vmax, sizeof(uint8_t), new_cap);
+    rc |= grow_array((void**)&vp->planned_move, sizeof(uint8_t), new_cap);
+    rc |= grow_array((void**)&vp->planned_next_link, sizeof(int32_t), new_cap);
+
+    rc |= grow_array((void**)&vp->entry_time, sizeof(double), new_cap);
+    rc |= grow_array((void**)&vp->stopped_time, sizeof(double), new_cap);
+    rc |= grow_array((void**)&vp->destination, sizeof(uint16_t), new_cap);
+
+    rc |= grow_array((void**)&vp->active, sizeof(int), new_cap);
+    rc |= grow_array((void**)&vp->active_pos, sizeof(int), new_cap);
+    rc |= grow_array((void**)&vp->free_ids, sizeof(int), new_cap);
+    if (rc != 0) return -1;
+
+    int old_cap = vp->cap;
+    vp->cap = new_cap;
+    push_free_range(vp, old_cap, new_cap);
+    return 0;
+}
+
+int vp_init(VehiclePool* vp, int initial_cap) {
+    memset(vp, 0, sizeof(*vp));
+    if (initial_cap < 1) initial_cap = 1;
+    return vp_grow(vp, initial_cap);
+}
+
+void vp_free(VehiclePool* vp) {
+    free(vp->link);
+    free(vp->cell_idx);
+    free(vp->speed);
+    free(vp->vmax);
+    free(vp->planned_move);
+    free(vp->planned_next_link);
+    free(vp->entry_time);
+    free(vp->stopped_time);
+    free(vp->destination);
+    free(vp->active);
+    free(vp->active_pos);
+    free(vp->free_ids);
+    memset(vp, 0, sizeof(*vp));
+}
+
+int vp_alloc(VehiclePool* vp) {
+    if (vp->n_free == 0 && vp_grow(vp, vp->cap * 2) != 0) return -1;
+
+    int id = vp->free_ids[--vp->n_free];
+    vp->active_pos[id] = vp->n_used;
+    vp->active[vp->n_used++] = id;
+    if (vp->n_used > vp->peak_used) vp->peak_used = vp->n_used;
+    return id;
+}
+
+void vp_release(VehiclePool* vp, int id) {
+    int pos = vp->active_pos[id];
+    if (pos < 0) return;
+
+    /* swap-remove: last live id takes the freed position */
+    int last = vp->active[--vp->n_used];
+    vp->active[pos] = last;
+    vp->active_pos[last] = pos;
+
+    vp->active_pos[id] = -1;
+    vp->free_ids[vp->n_free++] = id;
+}
+
+size_t vp_memory_bytes(const VehiclePool* vp) {
+    return (size_t)vp->cap * VP_BYTES_PER_SLOT;
+}
@@ -24,6 +24,25 @@ def aggregate_results(results_root: str) -> pd.DataFrame:
     df = pd.DataFrame(rows)
     return df
 
+SWEEP_COLUMNS = {
+    "demand.arrival_rate": "lambda",
+    "traffic_lights.controller": "controller",
+    "simulation.random_seed": "seed",
+}
+
+def load_sweep_results(sweep_csv: str) -> pd.DataFrame:
+    """
+    Reads traffic_sim --sweep output into the same layout as aggregate_results.
+    Raises if a point failed, so a partial grid is never averaged.
+    """
+    df = pd.read_csv(sweep_csv)
+    if "status" in df.columns:
+        failed = df[df["status"] != "ok"]
+        if len(failed):
+            raise ValueError(f"{sweep_csv}: {len(failed)} of {len(df)} sweep points failed")
+        df = df.drop(columns="status")
+    return df.rename(columns=SWEEP_COLUMNS)
+
 def summarize(df: pd.DataFrame) -> pd.DataFrame:
     g = df.groupby(["lambda", "controller"])
     agg = g.agg(
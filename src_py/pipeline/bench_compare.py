@@ -0,0 +1,65 @@
+from __future__ import annotations
+import argparse
+import json
+import math
+import sys
+
+
+def _entries(doc: dict) -> dict:
+    """Benchmark key -> entry for the micro and macro results of one ts_bench file."""
+    out = {}
+    for e in doc.get("micro", []):
+        out[f"micro {e['name']} [{e['variant']}]"] = e
+    for e in doc.get("macro", []):
+        out[f"macro {e['grid_size']}x{e['grid_size']} rate {e['arrival_rate']:g} "
+            f"{e['controller']} t{e['threads']}"] = e
+    return out
+
+
+def compare(base: dict, new: dict, threshold: float) -> list[tuple]:
+    """
+    Rows (key, base mean, new mean, change, verdict) for the benchmarks in both
+    files. change > 0 means new is slower. A change only counts when it is
+    above threshold and above 3 standard errors of the difference, so noise
+    of either run does not show up as a regression.
+    """
+    a, b = _entries(base), _entries(new)
+    rows = []
+    for key in a:
+        if key not in b:
+            continue
+        x, y = a[key], b[key]
+        change = y["mean_s"] / x["mean_s"] - 1.0
+        se = math.sqrt(x["stddev_s"] ** 2 / len(x["samples_s"]) + y["stddev_s"] ** 2 / len(y["samples_s"]))
+        real = abs(y["mean_s"] - x["mean_s"]) > 3.0 * se and abs(change) > threshold
+        verdict = ("slower" if change > 0 else "faster") if real else ""
+        rows.append((key, x["mean_s"], y["mean_s"], change, verdict))
+    return rows
+
+
+def main():
+    ap = argparse.ArgumentParser(description="compare two ts_bench JSON files (make -C src_c bench)")
+    ap.add_argument("base")
+    ap.add_argument("new")
+    ap.add_argument("--threshold", type=float, default=0.10,
+                    help="relative change below which a difference is ignored")
+    args = ap.parse_args()
+
+    with open(args.base) as f:
+        base = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+    if base.get("host") != new.get("host"):
+        print(f"warning: different hosts: {base.get('host')} vs {new.get('host')}", file=sys.stderr)
+
+    rows = compare(base, new, args.threshold)
+    width = max((len(r[0]) for r in rows), default=10)
+    for key, x, y, change, verdict in rows:
+        print(f"{key:<{width}}  {x * 1e3:10.3f} ms  {y * 1e3:10.3f} ms  {change * 100:+7.1f}%  {verdict}")
+    slower = sum(1 for r in rows if r[4] == "slower")
+    print(f"{len(rows)} benchmarks, {slower} slower, {sum(1 for r in rows if r[4] == 'faster')} faster")
+    sys.exit(1 if slower else 0)
+
+
+if __name__ == "__main__":
+    main()
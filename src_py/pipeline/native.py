@@ -0,0 +1,189 @@
+from __future__ import annotations
+import os
+import sys
+import numpy as np
+
+from .yaml_to_kv import yaml_to_kv_dict
+
+# _trafficsim is built next to traffic_sim: make -C src_c python
+_BIN_DIR = os.path.join(os.path.dirname(__file__), "..", "..", "src_c", "bin")
+if _BIN_DIR not in sys.path:
+    sys.path.insert(0, os.path.abspath(_BIN_DIR))
+import _trafficsim  # noqa: E402
+
+
+class Simulation:
+    """
+    One simulation running inside this process.
+
+    config is the flat {key: value} dict of config.kv (see yaml_to_kv_dict);
+    missing keys keep the C defaults. The array properties are read-only
+    NumPy views of the engine's own memory: they are not copied, they
+    change as the simulation steps, and they keep the engine alive.
+    """
+
+    def __init__(self, config: dict | None = None, checkpoint: str | None = None):
+        """checkpoint: a file from save_checkpoint (or --save-checkpoint) to continue from"""
+        self._kv = {k: (int(v) if isinstance(v, bool) else v) for k, v in (config or {}).items()}
+        self._sim = _trafficsim.Sim(self._kv, checkpoint)
+
+    @classmethod
+    def from_yaml(cls, yaml_path: str, overrides: dict | None = None) -> "Simulation":
+        """overrides use config.kv keys, e.g. {"traffic_lights.controller": "actuated"}"""
+        kv = yaml_to_kv_dict(yaml_path)
+        kv.update(overrides or {})
+        return cls(kv)
+
+    def step(self, n: int = 1) -> int:
+        """Advances n steps (fewer at the end of the run); returns the number run."""
+        return self._sim.step(n)
+
+    def run(self) -> dict:
+        """Steps to simulation.duration and returns the metrics."""
+        while self._sim.step(1 << 20) > 0:
+            pass
+        return self.metrics()
+
+    def status(self) -> dict:
+        return self._sim.status()
+
+    def metrics(self) -> dict:
+        """Same fields as metrics.csv, over the measured window so far."""
+        return self._sim.metrics()
+
+    def series_open(self, path: str) -> None:
+        """
+        From the next step on, writes one frame of per-intersection queues,
+        occupancy, crossings and light phases every output.export_interval
+        to path, from a background thread; src_c/bin/series_csv converts it.
+        """
+        self._sim.series_open(path)
+
+    def series_close(self) -> None:
+        self._sim.series_close()
+
+    def trajectories_open(self, path: str) -> None:
+        """
+        Records every vehicle's link entries, speed and lane changes and
+        exits from the next step on; src_c/bin/traj_decode rebuilds the
+        per-step trajectories.
+        """
+        self._sim.trajectories_open(path)
+
+    def trajectories_close(self) -> None:
+        self._sim.trajectories_close()
+
+    def save_checkpoint(self, path: str) -> None:
+        self._sim.save_checkpoint(path)
+
+    def fork(self, overrides: dict | None = None) -> "Simulation":
+        """
+        A new simulation starting from this one's current state, with this
+        config updated by overrides (e.g. another controller, demand or
+        random_seed). The network and time step must stay the same.
+        """
+        branch = Simulation.__new__(Simulation)
+        branch._kv = dict(self._kv)
+        branch._kv.update({k: (int(v) if isinstance(v, bool) else v) for k, v in (overrides or {}).items()})
+        branch._sim = self._sim.fork(branch._kv)
+        return branch
+
+    def export_csv(self, out_dir: str) -> None:
+        os.makedirs(out_dir, exist_ok=True)
+        self._sim.export_csv(out_dir)
+
+    def view(self, name: str) -> np.ndarray:
+        """Zero-copy array for any name in self._sim.view_names()."""
+        return np.asarray(self._sim.view(name))
+
+    # --- network state ---
+    @property
+    def occupancy(self) -> np.ndarray:
+        """uint64 bit words; link l owns words link_occ_off[l]..; bit c*n_lanes + lane = occupied"""
+        return self.view("occupancy")
+
+    @property
+    def cells(self) -> np.ndarray:
+        """vehicle id per slot c*n_lanes + lane (link l owns link_cell_off[l]..); only valid where occupied"""
+        return self.view("cells")
+
+    @property
+    def link_cell_off(self) -> np.ndarray:
+        return self.view("link.cell_off")
+
+    @property
+    def link_occ_off(self) -> np.ndarray:
+        return self.view("link.occ_off")
+
+    @property
+    def link_n_cells(self) -> np.ndarray:
+        return self.view("link.n_cells")
+
+    @property
+    def link_n_lanes(self) -> np.ndarray:
+        return self.view("link.n_lanes")
+
+    @property
+    def link_stop_count(self) -> np.ndarray:
+        """occupied slots in the stopline window (traffic_lights.queue_window_cells), all lanes"""
+        return self.view("link.stop_count")
+
+    @property
+    def link_head_count(self) -> np.ndarray:
+        """occupied cells in the head window"""
+        return self.view("link.head_count")
+
+    def occupied_cells(self) -> list[np.ndarray]:
+        """
+        Per link l, bool [link_n_cells[l], link_n_lanes[l]] (computed, not a
+        view). A list, as links of a network file differ in length and lane
+        count.
+        """
+        bits = np.unpackbits(self.occupancy.view(np.uint8), bitorder="little").astype(bool)
+        out = []
+        for off, n_cells, n_lanes in zip(self.link_occ_off.tolist(), self.link_n_cells.tolist(),
+                                         self.link_n_lanes.tolist()):
+            start = off * 64
+            out.append(bits[start:start + n_cells * n_lanes].reshape(n_cells, n_lanes))
+        return out
+
+    # --- lights ---
+    @property
+    def light_phase(self) -> np.ndarray:
+        """0 = NS green, 1 = EW green, per intersection"""
+        return self.view("light.phase")
+
+    @property
+    def light_phase_start(self) -> np.ndarray:
+        """step in which the current phase began"""
+        return self.view("light.phase_start")
+
+    @property
+    def light_next_eval(self) -> np.ndarray:
+        """step of the next scheduled decision (2**31-1: none)"""
+        return self.view("light.next_eval")
+
+    # --- stats accumulators ---
+    @property
+    def queue_sum(self) -> np.ndarray:
+        return self.view("queue_sum")
+
+    @property
+    def queue_max(self) -> np.ndarray:
+        return self.view("queue_max")
+
+    @property
+    def travel_time_counts(self) -> np.ndarray:
+        """travel-time histogram (after warmup), see travel_time_bucket_lower_s"""
+        return self.view("tt.counts")
+
+    @property
+    def travel_time_sums_ms(self) -> np.ndarray:
+        """exact sum of the travel times (ms) in each histogram bucket"""
+        return self.view("tt.sums_ms")
+
+    def travel_time_bucket_lower_s(self) -> np.ndarray:
+        """lower edge of each histogram bucket in seconds (computed once, not a view)"""
+        if not hasattr(self, "_tt_edges"):
+            self._tt_edges = np.asarray(self._sim.tt_bucket_lower_ms(), dtype=np.float64) / 1000.0
+        return self._tt_edges
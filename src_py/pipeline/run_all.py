@@ -4,8 +4,8 @@ import argparse
 import subprocess
 import shutil
 
-from .run_batch import run_sweep
-from .aggregate import aggregate_results, summarize
+from .run_batch import run_sweep, run_sweep_inprocess
+from .aggregate import aggregate_results, load_sweep_results, summarize
 from .plots import plot_curves
 from .tables import save_summary_table
 
@@ -17,6 +17,10 @@ def main():
     ap.add_argument("--figures", default="report_figures")
     ap.add_argument("--tables", default="report_tables")
     ap.add_argument("--sim_bin", default="src_c/bin/traffic_sim")
+    ap.add_argument("--jobs", type=int, default=0,
+                    help="sweep worker threads inside traffic_sim (0 = one per CPU)")
+    ap.add_argument("--per_run_dirs", action="store_true",
+                    help="one traffic_sim process and output directory per run (old behaviour)")
     args = ap.parse_args()
 
     # --------------------------------------------------
@@ -39,20 +43,31 @@ def main():
     controllers = ["fixed", "actuated", "max_pressure"]
     seeds = list(range(5))  # keep small for quick runs; increase later
 
-    run_sweep(
-        sim_bin=args.sim_bin,
-        yaml_config=args.config,
-        results_root=args.results,
-        lambdas=lambdas,              # still veh/s internally
-        controllers=controllers,
-        seeds=seeds,
-    )
-
+    if args.per_run_dirs:
+        run_sweep(
+            sim_bin=args.sim_bin,
+            yaml_config=args.config,
+            results_root=args.results,
+            lambdas=lambdas,              # still veh/s internally
+            controllers=controllers,
+            seeds=seeds,
+        )
+        df = aggregate_results(args.results)
+    else:
+        sweep_csv = run_sweep_inprocess(
+            sim_bin=args.sim_bin,
+            yaml_config=args.config,
+            results_root=args.results,
+            lambdas=lambdas,
+            controllers=controllers,
+            seeds=seeds,
+            jobs=args.jobs,
+        )
+        df = load_sweep_results(sweep_csv)
 
     # --------------------------------------------------
     # Aggregate + outputs for report
     # --------------------------------------------------
-    df = aggregate_results(args.results)
     os.makedirs(args.tables, exist_ok=True)
     os.makedirs(args.figures, exist_ok=True)
 
@@ -28,3 +28,28 @@ def run_sweep(sim_bin: str, yaml_config: str, results_root: str,
                     "simulation.random_seed": seed
                 }
                 run_one(sim_bin, yaml_config, out_dir, overrides)
+
+def run_sweep_inprocess(sim_bin: str, yaml_config: str, results_root: str,
+                        lambdas: list[float], controllers: list[str], seeds: list[int],
+                        jobs: int = 0) -> str:
+    """
+    Same design as run_sweep, but one traffic_sim process runs every point on
+    its own worker pool. Returns the path of the consolidated sweep_metrics.csv.
+    jobs=0 lets the simulator use one worker per CPU.
+    """
+    if os.path.exists(results_root):
+        shutil.rmtree(results_root)
+    os.makedirs(results_root, exist_ok=True)
+
+    kv_path = os.path.join(results_root, "base.kv")
+    yaml_to_kv(yaml_config, kv_path)
+
+    axes = [
+        "demand.arrival_rate=" + ",".join(repr(float(lam)) for lam in lambdas),
+        "traffic_lights.controller=" + ",".join(controllers),
+        "simulation.random_seed=" + ",".join(str(int(s)) for s in seeds),
+    ]
+    cmd = [sim_bin, "--config", kv_path, "--out", results_root,
+           "--sweep", ";".join(axes), "--jobs", str(jobs)]
+    subprocess.run(cmd, check=True)
+    return os.path.join(results_root, "sweep_metrics.csv")
@@ -2,9 +2,9 @@ from __future__ import annotations
 import os
 import yaml
 
-def yaml_to_kv(yaml_path: str, kv_out_path: str, overrides: dict | None = None) -> None:
+def yaml_to_kv_dict(yaml_path: str, overrides: dict | None = None) -> dict:
     """
-    Reads YAML config and writes a flat key=value config that the C code can parse.
+    Reads YAML config and returns the flat {key: value} config that the C code parses.
     overrides: optional dict like {"demand.arrival_rate": 0.2, "traffic_lights.controller": "fixed"}
     """
     with open(yaml_path, "r", encoding="utf-8") as f:
@@ -30,28 +30,41 @@ def yaml_to_kv(yaml_path: str, kv_out_path: str, overrides: dict | None = None)
     # Controller string -> keep in kv
     controller = tl["controller"]
 
-    lines = []
+    kv = {}
     def add(key, val):
-        lines.append(f"{key}={val}")
+        kv[key] = val
 
     add("simulation.time_step", sim["time_step"])
     add("simulation.duration", sim["duration"])
     add("simulation.warmup", sim["warmup"])
     add("simulation.random_seed", sim["random_seed"])
+    add("simulation.threads", sim.get("threads", 1))
 
     add("network.grid_size", net["grid_size"])
     add("network.cell_length", net["cell_length"])
     add("network.link_length_cells", net["link_length_cells"])
     add("network.lanes_per_direction", net["lanes_per_direction"])
+    if net.get("file"):
+        add("network.file", net["file"])
 
     add("vehicles.vmax_cells_per_step", veh["vmax_cells_per_step"])
     add("vehicles.slowdown_probability", veh["slowdown_probability"])
     add("vehicles.vehicle_length_cells", veh["vehicle_length_cells"])
+    add("vehicles.lane_change_probability", veh.get("lane_change_probability", 0.5))
 
     add("demand.arrival_rate", dem["arrival_rate"])
     add("demand.routing_randomness", dem["routing"]["randomness"])
+    routing = dem["routing"]
+    add("demand.routing_type", routing.get("type", "manhattan"))
+    add("demand.routing_update_interval", routing.get("update_interval", 0))
+    add("demand.routing_reweight_threshold", routing.get("threshold", 0.1))
+    if routing.get("destinations"):
+        add("demand.routing_destinations", ",".join(str(n) for n in routing["destinations"]))
+    if dem.get("od_file"):
+        add("demand.od_file", dem["od_file"])
 
     add("traffic_lights.controller", controller)
+    add("traffic_lights.queue_window_cells", tl.get("queue_window_cells", 5))
 
     # Fixed
     add("traffic_lights.fixed.cycle_time", tl["fixed"]["cycle_time"])
@@ -70,6 +83,12 @@ def yaml_to_kv(yaml_path: str, kv_out_path: str, overrides: dict | None = None)
     add("output.save_queue_snapshots", int(bool(out["save_queue_snapshots"])))
     add("output.save_vehicle_trajectories", int(bool(out["save_vehicle_trajectories"])))
 
+    return kv
+
+def yaml_to_kv(yaml_path: str, kv_out_path: str, overrides: dict | None = None) -> None:
+    """Writes yaml_to_kv_dict(yaml_path, overrides) as a config.kv file."""
+    kv = yaml_to_kv_dict(yaml_path, overrides)
+    lines = [f"{k}={v}" for k, v in kv.items()]
     os.makedirs(os.path.dirname(kv_out_path), exist_ok=True)
     with open(kv_out_path, "w", encoding="utf-8") as f:
         f.write("\n".join(lines) + "\n")